@@ -0,0 +1,140 @@
+/*
+ * ashmem_compress_test.c - check that ashmem compressed mode stores pages
+ *
+ * Turns on ashmem.compress, fills an ashmem area with compressible pages,
+ * unpins it and purges all ashmem caches. The purge must compress the
+ * pages (compressed_pages in debugfs ashmem/stats goes up), and pinning
+ * the area again must report it as not purged with its contents intact.
+ *
+ * Needs root, CONFIG_ASHMEM_COMPRESS and debugfs mounted on
+ * /sys/kernel/debug.
+ *
+ * Build: gcc -O2 -o ashmem_compress_test ashmem_compress_test.c
+ * Usage: ashmem_compress_test [pages]
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* from include/linux/ashmem.h */
+struct ashmem_pin {
+	uint32_t offset;
+	uint32_t len;
+};
+
+#define __ASHMEMIOC		0x77
+#define ASHMEM_SET_SIZE		_IOW(__ASHMEMIOC, 3, size_t)
+#define ASHMEM_PIN		_IOW(__ASHMEMIOC, 7, struct ashmem_pin)
+#define ASHMEM_UNPIN		_IOW(__ASHMEMIOC, 8, struct ashmem_pin)
+#define ASHMEM_PURGE_ALL_CACHES	_IO(__ASHMEMIOC, 10)
+#define ASHMEM_NOT_PURGED	0
+
+#define COMPRESS_PARAM	"/sys/module/ashmem/parameters/compress"
+#define STATS		"/sys/kernel/debug/ashmem/stats"
+
+static unsigned long read_stat(const char *name)
+{
+	char key[64];
+	unsigned long long val;
+	FILE *f;
+
+	f = fopen(STATS, "r");
+	if (!f) {
+		perror(STATS);
+		exit(1);
+	}
+	while (fscanf(f, "%63s %llu", key, &val) == 2) {
+		if (!strcmp(key, name)) {
+			fclose(f);
+			return val;
+		}
+	}
+	fclose(f);
+	fprintf(stderr, "%s: no %s, compressed mode not built?\n", STATS, name);
+	exit(1);
+}
+
+static void fill(char *p, size_t page, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		snprintf(p + i * page, page, "ashmem page %d", i);
+}
+
+int main(int argc, char **argv)
+{
+	int pages = argc > 1 ? atoi(argv[1]) : 32;
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t size = page * pages;
+	unsigned long stored, failed;
+	struct ashmem_pin pin = { 0, 0 };
+	char *p, *want;
+	FILE *f;
+	int fd, ret;
+
+	f = fopen(COMPRESS_PARAM, "w");
+	if (!f || fputs("1\n", f) < 0 || fclose(f)) {
+		perror(COMPRESS_PARAM);
+		return 1;
+	}
+	/* let the pool reserve fill */
+	sleep(1);
+
+	fd = open("/dev/ashmem", O_RDWR);
+	if (fd < 0 || ioctl(fd, ASHMEM_SET_SIZE, size) < 0) {
+		perror("/dev/ashmem");
+		return 1;
+	}
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	want = calloc(1, size);
+	if (p == MAP_FAILED || !want) {
+		perror("mmap");
+		return 1;
+	}
+	memset(p, 0, size);
+	fill(p, page, pages);
+	fill(want, page, pages);
+
+	stored = read_stat("compressed_pages");
+	failed = read_stat("compress_failed");
+
+	if (ioctl(fd, ASHMEM_UNPIN, &pin) < 0 ||
+	    ioctl(fd, ASHMEM_PURGE_ALL_CACHES) < 0) {
+		perror("unpin/purge");
+		return 1;
+	}
+
+	stored = read_stat("compressed_pages") - stored;
+	failed = read_stat("compress_failed") - failed;
+	printf("stored %lu of %d pages, %lu failed\n", stored, pages, failed);
+
+	ret = ioctl(fd, ASHMEM_PIN, &pin);
+	if (ret < 0) {
+		perror("pin");
+		return 1;
+	}
+
+	if (!stored) {
+		printf("FAIL: nothing was compressed\n");
+		return 1;
+	}
+	if (stored == (unsigned long)pages) {
+		if (ret != ASHMEM_NOT_PURGED) {
+			printf("FAIL: pin reported the area purged\n");
+			return 1;
+		}
+		if (memcmp(p, want, size)) {
+			printf("FAIL: restored pages differ\n");
+			return 1;
+		}
+	}
+	printf("PASS\n");
+	return 0;
+}
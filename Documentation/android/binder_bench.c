@@ -0,0 +1,463 @@
+/*
+ * binder_bench.c - binder transaction throughput benchmark
+ *
+ * Measures synchronous binder transactions per second in two patterns:
+ *
+ *   pingpong	N independent client/server process pairs
+ *   fanin	N clients calling one server process with N looper threads
+ *
+ * The benchmark forks its own context manager to hand out the server
+ * handles, so it must run while no other process (servicemanager) holds
+ * the binder context manager role.
+ *
+ * Build: gcc -O2 -pthread -o binder_bench binder_bench.c
+ * Usage: binder_bench [-m pingpong|fanin] [-n clients] [-s bytes] [-t secs]
+ *
+ * Payloads of up to 1MB can be sent, to measure the copy throughput of
+ * large transactions sweep the sizes:
+ *
+ *	for s in 4096 16384 65536 262144 1048576; do binder_bench -s $s; done
+ *
+ * The "pages:" line of /proc/binder/proc/<pid> shows how many of the pages
+ * mapped for the server were filled by the payload instead of zeroed.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../../drivers/staging/android/binder.h"
+
+#define MAP_SIZE	(4 * 1024 * 1024)
+#define MAX_CLIENTS	64
+
+enum {
+	CODE_REGISTER = 1,	/* registry: data = index, binder object */
+	CODE_LOOKUP,		/* registry: data = index */
+	CODE_PING,
+};
+
+struct registry_req {
+	uint32_t index;
+	struct flat_binder_object obj;
+};
+
+static int payload = 64;
+static int seconds = 5;
+
+static int binder_open(void)
+{
+	struct binder_version vers;
+	void *map;
+	int fd;
+
+	fd = open("/dev/binder", O_RDWR);
+	if (fd < 0) {
+		perror("open /dev/binder");
+		exit(1);
+	}
+	if (ioctl(fd, BINDER_VERSION, &vers) < 0 ||
+	    vers.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		fprintf(stderr, "binder protocol version mismatch\n");
+		exit(1);
+	}
+	map = mmap(NULL, MAP_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap /dev/binder");
+		exit(1);
+	}
+	return fd;
+}
+
+/* Command buffer for one BINDER_WRITE_READ */
+struct cmdbuf {
+	size_t len;
+	uint8_t data[256];
+};
+
+static void put_cmd(struct cmdbuf *cb, uint32_t cmd, const void *arg,
+		    size_t len)
+{
+	memcpy(cb->data + cb->len, &cmd, sizeof(cmd));
+	cb->len += sizeof(cmd);
+	memcpy(cb->data + cb->len, arg, len);
+	cb->len += len;
+}
+
+static void put_tr(struct cmdbuf *cb, uint32_t cmd, uint32_t handle,
+		   uint32_t code, const void *data, size_t size,
+		   const size_t *offsets, size_t offsets_size)
+{
+	struct binder_transaction_data tr;
+
+	memset(&tr, 0, sizeof(tr));
+	tr.target.handle = handle;
+	tr.code = code;
+	tr.data_size = size;
+	tr.offsets_size = offsets_size;
+	tr.data.ptr.buffer = data;
+	tr.data.ptr.offsets = offsets;
+	put_cmd(cb, cmd, &tr, sizeof(tr));
+}
+
+static int write_read(int fd, struct cmdbuf *cb, void *rbuf, size_t rsize,
+		      size_t *consumed)
+{
+	struct binder_write_read bwr;
+	int ret;
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_size = cb->len;
+	bwr.write_buffer = (unsigned long)cb->data;
+	bwr.read_size = rsize;
+	bwr.read_buffer = (unsigned long)rbuf;
+	do {
+		ret = ioctl(fd, BINDER_WRITE_READ, &bwr);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0) {
+		perror("BINDER_WRITE_READ");
+		exit(1);
+	}
+	cb->len = 0;
+	if (consumed)
+		*consumed = bwr.read_consumed;
+	return 0;
+}
+
+/*
+ * Serve transactions on 'fd' from the calling thread forever. 'handler'
+ * fills in the reply and may queue extra commands before BC_FREE_BUFFER.
+ */
+typedef size_t (*handler_t)(struct binder_transaction_data *tr,
+			    struct cmdbuf *cb, void *reply, size_t **offsets,
+			    size_t *offsets_size);
+
+static void serve(int fd, handler_t handler)
+{
+	static __thread uint8_t reply[MAP_SIZE / 4];
+	uint32_t rbuf[128];
+	struct cmdbuf cb = { 0 };
+	uint32_t cmd = BC_ENTER_LOOPER;
+
+	memcpy(cb.data, &cmd, sizeof(cmd));
+	cb.len = sizeof(cmd);
+
+	for (;;) {
+		size_t consumed, pos = 0;
+
+		write_read(fd, &cb, rbuf, sizeof(rbuf), &consumed);
+		while (pos < consumed) {
+			uint8_t *p = (uint8_t *)rbuf + pos;
+			struct binder_transaction_data *tr;
+			struct binder_ptr_cookie pc;
+			size_t *offsets = NULL, offsets_size = 0, size;
+
+			memcpy(&cmd, p, sizeof(cmd));
+			pos += sizeof(cmd) + _IOC_SIZE(cmd);
+			switch (cmd) {
+			case BR_INCREFS:
+			case BR_ACQUIRE:
+				memcpy(&pc, p + 4, sizeof(pc));
+				put_cmd(&cb, cmd == BR_INCREFS ?
+					BC_INCREFS_DONE : BC_ACQUIRE_DONE,
+					&pc, sizeof(pc));
+				break;
+			case BR_TRANSACTION:
+				tr = (struct binder_transaction_data *)(p + 4);
+				size = handler(tr, &cb, reply, &offsets,
+					       &offsets_size);
+				put_cmd(&cb, BC_FREE_BUFFER,
+					&tr->data.ptr.buffer, sizeof(void *));
+				put_tr(&cb, BC_REPLY, 0, 0, reply, size,
+				       offsets, offsets_size);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+}
+
+/* Context manager: maps server index to handle */
+static uint32_t registry[MAX_CLIENTS];
+
+static size_t registry_handler(struct binder_transaction_data *tr,
+			       struct cmdbuf *cb, void *reply,
+			       size_t **offsets, size_t *offsets_size)
+{
+	static size_t reply_offsets[1] = { 0 };
+	const struct registry_req *req = tr->data.ptr.buffer;
+	struct flat_binder_object obj;
+	uint32_t status = 0;
+
+	if (tr->data_size < sizeof(uint32_t) || req->index >= MAX_CLIENTS)
+		goto out;
+
+	if (tr->code == CODE_REGISTER && tr->data_size >= sizeof(*req)) {
+		/* keep the handle past BC_FREE_BUFFER */
+		put_cmd(cb, BC_ACQUIRE, &req->obj.handle, sizeof(uint32_t));
+		registry[req->index] = req->obj.handle;
+		status = 1;
+	} else if (tr->code == CODE_LOOKUP && registry[req->index]) {
+		memset(&obj, 0, sizeof(obj));
+		obj.type = BINDER_TYPE_HANDLE;
+		obj.handle = registry[req->index];
+		memcpy(reply, &obj, sizeof(obj));
+		*offsets = reply_offsets;
+		*offsets_size = sizeof(reply_offsets);
+		return sizeof(obj);
+	}
+out:
+	memcpy(reply, &status, sizeof(status));
+	return sizeof(status);
+}
+
+static size_t ping_handler(struct binder_transaction_data *tr,
+			   struct cmdbuf *cb, void *reply,
+			   size_t **offsets, size_t *offsets_size)
+{
+	return tr->data_size;
+}
+
+/*
+ * Synchronous call from a client thread. Returns the reply data, which
+ * stays valid until the next call; its buffer is freed with that call.
+ */
+static struct binder_transaction_data *call(int fd, struct cmdbuf *cb,
+					    uint32_t handle, uint32_t code,
+					    const void *data, size_t size,
+					    const size_t *offsets,
+					    size_t offsets_size)
+{
+	static __thread uint32_t rbuf[64];
+	static __thread const void *pending;
+	uint32_t cmd;
+
+	if (pending)
+		put_cmd(cb, BC_FREE_BUFFER, &pending, sizeof(void *));
+	pending = NULL;
+	put_tr(cb, BC_TRANSACTION, handle, code, data, size, offsets,
+	       offsets_size);
+
+	for (;;) {
+		size_t consumed, pos = 0;
+
+		write_read(fd, cb, rbuf, sizeof(rbuf), &consumed);
+		while (pos < consumed) {
+			uint8_t *p = (uint8_t *)rbuf + pos;
+
+			memcpy(&cmd, p, sizeof(cmd));
+			pos += sizeof(cmd) + _IOC_SIZE(cmd);
+			if (cmd == BR_REPLY) {
+				struct binder_transaction_data *tr =
+					(struct binder_transaction_data *)
+					(p + 4);
+				pending = tr->data.ptr.buffer;
+				return tr;
+			}
+			if (cmd == BR_DEAD_REPLY || cmd == BR_FAILED_REPLY) {
+				fprintf(stderr, "transaction failed: %s\n",
+					cmd == BR_DEAD_REPLY ? "dead" :
+					"failed");
+				exit(1);
+			}
+		}
+	}
+}
+
+static void run_registry(int ready)
+{
+	int fd = binder_open();
+
+	if (ioctl(fd, BINDER_SET_CONTEXT_MGR, 0) < 0) {
+		perror("BINDER_SET_CONTEXT_MGR (is servicemanager running?)");
+		exit(1);
+	}
+	if (write(ready, "r", 1) != 1)
+		exit(1);
+	close(ready);
+	serve(fd, registry_handler);
+}
+
+static void *server_thread(void *arg)
+{
+	serve((long)arg, ping_handler);
+	return NULL;
+}
+
+static void run_server(int index, int threads)
+{
+	static size_t offsets[1] = { offsetof(struct registry_req, obj) };
+	struct cmdbuf cb = { 0 };
+	struct registry_req req;
+	pthread_t tid;
+	size_t max = threads;
+	int fd = binder_open();
+	int i;
+
+	ioctl(fd, BINDER_SET_MAX_THREADS, &max);
+
+	memset(&req, 0, sizeof(req));
+	req.index = index;
+	req.obj.type = BINDER_TYPE_BINDER;
+	req.obj.binder = (void *)(long)(index + 1);
+	req.obj.cookie = NULL;
+	call(fd, &cb, 0, CODE_REGISTER, &req, sizeof(req), offsets,
+	     sizeof(offsets));
+
+	for (i = 1; i < threads; i++)
+		pthread_create(&tid, NULL, server_thread, (void *)(long)fd);
+	serve(fd, ping_handler);
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void run_client(int index, int start, int result)
+{
+	struct cmdbuf cb = { 0 };
+	struct binder_transaction_data *tr;
+	struct flat_binder_object obj;
+	unsigned long count = 0;
+	uint32_t handle;
+	double end, elapsed;
+	char *data, c;
+	int fd = binder_open();
+
+	/* find the server, it may not have registered yet */
+	for (;;) {
+		tr = call(fd, &cb, 0, CODE_LOOKUP, &index, sizeof(index),
+			  NULL, 0);
+		if (tr->data_size == sizeof(obj))
+			break;
+		usleep(10000);
+	}
+	memcpy(&obj, tr->data.ptr.buffer, sizeof(obj));
+	handle = obj.handle;
+	put_cmd(&cb, BC_ACQUIRE, &handle, sizeof(handle));
+
+	data = calloc(1, payload);
+
+	/* wait for the go from the parent, then run for 'seconds' */
+	if (read(start, &c, 1) != 1)
+		exit(1);
+	elapsed = now();
+	end = elapsed + seconds;
+	do {
+		int i;
+
+		for (i = 0; i < 64; i++)
+			call(fd, &cb, handle, CODE_PING, data, payload, NULL, 0);
+		count += i;
+	} while (now() < end);
+	elapsed = now() - elapsed;
+
+	count = count / elapsed;
+	if (write(result, &count, sizeof(count)) != sizeof(count))
+		exit(1);
+	exit(0);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: binder_bench [-m pingpong|fanin] "
+		"[-n clients] [-s bytes] [-t secs]\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	pid_t pids[2 * MAX_CLIENTS + 1];
+	int npids = 0, clients = 1, fanin = 0;
+	int ready[2], start[2], result[2];
+	unsigned long total = 0, rate;
+	char c;
+	int i, opt;
+
+	while ((opt = getopt(argc, argv, "m:n:s:t:")) != -1) {
+		switch (opt) {
+		case 'm':
+			if (!strcmp(optarg, "fanin"))
+				fanin = 1;
+			else if (strcmp(optarg, "pingpong"))
+				usage();
+			break;
+		case 'n':
+			clients = atoi(optarg);
+			break;
+		case 's':
+			payload = atoi(optarg);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (clients < 1 || clients > MAX_CLIENTS || payload < 4 ||
+	    payload > MAP_SIZE / 4 || seconds < 1)
+		usage();
+
+	if (pipe(ready) || pipe(start) || pipe(result)) {
+		perror("pipe");
+		return 1;
+	}
+
+	pids[npids] = fork();
+	if (!pids[npids++])
+		run_registry(ready[1]);
+	if (read(ready[0], &c, 1) != 1) {
+		fprintf(stderr, "context manager failed to start\n");
+		return 1;
+	}
+
+	for (i = 0; i < (fanin ? 1 : clients); i++) {
+		pids[npids] = fork();
+		if (!pids[npids++])
+			run_server(i, fanin ? clients : 1);
+	}
+	for (i = 0; i < clients; i++) {
+		if (!fork())
+			run_client(fanin ? 0 : i, start[0], result[1]);
+	}
+
+	/* let everybody connect, then start the clients together */
+	sleep(1);
+	for (i = 0; i < clients; i++)
+		if (write(start[1], "g", 1) != 1)
+			return 1;
+
+	for (i = 0; i < clients; i++) {
+		if (read(result[0], &rate, sizeof(rate)) != sizeof(rate))
+			break;
+		printf("client %d: %lu transactions/s\n", i, rate);
+		total += rate;
+	}
+	printf("%s, %d client%s, %d bytes: %lu transactions/s, %.1f MB/s\n",
+	       fanin ? "fanin" : "pingpong", clients, clients > 1 ? "s" : "",
+	       payload, total, 2.0 * total * payload / (1024 * 1024));
+
+	for (i = 0; i < npids; i++)
+		kill(pids[i], SIGTERM);
+	while (wait(NULL) > 0)
+		;
+	return 0;
+}
@@ -0,0 +1,395 @@
+/*
+ * sched_bench.c - governor response time and energy comparison
+ *
+ * Replays the same bursty load under each governor in turn: a thread
+ * pinned to one cpu sleeps, then runs a fixed amount of work, over and
+ * over. The work is calibrated at the maximum frequency, so the time a
+ * burst takes beyond its calibrated length is the cost of the governor
+ * not being at full speed yet. For each governor it prints the mean
+ * and 95th percentile of that extra time, and an energy estimate from
+ * the cpufreq stats residency, sum(time_in_state * (f / fmax)^3), in
+ * milliseconds at fmax.
+ *
+ * The trace is either generated from a seed or read from a file of
+ * "idle_ms work_ms" lines, so runs are repeatable.
+ *
+ * With -d, it instead checks the scheduler's utilization estimate under
+ * the sched governor: the thread runs fixed duty cycles of 10% to 90%
+ * of a period_ms period and samples the cpu's utilization from the
+ * debugfs file cpufreq_sched at each wakeup and before each sleep. The
+ * mean should follow the duty cycle within a few percent.
+ *
+ * Build: gcc -O2 -o sched_bench sched_bench.c
+ * Usage: sched_bench [-g gov,gov,...] [-c cpu] [-n bursts] [-s seed]
+ *		      [-f tracefile] [-d period_ms]
+ *
+ * Needs root, the performance governor for calibration and
+ * CONFIG_CPU_FREQ_STAT for the energy column, debugfs mounted on
+ * /sys/kernel/debug for -d. The cpu's original governor is restored
+ * on exit.
+ */
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define MAX_BURSTS	10000
+#define MAX_FREQS	64
+#define UTIL_SCALE	1024	/* SCHED_LOAD_SCALE */
+#define SCHED_STATS	"/sys/kernel/debug/cpufreq_sched"
+
+struct burst {
+	unsigned int idle_ms;
+	unsigned int work_ms;
+};
+
+static struct burst trace[MAX_BURSTS];
+static unsigned int nr_bursts = 200;
+static int cpu;
+static double loops_per_ms;
+
+static uint64_t now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static int sysfs_path(char *buf, size_t len, const char *file)
+{
+	return snprintf(buf, len, "/sys/devices/system/cpu/cpu%d/cpufreq/%s",
+			cpu, file);
+}
+
+static int read_governor(char *gov, size_t len)
+{
+	char path[128];
+	FILE *f;
+
+	sysfs_path(path, sizeof(path), "scaling_governor");
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	if (!fgets(gov, len, f)) {
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	gov[strcspn(gov, "\n")] = '\0';
+	return 0;
+}
+
+static int set_governor(const char *gov)
+{
+	char path[128];
+	FILE *f;
+	int ret;
+
+	sysfs_path(path, sizeof(path), "scaling_governor");
+	f = fopen(path, "w");
+	if (!f)
+		return -1;
+	ret = fprintf(f, "%s\n", gov) < 0;
+	if (fclose(f) || ret) {
+		fprintf(stderr, "cannot set governor %s\n", gov);
+		return -1;
+	}
+	return 0;
+}
+
+/* residency per frequency, in units of 10ms */
+static int read_time_in_state(unsigned int *freq, uint64_t *time)
+{
+	char path[128];
+	unsigned long long t;
+	unsigned int f;
+	FILE *file;
+	int n = 0;
+
+	sysfs_path(path, sizeof(path), "stats/time_in_state");
+	file = fopen(path, "r");
+	if (!file)
+		return 0;
+	while (n < MAX_FREQS && fscanf(file, "%u %llu", &f, &t) == 2) {
+		freq[n] = f;
+		time[n] = t;
+		n++;
+	}
+	fclose(file);
+	return n;
+}
+
+static volatile unsigned long sink;
+
+static void spin(unsigned long loops)
+{
+	unsigned long i;
+
+	for (i = 0; i < loops; i++)
+		sink += i;
+}
+
+static void calibrate(void)
+{
+	unsigned long loops = 1000000;
+	uint64_t t;
+
+	/* warm up, then grow until a run takes at least 200ms */
+	spin(loops);
+	for (;;) {
+		t = now_us();
+		spin(loops);
+		t = now_us() - t;
+		if (t >= 200000)
+			break;
+		loops *= 2;
+	}
+	loops_per_ms = (double)loops * 1000 / t;
+}
+
+/* deterministic, so every governor and every run sees the same load */
+static void generate_trace(unsigned int seed)
+{
+	uint32_t x = seed;
+	unsigned int i;
+
+	for (i = 0; i < nr_bursts; i++) {
+		x = x * 1103515245 + 12345;
+		trace[i].idle_ms = 10 + (x >> 16) % 190;
+		x = x * 1103515245 + 12345;
+		trace[i].work_ms = 1 + (x >> 16) % 30;
+	}
+}
+
+static int load_trace(const char *name)
+{
+	FILE *f = fopen(name, "r");
+	unsigned int idle, work;
+
+	if (!f) {
+		perror(name);
+		return -1;
+	}
+	nr_bursts = 0;
+	while (nr_bursts < MAX_BURSTS &&
+	       fscanf(f, "%u %u", &idle, &work) == 2) {
+		trace[nr_bursts].idle_ms = idle;
+		trace[nr_bursts].work_ms = work;
+		nr_bursts++;
+	}
+	fclose(f);
+	return nr_bursts ? 0 : -1;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void run(const char *gov)
+{
+	static double extra[MAX_BURSTS];
+	unsigned int freq0[MAX_FREQS], freq1[MAX_FREQS], fmax = 0;
+	uint64_t time0[MAX_FREQS], time1[MAX_FREQS];
+	double sum = 0, energy = 0, r;
+	uint64_t t, start;
+	int n0, n1, i;
+	unsigned int b;
+
+	if (set_governor(gov))
+		return;
+	sleep(1);
+
+	n0 = read_time_in_state(freq0, time0);
+	start = now_us();
+	for (b = 0; b < nr_bursts; b++) {
+		usleep(trace[b].idle_ms * 1000);
+		t = now_us();
+		spin((unsigned long)(trace[b].work_ms * loops_per_ms));
+		t = now_us() - t;
+		extra[b] = (double)t / 1000 - trace[b].work_ms;
+		if (extra[b] < 0)
+			extra[b] = 0;
+		sum += extra[b];
+	}
+	start = now_us() - start;
+	n1 = read_time_in_state(freq1, time1);
+
+	if (n0 && n0 == n1) {
+		for (i = 0; i < n1; i++)
+			if (freq1[i] > fmax)
+				fmax = freq1[i];
+		for (i = 0; i < n1; i++) {
+			r = (double)freq1[i] / fmax;
+			energy += (time1[i] - time0[i]) * 10 * r * r * r;
+		}
+	}
+
+	qsort(extra, nr_bursts, sizeof(extra[0]), cmp_double);
+	printf("%-14s %10.2f %10.2f %10.1f %12.0f\n", gov, sum / nr_bursts,
+	       extra[nr_bursts * 95 / 100],
+	       (double)start / 1000000, energy);
+}
+
+/* utilization of our cpu in UTIL_SCALE units, from the sched governor */
+static int read_util(void)
+{
+	FILE *f = fopen(SCHED_STATS, "r");
+	char line[256];
+	int c, util = -1;
+	unsigned long u;
+
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "%d %lu", &c, &u) == 2 && c == cpu) {
+			util = u;
+			break;
+		}
+	fclose(f);
+	return util;
+}
+
+/* busy for a wall clock time, whatever the frequency */
+static void busy_us(uint64_t us)
+{
+	uint64_t end = now_us() + us;
+
+	while (now_us() < end)
+		sink++;
+}
+
+static int run_duty(unsigned int period_ms)
+{
+	static const int duties[] = { 10, 25, 50, 75, 90 };
+	unsigned int i, p, periods = 3000 / period_ms + 1;
+	double work_ms, sum;
+	int util, min, max, n;
+
+	if (set_governor("sched"))
+		return 1;
+	sleep(1);
+	if (read_util() < 0) {
+		perror(SCHED_STATS);
+		return 1;
+	}
+
+	printf("%-8s %10s %10s %10s\n", "duty_%", "util_%", "min_%",
+	       "max_%");
+	for (i = 0; i < sizeof(duties) / sizeof(duties[0]); i++) {
+		work_ms = period_ms * duties[i] / 100.0;
+		sum = 0;
+		n = 0;
+		min = UTIL_SCALE;
+		max = 0;
+		/* one second to settle, then sample for two */
+		for (p = 0; p < periods; p++) {
+			usleep((period_ms - work_ms) * 1000);
+			util = p * period_ms >= 1000 ? read_util() : -1;
+			busy_us(work_ms * 1000);
+			if (util < 0)
+				continue;
+			util = (util + read_util()) / 2;
+			sum += util;
+			n++;
+			if (util < min)
+				min = util;
+			if (util > max)
+				max = util;
+		}
+		printf("%-8d %10.1f %10.1f %10.1f\n", duties[i],
+		       100.0 * sum / n / UTIL_SCALE, 100.0 * min / UTIL_SCALE,
+		       100.0 * max / UTIL_SCALE);
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	char *govs = "ondemand,sched", *trace_file = NULL, *gov;
+	char orig[64];
+	unsigned int seed = 1, duty_period = 0;
+	cpu_set_t set;
+	int c, ret = 0;
+
+	while ((c = getopt(argc, argv, "g:c:n:s:f:d:")) != -1) {
+		switch (c) {
+		case 'g':
+			govs = optarg;
+			break;
+		case 'c':
+			cpu = atoi(optarg);
+			break;
+		case 'n':
+			nr_bursts = atoi(optarg);
+			break;
+		case 's':
+			seed = atoi(optarg);
+			break;
+		case 'f':
+			trace_file = optarg;
+			break;
+		case 'd':
+			duty_period = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-g gov,gov,...] [-c cpu] "
+				"[-n bursts] [-s seed] [-f tracefile] "
+				"[-d period_ms]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (!nr_bursts || nr_bursts > MAX_BURSTS) {
+		fprintf(stderr, "bursts must be 1..%d\n", MAX_BURSTS);
+		return 1;
+	}
+	if (trace_file) {
+		if (load_trace(trace_file))
+			return 1;
+	} else {
+		generate_trace(seed);
+	}
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set)) {
+		perror("sched_setaffinity");
+		return 1;
+	}
+
+	if (read_governor(orig, sizeof(orig))) {
+		fprintf(stderr, "no cpufreq on cpu%d\n", cpu);
+		return 1;
+	}
+
+	if (set_governor("performance"))
+		return 1;
+	calibrate();
+
+	if (duty_period) {
+		printf("cpu%d, %u ms period, %.0f loops/ms at fmax\n", cpu,
+		       duty_period, loops_per_ms);
+		ret = run_duty(duty_period);
+		set_governor(orig);
+		return ret;
+	}
+
+	printf("cpu%d, %u bursts, %.0f loops/ms at fmax\n", cpu, nr_bursts,
+	       loops_per_ms);
+	printf("%-14s %10s %10s %10s %12s\n", "governor", "extra_ms",
+	       "p95_ms", "total_s", "energy_ms");
+	for (gov = strtok(govs, ","); gov; gov = strtok(NULL, ","))
+		run(gov);
+
+	set_governor(orig);
+	return ret;
+}
@@ -0,0 +1,419 @@
+/*
+ * arch/arm/mach-msm/cpuidle-predict.c
+ *
+ * Predictive idle governor for MSM8x60.
+ *
+ * The generic menu governor corrects the time to the next timer by a
+ * factor learned per sleep length bucket. It cannot see interrupts
+ * that come in at a steady rhythm, such as the SMD and modem ones. As
+ * a result it picks power collapse just before one of them arrives,
+ * and pays the exit latency for no saving.
+ *
+ * This governor learns, per cpu, the interval between wakeups caused
+ * by each interrupt. pm-8x60 reports which interrupt was pending when
+ * the low power mode returned. A source whose interval is steady
+ * enough predicts its next wakeup. The expected idle time is the
+ * earlier of that and the next timer, and the deepest allowed state
+ * whose target residency fits is chosen: WFI, standalone power
+ * collapse or power collapse.
+ *
+ * Per state residency and misprediction counts, and the learned
+ * sources, are in debugfs msm_idle_predict/stats.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/cpuidle.h>
+#include <linux/pm_qos_params.h>
+#include <linux/hrtimer.h>
+#include <linux/tick.h>
+#include <linux/err.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/spinlock.h>
+#include <linux/math64.h>
+
+#include "pm.h"
+
+#define PREDICT_SOURCES		8
+/* longer gaps say nothing about the next wakeup */
+#define PREDICT_MAX_INTERVAL_US	(10 * USEC_PER_SEC)
+/* a wakeup this close to the timer is the timer */
+#define PREDICT_TIMER_SLACK_US	100
+
+static unsigned int min_hits = 3;
+module_param(min_hits, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(min_hits, "Intervals seen before a source predicts");
+
+static unsigned int max_jitter = 25;
+module_param(max_jitter, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(max_jitter, "Largest interval deviation, in percent of "
+		 "the interval, of a source that predicts");
+
+struct msm_idle_source {
+	int irq;			/* -1 if the slot is free */
+	unsigned int hits;		/* intervals averaged */
+	unsigned int avg_us;
+	unsigned int dev_us;		/* mean deviation from avg_us */
+	s64 last_ns;
+	unsigned long wakes;
+};
+
+struct msm_idle_state_stats {
+	unsigned long entries;
+	u64 residency_us;
+	unsigned long too_deep;		/* left before target residency */
+	unsigned long too_shallow;	/* a deeper allowed state fitted */
+};
+
+struct msm_idle_predict {
+	struct cpuidle_device *dev;
+	struct msm_idle_source src[PREDICT_SOURCES];
+	struct msm_idle_state_stats state[CPUIDLE_STATE_MAX];
+
+	/* the last selection */
+	int last_idx;
+	unsigned int allowed;		/* states allowed by flags and QoS */
+	unsigned int timer_us;
+	unsigned int predicted_us;
+	int predicted_irq;		/* -1 if the timer set the limit */
+
+	unsigned long timer_wakes;
+	unsigned long irq_wakes;
+	unsigned long unknown_wakes;
+	unsigned long irq_limited;	/* selections an irq set the limit on */
+	unsigned long irq_hits;		/* ... and that irq then woke us */
+};
+
+static DEFINE_PER_CPU(struct msm_idle_predict, msm_idle_predict);
+
+/* only for the debugfs reader against reset and enable */
+static DEFINE_SPINLOCK(msm_idle_predict_lock);
+
+/*
+ * Microseconds until src is next expected, 0 if it has no usable
+ * pattern. The window is aimed early by the deviation: waking from
+ * WFI a little early costs less than collapsing just before the irq.
+ */
+static unsigned int msm_idle_source_next_us(struct msm_idle_source *src,
+					    s64 now)
+{
+	s64 start, end;
+
+	if (src->irq < 0 || src->hits < min_hits)
+		return 0;
+	if (src->dev_us * 100 > src->avg_us * max_jitter)
+		return 0;
+
+	start = src->last_ns +
+		(s64)(src->avg_us - src->dev_us) * NSEC_PER_USEC - now;
+	end = src->last_ns +
+		(s64)(src->avg_us + src->dev_us) * NSEC_PER_USEC - now;
+
+	/* missed it, the pattern picks up again at the next wakeup */
+	if (end < 0)
+		return 0;
+	/* inside the window, it is due any moment */
+	if (start <= 0)
+		return 1;
+
+	return div_u64(start, NSEC_PER_USEC) ?: 1;
+}
+
+static void msm_idle_source_update(struct msm_idle_predict *data, int irq,
+				   s64 now)
+{
+	struct msm_idle_source *src, *victim = NULL;
+	unsigned int interval, k;
+	int i, diff;
+
+	for (i = 0; i < PREDICT_SOURCES; i++) {
+		src = &data->src[i];
+		if (src->irq == irq)
+			goto found;
+		if (!victim || src->irq < 0 ||
+		    (victim->irq >= 0 && src->last_ns < victim->last_ns))
+			victim = src;
+	}
+
+	/* a new source, evicting the one that woke us longest ago */
+	victim->irq = irq;
+	victim->hits = 0;
+	victim->avg_us = 0;
+	victim->dev_us = 0;
+	victim->last_ns = now;
+	victim->wakes = 1;
+	return;
+
+found:
+	interval = min_t(s64, div_u64(now - src->last_ns, NSEC_PER_USEC),
+			 UINT_MAX);
+	src->last_ns = now;
+	src->wakes++;
+
+	if (interval > PREDICT_MAX_INTERVAL_US) {
+		src->hits = 0;
+		return;
+	}
+
+	if (!src->hits) {
+		src->avg_us = interval;
+		src->dev_us = interval / 2;
+		src->hits = 1;
+		return;
+	}
+
+	/* it fired on another cpu or while we were busy: k periods passed */
+	k = DIV_ROUND_CLOSEST(interval, max(src->avg_us, 1U));
+	if (k > 1 && k <= 4)
+		interval /= k;
+
+	diff = (int)interval - (int)src->avg_us;
+	src->avg_us += diff / 8;
+	src->dev_us = src->dev_us - src->dev_us / 4 + abs(diff) / 4;
+	src->hits++;
+}
+
+static int msm_idle_predict_select(struct cpuidle_device *dev)
+{
+	struct msm_idle_predict *data = &per_cpu(msm_idle_predict, dev->cpu);
+	int latency_req = pm_qos_requirement(PM_QOS_CPU_DMA_LATENCY);
+	unsigned int residency = 0, next;
+	s64 now;
+	int i;
+
+	data->last_idx = CPUIDLE_DRIVER_STATE_START;
+	data->allowed = 0;
+	data->timer_us = min_t(s64, ktime_to_us(tick_nohz_get_sleep_length()),
+			       UINT_MAX);
+	data->predicted_us = data->timer_us;
+	data->predicted_irq = -1;
+
+	if (unlikely(latency_req == 0))
+		return data->last_idx;
+
+	now = ktime_to_ns(ktime_get());
+	for (i = 0; i < PREDICT_SOURCES; i++) {
+		next = msm_idle_source_next_us(&data->src[i], now);
+		if (next && next < data->predicted_us) {
+			data->predicted_us = next;
+			data->predicted_irq = data->src[i].irq;
+		}
+	}
+	if (data->predicted_irq >= 0)
+		data->irq_limited++;
+
+	for (i = CPUIDLE_DRIVER_STATE_START; i < dev->state_count; i++) {
+		struct cpuidle_state *s = &dev->states[i];
+
+		if (s->flags & CPUIDLE_FLAG_IGNORE)
+			continue;
+		if (s->exit_latency > latency_req)
+			continue;
+		data->allowed |= 1 << i;
+
+		if (s->target_residency > data->predicted_us)
+			continue;
+		if (s->target_residency >= residency) {
+			residency = s->target_residency;
+			data->last_idx = i;
+		}
+	}
+
+	return data->last_idx;
+}
+
+static void msm_idle_predict_reflect(struct cpuidle_device *dev)
+{
+	struct msm_idle_predict *data = &per_cpu(msm_idle_predict, dev->cpu);
+	struct cpuidle_state *target = &dev->states[data->last_idx];
+	struct msm_idle_state_stats *st = &data->state[data->last_idx];
+	unsigned int us = cpuidle_get_last_residency(dev);
+	int irq = msm_pm_idle_wakeup_irq(dev->cpu);
+	int i;
+
+	st->entries++;
+	st->residency_us += us;
+
+	if (us < target->target_residency) {
+		st->too_deep++;
+	} else {
+		for (i = CPUIDLE_DRIVER_STATE_START; i < dev->state_count; i++)
+			if ((data->allowed & (1 << i)) &&
+			    dev->states[i].target_residency >
+			    target->target_residency &&
+			    dev->states[i].target_residency <= us) {
+				st->too_shallow++;
+				break;
+			}
+	}
+
+	if (us + target->exit_latency + PREDICT_TIMER_SLACK_US >=
+	    data->timer_us) {
+		data->timer_wakes++;
+		return;
+	}
+
+	if (irq < 0) {
+		data->unknown_wakes++;
+		return;
+	}
+
+	data->irq_wakes++;
+	if (irq == data->predicted_irq)
+		data->irq_hits++;
+	msm_idle_source_update(data, irq, ktime_to_ns(ktime_get()));
+}
+
+static void msm_idle_predict_reset(struct msm_idle_predict *data)
+{
+	int i;
+
+	memset(data, 0, sizeof(*data));
+	for (i = 0; i < PREDICT_SOURCES; i++)
+		data->src[i].irq = -1;
+	data->predicted_irq = -1;
+}
+
+static int msm_idle_predict_enable(struct cpuidle_device *dev)
+{
+	struct msm_idle_predict *data = &per_cpu(msm_idle_predict, dev->cpu);
+	unsigned long flags;
+
+	spin_lock_irqsave(&msm_idle_predict_lock, flags);
+	msm_idle_predict_reset(data);
+	data->dev = dev;
+	spin_unlock_irqrestore(&msm_idle_predict_lock, flags);
+
+	return 0;
+}
+
+static struct cpuidle_governor msm_idle_predict_governor = {
+	.name =		"msm_predict",
+	.rating =	30,
+	.enable =	msm_idle_predict_enable,
+	.select =	msm_idle_predict_select,
+	.reflect =	msm_idle_predict_reflect,
+	.owner =	THIS_MODULE,
+};
+
+#ifdef CONFIG_DEBUG_FS
+static int msm_idle_predict_stats_show(struct seq_file *m, void *unused)
+{
+	struct msm_idle_predict *data;
+	struct cpuidle_device *dev;
+	unsigned int cpu;
+	s64 now = ktime_to_ns(ktime_get());
+	int i;
+
+	spin_lock_irq(&msm_idle_predict_lock);
+	for_each_possible_cpu(cpu) {
+		data = &per_cpu(msm_idle_predict, cpu);
+		dev = data->dev;
+
+		seq_printf(m, "cpu%u: timer_wakes: %lu irq_wakes: %lu "
+			   "unknown_wakes: %lu irq_limited: %lu irq_hits: %lu\n",
+			   cpu, data->timer_wakes, data->irq_wakes,
+			   data->unknown_wakes, data->irq_limited,
+			   data->irq_hits);
+
+		seq_printf(m, "%-28s %10s %14s %10s %11s\n", "state",
+			   "entries", "residency_us", "too_deep",
+			   "too_shallow");
+		for (i = 0; dev && i < dev->state_count; i++) {
+			struct msm_idle_state_stats *st = &data->state[i];
+
+			seq_printf(m, "%-28s %10lu %14llu %10lu %11lu\n",
+				   dev->states[i].desc, st->entries,
+				   st->residency_us, st->too_deep,
+				   st->too_shallow);
+		}
+
+		seq_printf(m, "%-6s %10s %8s %10s %10s %10s\n", "irq",
+			   "wakes", "hits", "avg_us", "dev_us", "next_us");
+		for (i = 0; i < PREDICT_SOURCES; i++) {
+			struct msm_idle_source *src = &data->src[i];
+
+			if (src->irq < 0)
+				continue;
+			seq_printf(m, "%-6d %10lu %8u %10u %10u %10u\n",
+				   src->irq, src->wakes, src->hits,
+				   src->avg_us, src->dev_us,
+				   msm_idle_source_next_us(src, now));
+		}
+		seq_printf(m, "\n");
+	}
+	spin_unlock_irq(&msm_idle_predict_lock);
+
+	return 0;
+}
+
+static int msm_idle_predict_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, msm_idle_predict_stats_show, NULL);
+}
+
+static const struct file_operations msm_idle_predict_stats_fops = {
+	.open		= msm_idle_predict_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/* clears the counters, keeps what was learned about the sources */
+static int msm_idle_predict_stats_reset(void *data, u64 val)
+{
+	struct msm_idle_predict *d;
+	unsigned int cpu;
+
+	spin_lock_irq(&msm_idle_predict_lock);
+	for_each_possible_cpu(cpu) {
+		d = &per_cpu(msm_idle_predict, cpu);
+		memset(d->state, 0, sizeof(d->state));
+		d->timer_wakes = 0;
+		d->irq_wakes = 0;
+		d->unknown_wakes = 0;
+		d->irq_limited = 0;
+		d->irq_hits = 0;
+	}
+	spin_unlock_irq(&msm_idle_predict_lock);
+
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(msm_idle_predict_reset_fops, NULL,
+			msm_idle_predict_stats_reset, "%llu\n");
+
+static void __init msm_idle_predict_debugfs_init(void)
+{
+	struct dentry *dent;
+
+	dent = debugfs_create_dir("msm_idle_predict", NULL);
+	if (!dent || IS_ERR(dent))
+		return;
+
+	debugfs_create_file("stats", 0444, dent, NULL,
+			    &msm_idle_predict_stats_fops);
+	debugfs_create_file("reset", 0200, dent, NULL,
+			    &msm_idle_predict_reset_fops);
+}
+#else
+static inline void msm_idle_predict_debugfs_init(void) { }
+#endif
+
+static int __init msm_idle_predict_init(void)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu)
+		msm_idle_predict_reset(&per_cpu(msm_idle_predict, cpu));
+
+	msm_idle_predict_debugfs_init();
+	return cpuidle_register_governor(&msm_idle_predict_governor);
+}
+
+module_init(msm_idle_predict_init);
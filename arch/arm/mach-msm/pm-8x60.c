@@ -21,9 +21,12 @@
 #include <linux/init.h>
 #include <linux/completion.h>
 #include <linux/cpuidle.h>
+#include <linux/debugfs.h>
 #include <linux/io.h>
 #include <linux/pm.h>
 #include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
 #include <linux/smp.h>
 #include <linux/suspend.h>
 #include <linux/uaccess.h>
@@ -502,6 +505,288 @@ write_proc_failed:
 #undef MSM_PM_STATS_RESET
 #endif /* CONFIG_MSM_IDLE_STATS */
 
+/******************************************************************************
+ * CONFIG_MSM_IDLE_TRACE
+ *****************************************************************************/
+
+#ifdef CONFIG_MSM_IDLE_TRACE
+#define MSM_PM_TRACE_LEN	256	/* records per cpu, a power of 2 */
+/* a wakeup this close to the programmed timer is the timer */
+#define MSM_PM_TRACE_TIMER_SLACK_NS	(100 * NSEC_PER_USEC)
+
+/*
+ * One idle period. entry_us runs from msm_pm_idle_enter() to the low
+ * power instruction, sleep_us from there to its return and exit_us
+ * from the return until the timer runs again.
+ *
+ * In power collapse the timer is stopped until msm_timer_exit_idle(),
+ * so the way back up to that point is counted as sleep there.
+ */
+struct msm_pm_trace_rec {
+	int64_t start;		/* ktime, ns */
+	uint32_t entry_us;
+	uint32_t sleep_us;
+	uint32_t exit_us;
+	int16_t irq;		/* pending at wakeup, -1 if none */
+	uint8_t mode;		/* enum msm_pm_sleep_mode */
+	uint8_t timer;		/* woke at the programmed timer */
+};
+
+struct msm_pm_trace_mode {
+	unsigned long count;
+	uint64_t entry_us;
+	uint64_t sleep_us;
+	uint64_t exit_us;
+	uint32_t exit_max_us;
+};
+
+struct msm_pm_cpu_trace {
+	spinlock_t lock;
+	unsigned int head;	/* records written so far */
+	struct msm_pm_trace_rec rec[MSM_PM_TRACE_LEN];
+
+	struct msm_pm_trace_mode mode[MSM_PM_SLEEP_MODE_NR];
+	unsigned long timer_wakes;
+	unsigned long unknown_wakes;
+	/* wakeups per irq, and those too early for power collapse to pay */
+	unsigned int irq_wakes[NR_MSM_IRQS];
+	unsigned int irq_short[NR_MSM_IRQS];
+
+	/* around the low power instruction of the current period */
+	int64_t lp_enter;
+	int64_t lp_exit;
+};
+
+static DEFINE_PER_CPU(struct msm_pm_cpu_trace, msm_pm_trace);
+
+static inline void msm_pm_trace_mark_enter(void)
+{
+	__get_cpu_var(msm_pm_trace).lp_enter = ktime_to_ns(ktime_get());
+}
+
+static inline void msm_pm_trace_mark_exit(void)
+{
+	__get_cpu_var(msm_pm_trace).lp_exit = ktime_to_ns(ktime_get());
+}
+
+static uint32_t msm_pm_trace_us(int64_t from, int64_t to)
+{
+	uint64_t t;
+
+	if (to <= from)
+		return 0;
+	t = to - from;
+	do_div(t, NSEC_PER_USEC);
+	return (t > UINT_MAX) ? UINT_MAX : (uint32_t) t;
+}
+
+/*
+ * Record an idle period from @start to @end. Called with interrupts
+ * disabled, once the timer runs again.
+ */
+static void msm_pm_trace_add(enum msm_pm_sleep_mode mode, int64_t start,
+	int64_t end, int64_t timer_expiration, bool timer_halted, int irq)
+{
+	struct msm_pm_cpu_trace *trace = &__get_cpu_var(msm_pm_trace);
+	unsigned int cpu = smp_processor_id();
+	struct msm_pm_trace_mode *m = &trace->mode[mode];
+	struct msm_pm_trace_rec *rec;
+	uint32_t deep_us;
+
+	if (timer_halted || trace->lp_exit < trace->lp_enter)
+		trace->lp_exit = end;
+	if (trace->lp_enter < start)
+		trace->lp_enter = start;
+
+	spin_lock(&trace->lock);
+
+	rec = &trace->rec[trace->head++ & (MSM_PM_TRACE_LEN - 1)];
+	rec->start = start;
+	rec->entry_us = msm_pm_trace_us(start, trace->lp_enter);
+	rec->sleep_us = msm_pm_trace_us(trace->lp_enter, trace->lp_exit);
+	rec->exit_us = msm_pm_trace_us(trace->lp_exit, end);
+	rec->irq = irq;
+	rec->mode = mode;
+	rec->timer = timer_expiration &&
+		end - start + MSM_PM_TRACE_TIMER_SLACK_NS >= timer_expiration;
+
+	m->count++;
+	m->entry_us += rec->entry_us;
+	m->sleep_us += rec->sleep_us;
+	m->exit_us += rec->exit_us;
+	if (rec->exit_us > m->exit_max_us)
+		m->exit_max_us = rec->exit_us;
+
+	deep_us = msm_pm_modes[MSM_PM_MODE(cpu,
+			MSM_PM_SLEEP_MODE_POWER_COLLAPSE)].residency;
+	if (rec->timer) {
+		trace->timer_wakes++;
+	} else if (irq < 0 || irq >= NR_MSM_IRQS) {
+		trace->unknown_wakes++;
+	} else {
+		trace->irq_wakes[irq]++;
+		if (rec->entry_us + rec->sleep_us + rec->exit_us < deep_us)
+			trace->irq_short[irq]++;
+	}
+
+	spin_unlock(&trace->lock);
+
+	trace->lp_enter = 0;
+	trace->lp_exit = 0;
+}
+
+static int msm_pm_trace_show(struct seq_file *m, void *unused)
+{
+	struct msm_pm_trace_rec *recs;
+	unsigned int cpu, head, n, i;
+
+	recs = kmalloc(sizeof(*recs) * MSM_PM_TRACE_LEN, GFP_KERNEL);
+	if (!recs)
+		return -ENOMEM;
+
+	seq_printf(m, "cpu start_us mode entry_us sleep_us exit_us irq timer\n");
+	for_each_possible_cpu(cpu) {
+		struct msm_pm_cpu_trace *trace = &per_cpu(msm_pm_trace, cpu);
+
+		spin_lock_irq(&trace->lock);
+		head = trace->head;
+		memcpy(recs, trace->rec, sizeof(*recs) * MSM_PM_TRACE_LEN);
+		spin_unlock_irq(&trace->lock);
+
+		n = min_t(unsigned int, head, MSM_PM_TRACE_LEN);
+		for (i = head - n; i != head; i++) {
+			struct msm_pm_trace_rec *rec =
+				&recs[i & (MSM_PM_TRACE_LEN - 1)];
+			uint64_t start = rec->start;
+
+			do_div(start, NSEC_PER_USEC);
+			seq_printf(m, "%u %llu %s %u %u %u %d %u\n", cpu, start,
+				msm_pm_sleep_mode_labels[rec->mode],
+				rec->entry_us, rec->sleep_us, rec->exit_us,
+				rec->irq, rec->timer);
+		}
+	}
+
+	kfree(recs);
+	return 0;
+}
+
+static int msm_pm_trace_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, msm_pm_trace_show, NULL);
+}
+
+static const struct file_operations msm_pm_trace_fops = {
+	.open		= msm_pm_trace_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int msm_pm_trace_summary_show(struct seq_file *m, void *unused)
+{
+	unsigned int cpu;
+	int i;
+
+	for_each_possible_cpu(cpu) {
+		struct msm_pm_cpu_trace *trace = &per_cpu(msm_pm_trace, cpu);
+
+		spin_lock_irq(&trace->lock);
+
+		seq_printf(m, "cpu%u\n%-28s %10s %12s %12s %12s %12s\n", cpu,
+			"mode", "count", "sleep_ms", "entry_avg_us",
+			"exit_avg_us", "exit_max_us");
+		for (i = 0; i < MSM_PM_SLEEP_MODE_NR; i++) {
+			struct msm_pm_trace_mode *mode = &trace->mode[i];
+			uint64_t sleep_ms = mode->sleep_us;
+			uint64_t entry_avg = mode->entry_us;
+			uint64_t exit_avg = mode->exit_us;
+
+			if (!mode->count)
+				continue;
+			do_div(sleep_ms, USEC_PER_MSEC);
+			do_div(entry_avg, mode->count);
+			do_div(exit_avg, mode->count);
+			seq_printf(m, "%-28s %10lu %12llu %12llu %12llu %12u\n",
+				msm_pm_sleep_mode_labels[i], mode->count,
+				sleep_ms, entry_avg, exit_avg,
+				mode->exit_max_us);
+		}
+
+		seq_printf(m, "wakeups: timer %lu unknown %lu\n",
+			trace->timer_wakes, trace->unknown_wakes);
+		seq_printf(m, "%-6s %10s %10s\n", "irq", "wakes", "short");
+		for (i = 0; i < NR_MSM_IRQS; i++)
+			if (trace->irq_wakes[i])
+				seq_printf(m, "%-6d %10u %10u\n", i,
+					trace->irq_wakes[i],
+					trace->irq_short[i]);
+		seq_printf(m, "\n");
+
+		spin_unlock_irq(&trace->lock);
+	}
+
+	return 0;
+}
+
+static int msm_pm_trace_summary_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, msm_pm_trace_summary_show, NULL);
+}
+
+static const struct file_operations msm_pm_trace_summary_fops = {
+	.open		= msm_pm_trace_summary_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int msm_pm_trace_reset(void *data, u64 val)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct msm_pm_cpu_trace *trace = &per_cpu(msm_pm_trace, cpu);
+
+		spin_lock_irq(&trace->lock);
+		trace->head = 0;
+		memset(trace->mode, 0, sizeof(trace->mode));
+		trace->timer_wakes = 0;
+		trace->unknown_wakes = 0;
+		memset(trace->irq_wakes, 0, sizeof(trace->irq_wakes));
+		memset(trace->irq_short, 0, sizeof(trace->irq_short));
+		spin_unlock_irq(&trace->lock);
+	}
+
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(msm_pm_trace_reset_fops, NULL, msm_pm_trace_reset,
+	"%llu\n");
+
+static void __init msm_pm_trace_init(void)
+{
+	struct dentry *dent;
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu(msm_pm_trace, cpu).lock);
+
+	dent = debugfs_create_dir("msm_pm_trace", NULL);
+	if (!dent || IS_ERR(dent))
+		return;
+
+	debugfs_create_file("trace", S_IRUGO, dent, NULL, &msm_pm_trace_fops);
+	debugfs_create_file("summary", S_IRUGO, dent, NULL,
+		&msm_pm_trace_summary_fops);
+	debugfs_create_file("reset", S_IWUSR, dent, NULL,
+		&msm_pm_trace_reset_fops);
+}
+#else
+static inline void msm_pm_trace_mark_enter(void) { }
+static inline void msm_pm_trace_mark_exit(void) { }
+static inline void msm_pm_trace_init(void) { }
+#endif /* CONFIG_MSM_IDLE_TRACE */
+
 
 /******************************************************************************
  * Configure Hardware before/after Low Power Mode
@@ -597,7 +882,9 @@ static DEFINE_PER_CPU_SHARED_ALIGNED(struct msm_pm_device, msm_pm_devices);
 static void msm_pm_swfi(void)
 {
 	msm_pm_config_hw_before_swfi();
+	msm_pm_trace_mark_enter();
 	msm_arch_idle();
+	msm_pm_trace_mark_exit();
 }
 
 static void msm_pm_spm_power_collapse(
@@ -627,7 +914,9 @@ static void msm_pm_spm_power_collapse(
 	vfp_flush_context();
 #endif
 
+	msm_pm_trace_mark_enter();
 	collapsed = msm_pm_collapse();
+	msm_pm_trace_mark_exit();
 
 	if (collapsed) {
 #ifdef CONFIG_VFP
@@ -689,6 +978,31 @@ static void msm_pm_power_collapse(bool from_idle, uint32_t sleep_delay)
 }
 
 
+/*
+ * The interrupt that ended the last idle period on each cpu, for the
+ * idle governor to learn wakeup patterns from. See msm_pm_pending_irq().
+ */
+static DEFINE_PER_CPU(int, msm_pm_wakeup_irq) = -1;
+
+/*
+ * Interrupts are still disabled when the low power mode returns, so the
+ * interrupt that woke us is still pending in the GIC. IDs 1020-1023 mean
+ * nothing is pending.
+ */
+static int msm_pm_pending_irq(void)
+{
+	unsigned int irq;
+
+	irq = readl(MSM_QGIC_CPU_BASE + GIC_CPU_HIGHPRI) & 0x3ff;
+	return irq < 1020 ? irq : -1;
+}
+
+int msm_pm_idle_wakeup_irq(unsigned int cpu)
+{
+	return per_cpu(msm_pm_wakeup_irq, cpu);
+}
+
+
 /******************************************************************************
  * External Idle/Suspend Functions
  *****************************************************************************/
@@ -736,7 +1050,7 @@ int msm_pm_idle_prepare(struct cpuidle_device *dev)
 
 int msm_pm_idle_enter(enum msm_pm_sleep_mode sleep_mode)
 {
-	int64_t time;
+	int64_t time, end;
 	int64_t timer_expiration;
 	bool timer_halted;
 #ifdef CONFIG_MSM_IDLE_STATS
@@ -787,8 +1101,14 @@ int msm_pm_idle_enter(enum msm_pm_sleep_mode sleep_mode)
 		goto cpuidle_enter_bail_timer;
 	}
 
+	__get_cpu_var(msm_pm_wakeup_irq) = msm_pm_pending_irq();
 	msm_timer_exit_idle((int) timer_halted);
-	time = ktime_to_ns(ktime_get()) - time;
+	end = ktime_to_ns(ktime_get());
+#ifdef CONFIG_MSM_IDLE_TRACE
+	msm_pm_trace_add(sleep_mode, time, end, timer_expiration, timer_halted,
+		__get_cpu_var(msm_pm_wakeup_irq));
+#endif
+	time = end - time;
 #ifdef CONFIG_MSM_IDLE_STATS
 	msm_pm_add_stat(exit_stat, time);
 #endif
@@ -797,6 +1117,8 @@ int msm_pm_idle_enter(enum msm_pm_sleep_mode sleep_mode)
 	return (int) time;
 
 cpuidle_enter_bail_timer:
+	/* nothing woke us, don't leave the last wakeup for the governor */
+	__get_cpu_var(msm_pm_wakeup_irq) = -1;
 	msm_timer_exit_idle((int) timer_halted);
 	return 0;
 }
@@ -1027,6 +1349,7 @@ static int __init msm_pm_init(void)
 	}
 #endif  /* CONFIG_MSM_IDLE_STATS */
 
+	msm_pm_trace_init();
 	msm_pm_mode_sysfs_add();
 	msm_spm_allow_x_cpu_set_vdd(false);
 
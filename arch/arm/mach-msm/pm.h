@@ -53,6 +53,7 @@ struct msm_pm_platform_data {
 void msm_pm_set_platform_data(struct msm_pm_platform_data *data, int count);
 int msm_pm_idle_prepare(struct cpuidle_device *dev);
 int msm_pm_idle_enter(enum msm_pm_sleep_mode sleep_mode);
+int msm_pm_idle_wakeup_irq(unsigned int cpu);
 
 #ifdef CONFIG_HOTPLUG_CPU
 int msm_pm_platform_secondary_init(unsigned int cpu);
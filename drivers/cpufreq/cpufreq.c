@@ -28,7 +28,15 @@
 #include <linux/cpu.h>
 #include <linux/completion.h>
 #include <linux/mutex.h>
+#include <linux/sched.h>
 #include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/hrtimer.h>
+#include <linux/input.h>
+#include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/cpufreq_tickle.h>
+#include <trace/events/power.h>
 
 #define dprintk(msg...) cpufreq_debug_printk(CPUFREQ_DEBUG_CORE, \
 						"cpufreq-core", msg)
@@ -111,6 +119,33 @@ static int __cpufreq_governor(struct cpufreq_policy *policy,
 		unsigned int event);
 static unsigned int __cpufreq_get(unsigned int cpu);
 static void handle_update(struct work_struct *work);
+#ifdef CONFIG_CPU_FREQ_BOOST
+static int cpufreq_boost_adjust(struct cpufreq_policy *policy,
+				struct cpufreq_governor *governor);
+static void cpufreq_boost_transition(struct cpufreq_freqs *freqs);
+#else
+static inline int cpufreq_boost_adjust(struct cpufreq_policy *policy,
+				       struct cpufreq_governor *governor)
+{
+	return 0;
+}
+static inline void cpufreq_boost_transition(struct cpufreq_freqs *freqs) { }
+#endif
+
+/*
+ * What the last request for each cpu asked for and why, handed to the
+ * transition notifiers. Requests made by the task running a governor's
+ * START or LIMITS event are on behalf of the policy limits, anything
+ * else the governor asks for is its own decision.
+ */
+struct cpufreq_trans_ctx {
+	unsigned int requested;
+	unsigned int reason;
+	struct task_struct *limits_task;
+	int boosted;
+	ktime_t prechange;
+};
+static DEFINE_PER_CPU(struct cpufreq_trans_ctx, cpufreq_trans_ctx);
 
 /**
  * Two notifier lists: the "policy" list is involved in the
@@ -323,11 +358,15 @@ static inline void adjust_jiffies(unsigned long val, struct cpufreq_freqs *ci)
  */
 void cpufreq_notify_transition(struct cpufreq_freqs *freqs, unsigned int state)
 {
+	struct cpufreq_trans_ctx *ctx = &per_cpu(cpufreq_trans_ctx, freqs->cpu);
 	struct cpufreq_policy *policy;
 
 	BUG_ON(irqs_disabled());
 
 	freqs->flags = cpufreq_driver->flags;
+	freqs->requested = ctx->requested;
+	freqs->reason = ctx->requested ? ctx->reason : CPUFREQ_REASON_DRIVER;
+	freqs->latency_ns = 0;
 	dprintk("notification %u of frequency transition to %u kHz\n",
 		state, freqs->new);
 
@@ -351,14 +390,22 @@ void cpufreq_notify_transition(struct cpufreq_freqs *freqs, unsigned int state)
 		srcu_notifier_call_chain(&cpufreq_transition_notifier_list,
 				CPUFREQ_PRECHANGE, freqs);
 		adjust_jiffies(CPUFREQ_PRECHANGE, freqs);
+		/* from here to POSTCHANGE is the driver changing the clock */
+		ctx->prechange = ktime_get();
 		break;
 
 	case CPUFREQ_POSTCHANGE:
+		if (ctx->prechange.tv64)
+			freqs->latency_ns = ktime_to_ns(ktime_sub(ktime_get(),
+							ctx->prechange));
+		trace_cpufreq_transition(freqs);
 		adjust_jiffies(CPUFREQ_POSTCHANGE, freqs);
 		srcu_notifier_call_chain(&cpufreq_transition_notifier_list,
 				CPUFREQ_POSTCHANGE, freqs);
 		if (likely(policy) && likely(policy->cpu == freqs->cpu))
 			policy->cur = freqs->new;
+		cpufreq_boost_transition(freqs);
+		ctx->prechange.tv64 = 0;
 		break;
 	}
 }
@@ -477,12 +524,16 @@ static ssize_t store_##file_name					\
 	if (ret)							\
 		return -EINVAL;						\
 									\
+	/* start from the user limits, not a boosted policy->min */	\
+	new_policy.min = policy->user_policy.min;			\
+	new_policy.max = policy->user_policy.max;			\
+									\
 	ret = sscanf(buf, "%u", &new_policy.object);			\
 	if (ret != 1)							\
 		return -EINVAL;						\
 									\
 	ret = __cpufreq_set_policy(policy, &new_policy);		\
-	policy->user_policy.object = policy->object;			\
+	policy->user_policy.object = new_policy.object;			\
 									\
 	return ret ? ret : count;					\
 }
@@ -1500,13 +1551,33 @@ int __cpufreq_driver_target(struct cpufreq_policy *policy,
 			    unsigned int target_freq,
 			    unsigned int relation)
 {
+	struct cpufreq_trans_ctx *ctx = &per_cpu(cpufreq_trans_ctx, policy->cpu);
+	unsigned int reason = CPUFREQ_REASON_GOVERNOR;
 	int retval = -EINVAL;
+	int j;
 
 	dprintk("target for CPU %u: %u kHz, relation %u\n", policy->cpu,
 		target_freq, relation);
+
+	if (ctx->limits_task == current)
+		reason = ctx->boosted ? CPUFREQ_REASON_BOOST :
+			CPUFREQ_REASON_LIMITS;
+	trace_cpufreq_request(policy, target_freq, relation, reason);
+	for_each_cpu(j, policy->cpus) {
+		per_cpu(cpufreq_trans_ctx, j).requested = target_freq;
+		per_cpu(cpufreq_trans_ctx, j).reason = reason;
+	}
+
 	if (cpu_online(policy->cpu) && cpufreq_driver->target)
 		retval = cpufreq_driver->target(policy, target_freq, relation);
 
+	/*
+	 * The driver may have had nothing to do; either way a transition
+	 * it makes on its own later must not be put down to this request.
+	 */
+	for_each_cpu(j, policy->cpus)
+		per_cpu(cpufreq_trans_ctx, j).requested = 0;
+
 	return retval;
 }
 EXPORT_SYMBOL_GPL(__cpufreq_driver_target);
@@ -1590,7 +1661,15 @@ static int __cpufreq_governor(struct cpufreq_policy *policy,
 
 	dprintk("__cpufreq_governor for CPU %u, event %u\n",
 						policy->cpu, event);
-	ret = policy->governor->governor(policy, event);
+	if (event == CPUFREQ_GOV_START || event == CPUFREQ_GOV_LIMITS) {
+		struct cpufreq_trans_ctx *ctx =
+			&per_cpu(cpufreq_trans_ctx, policy->cpu);
+
+		ctx->limits_task = current;
+		ret = policy->governor->governor(policy, event);
+		ctx->limits_task = NULL;
+	} else
+		ret = policy->governor->governor(policy, event);
 
 	/* we keep one module reference alive for
 			each CPU governed by this CPU */
@@ -1726,6 +1805,8 @@ static int __cpufreq_set_policy(struct cpufreq_policy *data,
 
 	data->min = policy->min;
 	data->max = policy->max;
+	per_cpu(cpufreq_trans_ctx, data->cpu).boosted =
+		cpufreq_boost_adjust(data, policy->governor);
 
 	dprintk("new min and max freqs are %u - %u kHz\n",
 					data->min, data->max);
@@ -1834,6 +1915,827 @@ no_policy:
 }
 EXPORT_SYMBOL(cpufreq_update_policy);
 
+#ifdef CONFIG_CPU_FREQ_BOOST
+/*********************************************************************
+ *                               BOOST                               *
+ *********************************************************************/
+
+/*
+ * Boost requests raise policy->min of every policy while they are
+ * active: a boost to policy->max, a floor to the highest frequency any
+ * client asks for. Each governor sees the new limits through
+ * CPUFREQ_GOV_LIMITS and keeps scaling above them, so tickles, floors
+ * and input boost work the same whichever governor is in use.
+ *
+ * A governor with a ->boost hook is left its policy->min and is called
+ * instead to move the frequency itself, which saves a full policy
+ * update on every tickle.
+ */
+
+#define BOOST_MAX_WINDOW	10000	/* ms */
+#define BOOST_ALL		UINT_MAX
+
+static unsigned int boost_enabled = 1;
+module_param(boost_enabled, uint, 0644);
+
+/* window of an untimed tickle or floor, and the cap on timed ones */
+static unsigned int boost_ms = 3000;
+module_param(boost_ms, uint, 0644);
+
+static unsigned int floor_ms = 3000;
+module_param(floor_ms, uint, 0644);
+
+/* boost on input events, 0 to disable */
+static unsigned int input_boost_ms = 40;
+module_param(input_boost_ms, uint, 0644);
+
+static DEFINE_SPINLOCK(boost_lock);
+static DEFINE_MUTEX(boost_mutex);
+static LIST_HEAD(boost_clients);
+
+static struct {
+	int			boost_holds;
+	int			boost_timed;
+	unsigned long		boost_expires;
+	int			floor_timed;
+	unsigned long		floor_expires;
+	unsigned int		floor_timed_freq;
+	/* floor the policies were last set up with, under boost_mutex */
+	unsigned int		applied;
+	ktime_t			input_stamp;
+	int			input_pending;
+} boost;
+
+/*
+ * Latency from an input event that starts a boost to the frequency
+ * change it causes.
+ */
+static const unsigned int boost_lat_bounds[] = {
+	250, 500, 1000, 2000, 5000, 10000, 20000,	/* us */
+};
+#define BOOST_LAT_BUCKETS	(ARRAY_SIZE(boost_lat_bounds) + 1)
+
+static struct {
+	unsigned long		events;
+	unsigned long		changed;
+	unsigned long		already;
+	u64			total_ns;
+	u64			max_ns;
+	unsigned long		hist[BOOST_LAT_BUCKETS];
+} boost_lat;
+
+static struct cpufreq_boost_client boost_kernel_client = {
+	.name = "kernel",
+};
+
+static struct cpufreq_boost_client boost_input_client = {
+	.name = "input",
+};
+
+static void boost_update(struct work_struct *work);
+static void boost_timer_fn(unsigned long data);
+static void floor_timer_fn(unsigned long data);
+
+static DECLARE_WORK(boost_work, boost_update);
+static DEFINE_TIMER(boost_timer, boost_timer_fn, 0, 0);
+static DEFINE_TIMER(floor_timer, floor_timer_fn, 0, 0);
+
+/* Called with boost_lock held */
+static unsigned int boost_target(void)
+{
+	struct cpufreq_boost_client *client;
+	unsigned int floor = 0;
+
+	if (!boost_enabled)
+		return 0;
+
+	if (boost.boost_holds || boost.boost_timed)
+		return BOOST_ALL;
+
+	if (boost.floor_timed)
+		floor = boost.floor_timed_freq;
+
+	list_for_each_entry(client, &boost_clients, list) {
+		if (client->floor_holds && client->floor > floor)
+			floor = client->floor;
+	}
+
+	return floor;
+}
+
+/* Raise policy->min to the boost floor, returns 1 if it did */
+static int cpufreq_boost_adjust(struct cpufreq_policy *policy,
+				struct cpufreq_governor *governor)
+{
+	unsigned int floor = boost.applied;
+
+	if (governor && governor->boost)
+		return 0;
+
+	if (floor > policy->max)
+		floor = policy->max;
+	if (floor <= policy->min)
+		return 0;
+
+	policy->min = floor;
+	return 1;
+}
+
+static void boost_lat_record(s64 ns)
+{
+	unsigned int us = div_u64(ns, NSEC_PER_USEC);
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(boost_lat_bounds); i++)
+		if (us < boost_lat_bounds[i])
+			break;
+
+	boost_lat.hist[i]++;
+	boost_lat.changed++;
+	boost_lat.total_ns += ns;
+	if (ns > boost_lat.max_ns)
+		boost_lat.max_ns = ns;
+}
+
+static void cpufreq_boost_transition(struct cpufreq_freqs *freqs)
+{
+	unsigned long flags;
+
+	if (!boost.input_pending || freqs->new <= freqs->old)
+		return;
+
+	spin_lock_irqsave(&boost_lock, flags);
+	if (boost.input_pending) {
+		boost.input_pending = 0;
+		boost_lat_record(ktime_to_ns(ktime_sub(ktime_get(),
+						       boost.input_stamp)));
+	}
+	spin_unlock_irqrestore(&boost_lock, flags);
+}
+
+/*
+ * Let the governor apply the new floor, with the policy rwsem held.
+ * Whatever it asks the driver for is accounted to the boost.
+ */
+static void boost_governor(struct cpufreq_policy *policy)
+{
+	struct cpufreq_trans_ctx *ctx = &per_cpu(cpufreq_trans_ctx, policy->cpu);
+
+	ctx->boosted = 1;
+	ctx->limits_task = current;
+	policy->governor->boost(policy);
+	ctx->limits_task = NULL;
+	ctx->boosted = 0;
+}
+
+/* Returns 1 if the policy's governor took the floor change itself */
+static int boost_policy(struct cpufreq_policy *policy)
+{
+	int ret = 0;
+
+	if (lock_policy_rwsem_write(policy->cpu) < 0)
+		return 1;
+
+	if (policy->governor && policy->governor->boost) {
+		boost_governor(policy);
+		ret = 1;
+	}
+
+	unlock_policy_rwsem_write(policy->cpu);
+	return ret;
+}
+
+static void boost_update(struct work_struct *work)
+{
+	struct cpufreq_policy *policy;
+	unsigned long flags;
+	unsigned int floor;
+	int cpu;
+
+	mutex_lock(&boost_mutex);
+
+	spin_lock_irqsave(&boost_lock, flags);
+	floor = boost_target();
+	spin_unlock_irqrestore(&boost_lock, flags);
+
+	if (floor != boost.applied) {
+		dprintk("boost floor %u -> %u kHz\n", boost.applied, floor);
+		boost.applied = floor;
+
+		get_online_cpus();
+		for_each_online_cpu(cpu) {
+			policy = cpufreq_cpu_get(cpu);
+			if (!policy)
+				continue;
+			/* cpus sharing a policy are updated through its owner */
+			if (policy->cpu == cpu && !boost_policy(policy))
+				cpufreq_update_policy(cpu);
+			cpufreq_cpu_put(policy);
+		}
+		put_online_cpus();
+	}
+
+	/* no transition followed the input event, the cpus were fast enough */
+	spin_lock_irqsave(&boost_lock, flags);
+	if (boost.input_pending) {
+		boost.input_pending = 0;
+		boost_lat.already++;
+	}
+	spin_unlock_irqrestore(&boost_lock, flags);
+
+	mutex_unlock(&boost_mutex);
+}
+
+static void boost_timer_fn(unsigned long data)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&boost_lock, flags);
+	/* re-armed while we were waiting for the lock */
+	if (!timer_pending(&boost_timer))
+		boost.boost_timed = 0;
+	spin_unlock_irqrestore(&boost_lock, flags);
+
+	schedule_work(&boost_work);
+}
+
+static void floor_timer_fn(unsigned long data)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&boost_lock, flags);
+	if (!timer_pending(&floor_timer)) {
+		boost.floor_timed = 0;
+		boost.floor_timed_freq = 0;
+	}
+	spin_unlock_irqrestore(&boost_lock, flags);
+
+	schedule_work(&boost_work);
+}
+
+static unsigned long boost_expires(unsigned int millis, unsigned int max)
+{
+	if (max > BOOST_MAX_WINDOW)
+		max = BOOST_MAX_WINDOW;
+	if (millis > max)
+		millis = max;
+
+	return jiffies + msecs_to_jiffies(millis);
+}
+
+void cpufreq_boost_register_client(struct cpufreq_boost_client *client)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&boost_lock, flags);
+	list_add_tail(&client->list, &boost_clients);
+	spin_unlock_irqrestore(&boost_lock, flags);
+}
+EXPORT_SYMBOL(cpufreq_boost_register_client);
+
+/* drops whatever the client still holds */
+void cpufreq_boost_unregister_client(struct cpufreq_boost_client *client)
+{
+	unsigned long flags;
+	int queue;
+
+	spin_lock_irqsave(&boost_lock, flags);
+	queue = client->boost_holds || client->floor_holds;
+	boost.boost_holds -= client->boost_holds;
+	client->boost_holds = 0;
+	client->floor_holds = 0;
+	list_del(&client->list);
+	spin_unlock_irqrestore(&boost_lock, flags);
+
+	if (queue)
+		schedule_work(&boost_work);
+}
+EXPORT_SYMBOL(cpufreq_boost_unregister_client);
+
+void cpufreq_boost_millis(struct cpufreq_boost_client *client,
+			  unsigned int millis)
+{
+	unsigned long flags, expires;
+	int queue = 0;
+
+	if (!boost_enabled)
+		return;
+
+	client = client ? client : &boost_kernel_client;
+	expires = boost_expires(millis, boost_ms);
+
+	spin_lock_irqsave(&boost_lock, flags);
+	client->nr_boosts++;
+
+	if (!boost.boost_timed || time_after(expires, boost.boost_expires)) {
+		boost.boost_expires = expires;
+		mod_timer(&boost_timer, expires);
+	}
+
+	if (!boost.boost_timed) {
+		boost.boost_timed = 1;
+		queue = 1;
+	}
+	spin_unlock_irqrestore(&boost_lock, flags);
+
+	if (queue)
+		schedule_work(&boost_work);
+}
+EXPORT_SYMBOL(cpufreq_boost_millis);
+
+void cpufreq_boost(struct cpufreq_boost_client *client)
+{
+	cpufreq_boost_millis(client, boost_ms);
+}
+EXPORT_SYMBOL(cpufreq_boost);
+
+void cpufreq_boost_hold(struct cpufreq_boost_client *client)
+{
+	unsigned long flags;
+	int queue;
+
+	client = client ? client : &boost_kernel_client;
+
+	spin_lock_irqsave(&boost_lock, flags);
+	client->nr_holds++;
+	if (!client->boost_holds++)
+		client->hold_start = jiffies;
+	queue = !boost.boost_holds++;
+	spin_unlock_irqrestore(&boost_lock, flags);
+
+	if (queue)
+		schedule_work(&boost_work);
+}
+EXPORT_SYMBOL(cpufreq_boost_hold);
+
+/* waits until the policies have been raised before returning */
+void cpufreq_boost_hold_sync(struct cpufreq_boost_client *client)
+{
+	cpufreq_boost_hold(client);
+	flush_work(&boost_work);
+}
+EXPORT_SYMBOL(cpufreq_boost_hold_sync);
+
+void cpufreq_boost_unhold(struct cpufreq_boost_client *client)
+{
+	unsigned long flags;
+	int queue = 0;
+
+	client = client ? client : &boost_kernel_client;
+
+	spin_lock_irqsave(&boost_lock, flags);
+	if (client->boost_holds) {
+		if (!--client->boost_holds)
+			client->held_jiffies += jiffies - client->hold_start;
+		queue = !--boost.boost_holds;
+	} else {
+		printk(KERN_WARNING "%s: %s: unbalanced unhold\n",
+				__func__, client->name);
+	}
+	spin_unlock_irqrestore(&boost_lock, flags);
+
+	if (queue)
+		schedule_work(&boost_work);
+}
+EXPORT_SYMBOL(cpufreq_boost_unhold);
+
+void cpufreq_boost_floor_millis(struct cpufreq_boost_client *client,
+				unsigned int freq, unsigned int millis)
+{
+	unsigned long flags, expires;
+	int queue = 0;
+
+	if (!boost_enabled)
+		return;
+
+	client = client ? client : &boost_kernel_client;
+	expires = boost_expires(millis, floor_ms);
+
+	spin_lock_irqsave(&boost_lock, flags);
+	client->nr_floors++;
+
+	if (!boost.floor_timed || time_after(expires, boost.floor_expires)) {
+		boost.floor_expires = expires;
+		mod_timer(&floor_timer, expires);
+	}
+
+	boost.floor_timed = 1;
+	if (freq > boost.floor_timed_freq) {
+		boost.floor_timed_freq = freq;
+		queue = 1;
+	}
+	spin_unlock_irqrestore(&boost_lock, flags);
+
+	if (queue)
+		schedule_work(&boost_work);
+}
+EXPORT_SYMBOL(cpufreq_boost_floor_millis);
+
+void cpufreq_boost_floor(struct cpufreq_boost_client *client,
+			 unsigned int freq)
+{
+	cpufreq_boost_floor_millis(client, freq, floor_ms);
+}
+EXPORT_SYMBOL(cpufreq_boost_floor);
+
+/* nested holds keep the frequency of the latest one */
+void cpufreq_boost_floor_hold(struct cpufreq_boost_client *client,
+			      unsigned int freq)
+{
+	unsigned long flags;
+
+	client = client ? client : &boost_kernel_client;
+
+	spin_lock_irqsave(&boost_lock, flags);
+	client->nr_floors++;
+	client->floor_holds++;
+	client->floor = freq;
+	spin_unlock_irqrestore(&boost_lock, flags);
+
+	schedule_work(&boost_work);
+}
+EXPORT_SYMBOL(cpufreq_boost_floor_hold);
+
+void cpufreq_boost_floor_unhold(struct cpufreq_boost_client *client)
+{
+	unsigned long flags;
+	int queue = 0;
+
+	client = client ? client : &boost_kernel_client;
+
+	spin_lock_irqsave(&boost_lock, flags);
+	if (client->floor_holds) {
+		queue = !--client->floor_holds;
+	} else {
+		printk(KERN_WARNING "%s: %s: unbalanced unhold\n",
+				__func__, client->name);
+	}
+	spin_unlock_irqrestore(&boost_lock, flags);
+
+	if (queue)
+		schedule_work(&boost_work);
+}
+EXPORT_SYMBOL(cpufreq_boost_floor_unhold);
+
+/* nonzero while any client boosts the cpus to policy->max */
+int cpufreq_boost_active(void)
+{
+	return boost.applied == BOOST_ALL;
+}
+EXPORT_SYMBOL(cpufreq_boost_active);
+
+/* the floor in kHz the policies are held at, 0 if none */
+unsigned int cpufreq_boost_floor_freq(void)
+{
+	unsigned int floor = boost.applied;
+
+	return floor == BOOST_ALL ? 0 : floor;
+}
+EXPORT_SYMBOL(cpufreq_boost_floor_freq);
+
+/* the window in ms of an untimed tickle, or floor if @floor is set */
+unsigned int cpufreq_boost_get_window(int floor)
+{
+	return floor ? floor_ms : boost_ms;
+}
+EXPORT_SYMBOL(cpufreq_boost_get_window);
+
+void cpufreq_boost_set_window(int floor, unsigned int millis)
+{
+	if (millis > BOOST_MAX_WINDOW)
+		millis = BOOST_MAX_WINDOW;
+
+	if (floor)
+		floor_ms = millis;
+	else
+		boost_ms = millis;
+}
+EXPORT_SYMBOL(cpufreq_boost_set_window);
+
+/********************** input ***********************/
+
+static void boost_input_event(struct input_handle *handle, unsigned int type,
+		unsigned int code, int value)
+{
+	unsigned long flags;
+
+	if (!input_boost_ms || !boost_enabled || type == EV_SYN)
+		return;
+
+	/* only time events that have something to raise */
+	spin_lock_irqsave(&boost_lock, flags);
+	if (!boost.input_pending && boost.applied != BOOST_ALL) {
+		boost.input_pending = 1;
+		boost.input_stamp = ktime_get();
+		boost_lat.events++;
+	}
+	spin_unlock_irqrestore(&boost_lock, flags);
+
+	cpufreq_boost_millis(&boost_input_client, input_boost_ms);
+}
+
+static int boost_input_connect(struct input_handler *handler,
+		struct input_dev *dev, const struct input_device_id *id)
+{
+	struct input_handle *handle;
+	int error;
+
+	handle = kzalloc(sizeof(struct input_handle), GFP_KERNEL);
+	if (!handle)
+		return -ENOMEM;
+
+	handle->dev = dev;
+	handle->handler = handler;
+	handle->name = "cpufreq_boost";
+
+	error = input_register_handle(handle);
+	if (error)
+		goto err2;
+
+	error = input_open_device(handle);
+	if (error)
+		goto err1;
+
+	return 0;
+err1:
+	input_unregister_handle(handle);
+err2:
+	kfree(handle);
+	return error;
+}
+
+static void boost_input_disconnect(struct input_handle *handle)
+{
+	input_close_device(handle);
+	input_unregister_handle(handle);
+	kfree(handle);
+}
+
+static const struct input_device_id boost_input_ids[] = {
+	{ .driver_info = 1 },
+	{ },
+};
+
+static struct input_handler boost_input_handler = {
+	.event		= boost_input_event,
+	.connect	= boost_input_connect,
+	.disconnect	= boost_input_disconnect,
+	.name		= "cpufreq_boost",
+	.id_table	= boost_input_ids,
+};
+
+/********************** ioctl ***********************/
+
+/*
+ * The tickle device predates the boost core; every open file is a
+ * boost client of its own.
+ */
+struct tickle_file_data {
+	struct cpufreq_boost_client client;
+
+	int tickle_hold_flag;
+	int floor_hold_flag;
+};
+
+static struct class *tickle_class;
+static struct cdev tickle_cdev;
+static dev_t tickle_dev;
+
+static int tickle_open(struct inode *inode, struct file *filp)
+{
+	struct tickle_file_data *data;
+
+	data = kzalloc(sizeof(struct tickle_file_data), GFP_KERNEL);
+	if (!data)
+		return -ENOMEM;
+
+	get_task_comm(data->client.name, current);
+	cpufreq_boost_register_client(&data->client);
+	filp->private_data = data;
+
+	return 0;
+}
+
+static int tickle_release(struct inode *inode, struct file *filp)
+{
+	struct tickle_file_data *data = filp->private_data;
+
+	cpufreq_boost_unregister_client(&data->client);
+	kfree(data);
+
+	return 0;
+}
+
+static int tickle_ioctl(struct inode *inode, struct file *filp,
+		unsigned int cmd, unsigned long arg)
+{
+	struct tickle_file_data *data = filp->private_data;
+	struct cpufreq_boost_client *client = &data->client;
+
+	if (_IOC_TYPE(cmd) != TICKLE_IOC_MAGIC)
+		return -ENOTTY;
+
+	if (_IOC_NR(cmd) > TICKLE_IOC_MAXNR)
+		return -ENOTTY;
+
+	switch (cmd) {
+	case TICKLE_IOCT_TICKLE:
+		cpufreq_boost_millis(client, (unsigned int) arg);
+		break;
+
+	case TICKLE_IOCT_FLOOR:
+		cpufreq_boost_floor(client, (unsigned int) arg);
+		break;
+
+	case TICKLE_IOC_TICKLE_HOLD:
+		cpufreq_boost_hold_check(client, &data->tickle_hold_flag);
+		break;
+
+	case TICKLE_IOC_TICKLE_UNHOLD:
+		cpufreq_boost_unhold_check(client, &data->tickle_hold_flag);
+		break;
+
+	case TICKLE_IOCT_FLOOR_HOLD:
+		/* a second hold only moves the floor */
+		cpufreq_boost_floor_hold(client, (unsigned int) arg);
+		if (data->floor_hold_flag)
+			cpufreq_boost_floor_unhold(client);
+		data->floor_hold_flag = 1;
+		break;
+
+	case TICKLE_IOC_FLOOR_UNHOLD:
+		cpufreq_boost_floor_unhold_check(client, &data->floor_hold_flag);
+		break;
+
+	case TICKLE_IOC_TICKLE_HOLD_SYNC:
+		cpufreq_boost_hold_sync(client);
+		break;
+
+	default:
+		return -ENOTTY;
+	}
+
+	return 0;
+}
+
+static const struct file_operations tickle_fops = {
+	.owner		= THIS_MODULE,
+	.open		= tickle_open,
+	.release	= tickle_release,
+	.ioctl		= tickle_ioctl,
+};
+
+static int __init tickle_device_init(void)
+{
+	struct device *dev;
+	int res;
+
+	res = alloc_chrdev_region(&tickle_dev, 0, 1, "ondemandtcl");
+	if (res < 0)
+		return res;
+
+	tickle_class = class_create(THIS_MODULE, "ondemandtcl");
+	if (IS_ERR(tickle_class)) {
+		res = PTR_ERR(tickle_class);
+		goto error_unregister_region;
+	}
+
+	cdev_init(&tickle_cdev, &tickle_fops);
+	tickle_cdev.owner = THIS_MODULE;
+	res = cdev_add(&tickle_cdev, tickle_dev, 1);
+	if (res < 0)
+		goto error_remove_class;
+
+	/* always use ondemandtcl0, since userspace is already depending on that name */
+	dev = device_create(tickle_class, NULL, tickle_dev, NULL, "ondemandtcl%d", 0);
+	if (IS_ERR(dev)) {
+		res = PTR_ERR(dev);
+		goto error_remove_cdev;
+	}
+
+	return 0;
+
+error_remove_cdev:
+	cdev_del(&tickle_cdev);
+error_remove_class:
+	class_destroy(tickle_class);
+error_unregister_region:
+	unregister_chrdev_region(tickle_dev, 1);
+	return res;
+}
+
+/********************** debugfs *********************/
+
+#ifdef CONFIG_DEBUG_FS
+static int boost_stats_show(struct seq_file *m, void *unused)
+{
+	struct cpufreq_boost_client *client;
+	unsigned long changed;
+	unsigned int floor;
+	int i;
+
+	spin_lock_irq(&boost_lock);
+
+	floor = boost_target();
+	seq_printf(m, "target: %u\napplied: %u\nholds: %d\ntimed: %d\n"
+		   "floor_timed: %u\n",
+		   floor == BOOST_ALL ? 0 : floor,
+		   boost.applied == BOOST_ALL ? 0 : boost.applied,
+		   boost.boost_holds, boost.boost_timed,
+		   boost.floor_timed ? boost.floor_timed_freq : 0);
+
+	changed = boost_lat.changed;
+	seq_printf(m, "input_events: %lu\ninput_changed: %lu\n"
+		   "input_already: %lu\nlatency_avg_us: %llu\n"
+		   "latency_max_us: %llu\n",
+		   boost_lat.events, changed, boost_lat.already,
+		   changed ? div_u64(div_u64(boost_lat.total_ns, changed),
+				     NSEC_PER_USEC) : 0,
+		   div_u64(boost_lat.max_ns, NSEC_PER_USEC));
+
+	seq_printf(m, "latency_hist_us:");
+	for (i = 0; i < ARRAY_SIZE(boost_lat_bounds); i++)
+		seq_printf(m, " <%u:%lu", boost_lat_bounds[i], boost_lat.hist[i]);
+	seq_printf(m, " >=%u:%lu\n", boost_lat_bounds[i - 1], boost_lat.hist[i]);
+
+	seq_printf(m, "\n%-16s %8s %8s %8s %10s %5s %5s %8s\n", "client",
+		   "boosts", "floors", "holds", "held_ms", "hold", "fhold",
+		   "floor");
+	list_for_each_entry(client, &boost_clients, list) {
+		unsigned long held = client->held_jiffies;
+
+		if (client->boost_holds)
+			held += jiffies - client->hold_start;
+		seq_printf(m, "%-16s %8lu %8lu %8lu %10u %5d %5d %8u\n",
+			   client->name, client->nr_boosts, client->nr_floors,
+			   client->nr_holds, jiffies_to_msecs(held),
+			   client->boost_holds, client->floor_holds,
+			   client->floor);
+	}
+
+	spin_unlock_irq(&boost_lock);
+
+	return 0;
+}
+
+static int boost_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, boost_stats_show, NULL);
+}
+
+static const struct file_operations boost_stats_fops = {
+	.open		= boost_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int boost_lat_reset(void *data, u64 val)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&boost_lock, flags);
+	memset(&boost_lat, 0, sizeof(boost_lat));
+	spin_unlock_irqrestore(&boost_lock, flags);
+
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(boost_lat_reset_fops, NULL, boost_lat_reset, "%llu\n");
+
+static void __init boost_debugfs_init(void)
+{
+	struct dentry *dent;
+
+	dent = debugfs_create_dir("cpufreq_boost", NULL);
+	if (!dent || IS_ERR(dent))
+		return;
+
+	debugfs_create_file("stats", 0444, dent, NULL, &boost_stats_fops);
+	debugfs_create_file("reset", 0200, dent, NULL, &boost_lat_reset_fops);
+}
+#else
+static inline void boost_debugfs_init(void) { }
+#endif
+
+static int __init cpufreq_boost_init(void)
+{
+	int err;
+
+	err = tickle_device_init();
+	if (err)
+		printk(KERN_ERR "cpufreq: can't create tickle device (%d)\n", err);
+
+	err = input_register_handler(&boost_input_handler);
+	if (err)
+		printk(KERN_ERR "cpufreq: can't register input handler (%d)\n", err);
+
+	boost_debugfs_init();
+
+	return 0;
+}
+late_initcall(cpufreq_boost_init);
+#endif /* CONFIG_CPU_FREQ_BOOST */
+
 static int __cpuinit cpufreq_cpu_callback(struct notifier_block *nfb,
 					unsigned long action, void *hcpu)
 {
@@ -1987,6 +2889,11 @@ static int __init cpufreq_core_init(void)
 						&cpu_sysdev_class.kset.kobj);
 	BUG_ON(!cpufreq_global_kobject);
 
+#ifdef CONFIG_CPU_FREQ_BOOST
+	cpufreq_boost_register_client(&boost_kernel_client);
+	cpufreq_boost_register_client(&boost_input_client);
+#endif
+
 #ifdef CONFIG_CPU_FREQ_DEBUG
 	debugfs_create_u32("cpufreq_debug", 0600, NULL, &debug);
 #endif
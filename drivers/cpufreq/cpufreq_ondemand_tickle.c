@@ -2,11 +2,11 @@
  *  drivers/cpufreq/cpufreq_ondemand_tickle.c
  *
  *  A version of cpufreq_ondemand supporing hinting, or tickling, into
- *  high performance levels based on platform defined events. This governor
- *  also supports setting a temporary frequency floor for maintaining
- *  minimum required performance levels while still conserving power, such
- *  as may be required in codecs, com stacks, etc. Ondemand_tickle should
- *  behave identically to ondemand when neither a tickel nor a floor is active.
+ *  high performance levels based on platform defined events. Tickles and
+ *  temporary frequency floors are requested through the cpufreq boost
+ *  core, which calls back into this governor to move the frequency
+ *  directly; between samples it scales as ondemand does, never below the
+ *  current floor.
  *
  *  Copyright (C)  2001 Russell King
  *            (C)  2003 Venkatesh Pallipadi <venkatesh.pallipadi@intel.com>.
@@ -24,7 +24,6 @@
 #include <linux/module.h>
 #include <linux/init.h>
 #include <linux/cpufreq.h>
-#include <linux/cpufreq_tickle.h>
 #include <linux/cpu.h>
 #include <linux/jiffies.h>
 #include <linux/kernel_stat.h>
@@ -32,15 +31,14 @@
 #include <linux/hrtimer.h>
 #include <linux/tick.h>
 #include <linux/ktime.h>
-#include <linux/input.h>
 #include <linux/workqueue.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
 #include <linux/vmalloc.h>
-#include <linux/ioctl.h>
 #include <linux/fs.h>
-#include <linux/cdev.h>
-#include <linux/list.h>
+#include <linux/math64.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
 
 /*
  * dbs is used in this file as a shortform for demandbased switching
@@ -55,18 +53,6 @@
 #define MAX_FREQUENCY_UP_THRESHOLD		(100)
 #define MIN_FREQUENCY_DOWN_DIFFERENTIAL		(1)
 
-/*
- * The max and default time in mS to keep the processor at max freq from a tickle.
- */
-#define MAX_TICKLE_WINDOW				(10000)
-#define DEF_TICKLE_WINDOW				(3000)
-
-/*
- * The max and default time in mS to keep the processor at at least the floor freq.
- */
-#define MAX_FLOOR_WINDOW				(10000)
-#define DEF_FLOOR_WINDOW				(3000)
-
 #if defined(CONFIG_CPU_FREQ_MIN_TICKS)
 #define CPU_FREQ_MIN_TICKS CONFIG_CPU_FREQ_MIN_TICKS
 #else
@@ -101,9 +87,6 @@ static unsigned int def_sampling_rate;
 
 static void do_dbs_timer(struct work_struct *work);
 
-static void do_tickle_timer(unsigned long arg);
-static void do_floor_timer(unsigned long arg);
-
 /* Sampling types */
 enum {DBS_NORMAL_SAMPLE, DBS_SUB_SAMPLE};
 
@@ -118,11 +101,6 @@ struct cpu_dbs_info_s {
 	unsigned int freq_lo_jiffies;
 	unsigned int freq_hi_jiffies;
 
-	int tickle_active;
-	int floor_active;
-	unsigned int freq_floor;
-	unsigned int freq_save;
-	unsigned int rel_save;
 	int cur_load;
 	unsigned int max_load_freq;
 	
@@ -161,49 +139,11 @@ static struct dbs_tuners {
 	unsigned int down_differential;
 	unsigned int ignore_nice;
 	unsigned int powersave_bias;
-	unsigned int max_tickle_window;
-	unsigned int max_floor_window;
 } dbs_tuners_ins = {
 	.up_threshold = DEF_FREQUENCY_UP_THRESHOLD,
 	.down_differential = DEF_FREQUENCY_DOWN_DIFFERENTIAL,
 	.ignore_nice = 0,
 	.powersave_bias = 0,
-	.max_tickle_window = DEF_TICKLE_WINDOW,
-	.max_floor_window = DEF_FLOOR_WINDOW,
-};
-
-/*
- * tickle/floor state
- */
-static struct {
-	spinlock_t lock;
-
-	int active;
-	int active_tickle;
-	int active_count;
-	unsigned long tickle_jiffies;
-
-
-	int floor_active;
-	int floor_tickle;
-	int floor_count;
-	unsigned long floor_jiffies;
-	unsigned int cur_freq_floor;
-
-	struct work_struct tickle_work;
-	struct work_struct floor_work;
-
-	struct timer_list tickle_timer;
-	struct timer_list floor_timer;
-} tickle_state = {
-	.lock = SPIN_LOCK_UNLOCKED,
-	.active = 0,
-	.active_tickle = 0,
-	.active_count = 0,
-	.floor_active = 0,
-	.floor_tickle = 0,
-	.floor_count = 0,
-	.cur_freq_floor = 0,
 };
 
 /*
@@ -233,15 +173,9 @@ static DEFINE_PER_CPU(struct sample_stats, sample_stats);
 static int sampling_enabled = 0;
 module_param(sampling_enabled, bool, S_IRUGO | S_IWUSR);
 
-static int tickling_enabled = 1;
-module_param(tickling_enabled, bool, S_IRUGO | S_IWUSR);
-
 static int clear_samples = 0;
 module_param(clear_samples, bool, S_IRUGO | S_IWUSR);
 
-static int print_tickles = 0;
-module_param(print_tickles, bool, S_IRUGO | S_IWUSR);
-
 /********************* procfs ********************/
 struct stats_state {
 	int cpu;
@@ -405,217 +339,6 @@ done:
 }
 /******************** end procfs ********************/
 
-/********************** ioctl ***********************/
-
-static struct class *tickle_class = NULL;
-static struct cdev tickle_cdev;
-static dev_t tickle_dev;
-
-static LIST_HEAD(tickle_clients);
-
-struct tickle_file_data {
-	struct list_head list;
-
-	int tickle_hold_flag;
-	int floor_hold_flag;
-	unsigned int floor_freq;
-};
-
-/* static tickle_file_data entry for use by anonymous floor tickles that don't have a file handle */
-static struct tickle_file_data default_file_data;
-
-static int get_max_client_floor(void);
-
-static int tickle_open(struct inode *inode, struct file *filp);
-static int tickle_release(struct inode *inode, struct file *filp);
-static int tickle_ioctl(struct inode *inode, struct file *filp, unsigned int cmd, unsigned long arg);
-
-static struct file_operations tickle_fops = {
-	.owner			= THIS_MODULE,
-	.open			= tickle_open,
-	.release		= tickle_release,
-	.ioctl			= tickle_ioctl,
-};
-
-static int setup_tickle_device(void)
-{
-	int res = 0;
-	struct device *dev = NULL;
-
-	res = alloc_chrdev_region(&tickle_dev, 0, 1, "ondemandtcl");
-	if (res < 0) {
-		printk(KERN_ERR "%s: can't alloc major number (%d)\n", __FILE__, res);
-		goto error;
-	}
-	
-	tickle_class = class_create(THIS_MODULE, "ondemandtcl");
-	if (IS_ERR(tickle_class)) {
-		res = PTR_ERR(tickle_class);
-		printk(KERN_ERR "%s: can't create class (%d)\n", __FILE__, res);
-		goto error_unregister_region;
-	}
-
-	cdev_init(&tickle_cdev, &tickle_fops);
-	tickle_cdev.owner = THIS_MODULE;
-	res = cdev_add(&tickle_cdev, tickle_dev, 1);
-	if (res < 0) {
-		printk(KERN_ERR "%s: failed to add device (%d)\n", __FILE__, res);
-		goto error_remove_class;
-	}
-
-	/* always use ondemandtcl0, since userspace is already depending on that name */
-	dev = device_create(tickle_class, NULL, tickle_dev, NULL, "ondemandtcl%d", 0);
-	if (IS_ERR(dev)) {
-		res = PTR_ERR(dev);
-		printk(KERN_ERR "%s: failed to create device (%d)\n", __FILE__, res);
-
-		goto error_remove_cdev;
-	}
-	/* add the default file data for anonymous clients */
-	default_file_data.floor_freq = 0;
-	list_add(&default_file_data.list, &tickle_clients);
-
-	return res;
-
-error_remove_cdev:
-	cdev_del(&tickle_cdev);
-
-error_remove_class:
-	class_destroy(tickle_class);
-	tickle_class = NULL;
-
-error_unregister_region:
-	unregister_chrdev_region(tickle_dev, 1);
-	
-error:
-	return res;
-}
-
-static void remove_tickle_device(void)
-{
-	if (tickle_class) {
-		device_destroy(tickle_class, tickle_dev);
-		class_destroy(tickle_class);
-		cdev_del(&tickle_cdev);
-		unregister_chrdev_region(tickle_dev, 1);
-
-		/* for posterity */
-		list_del(&default_file_data.list);
-	}
-}
-
-static int tickle_open(struct inode *inode, struct file *filp)
-{
-	unsigned long flags;
-	struct tickle_file_data *data = kzalloc(sizeof(struct tickle_file_data), GFP_KERNEL);
-	if (!data)
-		return -ENOMEM;
-
-	//printk("%s\n", __FUNCTION__);
-
-	spin_lock_irqsave(&tickle_state.lock, flags);
-	list_add(&data->list, &tickle_clients);
-	spin_unlock_irqrestore(&tickle_state.lock, flags);
-
-	filp->private_data = data;
-
-	return 0;
-}
-
-static int tickle_release(struct inode *inode, struct file *filp)
-{
-	unsigned long flags;
-	struct tickle_file_data *data = filp->private_data;	
-
-	//printk("%s\n", __FUNCTION__);
-
-	if (data) {
-		spin_lock_irqsave(&tickle_state.lock, flags);
-		list_del(&data->list);
-		spin_unlock_irqrestore(&tickle_state.lock, flags);
-
-		CPUFREQ_UNHOLD_CHECK(&data->tickle_hold_flag);
-		CPUFREQ_FLOOR_UNHOLD_CHECK(&data->floor_hold_flag);
-
-		kfree(data);
-	}
-
-	return 0;
-}
-
-static int tickle_ioctl(struct inode *inode, struct file *filp, unsigned int cmd, unsigned long arg)
-{
-	unsigned long flags;
-	struct tickle_file_data *data = filp->private_data;
-
-	//printk("%s: cmd = %d, arg = %ld\n", __FUNCTION__, cmd, arg);
-	
-	if (_IOC_TYPE(cmd) != TICKLE_IOC_MAGIC)
-		return -ENOTTY;
-
-	if (_IOC_NR(cmd) > TICKLE_IOC_MAXNR)
-		return -ENOTTY;
-
-	switch (cmd) {
-		case TICKLE_IOCT_TICKLE:
-			CPUFREQ_TICKLE_MILLIS((unsigned int) arg);
-			break;
-
-		case TICKLE_IOCT_FLOOR:
-			CPUFREQ_FLOOR((unsigned int) arg);
-			break;
-
-		case TICKLE_IOC_TICKLE_HOLD:
-			CPUFREQ_HOLD_CHECK(&data->tickle_hold_flag);
-			break;
-
-		case TICKLE_IOC_TICKLE_UNHOLD:
-			CPUFREQ_UNHOLD_CHECK(&data->tickle_hold_flag);
-			break;
-
-		case TICKLE_IOCT_FLOOR_HOLD:
-			spin_lock_irqsave(&tickle_state.lock, flags);
-			data->floor_freq = (unsigned int) arg;
-			spin_unlock_irqrestore(&tickle_state.lock, flags);
-
-			CPUFREQ_FLOOR_HOLD_CHECK((unsigned int) arg, &data->floor_hold_flag);
-			break;
-
-		case TICKLE_IOC_FLOOR_UNHOLD:
-			spin_lock_irqsave(&tickle_state.lock, flags);
-			data->floor_freq = 0;
-			spin_unlock_irqrestore(&tickle_state.lock, flags);
-
-			CPUFREQ_FLOOR_UNHOLD_CHECK(&data->floor_hold_flag);
-			break;
-
-		case TICKLE_IOC_TICKLE_HOLD_SYNC:
-			CPUFREQ_HOLD_SYNC();
-			break;
-
-		default:
-			return -ENOTTY;
-	}
-
-	return 0;
-}
-
-/* This needs to be called with spinlock tickle_state.lock held */
-static int get_max_client_floor(void)
-{
-	int floor_freq = 0;
-	struct tickle_file_data *file_data;
-
-	list_for_each_entry(file_data, &tickle_clients, list) {
-		if (file_data->floor_freq > floor_freq)
-			floor_freq = file_data->floor_freq;
-	}
-
-	return floor_freq;
-}
-
-/******************** end ioctl *********************/
-
 static inline cputime64_t get_cpu_idle_time_jiffy(unsigned int cpu,
 							cputime64_t *wall)
 {
@@ -713,6 +436,316 @@ static void ondemand_powersave_bias_init(void)
 	}
 }
 
+#ifdef CONFIG_CPU_FREQ_ONDEMAND_TICKLE_HOTPLUG
+/*
+ * Automatic hotplug of the second core. CPU0's sampling timer feeds the
+ * run queue depth and per-cpu load into hotplug_sample(), which brings
+ * CPU1 up once the work no longer fits on CPU0 and takes it down again
+ * after both cores have been quiet for down_delay ms. An active tickle
+ * brings CPU1 up at once, and neither a tickle nor a floor lets it go
+ * down. The actual cpu_up()/cpu_down() runs on khotplugtcl, since it
+ * starts and stops this governor on CPU1.
+ */
+#define HOTPLUG_CPU		1
+#define HOTPLUG_TRACE_SIZE	128
+
+enum {HOTPLUG_LOAD, HOTPLUG_TICKLE, HOTPLUG_IDLE};
+
+static const char *hotplug_reasons[] = {"load", "tickle", "idle"};
+
+static struct hotplug_tuners {
+	unsigned int enable;
+	unsigned int up_rq;	/* runnable tasks x 100 */
+	unsigned int up_load;	/* CPU0 load, percent */
+	unsigned int up_delay;	/* ms the up condition must hold */
+	unsigned int down_rq;
+	unsigned int down_load;	/* both cores combined, percent */
+	unsigned int down_delay;
+} hotplug_tuners = {
+	.enable = 1,
+	.up_rq = 200,
+	.up_load = 80,
+	.up_delay = 100,
+	.down_rq = 120,
+	.down_load = 60,
+	.down_delay = 1000,
+};
+
+struct hotplug_trace {
+	u64 time;		/* ns, when the decision was made */
+	unsigned int latency;	/* us spent in cpu_up/cpu_down */
+	unsigned short rq_avg;
+	unsigned char load[2];
+	unsigned char up;
+	unsigned char reason;
+};
+
+static struct {
+	struct work_struct work;
+	struct hotplug_trace pending;	/* decision handed to the work */
+
+	/* sampler state, only touched from CPU0's dbs timer */
+	unsigned int rq_avg;
+	int was_online;
+	int holding;
+	unsigned long since;
+	cputime64_t prev_idle[2];
+	cputime64_t prev_wall[2];
+
+	spinlock_t lock;		/* protects pending, the trace and stats */
+	struct hotplug_trace trace[HOTPLUG_TRACE_SIZE];
+	unsigned int trace_next;
+	unsigned int nr[2];		/* downs, ups */
+	u64 total_us[2];
+	unsigned int max_us[2];
+} hotplug_state = {
+	.lock = __SPIN_LOCK_UNLOCKED(hotplug_state.lock),
+};
+
+static struct workqueue_struct *khotplug_wq;
+
+static unsigned int hotplug_cpu_load(unsigned int cpu)
+{
+	cputime64_t cur_wall_time, cur_idle_time;
+	unsigned int wall_time, idle_time;
+
+	cur_idle_time = get_cpu_idle_time(cpu, &cur_wall_time);
+
+	wall_time = (unsigned int) cputime64_sub(cur_wall_time,
+			hotplug_state.prev_wall[cpu]);
+	hotplug_state.prev_wall[cpu] = cur_wall_time;
+
+	idle_time = (unsigned int) cputime64_sub(cur_idle_time,
+			hotplug_state.prev_idle[cpu]);
+	hotplug_state.prev_idle[cpu] = cur_idle_time;
+
+	if (unlikely(!wall_time || wall_time < idle_time))
+		return 0;
+
+	return 100 * (wall_time - idle_time) / wall_time;
+}
+
+static void do_hotplug_work(struct work_struct *work)
+{
+	struct hotplug_trace t;
+	unsigned long flags;
+	ktime_t start;
+	int ret;
+
+	/* the sampler may queue the next decision while we run */
+	spin_lock_irqsave(&hotplug_state.lock, flags);
+	t = hotplug_state.pending;
+	spin_unlock_irqrestore(&hotplug_state.lock, flags);
+
+	if (t.up == !!cpu_online(HOTPLUG_CPU))
+		return;
+
+	start = ktime_get();
+	ret = t.up ? cpu_up(HOTPLUG_CPU) : cpu_down(HOTPLUG_CPU);
+	t.latency = (unsigned int)ktime_to_us(ktime_sub(ktime_get(), start));
+
+	if (ret) {
+		/* -EBUSY while suspend has hotplug disabled */
+		if (ret != -EBUSY)
+			printk(KERN_WARNING "%s: cpu%s(%d) failed: %d\n",
+				__FUNCTION__, t.up ? "_up" : "_down",
+				HOTPLUG_CPU, ret);
+		return;
+	}
+
+	spin_lock_irqsave(&hotplug_state.lock, flags);
+	hotplug_state.trace[hotplug_state.trace_next] = t;
+	hotplug_state.trace_next =
+		(hotplug_state.trace_next + 1) % HOTPLUG_TRACE_SIZE;
+	hotplug_state.nr[t.up]++;
+	hotplug_state.total_us[t.up] += t.latency;
+	if (t.latency > hotplug_state.max_us[t.up])
+		hotplug_state.max_us[t.up] = t.latency;
+	spin_unlock_irqrestore(&hotplug_state.lock, flags);
+}
+
+static void hotplug_request(int up, int reason, unsigned int load0,
+			    unsigned int load1)
+{
+	struct hotplug_trace *t = &hotplug_state.pending;
+	unsigned long flags;
+
+	spin_lock_irqsave(&hotplug_state.lock, flags);
+	t->time = ktime_to_ns(ktime_get());
+	t->latency = 0;
+	t->rq_avg = min(hotplug_state.rq_avg, 0xffffU);
+	t->load[0] = load0;
+	t->load[1] = load1;
+	t->up = up;
+	t->reason = reason;
+	spin_unlock_irqrestore(&hotplug_state.lock, flags);
+
+	hotplug_state.holding = 0;
+	queue_work(khotplug_wq, &hotplug_state.work);
+}
+
+/* true once cond has held for delay ms of consecutive samples */
+static int hotplug_held(int cond, unsigned int delay)
+{
+	if (!cond) {
+		hotplug_state.holding = 0;
+		return 0;
+	}
+
+	if (!hotplug_state.holding) {
+		hotplug_state.holding = 1;
+		hotplug_state.since = jiffies;
+	}
+
+	return time_after_eq(jiffies,
+			     hotplug_state.since + msecs_to_jiffies(delay));
+}
+
+/* Called from CPU0's dbs timer with its timer_mutex held. */
+static void hotplug_sample(void)
+{
+	unsigned int nr, load0, load1 = 0;
+	int online = cpu_online(HOTPLUG_CPU);
+	int tickled, floored;
+
+	if (!khotplug_wq)
+		return;
+
+	/* the sampling thread itself is one of the runnable tasks */
+	nr = nr_running();
+	nr = nr ? nr - 1 : 0;
+	hotplug_state.rq_avg = (hotplug_state.rq_avg * 3 + nr * 100) / 4;
+
+	load0 = hotplug_cpu_load(0);
+	if (online && hotplug_state.was_online)
+		load1 = hotplug_cpu_load(HOTPLUG_CPU);
+	else if (online)
+		/* idle time did not accumulate while it was down */
+		hotplug_state.prev_idle[HOTPLUG_CPU] = get_cpu_idle_time(
+			HOTPLUG_CPU, &hotplug_state.prev_wall[HOTPLUG_CPU]);
+	if (online != hotplug_state.was_online)
+		hotplug_state.holding = 0;
+	hotplug_state.was_online = online;
+
+	if (!hotplug_tuners.enable || work_pending(&hotplug_state.work))
+		return;
+
+	tickled = cpufreq_boost_active();
+	floored = cpufreq_boost_floor_freq() != 0;
+
+	if (!online) {
+		if (tickled)
+			hotplug_request(1, HOTPLUG_TICKLE, load0, load1);
+		else if (hotplug_held(hotplug_state.rq_avg >=
+					hotplug_tuners.up_rq &&
+				      load0 >= hotplug_tuners.up_load,
+				      hotplug_tuners.up_delay))
+			hotplug_request(1, HOTPLUG_LOAD, load0, load1);
+	} else if (hotplug_held(!tickled && !floored &&
+				hotplug_state.rq_avg < hotplug_tuners.down_rq &&
+				load0 + load1 < hotplug_tuners.down_load,
+				hotplug_tuners.down_delay))
+		hotplug_request(0, HOTPLUG_IDLE, load0, load1);
+}
+
+static int hotplug_show(struct seq_file *m, void *v)
+{
+	struct hotplug_trace *trace, *t;
+	unsigned int next, i, nr[2], max_us[2];
+	u64 total_us[2];
+	unsigned long flags;
+
+	trace = kmalloc(sizeof(hotplug_state.trace), GFP_KERNEL);
+	if (!trace)
+		return -ENOMEM;
+
+	spin_lock_irqsave(&hotplug_state.lock, flags);
+	memcpy(trace, hotplug_state.trace, sizeof(hotplug_state.trace));
+	next = hotplug_state.trace_next;
+	for (i = 0; i < 2; i++) {
+		nr[i] = hotplug_state.nr[i];
+		total_us[i] = hotplug_state.total_us[i];
+		max_us[i] = hotplug_state.max_us[i];
+	}
+	spin_unlock_irqrestore(&hotplug_state.lock, flags);
+
+	for (i = 2; i-- > 0; )
+		seq_printf(m, "%s: %u avg_us: %llu max_us: %u\n",
+			   i ? "up" : "down", nr[i],
+			   nr[i] ? div_u64(total_us[i], nr[i]) : 0, max_us[i]);
+	seq_printf(m, "rq_avg: %u\n\n", hotplug_state.rq_avg);
+
+	seq_printf(m, "%-14s %-4s %-6s %6s %5s %5s %10s\n", "time_ms", "dir",
+		   "reason", "rq_avg", "load0", "load1", "latency_us");
+	for (i = 0; i < HOTPLUG_TRACE_SIZE; i++) {
+		t = &trace[(next + i) % HOTPLUG_TRACE_SIZE];
+		if (!t->time)
+			continue;
+		seq_printf(m, "%-14llu %-4s %-6s %6u %5u %5u %10u\n",
+			   div_u64(t->time, NSEC_PER_MSEC),
+			   t->up ? "up" : "down", hotplug_reasons[t->reason],
+			   t->rq_avg, t->load[0], t->load[1], t->latency);
+	}
+
+	kfree(trace);
+	return 0;
+}
+
+static int hotplug_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, hotplug_show, NULL);
+}
+
+static const struct file_operations proc_hotplug_operations = {
+	.open		= hotplug_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int hotplug_init(void)
+{
+	struct proc_dir_entry *entry;
+
+	if (num_possible_cpus() <= HOTPLUG_CPU)
+		return 0;
+
+	khotplug_wq = create_singlethread_workqueue("khotplugtcl");
+	if (!khotplug_wq)
+		return -ENOMEM;
+	INIT_WORK(&hotplug_state.work, do_hotplug_work);
+
+	entry = create_proc_entry("ondemandtcl_hotplug", 0444, NULL);
+	if (entry)
+		entry->proc_fops = &proc_hotplug_operations;
+
+	return 0;
+}
+
+static void hotplug_exit(void)
+{
+	if (!khotplug_wq)
+		return;
+
+	remove_proc_entry("ondemandtcl_hotplug", NULL);
+	destroy_workqueue(khotplug_wq);
+	khotplug_wq = NULL;
+}
+#else
+static inline void hotplug_sample(void)
+{
+}
+
+static inline int hotplug_init(void)
+{
+	return 0;
+}
+
+static inline void hotplug_exit(void)
+{
+}
+#endif /* CONFIG_CPU_FREQ_ONDEMAND_TICKLE_HOTPLUG */
+
 /************************** sysfs interface ************************/
 static ssize_t show_sampling_rate_max(struct cpufreq_policy *policy, char *buf)
 {
@@ -754,8 +787,6 @@ show_one(up_threshold, up_threshold);
 show_one(down_differential, down_differential);
 show_one(ignore_nice_load, ignore_nice);
 show_one(powersave_bias, powersave_bias);
-show_one(max_tickle_window, max_tickle_window);
-show_one(max_floor_window, max_floor_window);
 
 static ssize_t store_sampling_rate(struct cpufreq_policy *unused,
 		const char *buf, size_t count)
@@ -875,46 +906,6 @@ static ssize_t store_powersave_bias(struct cpufreq_policy *unused,
 	return count;
 }
 
-static ssize_t store_max_tickle_window(struct cpufreq_policy *unuesd,
-		const char *buf, size_t count)
-{
-	unsigned int input;
-	int ret;
-	ret = sscanf(buf, "%u", &input);
-	
-	if (ret != 1)
-		return -EINVAL;
-	
-	if (input > MAX_TICKLE_WINDOW)
-		input = MAX_TICKLE_WINDOW;
-	
-	mutex_lock(&dbs_mutex);
-	dbs_tuners_ins.max_tickle_window = input;
-	mutex_unlock(&dbs_mutex);
-	
-	return count;
-}
-
-static ssize_t store_max_floor_window(struct cpufreq_policy *unuesd,
-		const char *buf, size_t count)
-{
-	unsigned int input;
-	int ret;
-	ret = sscanf(buf, "%u", &input);
-	
-	if (ret != 1)
-		return -EINVAL;
-	
-	if (input > MAX_FLOOR_WINDOW)
-		input = MAX_FLOOR_WINDOW;
-	
-	mutex_lock(&dbs_mutex);
-	dbs_tuners_ins.max_floor_window = input;
-	mutex_unlock(&dbs_mutex);
-	
-	return count;
-}
-
 static ssize_t store_screen_off_max_freq(struct cpufreq_policy *unuesd,
 						const char *buf, size_t count)
 {
@@ -963,11 +954,58 @@ define_one_rw(up_threshold);
 define_one_rw(down_differential);
 define_one_rw(ignore_nice_load);
 define_one_rw(powersave_bias);
-define_one_rw(max_tickle_window);
-define_one_rw(max_floor_window);
 define_one_rw(screen_off_max_freq);
 define_one_rw(screenstate_enable);
 
+/* aliases of the cpufreq boost_ms and floor_ms parameters */
+#define boost_window(_name, _floor)					\
+static ssize_t show_##_name(struct cpufreq_policy *unused, char *buf)	\
+{									\
+	return sprintf(buf, "%u\n", cpufreq_boost_get_window(_floor));	\
+}									\
+static ssize_t store_##_name(struct cpufreq_policy *unused,		\
+		const char *buf, size_t count)				\
+{									\
+	unsigned int input;						\
+									\
+	if (sscanf(buf, "%u", &input) != 1)				\
+		return -EINVAL;						\
+	cpufreq_boost_set_window(_floor, input);			\
+	return count;							\
+}									\
+define_one_rw(_name)
+
+boost_window(max_tickle_window, 0);
+boost_window(max_floor_window, 1);
+
+#ifdef CONFIG_CPU_FREQ_ONDEMAND_TICKLE_HOTPLUG
+#define hotplug_one(_name, _max)					\
+static ssize_t show_hotplug_##_name					\
+(struct cpufreq_policy *unused, char *buf)				\
+{									\
+	return sprintf(buf, "%u\n", hotplug_tuners._name);		\
+}									\
+static ssize_t store_hotplug_##_name(struct cpufreq_policy *unused,	\
+		const char *buf, size_t count)				\
+{									\
+	unsigned int input;						\
+									\
+	if (sscanf(buf, "%u", &input) != 1 || input > (_max))		\
+		return -EINVAL;						\
+	hotplug_tuners._name = input;					\
+	return count;							\
+}									\
+define_one_rw(hotplug_##_name)
+
+hotplug_one(enable, 1);
+hotplug_one(up_rq, 10000);
+hotplug_one(up_load, 100);
+hotplug_one(up_delay, 10000);
+hotplug_one(down_rq, 10000);
+hotplug_one(down_load, 200);
+hotplug_one(down_delay, 60000);
+#endif
+
 static struct attribute * dbs_attributes[] = {
 	&sampling_rate_max.attr,
 	&sampling_rate_min.attr,
@@ -976,10 +1014,19 @@ static struct attribute * dbs_attributes[] = {
 	&down_differential.attr,
 	&ignore_nice_load.attr,
 	&powersave_bias.attr,
-	&max_tickle_window.attr,
-	&max_floor_window.attr,
 	&screen_off_max_freq.attr,
 	&screenstate_enable.attr,
+	&max_tickle_window.attr,
+	&max_floor_window.attr,
+#ifdef CONFIG_CPU_FREQ_ONDEMAND_TICKLE_HOTPLUG
+	&hotplug_enable.attr,
+	&hotplug_up_rq.attr,
+	&hotplug_up_load.attr,
+	&hotplug_up_delay.attr,
+	&hotplug_down_rq.attr,
+	&hotplug_down_load.attr,
+	&hotplug_down_delay.attr,
+#endif
 	NULL
 };
 
@@ -1033,418 +1080,6 @@ static void record_sample(unsigned int cur_freq, unsigned int target_freq,
 	//}
 }
 
-static void do_tickle_state_change(struct work_struct *work)
-{
-	int cpu;
-	unsigned long flags;
-	int active, active_tickle, active_count;
-	unsigned long tickle_jiffies;
-
-	spin_lock_irqsave(&tickle_state.lock, flags);
-
-	active = tickle_state.active;
-	active_count = tickle_state.active_count;
-	active_tickle = tickle_state.active_tickle;
-	tickle_jiffies = tickle_state.tickle_jiffies;
-
-	spin_unlock_irqrestore(&tickle_state.lock, flags);
-
-	if (print_tickles)
-		printk("%s: active=%u, active_count=%u, tickle_jiffies=%lu\n",
-				__FUNCTION__, active, active_count, tickle_jiffies);
-
-	if (active_count) {
-		if (!active) {
-			for_each_online_cpu(cpu) {
-				struct cpu_dbs_info_s *dbs_info;
-				struct cpufreq_policy *policy;
-
-				mutex_lock(&dbs_mutex);
-				dbs_info = &per_cpu(cpu_dbs_info, cpu);
-
-				if (!dbs_info->enable) {
-					mutex_unlock(&dbs_mutex);
-					continue;
-				}
-
-				mutex_lock(&dbs_info->timer_mutex);
-				policy = dbs_info->cur_policy;
-				/* if we don't have a policy then we probably got tickled before setup completed */
-
-				if (!policy) {
-					mutex_unlock(&dbs_info->timer_mutex);
-					mutex_unlock(&dbs_mutex);
-					continue;
-				}
-
-				/* save the current operating frequency */	
-				dbs_info->freq_save = policy->cur;
-
-				/* ramp up to the policy max */
-				if (policy->cur < policy->max) {
-					record_sample(policy->cur, policy->max, -2, policy->cpu);
-					cpufreq_target(policy, policy->max,
-							CPUFREQ_RELATION_H);
-				}
-
-				dbs_info->tickle_active = 1;
-
-				mutex_unlock(&dbs_info->timer_mutex);
-				mutex_unlock(&dbs_mutex);
-			}
-		}
-		
-		if (active_tickle)
-			mod_timer(&tickle_state.tickle_timer, tickle_jiffies);
-
-		active = 1;
-	} else if (active) {
-
-		for_each_online_cpu(cpu) {
-			struct cpu_dbs_info_s *dbs_info;
-			struct cpufreq_policy *policy;
-
-			mutex_lock(&dbs_mutex);
-			dbs_info = &per_cpu(cpu_dbs_info, cpu);
-
-			if (!dbs_info->enable) {
-				mutex_unlock(&dbs_mutex);
-				continue;
-			}
-
-			mutex_lock(&dbs_info->timer_mutex);
-			policy = dbs_info->cur_policy;
-			dbs_info->tickle_active = 0;
-			adjust_for_load(dbs_info);
-
-			record_sample(policy->cur, policy->min, -5, policy->cpu);
-			mutex_unlock(&dbs_info->timer_mutex);
-			mutex_unlock(&dbs_mutex);
-		}
-
-		active = 0;
-	}
-	
-	/* update tickle_state */
-	spin_lock_irqsave(&tickle_state.lock, flags);
-	tickle_state.active = active;
-	spin_unlock_irqrestore(&tickle_state.lock, flags);
-}
-
-void cpufreq_ondemand_tickle_millis(unsigned int millis)
-{
-	int queue = 0;
-	unsigned long flags, expire;
-
-	if (!tickling_enabled)
-		return;
-
-	if (millis > dbs_tuners_ins.max_tickle_window)
-		millis = dbs_tuners_ins.max_tickle_window;
-	
-	expire = jiffies + msecs_to_jiffies(millis);
-
-	spin_lock_irqsave(&tickle_state.lock, flags);
-	
-	if (time_after(expire, tickle_state.tickle_jiffies)) {
-		tickle_state.tickle_jiffies = expire;
-
-		if (!tickle_state.active_tickle)
-			tickle_state.active_count += 1;
-		
-		tickle_state.active_tickle = 1;
-		queue = 1;
-	}
-
-	spin_unlock_irqrestore(&tickle_state.lock, flags);
-	
-	if (queue)
-		queue_work(kondemand_wq, &tickle_state.tickle_work);
-}
-EXPORT_SYMBOL(cpufreq_ondemand_tickle_millis);
-
-void cpufreq_ondemand_tickle(void)
-{
-	cpufreq_ondemand_tickle_millis(dbs_tuners_ins.max_tickle_window);
-}
-EXPORT_SYMBOL(cpufreq_ondemand_tickle);
-
-void cpufreq_ondemand_hold(void)
-{
-	unsigned long flags;
-
-	spin_lock_irqsave(&tickle_state.lock, flags);
-	tickle_state.active_count += 1;
-	spin_unlock_irqrestore(&tickle_state.lock, flags);
-
-	queue_work(kondemand_wq, &tickle_state.tickle_work);
-}
-EXPORT_SYMBOL(cpufreq_ondemand_hold);
-
-void cpufreq_ondemand_unhold(void)
-{
-	int queue = 0;
-	unsigned long flags;
-
-	spin_lock_irqsave(&tickle_state.lock, flags);
-
-	if (tickle_state.active_count) {
-		tickle_state.active_count -= 1;
-		queue = 1;
-	} else {
-		printk(KERN_WARNING "%s: attempt to decrement when active_count == 0!\n",
-				__FUNCTION__);
-	}
-
-	spin_unlock_irqrestore(&tickle_state.lock, flags);
-
-	if (queue)
-		queue_work(kondemand_wq, &tickle_state.tickle_work);
-}
-EXPORT_SYMBOL(cpufreq_ondemand_unhold);
-
-void cpufreq_ondemand_hold_check(int *flag)
-{
-	if (!*flag) {
-		cpufreq_ondemand_hold();
-		*flag = 1;
-	}
-}
-EXPORT_SYMBOL(cpufreq_ondemand_hold_check);
-
-/* this tickle option waits until the CPU is up to the max freq before it returns */
-void cpufreq_ondemand_hold_sync(void)
-{
-	cpufreq_ondemand_hold();
-	flush_work(&tickle_state.tickle_work);
-}
-EXPORT_SYMBOL(cpufreq_ondemand_hold_sync);
-
-void cpufreq_ondemand_unhold_check(int *flag)
-{
-	if (*flag) {
-		cpufreq_ondemand_unhold();
-		*flag = 0;
-	}
-}
-EXPORT_SYMBOL(cpufreq_ondemand_unhold_check);
-
-static void do_floor_state_change(struct work_struct *work)
-{
-	int cpu, floor_active, floor_tickle, floor_count, cur_freq_floor, pending_freq_floor;
-	unsigned long flags, floor_jiffies;
-
-	spin_lock_irqsave(&tickle_state.lock, flags);
-
-	floor_active = tickle_state.floor_active;
-	floor_tickle = tickle_state.floor_tickle;
-	floor_count = tickle_state.floor_count;
-	cur_freq_floor = tickle_state.cur_freq_floor;
-	floor_jiffies = tickle_state.floor_jiffies;
-
-	pending_freq_floor = get_max_client_floor();
-
-	spin_unlock_irqrestore(&tickle_state.lock, flags);
-
-
-	if (print_tickles)
-		printk("%s: floor_active=%u, floor_tickle=%u, floor_count=%u, floor_jiffies=%lu, "
-				"cur_freq_floor=%u, pending_freq_floor=%u\n",
-				__FUNCTION__, floor_active, floor_tickle, floor_count, floor_jiffies,
-				cur_freq_floor, pending_freq_floor);
-
-	if (floor_count) {
-		if (!floor_active || pending_freq_floor != cur_freq_floor) {
-
-			for_each_online_cpu(cpu) {
-				unsigned int f = pending_freq_floor;
-				struct cpu_dbs_info_s *dbs_info;
-				struct cpufreq_policy *policy;
-
-				mutex_lock(&dbs_mutex);
-				dbs_info = &per_cpu(cpu_dbs_info, cpu);
-
-				if (!dbs_info->enable) {
-					mutex_unlock(&dbs_mutex);
-					continue;
-				}
-
-				mutex_lock(&dbs_info->timer_mutex);
-
-				policy = dbs_info->cur_policy;
-
-				if (!policy) {
-					mutex_unlock(&dbs_info->timer_mutex);
-					mutex_unlock(&dbs_mutex);
-					continue;
-				}
-
-				if (policy->min >= f) {
-					mutex_unlock(&dbs_info->timer_mutex);
-					mutex_unlock(&dbs_mutex);
-					continue;
-				}
-
-				if (f > policy->max)
-					f = policy->max;
-
-				dbs_info->freq_floor = f;
-				dbs_info->freq_save = policy->cur;
-				dbs_info->floor_active = 1;
-
-				if (policy->cur < f) {
-					record_sample(policy->cur, f, -3, policy->cpu);
-					cpufreq_target(policy, f,
-							CPUFREQ_RELATION_H);
-				}
-
-				mutex_unlock(&dbs_info->timer_mutex);
-				mutex_unlock(&dbs_mutex);
-			}
-
-		}
-		
-		if (floor_tickle)
-			mod_timer(&tickle_state.floor_timer, floor_jiffies);
-
-		floor_active = 1;
-		cur_freq_floor = pending_freq_floor;
-	} else if (floor_active) {
-
-		for_each_online_cpu(cpu) {
-			struct cpu_dbs_info_s *dbs_info;
-			struct cpufreq_policy *policy;
-
-			mutex_lock(&dbs_mutex);
-			dbs_info = &per_cpu(cpu_dbs_info, cpu);
-
-			if (!dbs_info->enable) {
-				mutex_unlock(&dbs_mutex);
-				continue;
-			}
-
-			mutex_lock(&dbs_info->timer_mutex);
-
-			policy = dbs_info->cur_policy;
-
-			dbs_info->floor_active = 0;
-			cpufreq_target(policy, dbs_info->freq_save, dbs_info->rel_save);
-			record_sample(dbs_info->freq_save, policy->min, -5, policy->cpu);
-
-			mutex_unlock(&dbs_info->timer_mutex);
-			mutex_unlock(&dbs_mutex);
-		}
-
-
-		floor_active = 0;
-		cur_freq_floor = 0;
-	}
-
-	spin_lock_irqsave(&tickle_state.lock, flags);
-	tickle_state.floor_active = floor_active;
-	tickle_state.cur_freq_floor = cur_freq_floor;
-	spin_unlock_irqrestore(&tickle_state.lock, flags);
-}	
-
-void cpufreq_ondemand_floor_millis(unsigned int freq, unsigned int millis)
-{
-	int queue = 0;
-	unsigned long flags, expire;
-
-	if (!tickling_enabled)
-		return;
-
-	if (millis > dbs_tuners_ins.max_floor_window)
-		millis = dbs_tuners_ins.max_floor_window;
-	
-	expire = jiffies + msecs_to_jiffies(millis);
-
-	spin_lock_irqsave(&tickle_state.lock, flags);
-	
-	if (time_after(expire, tickle_state.floor_jiffies) ||
-			(freq >  get_max_client_floor() && freq > tickle_state.cur_freq_floor)) {
-		if (time_after(expire, tickle_state.floor_jiffies))
-			tickle_state.floor_jiffies = expire;
-		
-		if (!tickle_state.floor_tickle)
-			tickle_state.floor_count += 1;
-		
-		tickle_state.floor_tickle = 1;
-		
-		default_file_data.floor_freq = max(default_file_data.floor_freq, freq);
-
-		queue = 1;
-	}
-
-	spin_unlock_irqrestore(&tickle_state.lock, flags);
-	
-	if (queue)
-		queue_work(kondemand_wq, &tickle_state.floor_work);
-}
-EXPORT_SYMBOL(cpufreq_ondemand_floor_millis);
-
-void cpufreq_ondemand_floor(unsigned int freq)
-{
-	cpufreq_ondemand_floor_millis(freq, dbs_tuners_ins.max_floor_window);
-}
-EXPORT_SYMBOL(cpufreq_ondemand_floor);
-
-void cpufreq_ondemand_floor_hold(unsigned int freq)
-{
-	unsigned long flags;
-
-	spin_lock_irqsave(&tickle_state.lock, flags);
-	tickle_state.floor_count += 1;
-	
-	default_file_data.floor_freq = freq;
-
-	spin_unlock_irqrestore(&tickle_state.lock, flags);
-
-	queue_work(kondemand_wq, &tickle_state.floor_work);
-}
-EXPORT_SYMBOL(cpufreq_ondemand_floor_hold);
-
-void cpufreq_ondemand_floor_unhold(void)
-{
-	int queue = 0;
-	unsigned long flags;
-
-	spin_lock_irqsave(&tickle_state.lock, flags);
-
-	if (tickle_state.floor_count) {
-		tickle_state.floor_count -= 1;
-		queue = 1;
-	} else {
-		printk(KERN_WARNING "%s: attempt to decrement when floor_count == 0!\n",
-				__FUNCTION__);
-	}
-
-	spin_unlock_irqrestore(&tickle_state.lock, flags);
-
-	if (queue)
-		queue_work(kondemand_wq, &tickle_state.floor_work);
-}
-EXPORT_SYMBOL(cpufreq_ondemand_floor_unhold);
-
-void cpufreq_ondemand_floor_hold_check(unsigned int freq, int *flag)
-{
-	if (!*flag) {
-		cpufreq_ondemand_floor_hold(freq);
-		*flag = 1;
-	}
-}
-EXPORT_SYMBOL(cpufreq_ondemand_floor_hold_check);
-
-void cpufreq_ondemand_floor_unhold_check(int *flag)
-{
-	if (*flag) {
-		cpufreq_ondemand_floor_unhold();
-		*flag = 0;
-	}
-}
-EXPORT_SYMBOL(cpufreq_ondemand_floor_unhold_check);
-
-
 /** 
 * @brief 
 *
@@ -1534,6 +1169,18 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 	this_dbs_info->max_load_freq = max_load_freq;
 }
 
+/* the lowest frequency the boost core currently allows, 0 if none */
+static unsigned int boost_floor(struct cpufreq_policy *policy)
+{
+	unsigned int floor;
+
+	if (cpufreq_boost_active())
+		return policy->max;
+
+	floor = cpufreq_boost_floor_freq();
+	return floor > policy->max ? policy->max : floor;
+}
+
 /**
 * @brief
 *
@@ -1545,14 +1192,13 @@ static void adjust_for_load(struct cpu_dbs_info_s *this_dbs_info)
 {
 	unsigned int 		max_load_freq;
 	unsigned int		load;
+	unsigned int		floor;
 	struct cpufreq_policy*	policy;
 
-	if (this_dbs_info->tickle_active)
-		return;
-
 	max_load_freq 	= this_dbs_info->max_load_freq;
 	load		= this_dbs_info->cur_load;
 	policy 		= this_dbs_info->cur_policy;
+	floor		= boost_floor(policy);
 	/* Check for frequency increase */
 	if (max_load_freq > dbs_tuners_ins.up_threshold * policy->cur) {
 		/* if we are already at full speed then break out early */
@@ -1561,25 +1207,12 @@ static void adjust_for_load(struct cpu_dbs_info_s *this_dbs_info)
 			if (policy->cur == policy->max)
 				return;
 
-			if (this_dbs_info->floor_active) {
-				this_dbs_info->freq_save = policy->max;
-				this_dbs_info->rel_save = CPUFREQ_RELATION_H;
-			}
-
 			cpufreq_target(policy, policy->max,
 				CPUFREQ_RELATION_H);
 		} else {
 			int freq = powersave_bias_target(policy, policy->max,
 					CPUFREQ_RELATION_H);
 
-			if (this_dbs_info->floor_active) {
-				this_dbs_info->freq_save = freq;
-				this_dbs_info->rel_save = CPUFREQ_RELATION_L;
-
-				if (freq <= this_dbs_info->freq_floor) {
-					freq = this_dbs_info->freq_floor;
-				}
-			}
 			record_sample(policy->cur, freq, load, policy->cpu);
 
 			cpufreq_target(policy, freq, CPUFREQ_RELATION_L);
@@ -1587,9 +1220,16 @@ static void adjust_for_load(struct cpu_dbs_info_s *this_dbs_info)
 		return;
 	}
 
+	/* Hold a tickle or floor */
+	if (policy->cur < floor) {
+		record_sample(policy->cur, floor, load, policy->cpu);
+		cpufreq_target(policy, floor, CPUFREQ_RELATION_L);
+		return;
+	}
+
 	/* Check for frequency decrease */
 	/* if we cannot reduce the frequency anymore, break out early */
-	if (policy->cur == policy->min)
+	if (policy->cur == policy->min || policy->cur <= floor)
 		return;
 
 	/*
@@ -1604,29 +1244,19 @@ static void adjust_for_load(struct cpu_dbs_info_s *this_dbs_info)
 		freq_next = max_load_freq /
 				(dbs_tuners_ins.up_threshold -
 				 dbs_tuners_ins.down_differential);
+		if (freq_next < floor)
+			freq_next = floor;
 
 		if (!dbs_tuners_ins.powersave_bias) {
-			if (this_dbs_info->floor_active) {
-				this_dbs_info->freq_save = freq_next;
-				this_dbs_info->rel_save = CPUFREQ_RELATION_L;
-
-				if (freq_next <= this_dbs_info->freq_floor) {
-					freq_next = this_dbs_info->freq_floor;
-				}
-			}
 			record_sample(policy->cur, freq_next, load, policy->cpu);
 			cpufreq_target(policy, freq_next,
 					CPUFREQ_RELATION_L);
 		} else {
 			int freq = powersave_bias_target(policy, freq_next,
 					CPUFREQ_RELATION_L);
-			if (this_dbs_info->floor_active) {
-				this_dbs_info->freq_save = freq;
-				this_dbs_info->rel_save = CPUFREQ_RELATION_L;
-
-				if (freq <= this_dbs_info->freq_floor) {
-					freq = this_dbs_info->freq_floor;
-				}
+			if (freq < floor) {
+				freq = floor;
+				this_dbs_info->freq_lo = 0;
 			}
 			record_sample(policy->cur, freq, load, policy->cpu);
 			cpufreq_target(policy, freq, CPUFREQ_RELATION_L);
@@ -1654,6 +1284,8 @@ static void do_dbs_timer(struct work_struct *work)
 	    sample_type == DBS_NORMAL_SAMPLE) {
 		dbs_check_cpu(dbs_info);
 		adjust_for_load(dbs_info);
+		if (cpu == 0)
+			hotplug_sample();
 		if (dbs_info->freq_lo) {
 			/* Setup timer for SUB_SAMPLE */
 			dbs_info->sample_type = DBS_SUB_SAMPLE;
@@ -1669,46 +1301,19 @@ static void do_dbs_timer(struct work_struct *work)
 	mutex_unlock(&dbs_info->timer_mutex);
 }
 
-static void do_tickle_timer(unsigned long arg)
-{
-	unsigned long flags;
-
-	spin_lock_irqsave(&tickle_state.lock, flags);
-	
-	if (tickle_state.active_count) {
-		if (tickle_state.active_tickle) {
-			tickle_state.active_count -= 1;
-			tickle_state.active_tickle = 0;
-		}
-	} else {
-		printk(KERN_WARNING "%s: attempt to decrement when active_count == 0!\n",
-				__FUNCTION__);
-	}
-
-	spin_unlock_irqrestore(&tickle_state.lock, flags);
-
-	queue_work(kondemand_wq, &tickle_state.tickle_work);
-}
-
-static void do_floor_timer(unsigned long arg)
+/*
+ * Called by the boost core, with the policy rwsem held, when a tickle or
+ * floor starts or ends: raise to it now rather than at the next sample,
+ * and on release scale back down on the last sampled load.
+ */
+static void cpufreq_ondemand_tickle_boost(struct cpufreq_policy *policy)
 {
-	unsigned long flags;
-
-	spin_lock_irqsave(&tickle_state.lock, flags);
-
-	if (tickle_state.floor_count) {
-		if (tickle_state.floor_tickle) {
-			tickle_state.floor_count -= 1;
-			tickle_state.floor_tickle = 0;
-		}
-	} else {
-		printk(KERN_WARNING "%s: attempt to decrement when floor_count == 0!\n",
-				__FUNCTION__);
-	}
+	struct cpu_dbs_info_s *this_dbs_info = &per_cpu(cpu_dbs_info, policy->cpu);
 
-	spin_unlock_irqrestore(&tickle_state.lock, flags);
-
-	queue_work(kondemand_wq, &tickle_state.floor_work);
+	mutex_lock(&this_dbs_info->timer_mutex);
+	if (this_dbs_info->enable)
+		adjust_for_load(this_dbs_info);
+	mutex_unlock(&this_dbs_info->timer_mutex);
 }
 
 static inline void dbs_timer_init(struct cpu_dbs_info_s *dbs_info)
@@ -1723,9 +1328,6 @@ static inline void dbs_timer_init(struct cpu_dbs_info_s *dbs_info)
 	INIT_DELAYED_WORK_DEFERRABLE(&dbs_info->work, do_dbs_timer);
 	queue_delayed_work_on(dbs_info->cpu, kondemand_wq, &dbs_info->work,
 	                      delay);
-
-	dbs_info->tickle_active = 0;
-	dbs_info->floor_active = 0;
 }
 
 static inline void dbs_timer_exit(struct cpu_dbs_info_s *dbs_info)
@@ -1734,91 +1336,6 @@ static inline void dbs_timer_exit(struct cpu_dbs_info_s *dbs_info)
 	cancel_delayed_work(&dbs_info->work);
 }
 
-static void dbs_refresh_callback(struct work_struct *unused)
-{
-	struct cpufreq_policy *policy;
-	struct cpu_dbs_info_s *this_dbs_info;
-
-	mutex_lock(&dbs_mutex);
-	this_dbs_info = &per_cpu(cpu_dbs_info, 0);
-
-	if (!this_dbs_info->enable) {
-		mutex_unlock(&dbs_mutex);
-		return;
-	}
-
-	mutex_lock(&this_dbs_info->timer_mutex);
-	policy = this_dbs_info->cur_policy;
-
-	if (policy->cur < policy->max) {
-		policy->cur = policy->max;
-
-		cpufreq_target(policy, policy->max, CPUFREQ_RELATION_L);
-		this_dbs_info->prev_cpu_idle = get_cpu_idle_time(0,
-				&this_dbs_info->prev_cpu_wall);
-	}
-	mutex_unlock(&this_dbs_info->timer_mutex);
-	mutex_unlock(&dbs_mutex);
-}
-
-static DECLARE_WORK(dbs_refresh_work, dbs_refresh_callback);
-
-static void dbs_input_event(struct input_handle *handle, unsigned int type,
-		unsigned int code, int value)
-{
-	schedule_work(&dbs_refresh_work);
-}
-
-static int dbs_input_connect(struct input_handler *handler,
-		struct input_dev *dev, const struct input_device_id *id)
-{
-	struct input_handle *handle;
-	int error;
-
-	handle = kzalloc(sizeof(struct input_handle), GFP_KERNEL);
-	if (!handle)
-		return -ENOMEM;
-
-	handle->dev = dev;
-	handle->handler = handler;
-	handle->name = "cpufreq";
-
-	error = input_register_handle(handle);
-	if (error)
-		goto err2;
-
-	error = input_open_device(handle);
-	if (error)
-		goto err1;
-
-	return 0;
-err1:
-	input_unregister_handle(handle);
-err2:
-	kfree(handle);
-	return error;
-}
-
-static void dbs_input_disconnect(struct input_handle *handle)
-{
-	input_close_device(handle);
-	input_unregister_handle(handle);
-	kfree(handle);
-}
-
-static const struct input_device_id dbs_ids[] = {
-	{ .driver_info = 1 },
-	{ },
-};
-
-static struct input_handler dbs_input_handler = {
-	.event		= dbs_input_event,
-	.connect	= dbs_input_connect,
-	.disconnect	= dbs_input_disconnect,
-	.name		= "cpufreq_ond_tcl",
-	.id_table	= dbs_ids,
-};
-
 static int cpufreq_governor_dbs(struct cpufreq_policy *policy,
 				   unsigned int event)
 {
@@ -1898,7 +1415,6 @@ static int cpufreq_governor_dbs(struct cpufreq_policy *policy,
 
 			dbs_tuners_ins.sampling_rate = def_sampling_rate;
 		}
-		rc = input_register_handler(&dbs_input_handler);
 		mutex_unlock(&dbs_mutex);
 
 		mutex_init(&this_dbs_info->timer_mutex);
@@ -1923,8 +1439,6 @@ static int cpufreq_governor_dbs(struct cpufreq_policy *policy,
 		}
 
 		remove_proc_entry("ondemand_samples", NULL);
-
-		input_unregister_handler(&dbs_input_handler);
 		mutex_unlock(&dbs_mutex);
 		break;
 
@@ -1953,6 +1467,7 @@ static
 struct cpufreq_governor cpufreq_gov_ondemand_tickle = {
 	.name			= "ondemandtcl",
 	.governor		= cpufreq_governor_dbs,
+	.boost			= cpufreq_ondemand_tickle_boost,
 	.max_transition_latency = TRANSITION_LATENCY_LIMIT,
 	.owner			= THIS_MODULE,
 };
@@ -1979,20 +1494,9 @@ static int __init cpufreq_gov_dbs_init(void)
 		return -EFAULT;
 	}
 
-	init_timer(&tickle_state.tickle_timer);
-	init_timer(&tickle_state.floor_timer);
-
-	tickle_state.tickle_timer.function = do_tickle_timer;
-	tickle_state.floor_timer.function = do_floor_timer;
-
-	INIT_WORK(&tickle_state.tickle_work, do_tickle_state_change);
-	INIT_WORK(&tickle_state.floor_work, do_floor_state_change);
-
-	/* init these to current jiffies or short circuiting doesn't work until jiffies wraps */
-	tickle_state.tickle_jiffies = tickle_state.floor_jiffies = jiffies;
-
-	err = setup_tickle_device();
+	err = hotplug_init();
 	if (err < 0) {
+		destroy_workqueue(kondemand_wq);
 		return err;
 	}
 
@@ -2005,13 +1509,9 @@ static int __init cpufreq_gov_dbs_init(void)
 
 static void __exit cpufreq_gov_dbs_exit(void)
 {
-	remove_tickle_device();
 	cpufreq_unregister_governor(&cpufreq_gov_ondemand_tickle);
 
-	/* cancel any pending timers before destroying the work queue */
-	del_timer(&tickle_state.tickle_timer);
-	del_timer(&tickle_state.floor_timer);
-
+	hotplug_exit();
 	destroy_workqueue(kondemand_wq);
 }
 
@@ -0,0 +1,468 @@
+/*
+ *  drivers/cpufreq/cpufreq_sched.c
+ *
+ *  'sched' - a cpufreq governor that follows the scheduler's per
+ *  runqueue utilization estimates instead of sampling idle time.
+ *
+ *  The scheduler calls sched_gov_kick() whenever a runqueue's estimate
+ *  moves, on enqueue, dequeue and the tick. A SCHED_FIFO thread then
+ *  retargets the policy right away, but changes the frequency of a
+ *  policy at most once every rate_limit_us.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/cpufreq.h>
+#include <linux/cpu.h>
+#include <linux/sched.h>
+#include <linux/kthread.h>
+#include <linux/hrtimer.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#define dprintk(msg...) cpufreq_debug_printk(CPUFREQ_DEBUG_GOVERNOR, \
+						"sched", msg)
+
+/* go straight to policy->max above this */
+#define SCHED_GOV_SATURATED	(SCHED_LOAD_SCALE - SCHED_LOAD_SCALE / 16)
+
+#define DEF_RATE_LIMIT_US	4000
+#define MAX_RATE_LIMIT_US	1000000
+#define DEF_HEADROOM		25
+
+struct sched_gov_cpu {
+	struct cpufreq_policy *policy;
+
+	/* written by the kick, under sched_gov_lock */
+	unsigned long util;
+	int pending;
+	ktime_t kick_stamp;
+
+	/* on the cpu that owns the policy */
+	ktime_t last_change;
+
+	unsigned long kicks;
+	unsigned long changes;
+	unsigned long deferred;
+	unsigned long resp_count;
+	u64 resp_total_ns;
+	u64 resp_max_ns;
+};
+static DEFINE_PER_CPU(struct sched_gov_cpu, sched_gov_cpu);
+
+static DEFINE_SPINLOCK(sched_gov_lock);
+
+/*
+ * sched_gov_mutex serializes the thread's frequency changes with the
+ * governor limits and policy pointers. Start and stop also hold
+ * sched_gov_life_mutex, which the thread never takes, so the last stop
+ * can kthread_stop() it.
+ */
+static DEFINE_MUTEX(sched_gov_mutex);
+static DEFINE_MUTEX(sched_gov_life_mutex);
+
+static struct task_struct *sched_gov_task;
+static unsigned int sched_gov_enable;
+
+static struct sched_gov_tuners {
+	unsigned int rate_limit_us;
+	unsigned int headroom;
+} sched_gov_tuners = {
+	.rate_limit_us = DEF_RATE_LIMIT_US,
+	.headroom = DEF_HEADROOM,
+};
+
+/* Called by the scheduler with its locks dropped, possibly in irq context. */
+static void sched_gov_kick(int cpu, unsigned long util)
+{
+	struct sched_gov_cpu *sg = &per_cpu(sched_gov_cpu, cpu);
+	unsigned long flags;
+
+	spin_lock_irqsave(&sched_gov_lock, flags);
+	sg->util = util;
+	sg->kicks++;
+	if (!sg->pending) {
+		sg->pending = 1;
+		sg->kick_stamp = ktime_get();
+	}
+	spin_unlock_irqrestore(&sched_gov_lock, flags);
+
+	wake_up_process(sched_gov_task);
+}
+
+static int sched_gov_pending(void)
+{
+	unsigned long flags;
+	int cpu, pending = 0;
+
+	spin_lock_irqsave(&sched_gov_lock, flags);
+	for_each_online_cpu(cpu)
+		pending |= per_cpu(sched_gov_cpu, cpu).pending;
+	spin_unlock_irqrestore(&sched_gov_lock, flags);
+
+	return pending;
+}
+
+static unsigned int sched_gov_target(struct cpufreq_policy *policy,
+				     unsigned long util)
+{
+	u64 freq;
+
+	if (util >= SCHED_GOV_SATURATED)
+		return policy->max;
+
+	/* the estimate is a busy fraction at the current frequency */
+	freq = (u64)policy->cur * util * (100 + sched_gov_tuners.headroom);
+	freq = div_u64(freq, 100 * SCHED_LOAD_SCALE);
+
+	return clamp_t(unsigned int, freq, policy->min, policy->max);
+}
+
+/*
+ * Retarget every policy with a pending kick. Returns how long the
+ * first rate limited policy still has to wait, or 0 if none is.
+ */
+static s64 sched_gov_update(void)
+{
+	struct cpufreq_policy *policy;
+	struct sched_gov_cpu *owner;
+	unsigned long flags, util;
+	unsigned int target;
+	s64 left, wait = 0;
+	ktime_t stamp, now;
+	int cpu, j, pending;
+
+	mutex_lock(&sched_gov_mutex);
+
+	for_each_online_cpu(cpu) {
+		owner = &per_cpu(sched_gov_cpu, cpu);
+		policy = owner->policy;
+		if (!policy || policy->cpu != cpu)
+			continue;
+
+		pending = 0;
+		util = 0;
+		stamp.tv64 = KTIME_MAX;
+		spin_lock_irqsave(&sched_gov_lock, flags);
+		for_each_cpu(j, policy->cpus) {
+			struct sched_gov_cpu *sg = &per_cpu(sched_gov_cpu, j);
+
+			if (!sg->pending)
+				continue;
+			pending = 1;
+			util = max(util, sg->util);
+			if (sg->kick_stamp.tv64 < stamp.tv64)
+				stamp = sg->kick_stamp;
+		}
+		spin_unlock_irqrestore(&sched_gov_lock, flags);
+
+		if (!pending)
+			continue;
+
+		now = ktime_get();
+		left = (s64)sched_gov_tuners.rate_limit_us * NSEC_PER_USEC -
+			ktime_to_ns(ktime_sub(now, owner->last_change));
+		if (left > 0) {
+			owner->deferred++;
+			if (!wait || left < wait)
+				wait = left;
+			continue;
+		}
+
+		spin_lock_irqsave(&sched_gov_lock, flags);
+		for_each_cpu(j, policy->cpus) {
+			struct sched_gov_cpu *sg = &per_cpu(sched_gov_cpu, j);
+
+			/* take the latest estimate */
+			if (sg->pending)
+				util = max(util, sg->util);
+			sg->pending = 0;
+		}
+		spin_unlock_irqrestore(&sched_gov_lock, flags);
+
+		target = sched_gov_target(policy, util);
+		if (target != policy->cur) {
+			dprintk("cpu %u: util %lu, %u -> %u kHz\n", cpu, util,
+				policy->cur, target);
+			__cpufreq_driver_target(policy, target,
+						CPUFREQ_RELATION_L);
+			owner->last_change = ktime_get();
+			owner->changes++;
+
+			left = ktime_to_ns(ktime_sub(owner->last_change, stamp));
+			owner->resp_count++;
+			owner->resp_total_ns += left;
+			if (left > owner->resp_max_ns)
+				owner->resp_max_ns = left;
+		}
+	}
+
+	mutex_unlock(&sched_gov_mutex);
+
+	return wait;
+}
+
+static int sched_gov_thread(void *data)
+{
+	struct sched_param param = { .sched_priority = MAX_USER_RT_PRIO / 2 };
+	ktime_t wait;
+	s64 left;
+
+	sched_setscheduler_nocheck(current, SCHED_FIFO, &param);
+
+	while (1) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop())
+			break;
+
+		if (!sched_gov_pending()) {
+			schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+
+		left = sched_gov_update();
+		if (left) {
+			/* a new kick wakes us early, which is fine */
+			wait = ns_to_ktime(left);
+			set_current_state(TASK_INTERRUPTIBLE);
+			schedule_hrtimeout(&wait, HRTIMER_MODE_REL);
+		}
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return 0;
+}
+
+/************************** sysfs interface ************************/
+
+#define show_one(file_name, object)					\
+static ssize_t show_##file_name						\
+(struct kobject *kobj, struct attribute *attr, char *buf)		\
+{									\
+	return sprintf(buf, "%u\n", sched_gov_tuners.object);		\
+}
+show_one(rate_limit_us, rate_limit_us);
+show_one(headroom, headroom);
+
+static ssize_t store_rate_limit_us(struct kobject *a, struct attribute *b,
+				   const char *buf, size_t count)
+{
+	unsigned int input;
+
+	if (sscanf(buf, "%u", &input) != 1 || input > MAX_RATE_LIMIT_US)
+		return -EINVAL;
+
+	sched_gov_tuners.rate_limit_us = input;
+	return count;
+}
+
+static ssize_t store_headroom(struct kobject *a, struct attribute *b,
+			      const char *buf, size_t count)
+{
+	unsigned int input;
+
+	if (sscanf(buf, "%u", &input) != 1 || input > 100)
+		return -EINVAL;
+
+	sched_gov_tuners.headroom = input;
+	return count;
+}
+
+#define define_one_rw(_name) \
+static struct global_attr _name = \
+__ATTR(_name, 0644, show_##_name, store_##_name)
+
+define_one_rw(rate_limit_us);
+define_one_rw(headroom);
+
+static struct attribute *sched_gov_attributes[] = {
+	&rate_limit_us.attr,
+	&headroom.attr,
+	NULL
+};
+
+static struct attribute_group sched_gov_attr_group = {
+	.attrs = sched_gov_attributes,
+	.name = "sched",
+};
+
+/************************** debugfs stats **************************/
+
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *sched_gov_debugfs;
+
+static int sched_gov_stats_show(struct seq_file *m, void *unused)
+{
+	int cpu;
+
+	seq_printf(m, "cpu util kicks changes deferred resp_avg_us resp_max_us\n");
+	for_each_online_cpu(cpu) {
+		struct sched_gov_cpu *sg = &per_cpu(sched_gov_cpu, cpu);
+		u64 avg = sg->resp_count ?
+			div_u64(sg->resp_total_ns, sg->resp_count) : 0;
+
+		seq_printf(m, "%d %lu %lu %lu %lu %llu %llu\n", cpu,
+			   sched_cpu_util(cpu), sg->kicks, sg->changes,
+			   sg->deferred, div_u64(avg, NSEC_PER_USEC),
+			   div_u64(sg->resp_max_ns, NSEC_PER_USEC));
+	}
+
+	return 0;
+}
+
+static int sched_gov_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, sched_gov_stats_show, NULL);
+}
+
+static const struct file_operations sched_gov_stats_fops = {
+	.open		= sched_gov_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void sched_gov_debugfs_init(void)
+{
+	sched_gov_debugfs = debugfs_create_file("cpufreq_sched", 0444, NULL,
+						NULL, &sched_gov_stats_fops);
+}
+
+static void sched_gov_debugfs_exit(void)
+{
+	debugfs_remove(sched_gov_debugfs);
+}
+#else
+static inline void sched_gov_debugfs_init(void) { }
+static inline void sched_gov_debugfs_exit(void) { }
+#endif
+
+/************************** governor *******************************/
+
+static int sched_gov_start(struct cpufreq_policy *policy)
+{
+	struct task_struct *task;
+	int rc, j;
+
+	if (!cpu_online(policy->cpu) || !policy->cur)
+		return -EINVAL;
+
+	mutex_lock(&sched_gov_life_mutex);
+
+	if (!sched_gov_enable) {
+		rc = sysfs_create_group(cpufreq_global_kobject,
+					&sched_gov_attr_group);
+		if (rc)
+			goto out;
+
+		task = kthread_create(sched_gov_thread, NULL, "kschedfreq");
+		if (IS_ERR(task)) {
+			sysfs_remove_group(cpufreq_global_kobject,
+					   &sched_gov_attr_group);
+			rc = PTR_ERR(task);
+			goto out;
+		}
+		sched_gov_task = task;
+		wake_up_process(task);
+	}
+
+	mutex_lock(&sched_gov_mutex);
+	for_each_cpu(j, policy->cpus) {
+		per_cpu(sched_gov_cpu, j).policy = policy;
+		per_cpu(sched_gov_cpu, j).pending = 0;
+	}
+	per_cpu(sched_gov_cpu, policy->cpu).last_change = ktime_get();
+	mutex_unlock(&sched_gov_mutex);
+
+	if (!sched_gov_enable++)
+		sched_util_set_hook(sched_gov_kick);
+
+	/* start from what the scheduler sees now */
+	sched_gov_kick(policy->cpu, sched_cpu_util(policy->cpu));
+	rc = 0;
+out:
+	mutex_unlock(&sched_gov_life_mutex);
+	return rc;
+}
+
+static void sched_gov_stop(struct cpufreq_policy *policy)
+{
+	int j;
+
+	mutex_lock(&sched_gov_life_mutex);
+
+	mutex_lock(&sched_gov_mutex);
+	for_each_cpu(j, policy->cpus)
+		per_cpu(sched_gov_cpu, j).policy = NULL;
+	mutex_unlock(&sched_gov_mutex);
+
+	if (!--sched_gov_enable) {
+		/* no kick can be running once the hook is gone */
+		sched_util_set_hook(NULL);
+		kthread_stop(sched_gov_task);
+		sched_gov_task = NULL;
+		sysfs_remove_group(cpufreq_global_kobject,
+				   &sched_gov_attr_group);
+	}
+
+	mutex_unlock(&sched_gov_life_mutex);
+}
+
+static int cpufreq_governor_sched(struct cpufreq_policy *policy,
+				  unsigned int event)
+{
+	switch (event) {
+	case CPUFREQ_GOV_START:
+		return sched_gov_start(policy);
+
+	case CPUFREQ_GOV_STOP:
+		sched_gov_stop(policy);
+		break;
+
+	case CPUFREQ_GOV_LIMITS:
+		mutex_lock(&sched_gov_mutex);
+		if (policy->max < policy->cur)
+			__cpufreq_driver_target(policy, policy->max,
+						CPUFREQ_RELATION_H);
+		else if (policy->min > policy->cur)
+			__cpufreq_driver_target(policy, policy->min,
+						CPUFREQ_RELATION_L);
+		mutex_unlock(&sched_gov_mutex);
+		break;
+	}
+	return 0;
+}
+
+static struct cpufreq_governor cpufreq_gov_sched = {
+	.name			= "sched",
+	.governor		= cpufreq_governor_sched,
+	.owner			= THIS_MODULE,
+};
+
+static int __init cpufreq_gov_sched_init(void)
+{
+	sched_gov_debugfs_init();
+	return cpufreq_register_governor(&cpufreq_gov_sched);
+}
+
+static void __exit cpufreq_gov_sched_exit(void)
+{
+	cpufreq_unregister_governor(&cpufreq_gov_sched);
+	sched_gov_debugfs_exit();
+}
+
+MODULE_DESCRIPTION("'cpufreq_sched' - cpufreq governor driven by scheduler "
+		   "utilization estimates");
+MODULE_LICENSE("GPL");
+
+module_init(cpufreq_gov_sched_init);
+module_exit(cpufreq_gov_sched_exit);
@@ -19,6 +19,9 @@
 #include <linux/kobject.h>
 #include <linux/spinlock.h>
 #include <linux/notifier.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/math64.h>
 #include <asm/cputime.h>
 
 static spinlock_t cpufreq_stats_lock;
@@ -29,6 +32,30 @@ static struct freq_attr _attr_##_name = {\
 	.show = _show,\
 };
 
+/* PRECHANGE to POSTCHANGE, mostly the driver's set-rate */
+static const unsigned int trans_lat_bounds[] = {
+	50, 100, 200, 500, 1000, 2000, 5000, 10000,	/* us */
+};
+#define TRANS_LAT_BUCKETS	(ARRAY_SIZE(trans_lat_bounds) + 1)
+
+static const char *const trans_reason_names[CPUFREQ_REASON_MAX] = {
+	[CPUFREQ_REASON_DRIVER]		= "driver",
+	[CPUFREQ_REASON_GOVERNOR]	= "governor",
+	[CPUFREQ_REASON_LIMITS]		= "limits",
+	[CPUFREQ_REASON_BOOST]		= "boost",
+};
+
+struct cpufreq_trans_hist {
+	unsigned long count;
+	u64 lat_total_ns;
+	u64 lat_max_ns;
+	unsigned long lat[TRANS_LAT_BUCKETS];
+	unsigned long reason[CPUFREQ_REASON_MAX];
+	unsigned long exact;
+	unsigned long above;
+	unsigned long below;
+};
+
 struct cpufreq_stats {
 	unsigned int cpu;
 	unsigned int total_trans;
@@ -38,9 +65,11 @@ struct cpufreq_stats {
 	unsigned int last_index;
 	cputime64_t *time_in_state;
 	unsigned int *freq_table;
+	unsigned int *req_table;	/* requested state x granted state */
 #ifdef CONFIG_CPU_FREQ_STAT_DETAILS
 	unsigned int *trans_table;
 #endif
+	struct cpufreq_trans_hist hist;
 };
 
 static DEFINE_PER_CPU(struct cpufreq_stats *, cpufreq_stats_table);
@@ -164,17 +193,37 @@ static int freq_table_get_index(struct cpufreq_stats *stat, unsigned int freq)
 	return -1;
 }
 
+/* the state a RELATION_L request for freq would end up in */
+static int freq_table_get_ceil_index(struct cpufreq_stats *stat,
+				     unsigned int freq)
+{
+	int index, best = -1, top = -1;
+
+	for (index = 0; index < stat->state_num; index++) {
+		unsigned int f = stat->freq_table[index];
+
+		if (f >= freq && (best == -1 || f < stat->freq_table[best]))
+			best = index;
+		if (top == -1 || f > stat->freq_table[top])
+			top = index;
+	}
+	return best != -1 ? best : top;
+}
+
 static void cpufreq_stats_free_table(unsigned int cpu)
 {
 	struct cpufreq_stats *stat = per_cpu(cpufreq_stats_table, cpu);
 	struct cpufreq_policy *policy = cpufreq_cpu_get(cpu);
 	if (policy && policy->cpu == cpu)
 		sysfs_remove_group(&policy->kobj, &stats_attr_group);
+	/* the debugfs reader looks at the table under the lock */
+	spin_lock(&cpufreq_stats_lock);
+	per_cpu(cpufreq_stats_table, cpu) = NULL;
+	spin_unlock(&cpufreq_stats_lock);
 	if (stat) {
 		kfree(stat->time_in_state);
 		kfree(stat);
 	}
-	per_cpu(cpufreq_stats_table, cpu) = NULL;
 	if (policy)
 		cpufreq_cpu_put(policy);
 }
@@ -214,6 +263,7 @@ static int cpufreq_stats_create_table(struct cpufreq_policy *policy,
 	}
 
 	alloc_size = count * sizeof(int) + count * sizeof(cputime64_t);
+	alloc_size += count * count * sizeof(int);
 
 #ifdef CONFIG_CPU_FREQ_STAT_DETAILS
 	alloc_size += count * count * sizeof(int);
@@ -225,9 +275,10 @@ static int cpufreq_stats_create_table(struct cpufreq_policy *policy,
 		goto error_out;
 	}
 	stat->freq_table = (unsigned int *)(stat->time_in_state + count);
+	stat->req_table = stat->freq_table + count;
 
 #ifdef CONFIG_CPU_FREQ_STAT_DETAILS
-	stat->trans_table = stat->freq_table + count;
+	stat->trans_table = stat->req_table + count * count;
 #endif
 	j = 0;
 	for (i = 0; table[i].frequency != CPUFREQ_TABLE_END; i++) {
@@ -270,6 +321,41 @@ static int cpufreq_stat_notifier_policy(struct notifier_block *nb,
 	return 0;
 }
 
+static void cpufreq_stats_record(struct cpufreq_stats *stat,
+				 struct cpufreq_freqs *freq, int new_index)
+{
+	struct cpufreq_trans_hist *hist = &stat->hist;
+	u64 ns = freq->latency_ns > 0 ? freq->latency_ns : 0;
+	unsigned int us = div_u64(ns, NSEC_PER_USEC);
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(trans_lat_bounds); i++)
+		if (us < trans_lat_bounds[i])
+			break;
+	hist->lat[i]++;
+	hist->count++;
+	hist->lat_total_ns += ns;
+	if (ns > hist->lat_max_ns)
+		hist->lat_max_ns = ns;
+
+	if (freq->reason < CPUFREQ_REASON_MAX)
+		hist->reason[freq->reason]++;
+
+	if (!freq->requested)
+		return;
+
+	if (freq->new == freq->requested)
+		hist->exact++;
+	else if (freq->new > freq->requested)
+		hist->above++;
+	else
+		hist->below++;
+
+	i = freq_table_get_ceil_index(stat, freq->requested);
+	if (i != -1 && new_index != -1)
+		stat->req_table[i * stat->max_state + new_index]++;
+}
+
 static int cpufreq_stat_notifier_trans(struct notifier_block *nb,
 		unsigned long val, void *data)
 {
@@ -288,6 +374,11 @@ static int cpufreq_stat_notifier_trans(struct notifier_block *nb,
 	new_index = freq_table_get_index(stat, freq->new);
 
 	cpufreq_stats_update(freq->cpu);
+
+	spin_lock(&cpufreq_stats_lock);
+	cpufreq_stats_record(stat, freq, new_index);
+	spin_unlock(&cpufreq_stats_lock);
+
 	if (old_index == new_index)
 		return 0;
 
@@ -336,6 +427,124 @@ static struct notifier_block notifier_trans_block = {
 	.notifier_call = cpufreq_stat_notifier_trans
 };
 
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *cpufreq_stats_debugfs;
+
+/*
+ * One block per cpu with a table, one "key: value..." line per item:
+ *
+ *   latency_hist_us: <50:n ... >=10000:n
+ *   reason: driver:n governor:n limits:n boost:n
+ *   granted: exact:n above:n below:n	(against the requested kHz)
+ *   requested_granted: req>granted:n ...	(table states, nonzero only)
+ */
+static int cpufreq_stats_trans_show(struct seq_file *m, void *unused)
+{
+	struct cpufreq_trans_hist *hist;
+	struct cpufreq_stats *stat;
+	unsigned int cpu, n;
+	int i, j;
+
+	spin_lock(&cpufreq_stats_lock);
+	for_each_possible_cpu(cpu) {
+		stat = per_cpu(cpufreq_stats_table, cpu);
+		if (!stat)
+			continue;
+		hist = &stat->hist;
+
+		seq_printf(m, "cpu: %u\ntransitions: %lu\nlatency_avg_us: %llu\n"
+			   "latency_max_us: %llu\n", cpu, hist->count,
+			   hist->count ? div_u64(div_u64(hist->lat_total_ns,
+						hist->count), NSEC_PER_USEC) : 0,
+			   div_u64(hist->lat_max_ns, NSEC_PER_USEC));
+
+		seq_printf(m, "latency_hist_us:");
+		for (i = 0; i < ARRAY_SIZE(trans_lat_bounds); i++)
+			seq_printf(m, " <%u:%lu", trans_lat_bounds[i],
+				   hist->lat[i]);
+		seq_printf(m, " >=%u:%lu\n", trans_lat_bounds[i - 1],
+			   hist->lat[i]);
+
+		seq_printf(m, "reason:");
+		for (i = 0; i < CPUFREQ_REASON_MAX; i++)
+			seq_printf(m, " %s:%lu", trans_reason_names[i],
+				   hist->reason[i]);
+		seq_printf(m, "\ngranted: exact:%lu above:%lu below:%lu\n",
+			   hist->exact, hist->above, hist->below);
+
+		seq_printf(m, "requested_granted:");
+		for (i = 0; i < stat->state_num; i++)
+			for (j = 0; j < stat->state_num; j++) {
+				n = stat->req_table[i * stat->max_state + j];
+				if (n)
+					seq_printf(m, " %u>%u:%u",
+						   stat->freq_table[i],
+						   stat->freq_table[j], n);
+			}
+		seq_printf(m, "\n\n");
+	}
+	spin_unlock(&cpufreq_stats_lock);
+
+	return 0;
+}
+
+static int cpufreq_stats_trans_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, cpufreq_stats_trans_show, NULL);
+}
+
+static const struct file_operations cpufreq_stats_trans_fops = {
+	.open		= cpufreq_stats_trans_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int cpufreq_stats_trans_reset(void *data, u64 val)
+{
+	struct cpufreq_stats *stat;
+	unsigned int cpu;
+
+	spin_lock(&cpufreq_stats_lock);
+	for_each_possible_cpu(cpu) {
+		stat = per_cpu(cpufreq_stats_table, cpu);
+		if (!stat)
+			continue;
+		memset(&stat->hist, 0, sizeof(stat->hist));
+		memset(stat->req_table, 0, stat->max_state * stat->max_state *
+		       sizeof(*stat->req_table));
+	}
+	spin_unlock(&cpufreq_stats_lock);
+
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(cpufreq_stats_trans_reset_fops, NULL,
+			cpufreq_stats_trans_reset, "%llu\n");
+
+static void cpufreq_stats_debugfs_init(void)
+{
+	struct dentry *dent;
+
+	dent = debugfs_create_dir("cpufreq_stats", NULL);
+	if (!dent || IS_ERR(dent))
+		return;
+
+	debugfs_create_file("transitions", 0444, dent, NULL,
+			    &cpufreq_stats_trans_fops);
+	debugfs_create_file("reset", 0200, dent, NULL,
+			    &cpufreq_stats_trans_reset_fops);
+	cpufreq_stats_debugfs = dent;
+}
+
+static void cpufreq_stats_debugfs_exit(void)
+{
+	debugfs_remove_recursive(cpufreq_stats_debugfs);
+}
+#else
+static inline void cpufreq_stats_debugfs_init(void) { }
+static inline void cpufreq_stats_debugfs_exit(void) { }
+#endif
+
 static int __init cpufreq_stats_init(void)
 {
 	int ret;
@@ -359,12 +568,14 @@ static int __init cpufreq_stats_init(void)
 	for_each_online_cpu(cpu) {
 		cpufreq_update_policy(cpu);
 	}
+	cpufreq_stats_debugfs_init();
 	return 0;
 }
 static void __exit cpufreq_stats_exit(void)
 {
 	unsigned int cpu;
 
+	cpufreq_stats_debugfs_exit();
 	cpufreq_unregister_notifier(&notifier_policy_block,
 			CPUFREQ_POLICY_NOTIFIER);
 	cpufreq_unregister_notifier(&notifier_trans_block,
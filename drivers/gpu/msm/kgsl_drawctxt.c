@@ -17,6 +17,10 @@
  */
 #include <linux/string.h>
 #include <linux/types.h>
+#include <linux/debugfs.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/seq_file.h>
 #include <linux/msm_kgsl.h>
 
 #include "yamato_reg.h"
@@ -1486,6 +1490,7 @@ kgsl_drawctxt_create(struct kgsl_device_private *dev_priv,
 	drawctxt->pagetable = pagetable;
 	drawctxt->flags = CTXT_FLAGS_IN_USE;
 	drawctxt->bin_base_offset = 0;
+	memset(&drawctxt->stats, 0, sizeof(drawctxt->stats));
 
 	yamato_device->drawctxt_count++;
 
@@ -1706,6 +1711,165 @@ int kgsl_drawctxt_set_bin_base_offset(struct kgsl_device *device,
 	return 0;
 }
 
+/* state moved by one register/constant save or restore */
+#define REG_STATE_BYTES		(ALU_SHADOW_SIZE + REG_SHADOW_SIZE + \
+				 TEX_SHADOW_SIZE)
+/* state moved by one shader save or restore */
+#define SHADER_STATE_BYTES	(3 * SHADER_SHADOW_SIZE)
+
+/* issue a save/restore command buffer, charging it to drawctxt */
+static void
+drawctxt_issuecmds(struct kgsl_device *device, struct kgsl_drawctxt *drawctxt,
+		   unsigned int flags, unsigned int *cmds, int sizedwords,
+		   unsigned int bytes)
+{
+	kgsl_ringbuffer_issuecmds(device, flags, cmds, sizedwords);
+	drawctxt->stats.cmds++;
+	drawctxt->stats.bytes += bytes;
+}
+
+static void
+drawctxt_save(struct kgsl_yamato_device *yamato_device,
+	      struct kgsl_drawctxt *active_ctxt)
+{
+	struct kgsl_device *device = &yamato_device->dev;
+
+	active_ctxt->stats.saves++;
+
+	/* save registers and constants. */
+	KGSL_CTXT_DBG("save regs");
+	drawctxt_issuecmds(device, active_ctxt, 0, active_ctxt->reg_save, 3,
+			   REG_STATE_BYTES);
+
+	if (active_ctxt->flags & CTXT_FLAGS_SHADER_SAVE) {
+		/* save shader partitioning and instructions. */
+		KGSL_CTXT_DBG("save shader");
+		drawctxt_issuecmds(device, active_ctxt, KGSL_CMD_FLAGS_PMODE,
+				   active_ctxt->shader_save, 3,
+				   SHADER_STATE_BYTES);
+
+		/* fixup shader partitioning parameter for
+		 *  SET_SHADER_BASES.
+		 */
+		KGSL_CTXT_DBG("save shader fixup");
+		drawctxt_issuecmds(device, active_ctxt, 0,
+				   active_ctxt->shader_fixup, 3, 0);
+
+		active_ctxt->flags |= CTXT_FLAGS_SHADER_RESTORE;
+	}
+
+#ifdef CONFIG_MSM_KGSL_FORCE_GMEM_SAVE
+	if (!(active_ctxt->flags & CTXT_FLAGS_GMEM_SAVE))
+		active_ctxt->flags |= CTXT_FLAGS_GMEM_SAVE;
+#endif
+
+	if (active_ctxt->flags & CTXT_FLAGS_GMEM_SAVE
+		&& active_ctxt->flags & CTXT_FLAGS_GMEM_SHADOW) {
+		/* save gmem.
+		 * (note: changes shader. shader must already be saved.)
+		 */
+		unsigned int i, numbuffers = 0;
+		struct gmem_shadow_t *shadow;
+
+		KGSL_CTXT_DBG("save gmem");
+		for (i = 0; i < KGSL_MAX_GMEM_SHADOW_BUFFERS; i++) {
+			shadow = &active_ctxt->user_gmem_shadow[i];
+			if (shadow->gmemshadow.size > 0) {
+				drawctxt_issuecmds(device, active_ctxt,
+					KGSL_CMD_FLAGS_PMODE,
+					shadow->gmem_save, 3, shadow->size);
+
+				/* Restore TP0_CHICKEN */
+				drawctxt_issuecmds(device, active_ctxt, 0,
+					active_ctxt->chicken_restore, 3, 0);
+
+				numbuffers++;
+			}
+		}
+		if (numbuffers == 0) {
+			shadow = &active_ctxt->context_gmem_shadow;
+			drawctxt_issuecmds(device, active_ctxt,
+				KGSL_CMD_FLAGS_PMODE,
+				shadow->gmem_save, 3, shadow->size);
+
+			/* Restore TP0_CHICKEN */
+			drawctxt_issuecmds(device, active_ctxt, 0,
+				active_ctxt->chicken_restore, 3, 0);
+		}
+
+		active_ctxt->flags |= CTXT_FLAGS_GMEM_RESTORE;
+		active_ctxt->stats.gmem_saves++;
+	}
+}
+
+static void
+drawctxt_restore(struct kgsl_yamato_device *yamato_device,
+		 struct kgsl_drawctxt *drawctxt)
+{
+	struct kgsl_device *device = &yamato_device->dev;
+	unsigned int cmds[2];
+
+	drawctxt->stats.switches++;
+
+	KGSL_CTXT_INFO("drawctxt flags %08x\n", drawctxt->flags);
+	KGSL_CTXT_DBG("restore pagetable");
+	kgsl_mmu_setstate(device, drawctxt->pagetable);
+
+	/* restore gmem.
+	 *  (note: changes shader. shader must not already be restored.)
+	 */
+	if (drawctxt->flags & CTXT_FLAGS_GMEM_RESTORE) {
+		unsigned int i, numbuffers = 0;
+		struct gmem_shadow_t *shadow;
+
+		KGSL_CTXT_DBG("restore gmem");
+		for (i = 0; i < KGSL_MAX_GMEM_SHADOW_BUFFERS; i++) {
+			shadow = &drawctxt->user_gmem_shadow[i];
+			if (shadow->gmemshadow.size > 0) {
+				drawctxt_issuecmds(device, drawctxt,
+					KGSL_CMD_FLAGS_PMODE,
+					shadow->gmem_restore, 3, shadow->size);
+
+				/* Restore TP0_CHICKEN */
+				drawctxt_issuecmds(device, drawctxt, 0,
+					drawctxt->chicken_restore, 3, 0);
+				numbuffers++;
+			}
+		}
+		if (numbuffers == 0) {
+			shadow = &drawctxt->context_gmem_shadow;
+			drawctxt_issuecmds(device, drawctxt,
+				KGSL_CMD_FLAGS_PMODE,
+				shadow->gmem_restore, 3, shadow->size);
+
+			/* Restore TP0_CHICKEN */
+			drawctxt_issuecmds(device, drawctxt, 0,
+				drawctxt->chicken_restore, 3, 0);
+		}
+		drawctxt->flags &= ~CTXT_FLAGS_GMEM_RESTORE;
+		drawctxt->stats.gmem_restores++;
+	}
+
+	/* restore registers and constants. */
+	KGSL_CTXT_DBG("restore regs");
+	drawctxt_issuecmds(device, drawctxt, 0, drawctxt->reg_restore, 3,
+			   REG_STATE_BYTES);
+
+	/* restore shader instructions & partitioning. */
+	if (drawctxt->flags & CTXT_FLAGS_SHADER_RESTORE) {
+		KGSL_CTXT_DBG("restore shader");
+		drawctxt_issuecmds(device, drawctxt, 0,
+				   drawctxt->shader_restore, 3,
+				   SHADER_STATE_BYTES);
+	}
+	drawctxt->stats.restores++;
+
+	cmds[0] = pm4_type3_packet(PM4_SET_BIN_BASE_OFFSET, 1);
+	cmds[1] = drawctxt->bin_base_offset;
+	if (device->chip_id != KGSL_CHIPID_LEIA_REV470)
+		kgsl_ringbuffer_issuecmds(device, 0, cmds, 2);
+}
+
 /* switch drawing contexts */
 void
 kgsl_drawctxt_switch(struct kgsl_yamato_device *yamato_device,
@@ -1714,7 +1878,7 @@ kgsl_drawctxt_switch(struct kgsl_yamato_device *yamato_device,
 {
 	struct kgsl_drawctxt *active_ctxt = yamato_device->drawctxt_active;
 	struct kgsl_device *device = &yamato_device->dev;
-	unsigned int cmds[2];
+	ktime_t start, end;
 
 	if (drawctxt) {
 		if (flags & KGSL_CONTEXT_SAVE_GMEM)
@@ -1732,132 +1896,115 @@ kgsl_drawctxt_switch(struct kgsl_yamato_device *yamato_device,
 	KGSL_CTXT_INFO("from %p to %p flags %d\n",
 			yamato_device->drawctxt_active, drawctxt, flags);
 	/* save old context*/
+	start = ktime_get();
 	if (active_ctxt != NULL) {
 		KGSL_CTXT_INFO("active_ctxt flags %08x\n", active_ctxt->flags);
-		/* save registers and constants. */
-		KGSL_CTXT_DBG("save regs");
-		kgsl_ringbuffer_issuecmds(device, 0, active_ctxt->reg_save, 3);
-
-		if (active_ctxt->flags & CTXT_FLAGS_SHADER_SAVE) {
-			/* save shader partitioning and instructions. */
-			KGSL_CTXT_DBG("save shader");
-			kgsl_ringbuffer_issuecmds(device, KGSL_CMD_FLAGS_PMODE,
-						  active_ctxt->shader_save, 3);
-
-			/* fixup shader partitioning parameter for
-			 *  SET_SHADER_BASES.
-			 */
-			KGSL_CTXT_DBG("save shader fixup");
-			kgsl_ringbuffer_issuecmds(device, 0,
-					active_ctxt->shader_fixup, 3);
-
-			active_ctxt->flags |= CTXT_FLAGS_SHADER_RESTORE;
-		}
-
-#ifdef CONFIG_MSM_KGSL_FORCE_GMEM_SAVE
-		if (!(active_ctxt->flags & CTXT_FLAGS_GMEM_SAVE))
-			active_ctxt->flags |= CTXT_FLAGS_GMEM_SAVE;
-#endif
-        
-		if (active_ctxt->flags & CTXT_FLAGS_GMEM_SAVE
-			&& active_ctxt->flags & CTXT_FLAGS_GMEM_SHADOW) {
-			/* save gmem.
-			 * (note: changes shader. shader must already be saved.)
-			 */
-			unsigned int i, numbuffers = 0;
-			KGSL_CTXT_DBG("save gmem");
-			for (i = 0; i < KGSL_MAX_GMEM_SHADOW_BUFFERS; i++) {
-				if (active_ctxt->user_gmem_shadow[i].gmemshadow.
-				    size > 0) {
-					kgsl_ringbuffer_issuecmds(device,
-						KGSL_CMD_FLAGS_PMODE,
-					  active_ctxt->user_gmem_shadow[i].
-						gmem_save, 3);
-
-					/* Restore TP0_CHICKEN */
-					kgsl_ringbuffer_issuecmds(device, 0,
-					  active_ctxt->chicken_restore, 3);
-
-					numbuffers++;
-				}
-			}
-			if (numbuffers == 0) {
-				kgsl_ringbuffer_issuecmds(device,
-				    KGSL_CMD_FLAGS_PMODE,
-				    active_ctxt->context_gmem_shadow.gmem_save,
-				    3);
-
-				/* Restore TP0_CHICKEN */
-				kgsl_ringbuffer_issuecmds(device, 0,
-					 active_ctxt->chicken_restore, 3);
-			}
-
-			active_ctxt->flags |= CTXT_FLAGS_GMEM_RESTORE;
-		}
+		drawctxt_save(yamato_device, active_ctxt);
+		end = ktime_get();
+		active_ctxt->stats.ns += ktime_to_ns(ktime_sub(end, start));
+		start = end;
 	}
 
 	yamato_device->drawctxt_active = drawctxt;
 
 	/* restore new context */
 	if (drawctxt != NULL) {
+		drawctxt_restore(yamato_device, drawctxt);
+		drawctxt->stats.ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	} else
+		kgsl_mmu_setstate(device, device->mmu.defaultpagetable);
 
-		KGSL_CTXT_INFO("drawctxt flags %08x\n", drawctxt->flags);
-		KGSL_CTXT_DBG("restore pagetable");
-		kgsl_mmu_setstate(device, drawctxt->pagetable);
+	KGSL_CTXT_INFO("return\n");
+}
 
-		/* restore gmem.
-		 *  (note: changes shader. shader must not already be restored.)
-		 */
-		if (drawctxt->flags & CTXT_FLAGS_GMEM_RESTORE) {
-			unsigned int i, numbuffers = 0;
-			KGSL_CTXT_DBG("restore gmem");
-
-			for (i = 0; i < KGSL_MAX_GMEM_SHADOW_BUFFERS; i++) {
-				if (drawctxt->user_gmem_shadow[i].gmemshadow.
-				    size > 0) {
-					kgsl_ringbuffer_issuecmds(device,
-						KGSL_CMD_FLAGS_PMODE,
-					  drawctxt->user_gmem_shadow[i].
-						gmem_restore, 3);
-
-					/* Restore TP0_CHICKEN */
-					kgsl_ringbuffer_issuecmds(device, 0,
-					  drawctxt->chicken_restore, 3);
-					numbuffers++;
-				}
-			}
-			if (numbuffers == 0) {
-				kgsl_ringbuffer_issuecmds(device,
-					KGSL_CMD_FLAGS_PMODE,
-				  drawctxt->context_gmem_shadow.gmem_restore,
-					3);
+#ifdef CONFIG_DEBUG_FS
+static int kgsl_drawctxt_stats_show(struct seq_file *s, void *unused)
+{
+	struct kgsl_yamato_device *yamato_device = (struct kgsl_yamato_device *)
+					kgsl_get_yamato_generic_device();
+	struct kgsl_drawctxt_stats *st;
+	unsigned int i, nr;
+
+	seq_printf(s, "%3s %8s %8s %8s %8s %8s %8s %12s %8s\n",
+		   "id", "switches", "saves", "restores", "gmem_sav",
+		   "gmem_rst", "cmds", "bytes", "avg_us");
+
+	mutex_lock(&kgsl_driver.mutex);
+	for (i = 0; i < KGSL_CONTEXT_MAX; i++) {
+		if (yamato_device->drawctxt[i].flags == CTXT_FLAGS_NOT_IN_USE)
+			continue;
+		st = &yamato_device->drawctxt[i].stats;
+		nr = st->saves + st->switches;
+		seq_printf(s, "%3u %8u %8u %8u %8u %8u %8u %12llu %8llu\n",
+			   i, st->switches, st->saves, st->restores,
+			   st->gmem_saves, st->gmem_restores, st->cmds,
+			   st->bytes, nr ? div_u64(div_u64(st->ns, nr), 1000)
+			   : 0);
+	}
+	mutex_unlock(&kgsl_driver.mutex);
 
-				/* Restore TP0_CHICKEN */
-				kgsl_ringbuffer_issuecmds(device, 0,
-				  drawctxt->chicken_restore, 3);
-			}
-			drawctxt->flags &= ~CTXT_FLAGS_GMEM_RESTORE;
-		}
+	return 0;
+}
 
-		/* restore registers and constants. */
-		KGSL_CTXT_DBG("restore regs");
-		kgsl_ringbuffer_issuecmds(device, 0,
-					  drawctxt->reg_restore, 3);
+static int kgsl_drawctxt_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, kgsl_drawctxt_stats_show, NULL);
+}
+
+static const struct file_operations kgsl_drawctxt_stats_fops = {
+	.open		= kgsl_drawctxt_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
 
-		/* restore shader instructions & partitioning. */
-		if (drawctxt->flags & CTXT_FLAGS_SHADER_RESTORE) {
-			KGSL_CTXT_DBG("restore shader");
-			kgsl_ringbuffer_issuecmds(device, 0,
-					  drawctxt->shader_restore, 3);
+static int kgsl_drawctxt_submit_show(struct seq_file *s, void *unused)
+{
+	struct kgsl_yamato_device *yamato_device = (struct kgsl_yamato_device *)
+					kgsl_get_yamato_generic_device();
+	struct kgsl_drawctxt_stats *st;
+	unsigned int i;
+
+	seq_printf(s, "%3s %8s %8s %8s %9s %9s\n", "id", "submits",
+		   "avg_us", "max_us", "avg_depth", "max_depth");
+
+	mutex_lock(&kgsl_driver.mutex);
+	for (i = 0; i < KGSL_CONTEXT_MAX; i++) {
+		if (yamato_device->drawctxt[i].flags == CTXT_FLAGS_NOT_IN_USE)
+			continue;
+		st = &yamato_device->drawctxt[i].stats;
+		if (!st->submits) {
+			seq_printf(s, "%3u %8u\n", i, 0);
+			continue;
 		}
+		seq_printf(s, "%3u %8u %8llu %8u %9llu %9u\n", i, st->submits,
+			   div_u64(div_u64(st->submit_ns, st->submits), 1000),
+			   st->submit_max_ns / 1000,
+			   div_u64(st->depth_total, st->submits),
+			   st->depth_max);
+	}
+	mutex_unlock(&kgsl_driver.mutex);
 
-		cmds[0] = pm4_type3_packet(PM4_SET_BIN_BASE_OFFSET, 1);
-		cmds[1] = drawctxt->bin_base_offset;
-		if (device->chip_id != KGSL_CHIPID_LEIA_REV470)
-			kgsl_ringbuffer_issuecmds(device, 0, cmds, 2);
+	return 0;
+}
 
-	} else
-		kgsl_mmu_setstate(device, device->mmu.defaultpagetable);
+static int kgsl_drawctxt_submit_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, kgsl_drawctxt_submit_show, NULL);
+}
 
-	KGSL_CTXT_INFO("return\n");
+static const struct file_operations kgsl_drawctxt_submit_fops = {
+	.open		= kgsl_drawctxt_submit_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+void kgsl_drawctxt_debugfs_init(struct dentry *dent)
+{
+	debugfs_create_file("ctxt_switch_stats", 0444, dent, 0,
+				&kgsl_drawctxt_stats_fops);
+	debugfs_create_file("ctxt_submit_stats", 0444, dent, 0,
+				&kgsl_drawctxt_submit_fops);
 }
+#endif /* CONFIG_DEBUG_FS */
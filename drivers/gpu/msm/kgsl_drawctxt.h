@@ -53,6 +53,7 @@
 
 #define KGSL_MAX_GMEM_SHADOW_BUFFERS	2
 
+struct dentry;
 struct kgsl_device;
 struct kgsl_yamato_device;
 struct kgsl_device_private;
@@ -86,6 +87,24 @@ struct gmem_shadow_t {
 	struct kgsl_memdesc quad_texcoords;
 };
 
+/* context switch and submission cost, reported in debugfs */
+struct kgsl_drawctxt_stats {
+	unsigned int switches;		/* times switched in */
+	unsigned int saves;		/* state saved on switch out */
+	unsigned int restores;		/* state restored on switch in */
+	unsigned int gmem_saves;
+	unsigned int gmem_restores;
+	unsigned int cmds;		/* command buffers issued */
+	uint64_t bytes;			/* state copied by those commands */
+	uint64_t ns;			/* time spent issuing them */
+	/* IB submission, see kgsl_ringbuffer_issueibcmds() */
+	unsigned int submits;
+	unsigned int submit_max_ns;	/* ioctl entry to doorbell */
+	uint64_t submit_ns;
+	unsigned int depth_max;		/* timestamps in flight */
+	uint64_t depth_total;
+};
+
 struct kgsl_drawctxt {
 	uint32_t         flags;
 	struct kgsl_pagetable *pagetable;
@@ -101,6 +120,7 @@ struct kgsl_drawctxt {
 	struct gmem_shadow_t context_gmem_shadow;
 	/* User defined GMEM shadow buffers */
 	struct gmem_shadow_t user_gmem_shadow[KGSL_MAX_GMEM_SHADOW_BUFFERS];
+	struct kgsl_drawctxt_stats stats;
 };
 
 
@@ -129,4 +149,6 @@ int kgsl_drawctxt_set_bin_base_offset(struct kgsl_device *device,
 					unsigned int drawctxt_id,
 					unsigned int offset);
 
+void kgsl_drawctxt_debugfs_init(struct dentry *dent);
+
 #endif  /* __GSL_DRAWCTXT_H */
@@ -19,6 +19,8 @@
 #include "kgsl_log.h"
 #include "kgsl_device.h"
 #include "kgsl.h"
+#include "kgsl_drawctxt.h"
+#include "kgsl_ringbuffer.h"
 
 /*default log levels is error for everything*/
 #define KGSL_LOG_LEVEL_DEFAULT 3
@@ -136,6 +138,9 @@ int kgsl_debug_init(void)
 				&kgsl_cache_enable_fops);
 #endif
 
+	kgsl_drawctxt_debugfs_init(dent);
+	kgsl_ringbuffer_debugfs_init(dent);
+
 #endif /* CONFIG_DEBUG_FS */
 	return 0;
 }
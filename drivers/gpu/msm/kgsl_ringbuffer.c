@@ -15,9 +15,13 @@
  * 02110-1301, USA.
  *
  */
+#include <linux/debugfs.h>
 #include <linux/firmware.h>
+#include <linux/hrtimer.h>
 #include <linux/io.h>
+#include <linux/math64.h>
 #include <linux/sched.h>
+#include <linux/seq_file.h>
 #include <linux/wait.h>
 
 #include "kgsl.h"
@@ -32,6 +36,10 @@
 
 #define VALID_STATUS_COUNT_MAX	10
 #define GSL_RB_NOP_SIZEDWORDS				2
+/* recheck ring space this often in case a CP interrupt is missed */
+#define GSL_RB_SPACE_WAIT_MS			1
+/* the CP is taken to be hung if it frees no space for this long */
+#define GSL_RB_SPACE_TIMEOUT_MS			2000
 /* protected mode error checking below register address 0x800
 *  note: if CP_INTERRUPT packet is used then checking needs
 *  to change to below register address 0x7C8
@@ -96,7 +104,7 @@ void kgsl_cp_intrcallback(struct kgsl_device *device)
 			 * did not ack any interrupts this interrupt will
 			 * be generated again */
 			KGSL_DRV_WARN("Unable to read CP_INT_STATUS\n");
-			wake_up_interruptible_all(&yamato_device->ib1_wq);
+			wake_up_all(&yamato_device->ib1_wq);
 		} else
 			KGSL_DRV_WARN("Spurious interrput detected\n");
 		return;
@@ -152,7 +160,7 @@ void kgsl_cp_intrcallback(struct kgsl_device *device)
 
 	if (status & (CP_INT_CNTL__IB1_INT_MASK | CP_INT_CNTL__RB_INT_MASK)) {
 		KGSL_CMD_WARN("ringbuffer ib1/rb interrupt\n");
-		wake_up_interruptible_all(&yamato_device->ib1_wq);
+		wake_up_all(&yamato_device->ib1_wq);
 		atomic_notifier_call_chain(&(device->ts_notifier_list),
 					   KGSL_DEVICE_YAMATO,
 					   NULL);
@@ -220,6 +228,124 @@ static void kgsl_ringbuffer_submit(struct kgsl_ringbuffer *rb)
 	kgsl_yamato_regwrite(rb->device, REG_CP_RB_WPTR, rb->wptr);
 
 	rb->flags |= KGSL_FLAGS_ACTIVE;
+	rb->submit_pending = 0;
+	GSL_RB_STATS(rb->stats.doorbells++);
+}
+
+/* Defer CP_RB_WPTR writes until the matching kgsl_ringbuffer_batch_end().
+ * Caller must hold the driver mutex across the whole batch.
+ */
+void kgsl_ringbuffer_batch_begin(struct kgsl_ringbuffer *rb)
+{
+	rb->batch++;
+}
+
+void kgsl_ringbuffer_batch_end(struct kgsl_ringbuffer *rb)
+{
+	BUG_ON(rb->batch == 0);
+
+	if (--rb->batch == 0)
+		kgsl_ringbuffer_flush(rb);
+}
+
+/* ring the doorbell for anything written but not yet submitted */
+void kgsl_ringbuffer_flush(struct kgsl_ringbuffer *rb)
+{
+	if (rb->submit_pending)
+		kgsl_ringbuffer_submit(rb);
+}
+
+static int kgsl_ringbuffer_hasspace(struct kgsl_ringbuffer *rb,
+				    unsigned int numcmds)
+{
+	unsigned int freecmds;
+
+	GSL_RB_GET_READPTR(rb, &rb->rptr);
+	freecmds = rb->rptr - rb->wptr;
+
+	return freecmds == 0 || freecmds > numcmds;
+}
+
+static int kgsl_ringbuffer_rptr_moved(struct kgsl_ringbuffer *rb,
+				      unsigned int numcmds)
+{
+	GSL_RB_GET_READPTR(rb, &rb->rptr);
+
+	return rb->rptr != 0;
+}
+
+/* Ask for an RB interrupt when the next timestamp retires. Every batch ends
+ * in a COND_EXEC against ref_wait_ts, so any batch still queued behind it
+ * will raise the interrupt.
+ */
+static void kgsl_ringbuffer_arm_interrupt(struct kgsl_ringbuffer *rb)
+{
+	struct kgsl_device *device = rb->device;
+	unsigned int timestamp, ref_ts, enableflag;
+
+	KGSL_CMDSTREAM_GET_EOP_TIMESTAMP(device, &timestamp);
+	timestamp++;
+
+	kgsl_sharedmem_readl(&device->memstore, &enableflag,
+		KGSL_DEVICE_MEMSTORE_OFFSET(ts_cmp_enable));
+	rmb();
+
+	if (enableflag) {
+		kgsl_sharedmem_readl(&device->memstore, &ref_ts,
+			KGSL_DEVICE_MEMSTORE_OFFSET(ref_wait_ts));
+		rmb();
+		if (!timestamp_cmp(ref_ts, timestamp))
+			return;
+	}
+
+	kgsl_sharedmem_writel(&device->memstore,
+		KGSL_DEVICE_MEMSTORE_OFFSET(ref_wait_ts), timestamp);
+	enableflag = 1;
+	kgsl_sharedmem_writel(&device->memstore,
+		KGSL_DEVICE_MEMSTORE_OFFSET(ts_cmp_enable), enableflag);
+	wmb();
+}
+
+/* Sleep on the CP interrupt until ready() holds. The driver mutex stays
+ * held; nothing else may write the ring while it is being waited on, so
+ * give up with -ETIMEDOUT after GSL_RB_SPACE_TIMEOUT_MS and report the
+ * hang the way a timed out timestamp wait does.
+ */
+static int
+kgsl_ringbuffer_sleep(struct kgsl_ringbuffer *rb, unsigned int numcmds,
+		      int (*ready)(struct kgsl_ringbuffer *, unsigned int))
+{
+	struct kgsl_yamato_device *yamato_device =
+				(struct kgsl_yamato_device *)rb->device;
+	unsigned long timeout;
+	ktime_t start;
+	int done;
+
+	if (ready(rb, numcmds))
+		return 0;
+
+	start = ktime_get();
+	timeout = jiffies + msecs_to_jiffies(GSL_RB_SPACE_TIMEOUT_MS);
+	do {
+		kgsl_ringbuffer_arm_interrupt(rb);
+		wait_event_timeout(yamato_device->ib1_wq, ready(rb, numcmds),
+				   msecs_to_jiffies(GSL_RB_SPACE_WAIT_MS));
+		done = ready(rb, numcmds);
+	} while (!done && time_before(jiffies, timeout));
+
+	GSL_RB_STATS(rb->stats.space_waits++);
+	GSL_RB_STATS(rb->stats.space_wait_ns +=
+			ktime_to_ns(ktime_sub(ktime_get(), start)));
+
+	if (!done) {
+		KGSL_CMD_ERR("no ringbuffer space for %d dwords after %d ms, "
+			     "rptr %d wptr %d\n", numcmds,
+			     GSL_RB_SPACE_TIMEOUT_MS, rb->rptr, rb->wptr);
+		kgsl_register_dump(rb->device);
+		kgsl_ringbuffer_dump(rb);
+		return -ETIMEDOUT;
+	}
+	return 0;
 }
 
 static int
@@ -227,12 +353,15 @@ kgsl_ringbuffer_waitspace(struct kgsl_ringbuffer *rb, unsigned int numcmds,
 			  int wptr_ahead)
 {
 	int nopcount;
-	unsigned int freecmds;
 	unsigned int *cmds;
+	int status;
 
 	KGSL_CMD_VDBG("enter (rb=%p, numcmds=%d, wptr_ahead=%d)\n",
 		      rb, numcmds, wptr_ahead);
 
+	/* the CP can only free space it has been told about */
+	kgsl_ringbuffer_flush(rb);
+
 	/* if wptr ahead, fill the remaining with NOPs */
 	if (wptr_ahead) {
 		/* -1 for header */
@@ -245,9 +374,10 @@ kgsl_ringbuffer_waitspace(struct kgsl_ringbuffer *rb, unsigned int numcmds,
 		 * commands at the end of ringbuffer. We do not
 		 * want the rptr and wptr to become equal when
 		 * the ringbuffer is not empty */
-		do {
-			GSL_RB_GET_READPTR(rb, &rb->rptr);
-		} while (!rb->rptr);
+		status = kgsl_ringbuffer_sleep(rb, 0,
+					       kgsl_ringbuffer_rptr_moved);
+		if (status)
+			goto done;
 
 		rb->wptr++;
 
@@ -257,16 +387,12 @@ kgsl_ringbuffer_waitspace(struct kgsl_ringbuffer *rb, unsigned int numcmds,
 	}
 
 	/* wait for space in ringbuffer */
-	do {
-		GSL_RB_GET_READPTR(rb, &rb->rptr);
-
-		freecmds = rb->rptr - rb->wptr;
-
-	} while ((freecmds != 0) && (freecmds <= numcmds));
+	status = kgsl_ringbuffer_sleep(rb, numcmds, kgsl_ringbuffer_hasspace);
 
-	KGSL_CMD_VDBG("return %d\n", 0);
+done:
+	KGSL_CMD_VDBG("return %d\n", status);
 
-	return 0;
+	return status;
 }
 
 
@@ -291,7 +417,7 @@ static unsigned int *kgsl_ringbuffer_allocspace(struct kgsl_ringbuffer *rb,
 			status  = kgsl_ringbuffer_waitspace(rb, numcmds, 0);
 		/* check for remaining space */
 		/* reserve dwords for nop packet */
-		if ((rb->wptr + numcmds) > (rb->sizedwords -
+		if (status == 0 && (rb->wptr + numcmds) > (rb->sizedwords -
 				GSL_RB_NOP_SIZEDWORDS))
 			status = kgsl_ringbuffer_waitspace(rb, numcmds, 1);
 	}
@@ -482,6 +608,8 @@ int kgsl_ringbuffer_start(struct kgsl_ringbuffer *rb)
 
 	rb->rptr = 0;
 	rb->wptr = 0;
+	rb->batch = 0;
+	rb->submit_pending = 0;
 
 	rb->timestamp = 0;
 	GSL_RB_INIT_TIMESTAMP(rb);
@@ -625,13 +753,12 @@ int kgsl_ringbuffer_close(struct kgsl_ringbuffer *rb)
 	return 0;
 }
 
-static uint32_t
+static int
 kgsl_ringbuffer_addcmds(struct kgsl_ringbuffer *rb,
 				unsigned int flags, unsigned int *cmds,
-				int sizedwords)
+				int sizedwords, uint32_t *timestamp)
 {
 	unsigned int *ringcmds;
-	unsigned int timestamp;
 	unsigned int total_sizedwords = sizedwords + 6;
 	unsigned int i;
 
@@ -642,6 +769,8 @@ kgsl_ringbuffer_addcmds(struct kgsl_ringbuffer *rb,
 	total_sizedwords += !(flags & KGSL_CMD_FLAGS_NO_TS_CMP) ? 9 : 0;
 
 	ringcmds = kgsl_ringbuffer_allocspace(rb, total_sizedwords);
+	if (ringcmds == NULL)
+		return -ETIMEDOUT;
 
 	if (flags & KGSL_CMD_FLAGS_PMODE) {
 		/* disable protected mode error checking */
@@ -663,7 +792,7 @@ kgsl_ringbuffer_addcmds(struct kgsl_ringbuffer *rb,
 	}
 
 	rb->timestamp++;
-	timestamp = rb->timestamp;
+	*timestamp = rb->timestamp;
 
 	/* start-of-pipeline and end-of-pipeline timestamps */
 	GSL_RB_WRITE(ringcmds, pm4_type0_packet(REG_CP_TIMESTAMP, 1));
@@ -692,15 +821,19 @@ kgsl_ringbuffer_addcmds(struct kgsl_ringbuffer *rb,
 		GSL_RB_WRITE(ringcmds, CP_INT_CNTL__RB_INT_MASK);
 	}
 
-	kgsl_ringbuffer_submit(rb);
+	if (rb->batch) {
+		if (rb->submit_pending)
+			GSL_RB_STATS(rb->stats.coalesced++);
+		rb->submit_pending = 1;
+	} else
+		kgsl_ringbuffer_submit(rb);
 
 	GSL_RB_STATS(rb->stats.words_total += sizedwords);
 	GSL_RB_STATS(rb->stats.issues++);
 
-	KGSL_CMD_VDBG("return %d\n", timestamp);
+	KGSL_CMD_VDBG("return %d\n", *timestamp);
 
-	/* return timestamp of issued coREG_ands */
-	return timestamp;
+	return 0;
 }
 
 uint32_t
@@ -715,7 +848,9 @@ kgsl_ringbuffer_issuecmds(struct kgsl_device *device,
 	KGSL_CMD_VDBG("enter (device->id=%d, flags=%d, cmds=%p, "
 		"sizedwords=%d)\n", device->id, flags, cmds, sizedwords);
 
-	timestamp = kgsl_ringbuffer_addcmds(rb, flags, cmds, sizedwords);
+	/* on failure the commands are dropped, hand back the last ones */
+	if (kgsl_ringbuffer_addcmds(rb, flags, cmds, sizedwords, &timestamp))
+		timestamp = rb->timestamp;
 
 	KGSL_CMD_VDBG("return %d\n)", timestamp);
 	return timestamp;
@@ -733,6 +868,11 @@ kgsl_ringbuffer_issueibcmds(struct kgsl_device_private *dev_priv,
 	struct kgsl_device *device = dev_priv->device;
 	struct kgsl_yamato_device *yamato_device = (struct kgsl_yamato_device *)
 							device;
+	struct kgsl_ringbuffer *rb = &device->ringbuffer;
+	struct kgsl_drawctxt_stats *stats;
+	unsigned int eoptimestamp, depth, ns;
+	ktime_t start = ktime_get();
+	int status;
 
 	KGSL_CMD_VDBG("enter (device_id=%d, drawctxt_index=%d, ibaddr=0x%08x,"
 			" sizedwords=%d, timestamp=%p)\n",
@@ -753,13 +893,34 @@ kgsl_ringbuffer_issueibcmds(struct kgsl_device_private *dev_priv,
 	link[1] = ibaddr;
 	link[2] = sizedwords;
 
+	/* pagetable update, context switch and IB go out on one doorbell */
+	kgsl_ringbuffer_batch_begin(rb);
+
 	kgsl_setstate(device, device->mmu.tlb_flags);
 
 	kgsl_drawctxt_switch(yamato_device,
 			&yamato_device->drawctxt[drawctxt_index], flags);
 
-	*timestamp = kgsl_ringbuffer_addcmds(&device->ringbuffer,
-					0, &link[0], 3);
+	status = kgsl_ringbuffer_addcmds(rb, 0, &link[0], 3, timestamp);
+
+	kgsl_ringbuffer_batch_end(rb);
+
+	if (status) {
+		KGSL_CMD_VDBG("return %d\n", status);
+		return status;
+	}
+
+	/* submissions still in flight, this one included */
+	KGSL_CMDSTREAM_GET_EOP_TIMESTAMP(device, &eoptimestamp);
+	depth = *timestamp - eoptimestamp;
+	ns = (unsigned int)ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	stats = &yamato_device->drawctxt[drawctxt_index].stats;
+	stats->submits++;
+	stats->submit_ns += ns;
+	stats->submit_max_ns = max(stats->submit_max_ns, ns);
+	stats->depth_total += depth;
+	stats->depth_max = max(stats->depth_max, depth);
 
 
 	KGSL_CMD_INFO("ctxt %d g %08x sd %d ts %d\n",
@@ -770,6 +931,49 @@ kgsl_ringbuffer_issueibcmds(struct kgsl_device_private *dev_priv,
 	return 0;
 }
 
+#if defined(CONFIG_DEBUG_FS) && defined(GSL_STATS_RINGBUFFER)
+static int kgsl_ringbuffer_stats_show(struct seq_file *s, void *unused)
+{
+	struct kgsl_device *device = kgsl_get_yamato_generic_device();
+	struct kgsl_rbstats stats;
+
+	mutex_lock(&kgsl_driver.mutex);
+	stats = device->ringbuffer.stats;
+	mutex_unlock(&kgsl_driver.mutex);
+
+	seq_printf(s, "issues: %lld\n", stats.issues);
+	seq_printf(s, "words: %lld\n", stats.words_total);
+	seq_printf(s, "doorbells: %lld\n", stats.doorbells);
+	seq_printf(s, "coalesced: %lld\n", stats.coalesced);
+	seq_printf(s, "space_waits: %lld\n", stats.space_waits);
+	seq_printf(s, "space_wait_us: %llu\n",
+		   div_u64(stats.space_wait_ns, 1000));
+	return 0;
+}
+
+static int kgsl_ringbuffer_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, kgsl_ringbuffer_stats_show, NULL);
+}
+
+static const struct file_operations kgsl_ringbuffer_stats_fops = {
+	.open		= kgsl_ringbuffer_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+void kgsl_ringbuffer_debugfs_init(struct dentry *dent)
+{
+	debugfs_create_file("rb_stats", 0444, dent, 0,
+				&kgsl_ringbuffer_stats_fops);
+}
+#else
+void kgsl_ringbuffer_debugfs_init(struct dentry *dent)
+{
+}
+#endif
+
 #ifdef DEBUG
 void kgsl_ringbuffer_debug(struct kgsl_ringbuffer *rb,
 				struct kgsl_rb_debug *rb_debug)
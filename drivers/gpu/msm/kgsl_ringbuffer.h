@@ -70,6 +70,7 @@ static const unsigned int kgsl_cfg_rb_blksizequadwords  = GSL_RB_SIZE_16;
 #define	REG_CP_TIMESTAMP		 REG_SCRATCH_REG0
 
 
+struct dentry;
 struct kgsl_device;
 struct kgsl_device_private;
 struct kgsl_drawctxt;
@@ -146,6 +147,10 @@ struct kgsl_rbmemptrs {
 struct kgsl_rbstats {
 	int64_t issues;
 	int64_t words_total;
+	int64_t doorbells;	/* CP_RB_WPTR writes */
+	int64_t coalesced;	/* batches that shared a doorbell */
+	int64_t space_waits;	/* sleeps waiting for ring space */
+	int64_t space_wait_ns;
 };
 
 
@@ -166,6 +171,12 @@ struct kgsl_ringbuffer {
 	unsigned int rptr; /* read pointer offset in dwords from baseaddr */
 	uint32_t timestamp;
 
+	/* while batch is non zero, writes to CP_RB_WPTR are deferred until
+	 * kgsl_ringbuffer_batch_end() so that one doorbell covers them all
+	 */
+	unsigned int batch;
+	unsigned int submit_pending;
+
 	/* queue of memfrees pending timestamp elapse */
 	struct list_head memqueue;
 
@@ -256,6 +267,14 @@ uint32_t kgsl_ringbuffer_issuecmds(struct kgsl_device *device,
 					unsigned int *cmdaddr,
 					int sizedwords);
 
+void kgsl_ringbuffer_batch_begin(struct kgsl_ringbuffer *rb);
+
+void kgsl_ringbuffer_batch_end(struct kgsl_ringbuffer *rb);
+
+void kgsl_ringbuffer_flush(struct kgsl_ringbuffer *rb);
+
+void kgsl_ringbuffer_debugfs_init(struct dentry *dent);
+
 int kgsl_ringbuffer_gettimestampshadow(struct kgsl_device *device,
 					unsigned int *sopaddr,
 					unsigned int *eopaddr);
@@ -66,7 +66,7 @@ static int kgsl_yamato_stop(struct kgsl_device *device);
 static int kgsl_yamato_sleep(struct kgsl_device *device, const int idle);
 
 
-static void kgsl_register_dump(struct kgsl_device *device)
+void kgsl_register_dump(struct kgsl_device *device)
 {
 	if (kgsl_cmd_log >= 3) {
 		unsigned int reg_value;
@@ -907,6 +907,7 @@ int kgsl_yamato_idle(struct kgsl_device *device, unsigned int timeout)
 	 * the ring buffer
 	 */
 	if (rb->flags & KGSL_FLAGS_STARTED) {
+		kgsl_ringbuffer_flush(rb);
 		do {
 			idle_count++;
 			GSL_RB_GET_READPTR(rb, &rb->rptr);
@@ -53,6 +53,7 @@ int __init kgsl_yamato_init(struct kgsl_device *device,
 int kgsl_yamato_close(struct kgsl_device *device);
 
 int kgsl_yamato_idle(struct kgsl_device *device, unsigned int timeout);
+void kgsl_register_dump(struct kgsl_device *device);
 int kgsl_yamato_regread(struct kgsl_device *device, unsigned int offsetwords,
 				unsigned int *value);
 int kgsl_yamato_regwrite(struct kgsl_device *device, unsigned int offsetwords,
@@ -22,6 +22,7 @@
 #include <linux/poll.h>
 #include <linux/wait.h>
 #include <linux/shmem_fs.h>
+#include <linux/uaccess.h>
 
 #include <asm/atomic.h>
 
@@ -36,6 +37,8 @@
 struct memnotify_file_info {
 	unsigned long	 last_memnotify;
 	int		 last_threshold;
+	int		 last_predicted;
+	unsigned long	 subscribed;	/* MEMNOTIFY_SUBSCRIBE_* mask */
 
 	struct file		*file;
 };
@@ -83,6 +86,64 @@ static atomic_t memnotify_last_threshold = ATOMIC_INIT(THRESHOLD_NORMAL);
 static atomic_long_t memnotify_last_report =
 						ATOMIC_LONG_INIT(INITIAL_JIFFIES);
 
+/** 
+* @brief Threshold we expect to reach within predict_ms, see
+* memnotify_update_trend(). Never below the current threshold.
+*/
+static atomic_t memnotify_predicted = ATOMIC_INIT(THRESHOLD_NORMAL);
+
+/* Trend estimator tunables */
+static uint32_t memnotify_sample_ms = 250;
+static uint32_t memnotify_predict_ms = 2000;	/* 0 disables prediction */
+static uint32_t memnotify_reclaim_alert = 2048;	/* pages/s, 0 = off */
+static uint32_t memnotify_fault_alert = 500;	/* major faults/s, 0 = off */
+
+/* Weight of the old value in the moving averages, out of 8 */
+#define TREND_EWMA_OLD	6
+
+/** 
+* @brief Moving averages of how fast memory is being used up.
+* Updated at most every sample_ms under memnotify_trend_lock.
+*/
+struct memnotify_trend {
+	unsigned long	last_sample;	/* jiffies */
+	unsigned long	last_used;
+	unsigned long	last_swap_used;
+	unsigned long	last_reclaimed;
+	unsigned long	last_faults;
+
+	long		used_rate;	/* pages/s, may be negative */
+	long		swap_rate;	/* swap (ramzswap) fill, pages/s */
+	long		reclaim_rate;	/* pages reclaimed/s */
+	long		fault_rate;	/* major faults/s */
+};
+
+static struct memnotify_trend memnotify_trend = {
+	.last_sample = INITIAL_JIFFIES,
+};
+static DEFINE_SPINLOCK(memnotify_trend_lock);
+
+/** 
+* @brief Log of threshold crossings, actual and predicted, for tuning.
+*/
+#define MEMNOTIFY_TRACE_SIZE	64
+
+struct memnotify_trace_entry {
+	unsigned long	time;		/* jiffies */
+	unsigned char	from;
+	unsigned char	to;
+	unsigned char	predicted;
+	unsigned char	used_ratio;
+	long		used_rate;
+	long		swap_rate;
+	long		reclaim_rate;
+	long		fault_rate;
+};
+
+static struct memnotify_trace_entry memnotify_trace[MEMNOTIFY_TRACE_SIZE];
+static unsigned int memnotify_trace_next;	/* total entries logged */
+static DEFINE_SPINLOCK(memnotify_trace_lock);
+
 /** 
 * @brief Thresholds are % used of (TOTAL_MEM + TOTAL_SWAP)
 */
@@ -117,6 +178,46 @@ module_param_array_named(thresholds_leave,
 module_param_named(debug_level,
 	memnotify_debug_level, uint, S_IRUGO | S_IWUSR);
 
+module_param_named(sample_ms,
+	memnotify_sample_ms, uint, S_IRUGO | S_IWUSR);
+
+module_param_named(predict_ms,
+	memnotify_predict_ms, uint, S_IRUGO | S_IWUSR);
+
+module_param_named(reclaim_alert,
+	memnotify_reclaim_alert, uint, S_IRUGO | S_IWUSR);
+
+module_param_named(fault_alert,
+	memnotify_fault_alert, uint, S_IRUGO | S_IWUSR);
+
+/** 
+* @brief Record a threshold crossing in the trace log.
+* 
+* @param  from 
+* @param  to 
+* @param  predicted	crossing of the predicted threshold
+* @param  used_ratio 
+*/
+static void memnotify_trace_crossing(int from, int to, int predicted,
+		int used_ratio)
+{
+	struct memnotify_trace_entry *e;
+	unsigned long flags;
+
+	spin_lock_irqsave(&memnotify_trace_lock, flags);
+	e = &memnotify_trace[memnotify_trace_next++ % MEMNOTIFY_TRACE_SIZE];
+	e->time = jiffies;
+	e->from = from;
+	e->to = to;
+	e->predicted = predicted;
+	e->used_ratio = used_ratio;
+	e->used_rate = memnotify_trend.used_rate;
+	e->swap_rate = memnotify_trend.swap_rate;
+	e->reclaim_rate = memnotify_trend.reclaim_rate;
+	e->fault_rate = memnotify_trend.fault_rate;
+	spin_unlock_irqrestore(&memnotify_trace_lock, flags);
+}
+
 /** 
 * @brief Wakes up low-memory watchers if state changed.
 * 
@@ -159,6 +260,7 @@ static int memory_pressure_notify(unsigned long used, int used_ratio, int thresh
 
 	atomic_long_set(&memnotify_last_report, now);
 	atomic_set(&memnotify_last_threshold, threshold);
+	memnotify_trace_crossing(last_threshold, threshold, 0, used_ratio);
 
 	wake_up_interruptible_all(&memnotify_wait);
 	return 0;
@@ -211,6 +313,147 @@ unsigned long memnotify_get_used(void)
 	return used_mem;
 }
 
+/** 
+* @brief Threshold entered at a given used ratio.
+*/
+static int memnotify_ratio_threshold(int used_ratio)
+{
+	int i;
+
+	for(i = memnotify_messages_size - 1; i >= 0; i--) {
+		if(used_ratio > memnotify_enter_thresholds[i])
+			return i;
+	}
+	return THRESHOLD_NORMAL;
+}
+
+/** 
+* @brief Sum of vm event counters first..last over all cpus.
+* This may be called from atomic context so we cannot use
+* all_vm_events().
+*/
+static unsigned long memnotify_sum_events(int first, int last)
+{
+	unsigned long sum = 0;
+#ifdef CONFIG_VM_EVENT_COUNTERS
+	int cpu, i;
+
+	for_each_online_cpu(cpu) {
+		struct vm_event_state *this = &per_cpu(vm_event_states, cpu);
+
+		for (i = first; i <= last; i++)
+			sum += this->event[i];
+	}
+#endif
+	return sum;
+}
+
+static long memnotify_ewma(long avg, long sample)
+{
+	return (avg * TREND_EWMA_OLD + sample * (8 - TREND_EWMA_OLD)) / 8;
+}
+
+/** 
+* @brief Update the pressure trend and the predicted threshold.
+*
+* Samples the growth of used memory and of swap (on our devices swap is
+* ramzswap, so swap filling up means compressed RAM filling up), the
+* page reclaim rate and the major fault rate. Used memory growth is
+* extrapolated predict_ms ahead and looked up in the enter thresholds.
+* Heavy reclaim or faulting raises the prediction one level above the
+* current threshold, and swap running out within predict_ms raises it
+* to at least low.
+* 
+* @param  used		current used pages
+* @param  threshold	current threshold
+*/
+static void memnotify_update_trend(unsigned long used, int threshold)
+{
+	struct memnotify_trend *t = &memnotify_trend;
+	unsigned long now = jiffies;
+	unsigned long total = totalram_pages + total_swap_pages;
+	unsigned long swap_used, reclaimed, faults, dt, flags;
+	long horizon_pages;
+	int predicted, last_predicted, used_ratio;
+
+	if (!memnotify_predict_ms) {
+		predicted = threshold;
+		goto update;
+	}
+
+	if (time_before(now, t->last_sample +
+			msecs_to_jiffies(memnotify_sample_ms)))
+		return;
+
+	/* Someone else is sampling, use their result */
+	if (!spin_trylock_irqsave(&memnotify_trend_lock, flags))
+		return;
+
+	dt = now - t->last_sample;
+	if (!dt || time_before(now, t->last_sample +
+			msecs_to_jiffies(memnotify_sample_ms))) {
+		spin_unlock_irqrestore(&memnotify_trend_lock, flags);
+		return;
+	}
+
+	swap_used = total_swap_pages - nr_swap_pages;
+	reclaimed = memnotify_sum_events(PGSTEAL_NORMAL - ZONE_NORMAL,
+			PGSTEAL_MOVABLE);
+	faults = memnotify_sum_events(PGMAJFAULT, PGMAJFAULT);
+
+	/* First sample only sets the baseline */
+	if (t->last_used) {
+		t->used_rate = memnotify_ewma(t->used_rate,
+			(long)(used - t->last_used) * HZ / (long)dt);
+		t->swap_rate = memnotify_ewma(t->swap_rate,
+			(long)(swap_used - t->last_swap_used) * HZ / (long)dt);
+		t->reclaim_rate = memnotify_ewma(t->reclaim_rate,
+			(reclaimed - t->last_reclaimed) * HZ / dt);
+		t->fault_rate = memnotify_ewma(t->fault_rate,
+			(faults - t->last_faults) * HZ / dt);
+	}
+
+	t->last_sample = now;
+	t->last_used = used;
+	t->last_swap_used = swap_used;
+	t->last_reclaimed = reclaimed;
+	t->last_faults = faults;
+
+	horizon_pages = max(t->used_rate, 0L) * (long)memnotify_predict_ms
+			/ 1000;
+	predicted = memnotify_ratio_threshold((used + horizon_pages) * 100
+			/ total);
+
+	if ((memnotify_reclaim_alert &&
+			t->reclaim_rate > memnotify_reclaim_alert) ||
+	    (memnotify_fault_alert &&
+			t->fault_rate > memnotify_fault_alert))
+		predicted = max(predicted, threshold + 1);
+
+	if (t->swap_rate > 0 && total_swap_pages && nr_swap_pages <
+			t->swap_rate * (long)memnotify_predict_ms / 1000)
+		predicted = max(predicted, (int)THRESHOLD_LOW);
+
+	spin_unlock_irqrestore(&memnotify_trend_lock, flags);
+
+	/* Only the actual usage can take us to reboot */
+	predicted = min(predicted, max(threshold, (int)THRESHOLD_CRITICAL));
+
+update:
+	predicted = max(predicted, threshold);
+	last_predicted = atomic_xchg(&memnotify_predicted, predicted);
+	if (predicted == last_predicted)
+		return;
+
+	used_ratio = used * 100 / total;
+	lowmem_print(2, "%s: predicted %s (%d%%, %ld pages/s)\n",
+		__FUNCTION__, threshold_string(predicted), used_ratio,
+		memnotify_trend.used_rate);
+
+	memnotify_trace_crossing(last_predicted, predicted, 1, used_ratio);
+	wake_up_interruptible_all(&memnotify_wait);
+}
+
 /** 
 * @brief Find current threshold and broadcast if necessary.
 * 
@@ -222,21 +465,14 @@ int memnotify_threshold(void)
 	int used_ratio;
 	int threshold;
 	int last_threshold;
-	int i;
 
 	used = memnotify_get_used();
 	used_ratio = used * 100 / (totalram_pages + total_swap_pages);
 
-	threshold = THRESHOLD_NORMAL;
 	last_threshold = atomic_read(&memnotify_last_threshold);
 
 	/* Obtain threshold level */
-	for(i = memnotify_messages_size - 1; i >= 0; i--) {
-		if(used_ratio > memnotify_enter_thresholds[i]) {
-			threshold = i;
-			break;
-		}
-	}
+	threshold = memnotify_ratio_threshold(used_ratio);
 
 	/* Need to leave a threshold by a certain margin. */
 	if (threshold < last_threshold) {
@@ -251,6 +487,8 @@ int memnotify_threshold(void)
 	/* Rate limited notification of threshold changes. */
 	memory_pressure_notify(used, used_ratio, threshold);
 
+	memnotify_update_trend(used, threshold);
+
 	return threshold;
 }
 
@@ -267,6 +505,8 @@ static int lowmemnotify_open(struct inode *inode, struct file *file)
 
 	info->last_memnotify = INITIAL_JIFFIES;
 	info->last_threshold = MEMNOTIFY_INVALID; 
+	info->last_predicted = MEMNOTIFY_INVALID;
+	info->subscribed = MEMNOTIFY_SUBSCRIBE_ALL;
 	info->file = file;
 	file->private_data = info;
 	atomic_inc(&nr_watcher_task);
@@ -289,12 +529,21 @@ static unsigned int lowmemnotify_poll(struct file *file, poll_table *wait)
 
 	struct memnotify_file_info *info = file->private_data;
 	int last_threshold;
+	int predicted;
 	int changed = 0;
 
 	poll_wait(file, &memnotify_wait, wait);
 
 	last_threshold = atomic_read(&memnotify_last_threshold);
-	changed = (info->last_threshold != last_threshold);
+	changed = (info->last_threshold != last_threshold) &&
+		(info->subscribed & (1 << last_threshold));
+
+	/* Predicted threshold changes only for watchers asking for them */
+	if (info->subscribed & MEMNOTIFY_SUBSCRIBE_PREDICTED) {
+		predicted = atomic_read(&memnotify_predicted);
+		changed |= (info->last_predicted != predicted) &&
+			(info->subscribed & (1 << predicted));
+	}
 
 	/* Notify only in the case that the threshold has changed */
 	if (changed) {
@@ -309,7 +558,7 @@ static ssize_t lowmemnotify_read(struct file *file,
 {
 	struct memnotify_file_info *info = file->private_data;
 	unsigned long now = jiffies;
-	unsigned long data;
+	unsigned long data[2];
 	ssize_t ret = 0;
 
 	if (count < sizeof(unsigned long))
@@ -317,16 +566,56 @@ static ssize_t lowmemnotify_read(struct file *file,
 
 	info->last_threshold = atomic_read(&memnotify_last_threshold);
 	info->last_memnotify = now;
-	data = memnotify_messages[info->last_threshold];
+	data[0] = memnotify_messages[info->last_threshold];
+
+	/*
+	 * Only watchers subscribed to predicted changes get the predicted
+	 * message as a second word, if they ask for it. Everybody else
+	 * keeps the one word read.
+	 */
+	if (info->subscribed & MEMNOTIFY_SUBSCRIBE_PREDICTED) {
+		info->last_predicted = atomic_read(&memnotify_predicted);
+		data[1] = memnotify_messages[info->last_predicted];
+	}
+	if ((info->subscribed & MEMNOTIFY_SUBSCRIBE_PREDICTED) &&
+	    count >= sizeof(data))
+		count = sizeof(data);
+	else
+		count = sizeof(unsigned long);
 
 	if (0 == ret) {
-		ret = put_user(data, (unsigned long __user*)buf);
-		if (0 == ret)
-			ret = sizeof(unsigned long);
+		if (copy_to_user(buf, data, count))
+			ret = -EFAULT;
+		else
+			ret = count;
 	}
 	return ret;
 }
 
+/** 
+* @brief Subscribe to a set of thresholds: write an unsigned long mask
+* of MEMNOTIFY_SUBSCRIBE_* bits. poll() then only reports changes
+* into the subscribed thresholds.
+*/
+static ssize_t lowmemnotify_write(struct file *file,
+		const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct memnotify_file_info *info = file->private_data;
+	unsigned long mask;
+
+	if (count < sizeof(unsigned long))
+		return -EINVAL;
+
+	if (get_user(mask, (unsigned long __user *)buf))
+		return -EFAULT;
+
+	if (mask & ~(MEMNOTIFY_SUBSCRIBE_ALL | MEMNOTIFY_SUBSCRIBE_PREDICTED))
+		return -EINVAL;
+
+	info->subscribed = mask;
+	return sizeof(unsigned long);
+}
+
 /*********************************************************************
  * Print Current Free
  */
@@ -369,6 +658,19 @@ meminfo_show(struct class *class, char *buf)
 		"Current Threshold: %s\n", threshold_string(threshold));
 	len += snprintf(buf+len, PAGE_SIZE,
 		"Last Threshold: %s\n", threshold_string(last_threshold));
+	len += snprintf(buf+len, PAGE_SIZE,
+		"Predicted Threshold: %s\n",
+		threshold_string(atomic_read(&memnotify_predicted)));
+
+	len += snprintf(buf+len, PAGE_SIZE,
+		"Used Rate: %ldkB/s\n", (long)K(memnotify_trend.used_rate));
+	len += snprintf(buf+len, PAGE_SIZE,
+		"Swap Fill Rate: %ldkB/s\n", (long)K(memnotify_trend.swap_rate));
+	len += snprintf(buf+len, PAGE_SIZE,
+		"Reclaim Rate: %ldkB/s\n",
+		(long)K(memnotify_trend.reclaim_rate));
+	len += snprintf(buf+len, PAGE_SIZE,
+		"Major Fault Rate: %ld/s\n", memnotify_trend.fault_rate);
 
 	len += snprintf(buf+len, PAGE_SIZE, "Enter Thresholds:\n");
 	for (i = 0; i < memnotify_enter_thresholds_size; i++) {
@@ -404,10 +706,50 @@ meminfo_show(struct class *class, char *buf)
 
 static CLASS_ATTR(meminfo, S_IRUGO, meminfo_show, NULL);
 
+/*********************************************************************
+ * Print threshold crossing log, oldest first
+ */
+static ssize_t
+trace_show(struct class *class, char *buf)
+{
+	struct memnotify_trace_entry e;
+	unsigned long flags;
+	unsigned int i, first, last;
+	int len = 0;
+
+	len += snprintf(buf+len, PAGE_SIZE - len,
+		"# time_ms kind from to used%% used_kBps swap_kBps "
+		"reclaim_kBps majflt_ps\n");
+
+	spin_lock_irqsave(&memnotify_trace_lock, flags);
+	last = memnotify_trace_next;
+	spin_unlock_irqrestore(&memnotify_trace_lock, flags);
+	first = last > MEMNOTIFY_TRACE_SIZE ? last - MEMNOTIFY_TRACE_SIZE : 0;
+
+	for (i = first; i < last && len < PAGE_SIZE - 128; i++) {
+		spin_lock_irqsave(&memnotify_trace_lock, flags);
+		e = memnotify_trace[i % MEMNOTIFY_TRACE_SIZE];
+		spin_unlock_irqrestore(&memnotify_trace_lock, flags);
+
+		len += snprintf(buf+len, PAGE_SIZE - len,
+			"%u %s %s %s %u %ld %ld %ld %ld\n",
+			jiffies_to_msecs(e.time - INITIAL_JIFFIES),
+			e.predicted ? "predicted" : "actual",
+			threshold_string(e.from), threshold_string(e.to),
+			e.used_ratio, (long)K(e.used_rate), (long)K(e.swap_rate),
+			(long)K(e.reclaim_rate), e.fault_rate);
+	}
+
+	return len;
+}
+
+static CLASS_ATTR(trace, S_IRUGO, trace_show, NULL);
+
 struct file_operations memnotify_fops = {
 	.open = lowmemnotify_open,
 	.release = lowmemnotify_release,
 	.read = lowmemnotify_read,
+	.write = lowmemnotify_write,
 	.poll = lowmemnotify_poll,
 };
 
@@ -448,8 +790,16 @@ static int __init lowmemnotify_init(void)
 		goto error_create_class_file;
 	}
 
+	err = class_create_file(memnotify_class, &class_attr_trace);
+	if (err) {
+		printk(KERN_ERR "%s: couldn't create trace.\n", __FUNCTION__);
+		goto error_create_trace_file;
+	}
+
 	return 0;
 
+error_create_trace_file:
+	class_remove_file(memnotify_class, &class_attr_meminfo);
 error_create_class_file:
 	device_del(memnotify_device);
 error_create_class_dev:
@@ -20,10 +20,16 @@
 #include <linux/file.h>
 #include <linux/mm.h>
 #include <linux/list.h>
+#include <linux/math64.h>
+#include <linux/rbtree.h>
 #include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <linux/android_pmem.h>
 #include <linux/mempolicy.h>
 #include <linux/kobject.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
 #ifdef CONFIG_MEMORY_HOTPLUG
 #include <linux/memory.h>
 #include <linux/memory_hotplug.h>
@@ -103,6 +109,24 @@ struct pmem_bits {
 	unsigned order:7;		/* size of the region in pmem space */
 };
 
+/* a free or allocated run of quanta in the extent allocator */
+struct pmem_extent {
+	/* free: in free_by_start, allocated: in allocated */
+	struct rb_node by_start;
+	/* free only: in free_by_size, ordered by size then start */
+	struct rb_node by_size;
+	unsigned long start;		/* first quantum */
+	unsigned long quanta;
+};
+
+/* a freed region waiting in the recycle cache */
+struct pmem_recycled {
+	struct list_head list;
+	int index;
+	unsigned long paddr;
+	unsigned long len;
+};
+
 struct pmem_region_node {
 	struct pmem_region region;
 	struct list_head list;
@@ -203,6 +227,18 @@ struct pmem_info {
 				unsigned short quanta;
 			} *bitm_alloc;
 		} bitmap;
+
+		struct {
+			/* free extents by address, for coalescing */
+			struct rb_root free_by_start;
+			/* free extents by size, for best fit */
+			struct rb_root free_by_size;
+			/* allocated extents by address */
+			struct rb_root allocated;
+			unsigned long free_quanta;
+			unsigned long nr_free;
+			unsigned long nr_allocated;
+		} extent;
 	} allocator;
 
 	int id;
@@ -220,6 +256,18 @@ struct pmem_info {
 	 */
 	struct mutex arena_mutex;
 
+	/* recycle cache of freed regions, protected by arena_mutex */
+	struct list_head recycle_pending;	/* waiting to be zeroed */
+	struct list_head recycle_ready;		/* zeroed, oldest first */
+	unsigned int recycle_nr;		/* entries, being zeroed too */
+	struct {
+		unsigned long hits;
+		unsigned long misses;
+		unsigned long zeroed;
+		unsigned long evicted;		/* returned to the allocator */
+		u64 zeroed_bytes;
+	} recycle_stats;
+
 	long (*ioctl)(struct file *, unsigned int, unsigned long);
 	int (*release)(struct inode *, struct file *);
 };
@@ -248,6 +296,8 @@ static struct {
 #define PMEM_SYSFS_DIR_NAME "pmem_regions" /* under /sys/kernel/ */
 static struct kset *pmem_kset;
 
+static struct dentry *pmem_debugfs_dir;
+
 #define PMEM_IS_FREE_BUDDY(id, index) \
 	(!(pmem[id].allocator.buddy_bestfit.buddy_bitmap[index].allocated))
 #define PMEM_BUDDY_ORDER(id, index) \
@@ -353,6 +403,8 @@ static ssize_t show_pmem_allocator_type(int id, char *buf)
 		return scnprintf(buf, PAGE_SIZE, "%s\n", "Buddy Bestfit");
 	case  PMEM_ALLOCATORTYPE_BITMAP:
 		return scnprintf(buf, PAGE_SIZE, "%s\n", "Bitmap");
+	case  PMEM_ALLOCATORTYPE_EXTENT:
+		return scnprintf(buf, PAGE_SIZE, "%s\n", "Extent");
 	default:
 		return scnprintf(buf, PAGE_SIZE,
 			"??? Invalid allocator type (%d) for this region! "
@@ -396,11 +448,28 @@ static ssize_t show_pmem_mapped_regions(int id, char *buf)
 }
 RO_PMEM_ATTR(mapped_regions);
 
+static ssize_t show_pmem_recycle_stats(int id, char *buf)
+{
+	ssize_t ret;
+
+	mutex_lock(&pmem[id].arena_mutex);
+	ret = scnprintf(buf, PAGE_SIZE, "hits %lu\nmisses %lu\nzeroed %lu "
+		"(%llu bytes)\nevicted %lu\ncached %u\n",
+		pmem[id].recycle_stats.hits, pmem[id].recycle_stats.misses,
+		pmem[id].recycle_stats.zeroed,
+		pmem[id].recycle_stats.zeroed_bytes,
+		pmem[id].recycle_stats.evicted, pmem[id].recycle_nr);
+	mutex_unlock(&pmem[id].arena_mutex);
+	return ret;
+}
+RO_PMEM_ATTR(recycle_stats);
+
 #define PMEM_COMMON_SYSFS_ATTRS \
 	&pmem_attr_base.attr, \
 	&pmem_attr_size.attr, \
 	&pmem_attr_allocator_type.attr, \
-	&pmem_attr_mapped_regions.attr
+	&pmem_attr_mapped_regions.attr, \
+	&pmem_attr_recycle_stats.attr
 
 
 static ssize_t show_pmem_allocated(int id, char *buf)
@@ -532,6 +601,69 @@ static struct kobj_type pmem_bitmap_ktype = {
 	.default_attrs = pmem_bitmap_attrs,
 };
 
+static ssize_t show_pmem_free_extents(int id, char *buf)
+{
+	ssize_t ret;
+
+	mutex_lock(&pmem[id].arena_mutex);
+	ret = scnprintf(buf, PAGE_SIZE, "%lu extents, %lu quanta\n",
+		pmem[id].allocator.extent.nr_free,
+		pmem[id].allocator.extent.free_quanta);
+	mutex_unlock(&pmem[id].arena_mutex);
+	return ret;
+}
+RO_PMEM_ATTR(free_extents);
+
+static ssize_t show_pmem_extent_dump(int id, char *buf)
+{
+	struct rb_node *f, *a;
+	ssize_t ret;
+
+	mutex_lock(&pmem[id].arena_mutex);
+	ret = scnprintf(buf, PAGE_SIZE, "start\tquanta\tallocated\n");
+
+	/* merge the free and allocated extents in address order */
+	f = rb_first(&pmem[id].allocator.extent.free_by_start);
+	a = rb_first(&pmem[id].allocator.extent.allocated);
+	while ((f || a) && (PAGE_SIZE - ret)) {
+		struct pmem_extent *fe = f ? rb_entry(f, struct pmem_extent,
+						      by_start) : NULL;
+		struct pmem_extent *ae = a ? rb_entry(a, struct pmem_extent,
+						      by_start) : NULL;
+		struct pmem_extent *e;
+
+		if (!ae || (fe && fe->start < ae->start)) {
+			e = fe;
+			f = rb_next(f);
+		} else {
+			e = ae;
+			a = rb_next(a);
+		}
+		ret += scnprintf(buf + ret, PAGE_SIZE - ret, "%lu\t%lu\t%d\n",
+			e->start, e->quanta, e == ae);
+	}
+
+	mutex_unlock(&pmem[id].arena_mutex);
+	return ret;
+}
+RO_PMEM_ATTR(extent_dump);
+
+static struct attribute *pmem_extent_attrs[] = {
+	PMEM_COMMON_SYSFS_ATTRS,
+
+	PMEM_BITMAP_BUDDY_BESTFIT_COMMON_SYSFS_ATTRS,
+
+	&pmem_attr_free_extents.attr,
+	&pmem_attr_extent_dump.attr,
+
+	NULL
+};
+
+static struct kobj_type pmem_extent_ktype = {
+	.sysfs_ops = &pmem_ops,
+	.default_attrs = pmem_extent_attrs,
+};
+
 static int get_id(struct file *file)
 {
 	return MINOR(file->f_dentry->d_inode->i_rdev);
@@ -778,7 +910,68 @@ static int pmem_free_space_bitmap(int id, struct pmem_freespace *fs)
 	return 0;
 }
 
+/*
+ * Fragmentation report, one debugfs file per region: free space, the
+ * largest allocation that can still succeed and the share of free space
+ * that is not in the largest free block. The extent allocator adds a
+ * histogram of its free extents by power of two size.
+ */
+static int pmem_debugfs_show(struct seq_file *m, void *unused)
+{
+	int id = (int)m->private;
+	struct pmem_freespace fs;
+	unsigned long hist[BITS_PER_LONG];
+	struct rb_node *n;
+	int i, last = -1;
+
+	mutex_lock(&pmem[id].arena_mutex);
+	pmem[id].free_space(id, &fs);
+
+	seq_printf(m, "size %lu\nquantum %u\nfree %lu\nlargest_free %lu\n",
+		pmem[id].size, pmem[id].quantum, fs.total, fs.largest);
+	seq_printf(m, "fragmentation %lu%%\n", fs.total ?
+		100 - (unsigned long)div64_u64((u64)fs.largest * 100,
+					      fs.total) : 0);
+
+	if (pmem[id].allocator_type != PMEM_ALLOCATORTYPE_EXTENT)
+		goto out;
+
+	seq_printf(m, "free_extents %lu\nallocated_extents %lu\n",
+		pmem[id].allocator.extent.nr_free,
+		pmem[id].allocator.extent.nr_allocated);
+
+	memset(hist, 0, sizeof(hist));
+	for (n = rb_first(&pmem[id].allocator.extent.free_by_start); n;
+	     n = rb_next(n)) {
+		i = fls_long(rb_entry(n, struct pmem_extent,
+				      by_start)->quanta) - 1;
+		hist[i]++;
+		last = max(last, i);
+	}
+	seq_printf(m, "quanta\tfree extents\n");
+	for (i = 0; i <= last; i++)
+		seq_printf(m, "%lu-%lu\t%lu\n", 1UL << i, (2UL << i) - 1,
+			hist[i]);
+out:
+	mutex_unlock(&pmem[id].arena_mutex);
+	return 0;
+}
+
+static int pmem_debugfs_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, pmem_debugfs_show, inode->i_private);
+}
+
+static const struct file_operations pmem_debugfs_fops = {
+	.open = pmem_debugfs_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 static void pmem_revoke(struct file *file, struct pmem_data *data);
+static int pmem_recycle(int id, int index, unsigned long paddr,
+		unsigned long len);
 
 static int pmem_release(struct inode *inode, struct file *file)
 {
@@ -818,8 +1011,11 @@ static int pmem_release(struct inode *inode, struct file *file)
 
 	/* if it is not a connected file and it has an allocation, free it */
 	if (!(PMEM_FLAGS_CONNECTED & data->flags) && has_allocation(file)) {
+		unsigned long len = pmem[id].len(id, data);
+		unsigned long paddr = pmem[id].start_addr(id, data);
+
 		mutex_lock(&pmem[id].arena_mutex);
-		ret = pmem[id].free(id, data->index);
+		ret = pmem_recycle(id, data->index, paddr, len);
 		mutex_unlock(&pmem[id].arena_mutex);
 	}
 
@@ -1219,6 +1415,481 @@ leave:
 	return bitnum;
 }
 
+/*
+ * Extent allocator: free space is kept as extents of quanta in two
+ * rbtrees, one by address for coalescing on free and one by size for best
+ * fit allocation, and allocations in a third one by address. Allocating
+ * and freeing are O(log n) in the number of extents, except for alignments
+ * over 4K which may have to look at larger free extents in turn.
+ */
+static void extent_insert_by_start(struct rb_root *root,
+		struct pmem_extent *new)
+{
+	struct rb_node **p = &root->rb_node, *parent = NULL;
+
+	while (*p) {
+		struct pmem_extent *e;
+
+		parent = *p;
+		e = rb_entry(parent, struct pmem_extent, by_start);
+		if (new->start < e->start)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&new->by_start, parent, p);
+	rb_insert_color(&new->by_start, root);
+}
+
+static void extent_insert_by_size(struct rb_root *root,
+		struct pmem_extent *new)
+{
+	struct rb_node **p = &root->rb_node, *parent = NULL;
+
+	while (*p) {
+		struct pmem_extent *e;
+
+		parent = *p;
+		e = rb_entry(parent, struct pmem_extent, by_size);
+		if (new->quanta < e->quanta ||
+		    (new->quanta == e->quanta && new->start < e->start))
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&new->by_size, parent, p);
+	rb_insert_color(&new->by_size, root);
+}
+
+/* caller should hold the lock on arena_mutex! */
+static void extent_add_free(const int id, struct pmem_extent *e)
+{
+	extent_insert_by_start(&pmem[id].allocator.extent.free_by_start, e);
+	extent_insert_by_size(&pmem[id].allocator.extent.free_by_size, e);
+	pmem[id].allocator.extent.free_quanta += e->quanta;
+	pmem[id].allocator.extent.nr_free++;
+}
+
+/* caller should hold the lock on arena_mutex! */
+static void extent_del_free(const int id, struct pmem_extent *e)
+{
+	rb_erase(&e->by_start, &pmem[id].allocator.extent.free_by_start);
+	rb_erase(&e->by_size, &pmem[id].allocator.extent.free_by_size);
+	pmem[id].allocator.extent.free_quanta -= e->quanta;
+	pmem[id].allocator.extent.nr_free--;
+}
+
+static struct pmem_extent *extent_find_allocated(const int id,
+		unsigned long start)
+{
+	struct rb_node *n = pmem[id].allocator.extent.allocated.rb_node;
+
+	while (n) {
+		struct pmem_extent *e = rb_entry(n, struct pmem_extent,
+						 by_start);
+
+		if (start < e->start)
+			n = n->rb_left;
+		else if (start > e->start)
+			n = n->rb_right;
+		else
+			return e;
+	}
+	return NULL;
+}
+
+/* quanta to skip at the start of 'e' to reach an 'align' boundary */
+static unsigned long extent_align_pad(const int id, struct pmem_extent *e,
+		unsigned int align)
+{
+	unsigned long paddr = paddr_from_bit(id, e->start);
+
+	return (ALIGN(paddr, align) - paddr) / pmem[id].quantum;
+}
+
+static int pmem_allocator_extent(const int id,
+		const unsigned long len,
+		const unsigned int align)
+{
+	/* caller should hold the lock on arena_mutex! */
+	struct pmem_extent *e = NULL, *head, *tail;
+	unsigned long quanta_needed, pad = 0;
+	struct rb_node *n, *lower = NULL;
+
+	quanta_needed = (len + pmem[id].quantum - 1) / pmem[id].quantum;
+	DLOG("extent id %d, len %ld, align %u, quanta needed %lu free %lu\n",
+		id, len, align, quanta_needed,
+		pmem[id].allocator.extent.free_quanta);
+	if (!quanta_needed ||
+	    quanta_needed > pmem[id].allocator.extent.free_quanta)
+		return -1;
+
+	/* smallest free extent that is large enough */
+	n = pmem[id].allocator.extent.free_by_size.rb_node;
+	while (n) {
+		struct pmem_extent *c = rb_entry(n, struct pmem_extent,
+						 by_size);
+
+		if (c->quanta >= quanta_needed) {
+			lower = n;
+			n = n->rb_left;
+		} else
+			n = n->rb_right;
+	}
+
+	/* the first one that also fits once aligned */
+	for (n = lower; n; n = rb_next(n)) {
+		e = rb_entry(n, struct pmem_extent, by_size);
+		pad = extent_align_pad(id, e, align);
+		if (e->quanta >= quanta_needed + pad)
+			break;
+	}
+	if (!n) {
+#if PMEM_DEBUG
+		printk(KERN_ALERT "pmem: %s: no free extent of %lu quanta "
+			"aligned to %u in id %d\n", __func__, quanta_needed,
+			align, id);
+#endif
+		return -1;
+	}
+
+	head = pad ? kmalloc(sizeof(*head), GFP_KERNEL) : NULL;
+	tail = e->quanta > quanta_needed + pad ?
+		kmalloc(sizeof(*tail), GFP_KERNEL) : NULL;
+	if ((pad && !head) ||
+	    (e->quanta > quanta_needed + pad && !tail)) {
+		kfree(head);
+		kfree(tail);
+		return -1;
+	}
+
+	extent_del_free(id, e);
+	if (head) {
+		head->start = e->start;
+		head->quanta = pad;
+		extent_add_free(id, head);
+	}
+	if (tail) {
+		tail->start = e->start + pad + quanta_needed;
+		tail->quanta = e->quanta - pad - quanta_needed;
+		extent_add_free(id, tail);
+	}
+	e->start += pad;
+	e->quanta = quanta_needed;
+	extent_insert_by_start(&pmem[id].allocator.extent.allocated, e);
+	pmem[id].allocator.extent.nr_allocated++;
+
+	return e->start;
+}
+
+static int pmem_free_extent(int id, int index)
+{
+	/* caller should hold the lock on arena_mutex! */
+	struct pmem_extent *e, *prev = NULL, *next = NULL;
+	struct rb_node *n;
+	char currtask_name[FIELD_SIZEOF(struct task_struct, comm) + 1];
+
+	DLOG("index %d\n", index);
+
+	e = extent_find_allocated(id, index);
+	if (!e) {
+		printk(KERN_ALERT "pmem: %s: Attempt to free unallocated "
+			"index %d, id %d, pid %d(%s)\n", __func__, index, id,
+			current->pid, get_task_comm(currtask_name, current));
+		return -1;
+	}
+	rb_erase(&e->by_start, &pmem[id].allocator.extent.allocated);
+	pmem[id].allocator.extent.nr_allocated--;
+
+	/* find the free neighbours: the last extent before and the first after */
+	n = pmem[id].allocator.extent.free_by_start.rb_node;
+	while (n) {
+		struct pmem_extent *c = rb_entry(n, struct pmem_extent,
+						 by_start);
+
+		if (c->start < e->start) {
+			prev = c;
+			n = n->rb_right;
+		} else {
+			next = c;
+			n = n->rb_left;
+		}
+	}
+
+	if (prev && prev->start + prev->quanta == e->start) {
+		extent_del_free(id, prev);
+		e->start = prev->start;
+		e->quanta += prev->quanta;
+		kfree(prev);
+	}
+	if (next && e->start + e->quanta == next->start) {
+		extent_del_free(id, next);
+		e->quanta += next->quanta;
+		kfree(next);
+	}
+	extent_add_free(id, e);
+
+	return 0;
+}
+
+static int pmem_free_space_extent(int id, struct pmem_freespace *fs)
+{
+	/* caller should hold the lock on arena_mutex! */
+	struct rb_node *n = rb_last(&pmem[id].allocator.extent.free_by_size);
+
+	fs->total = pmem[id].allocator.extent.free_quanta * pmem[id].quantum;
+	fs->largest = n ? rb_entry(n, struct pmem_extent, by_size)->quanta *
+		pmem[id].quantum : 0;
+	return 0;
+}
+
+static unsigned long pmem_len_extent(int id, struct pmem_data *data)
+{
+	struct pmem_extent *e;
+	unsigned long ret = 0;
+
+	mutex_lock(&pmem[id].arena_mutex);
+	e = extent_find_allocated(id, data->index);
+	if (e)
+		ret = e->quanta * pmem[id].quantum;
+	mutex_unlock(&pmem[id].arena_mutex);
+#if PMEM_DEBUG
+	if (!e)
+		pr_alert("pmem: %s: can't find extent %d!\n",
+			__func__, data->index);
+#endif
+	return ret;
+}
+
+static unsigned long pmem_start_addr_extent(int id, struct pmem_data *data)
+{
+	return paddr_from_bit(id, data->index);
+}
+
+static int pmem_kapi_free_index_extent(const int32_t physaddr, int id)
+{
+	return (physaddr >= pmem[id].base &&
+		physaddr < (pmem[id].base + pmem[id].size)) ?
+		bit_from_paddr(id, physaddr) : -1;
+}
+
+static int pmem_extent_init(int id)
+{
+	struct pmem_extent *e = kmalloc(sizeof(*e), GFP_KERNEL);
+
+	if (!e)
+		return -ENOMEM;
+
+	pmem[id].allocator.extent.free_by_start = RB_ROOT;
+	pmem[id].allocator.extent.free_by_size = RB_ROOT;
+	pmem[id].allocator.extent.allocated = RB_ROOT;
+	pmem[id].allocator.extent.free_quanta = 0;
+	pmem[id].allocator.extent.nr_free = 0;
+	pmem[id].allocator.extent.nr_allocated = 0;
+
+	e->start = 0;
+	e->quanta = pmem[id].num_entries;
+	extent_add_free(id, e);
+	return 0;
+}
+
+static void pmem_extent_destroy(int id)
+{
+	struct rb_node *n;
+
+	while ((n = rb_first(&pmem[id].allocator.extent.free_by_start))) {
+		struct pmem_extent *e = rb_entry(n, struct pmem_extent,
+						 by_start);
+
+		extent_del_free(id, e);
+		kfree(e);
+	}
+}
+
+/*
+ * Recycle cache: user space regions are not handed back to the allocator
+ * when they are freed but queued for pmem_recycle_thread(), which zeroes
+ * them at low priority and keeps up to recycle_max of them per device.
+ * pmem_allocate() hands out a cached region of the right size, so the
+ * camera and video buffers that are freed and allocated again every frame
+ * or session come back zeroed without a trip through the allocator.
+ *
+ * Only recycled regions are scrubbed. A cache miss gets its region from
+ * the allocator with whatever it held before, as pmem always did, and
+ * devices whose memory is not MEMORY_STABLE do not use the cache at all.
+ */
+static unsigned int pmem_recycle_max = 4;
+module_param_named(recycle_max, pmem_recycle_max, uint, S_IRUGO | S_IWUSR);
+
+static DECLARE_WAIT_QUEUE_HEAD(pmem_recycle_wait);
+static atomic_t pmem_recycle_queued = ATOMIC_INIT(0);
+static struct task_struct *pmem_recycle_task;
+
+static int pmem_recycle_enabled(int id)
+{
+	return pmem[id].vbase && pmem[id].memory_state == MEMORY_STABLE &&
+		pmem[id].allocator_type != PMEM_ALLOCATORTYPE_ALLORNOTHING;
+}
+
+/* the length the allocator hands out for a request of 'len' bytes */
+static unsigned long pmem_alloc_len(int id, unsigned long len)
+{
+	if (pmem[id].allocator_type == PMEM_ALLOCATORTYPE_BUDDYBESTFIT)
+		return (1UL << pmem_order(len, id)) * pmem[id].quantum;
+	return ALIGN(len, pmem[id].quantum);
+}
+
+static void pmem_recycle_zero(int id, struct pmem_recycled *r)
+{
+	void *vaddr = pmem[id].vbase + (r->paddr - pmem[id].base);
+	unsigned long done, chunk;
+
+	for (done = 0; done < r->len; done += chunk) {
+		chunk = min(r->len - done, (unsigned long)SZ_64K);
+		memset(vaddr + done, 0, chunk);
+		cond_resched();
+	}
+	if (pmem[id].cached)
+		clean_caches((unsigned long)vaddr, r->len, r->paddr);
+	mb();
+}
+
+/*
+ * pmem_recycle_drain - give every cached region back to the allocator,
+ * zeroing the ones still waiting for that. Returns how many there were.
+ */
+static int pmem_recycle_drain(int id)
+{
+	/* caller should hold the lock on arena_mutex! */
+	struct pmem_recycled *r, *tmp;
+	int n = 0;
+
+	list_for_each_entry_safe(r, tmp, &pmem[id].recycle_pending, list) {
+		list_move_tail(&r->list, &pmem[id].recycle_ready);
+		atomic_dec(&pmem_recycle_queued);
+		pmem_recycle_zero(id, r);
+		pmem[id].recycle_stats.zeroed++;
+		pmem[id].recycle_stats.zeroed_bytes += r->len;
+	}
+	list_for_each_entry_safe(r, tmp, &pmem[id].recycle_ready, list) {
+		list_del(&r->list);
+		pmem[id].free(id, r->index);
+		pmem[id].recycle_nr--;
+		pmem[id].recycle_stats.evicted++;
+		kfree(r);
+		n++;
+	}
+	return n;
+}
+
+static int pmem_recycle(int id, int index, unsigned long paddr,
+		unsigned long len)
+{
+	/* caller should hold the lock on arena_mutex! */
+	struct pmem_recycled *r;
+
+	if (!pmem_recycle_enabled(id) || !pmem_recycle_max || !len)
+		return pmem[id].free(id, index);
+
+	/* make room by evicting the oldest zeroed region */
+	if (pmem[id].recycle_nr >= pmem_recycle_max) {
+		if (list_empty(&pmem[id].recycle_ready))
+			return pmem[id].free(id, index);
+		r = list_first_entry(&pmem[id].recycle_ready,
+				     struct pmem_recycled, list);
+		list_del(&r->list);
+		pmem[id].free(id, r->index);
+		pmem[id].recycle_nr--;
+		pmem[id].recycle_stats.evicted++;
+	} else {
+		r = kmalloc(sizeof(*r), GFP_KERNEL);
+		if (!r)
+			return pmem[id].free(id, index);
+	}
+
+	r->index = index;
+	r->paddr = paddr;
+	r->len = len;
+	list_add_tail(&r->list, &pmem[id].recycle_pending);
+	pmem[id].recycle_nr++;
+	atomic_inc(&pmem_recycle_queued);
+	wake_up(&pmem_recycle_wait);
+	return 0;
+}
+
+/*
+ * pmem_allocate - allocate from the recycle cache if it has a zeroed
+ * region of the size the allocator would hand out, else from the
+ * allocator, draining the cache into it if it is out of space. Only the
+ * first case returns zeroed memory.
+ */
+static int pmem_allocate(int id, unsigned long len, unsigned int align)
+{
+	/* caller should hold the lock on arena_mutex! */
+	struct pmem_recycled *r;
+	unsigned long want;
+	int index;
+
+	if (!pmem_recycle_enabled(id))
+		return pmem[id].allocate(id, len, align);
+
+	want = pmem_alloc_len(id, len);
+	list_for_each_entry(r, &pmem[id].recycle_ready, list) {
+		if (r->len == want && !(r->paddr & (align - 1))) {
+			list_del(&r->list);
+			pmem[id].recycle_nr--;
+			pmem[id].recycle_stats.hits++;
+			index = r->index;
+			kfree(r);
+			return index;
+		}
+	}
+	pmem[id].recycle_stats.misses++;
+
+	index = pmem[id].allocate(id, len, align);
+	if (index < 0 && pmem_recycle_drain(id))
+		index = pmem[id].allocate(id, len, align);
+	return index;
+}
+
+static int pmem_recycle_thread(void *unused)
+{
+	set_user_nice(current, 19);
+
+	while (!kthread_should_stop()) {
+		int id;
+
+		wait_event_interruptible(pmem_recycle_wait,
+			atomic_read(&pmem_recycle_queued) ||
+			kthread_should_stop());
+
+		for (id = 0; id < id_count; id++) {
+			struct pmem_recycled *r = NULL;
+
+			mutex_lock(&pmem[id].arena_mutex);
+			if (!list_empty(&pmem[id].recycle_pending)) {
+				r = list_first_entry(&pmem[id].recycle_pending,
+					struct pmem_recycled, list);
+				list_del(&r->list);
+				atomic_dec(&pmem_recycle_queued);
+			}
+			mutex_unlock(&pmem[id].arena_mutex);
+			if (!r)
+				continue;
+
+			/* off both lists, nobody else touches it meanwhile */
+			pmem_recycle_zero(id, r);
+
+			mutex_lock(&pmem[id].arena_mutex);
+			list_add_tail(&r->list, &pmem[id].recycle_ready);
+			pmem[id].recycle_stats.zeroed++;
+			pmem[id].recycle_stats.zeroed_bytes += r->len;
+			mutex_unlock(&pmem[id].arena_mutex);
+		}
+	}
+	return 0;
+}
+
 static pgprot_t phys_mem_access_prot(struct file *file, pgprot_t vma_prot)
 {
 	int id = get_id(file);
@@ -1457,7 +2128,7 @@ static int pmem_mmap(struct file *file, struct vm_area_struct *vma)
 	/* if file->private_data == unalloced, alloc*/
 	if (data && data->index == -1) {
 		mutex_lock(&pmem[id].arena_mutex);
-		index = pmem[id].allocate(id,
+		index = pmem_allocate(id,
 				vma->vm_end - vma->vm_start,
 				SZ_4K);
 		mutex_unlock(&pmem[id].arena_mutex);
@@ -2378,7 +3049,7 @@ static long pmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			}
 
 			mutex_lock(&pmem[id].arena_mutex);
-			data->index = pmem[id].allocate(id,
+			data->index = pmem_allocate(id,
 					arg,
 					SZ_4K);
 			mutex_unlock(&pmem[id].arena_mutex);
@@ -2411,9 +3082,12 @@ static long pmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 
 			if (alloc.align != SZ_4K &&
 					(pmem[id].allocator_type !=
-						PMEM_ALLOCATORTYPE_BITMAP)) {
+						PMEM_ALLOCATORTYPE_BITMAP &&
+					pmem[id].allocator_type !=
+						PMEM_ALLOCATORTYPE_EXTENT)) {
 				pr_err("pmem: Non 4k alignment requires bitmap"
-					" allocator on %s\n", pmem[id].name);
+					" or extent allocator on %s\n",
+					pmem[id].name);
 				return -EINVAL;
 			}
 
@@ -2425,7 +3099,7 @@ static long pmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			}
 
 			mutex_lock(&pmem[id].arena_mutex);
-			data->index = pmem[id].allocate(id,
+			data->index = pmem_allocate(id,
 					alloc.size,
 					alloc.align);
 			mutex_unlock(&pmem[id].arena_mutex);
@@ -2837,6 +3511,32 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 			pmem[id].size, pmem[id].quantum);
 		break;
 
+	case PMEM_ALLOCATORTYPE_EXTENT:
+		if (pmem_extent_init(id)) {
+			pr_alert("pmem: %s: Unable to register pmem "
+				"driver %s - can't allocate extent!\n",
+				__func__, pdata->name);
+			goto err_reset_pmem_info;
+		}
+
+		pmem[id].allocate = pmem_allocator_extent;
+		pmem[id].free = pmem_free_extent;
+		pmem[id].free_space = pmem_free_space_extent;
+		pmem[id].kapi_free_index = pmem_kapi_free_index_extent;
+		pmem[id].len = pmem_len_extent;
+		pmem[id].start_addr = pmem_start_addr_extent;
+
+		if (kobject_init_and_add(&pmem[id].kobj,
+				&pmem_extent_ktype, NULL,
+				"%s", pdata->name))
+			goto out_put_kobj;
+
+		DLOG("extent allocator id %d (%s), num_entries %lu, raw size "
+			"%lu, quanta size %u\n",
+			id, pdata->name, pmem[id].num_entries,
+			pmem[id].size, pmem[id].quantum);
+		break;
+
 	default:
 		pr_alert("Invalid allocator type (%d) for pmem driver\n",
 			pdata->allocator_type);
@@ -2848,6 +3548,8 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 	mutex_init(&pmem[id].arena_mutex);
 	mutex_init(&pmem[id].data_list_mutex);
 	INIT_LIST_HEAD(&pmem[id].data_list);
+	INIT_LIST_HEAD(&pmem[id].recycle_pending);
+	INIT_LIST_HEAD(&pmem[id].recycle_ready);
 
 	pmem[id].dev.name = pdata->name;
 	if (!is_kernel_memtype) {
@@ -2880,6 +3582,10 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 
 	pmem[id].garbage_pfn = page_to_pfn(alloc_page(GFP_KERNEL));
 
+	if (pmem_debugfs_dir)
+		debugfs_create_file(pmem[id].name, S_IRUGO, pmem_debugfs_dir,
+				    (void *)id, &pmem_debugfs_fops);
+
 	return 0;
 
 error_cant_remap:
@@ -2893,7 +3599,8 @@ out_put_kobj:
 	else if (pmem[id].allocator_type == PMEM_ALLOCATORTYPE_BITMAP) {
 		kfree(pmem[id].allocator.bitmap.bitmap);
 		kfree(pmem[id].allocator.bitmap.bitm_alloc);
-	}
+	} else if (pmem[id].allocator_type == PMEM_ALLOCATORTYPE_EXTENT)
+		pmem_extent_destroy(id);
 err_reset_pmem_info:
 	pmem[id].allocate = 0;
 	pmem[id].dev.minor = -1;
@@ -2964,6 +3671,17 @@ static int __init pmem_init(void)
 		return -ENOMEM;
 	}
 
+	pmem_debugfs_dir = debugfs_create_dir("pmem", NULL);
+
+	pmem_recycle_task = kthread_run(pmem_recycle_thread, NULL,
+					"pmem_recycle");
+	if (IS_ERR(pmem_recycle_task)) {
+		pr_err("pmem(%s): no recycle thread, caching disabled\n",
+			__func__);
+		pmem_recycle_task = NULL;
+		pmem_recycle_max = 0;
+	}
+
 #ifdef CONFIG_MEMORY_HOTPLUG
 	hotplug_memory_notifier(pmem_memory_callback, 0);
 #endif
@@ -2972,6 +3690,16 @@ static int __init pmem_init(void)
 
 static void __exit pmem_exit(void)
 {
+	int id;
+
+	/* the thread is gone, so nothing is being zeroed off the lists */
+	if (pmem_recycle_task)
+		kthread_stop(pmem_recycle_task);
+	for (id = 0; id < id_count; id++) {
+		mutex_lock(&pmem[id].arena_mutex);
+		pmem_recycle_drain(id);
+		mutex_unlock(&pmem[id].arena_mutex);
+	}
 	platform_driver_unregister(&pmem_driver);
 }
 
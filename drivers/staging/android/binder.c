@@ -64,6 +64,14 @@ static int binder_read_proc_proc(char *page, char **start, off_t off,
 
 #define BINDER_SMALL_BUF_SIZE (PAGE_SIZE * 64)
 
+/*
+ * Free buffers smaller than BINDER_FREE_CLASSES << BINDER_FREE_CLASS_SHIFT
+ * bytes are kept on per-size-class lists instead of the free_buffers tree.
+ */
+#define BINDER_FREE_CLASS_SHIFT	5
+#define BINDER_FREE_CLASSES	16
+#define BINDER_FREE_SMALL_MAX	(BINDER_FREE_CLASSES << BINDER_FREE_CLASS_SHIFT)
+
 enum {
 	BINDER_DEBUG_USER_ERROR             = 1U << 0,
 	BINDER_DEBUG_FAILED_TRANSACTION     = 1U << 1,
@@ -89,6 +97,16 @@ module_param_named(debug_mask, binder_debug_mask, uint, S_IWUSR | S_IRUGO);
 static int binder_debug_no_lock;
 module_param_named(proc_no_lock, binder_debug_no_lock, bool, S_IWUSR | S_IRUGO);
 
+/*
+ * Pages of freed buffers each proc keeps mapped for reuse instead of
+ * returning them to the page allocator.
+ */
+static unsigned int binder_page_retain = 8;
+module_param_named(page_retain, binder_page_retain, uint, S_IWUSR | S_IRUGO);
+
+/* retained pages of all procs, given back by binder_shrink() */
+static int binder_retained_pages;
+
 static DECLARE_WAIT_QUEUE_HEAD(binder_user_error_wait);
 static int binder_stop_on_user_error;
 
@@ -242,12 +260,16 @@ struct binder_ref {
 
 struct binder_buffer {
 	struct list_head entry; /* free and allocated entries by addesss */
-	struct rb_node rb_node; /* free entry by size or allocated entry */
-				/* by address */
+	union {
+		struct rb_node rb_node; /* free entry by size or allocated */
+					/* entry by address */
+		struct list_head class_entry; /* small free entry */
+	};
 	unsigned free:1;
+	unsigned free_small:1;	/* on a free_small list, not free_buffers */
 	unsigned allow_user_free:1;
 	unsigned async_transaction:1;
-	unsigned debug_id:29;
+	unsigned debug_id:28;
 
 	struct binder_transaction *transaction;
 
@@ -257,6 +279,17 @@ struct binder_buffer {
 	uint8_t data[0];
 };
 
+struct binder_alloc_stats {
+	unsigned int allocs;		/* buffers allocated */
+	unsigned int small_allocs;	/* ...from a size class list */
+	unsigned int failed;		/* allocations that failed */
+	unsigned int page_maps;		/* pages allocated and mapped */
+	unsigned int page_fills;	/* ...of which not zeroed */
+	unsigned int page_reuses;	/* retained pages reused */
+	unsigned int page_frees;	/* pages unmapped and freed */
+	unsigned int page_trims;	/* retained pages freed by the shrinker */
+};
+
 enum binder_deferred_state {
 	BINDER_DEFERRED_PUT_FILES    = 0x01,
 	BINDER_DEFERRED_FLUSH        = 0x02,
@@ -280,10 +313,13 @@ struct binder_proc {
 
 	struct list_head buffers;
 	struct rb_root free_buffers;
+	struct list_head free_small[BINDER_FREE_CLASSES];
 	struct rb_root allocated_buffers;
 	size_t free_async_space;
 
 	struct page **pages;
+	int pages_retained;	/* unused pages kept mapped */
+	struct binder_alloc_stats alloc_stats;
 	size_t buffer_size;
 	uint32_t buffer_free;
 	struct list_head todo;
@@ -525,6 +561,14 @@ static void binder_insert_free_buffer(struct binder_proc *proc,
 		     "binder: %d: add free buffer, size %zd, "
 		     "at %p\n", proc->pid, new_buffer_size, new_buffer);
 
+	if (new_buffer_size < BINDER_FREE_SMALL_MAX) {
+		new_buffer->free_small = 1;
+		list_add(&new_buffer->class_entry, &proc->free_small[
+			 new_buffer_size >> BINDER_FREE_CLASS_SHIFT]);
+		return;
+	}
+	new_buffer->free_small = 0;
+
 	while (*p) {
 		parent = *p;
 		buffer = rb_entry(parent, struct binder_buffer, rb_node);
@@ -541,6 +585,61 @@ static void binder_insert_free_buffer(struct binder_proc *proc,
 	rb_insert_color(&new_buffer->rb_node, &proc->free_buffers);
 }
 
+static void binder_erase_free_buffer(struct binder_proc *proc,
+				     struct binder_buffer *buffer)
+{
+	BUG_ON(!buffer->free);
+
+	if (buffer->free_small)
+		list_del(&buffer->class_entry);
+	else
+		rb_erase(&buffer->rb_node, &proc->free_buffers);
+}
+
+/*
+ * binder_find_free_buffer - find a free buffer of at least 'size' bytes.
+ * Small requests take the first buffer that fits from the size class lists;
+ * everything else is a best fit from the free_buffers tree, which only holds
+ * buffers at least BINDER_FREE_SMALL_MAX bytes large.
+ */
+static struct binder_buffer *binder_find_free_buffer(struct binder_proc *proc,
+						     size_t size)
+{
+	struct rb_node *n = proc->free_buffers.rb_node;
+	struct rb_node *best_fit = NULL;
+	struct binder_buffer *buffer;
+	size_t buffer_size;
+	int class;
+
+	for (class = size >> BINDER_FREE_CLASS_SHIFT;
+	     class < BINDER_FREE_CLASSES; class++) {
+		list_for_each_entry(buffer, &proc->free_small[class],
+				    class_entry) {
+			if (binder_buffer_size(proc, buffer) >= size) {
+				proc->alloc_stats.small_allocs++;
+				return buffer;
+			}
+		}
+	}
+
+	while (n) {
+		buffer = rb_entry(n, struct binder_buffer, rb_node);
+		BUG_ON(!buffer->free);
+		buffer_size = binder_buffer_size(proc, buffer);
+
+		if (size < buffer_size) {
+			best_fit = n;
+			n = n->rb_left;
+		} else if (size > buffer_size)
+			n = n->rb_right;
+		else
+			return buffer;
+	}
+	if (best_fit == NULL)
+		return NULL;
+	return rb_entry(best_fit, struct binder_buffer, rb_node);
+}
+
 static void binder_insert_allocated_buffer(struct binder_proc *proc,
 					   struct binder_buffer *new_buffer)
 {
@@ -590,113 +689,332 @@ static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 	return NULL;
 }
 
-static int binder_update_page_range(struct binder_proc *proc, int allocate,
-				    void *start, void *end,
-				    struct vm_area_struct *vma)
+/*
+ * binder_map_page_run - allocate the unpopulated pages from 'start' to 'end'
+ * and map them in the kernel with one map_vm_area() call. They are not
+ * zeroed: only the parts outside 'fill_start'-'fill_end' are cleared, the
+ * caller overwrites the rest before binder_insert_page_range() maps them in
+ * userspace. page_private() marks them until then.
+ */
+static int binder_map_page_run(struct binder_proc *proc,
+			       void *start, void *end,
+			       void *fill_start, void *fill_end)
 {
-	void *page_addr;
-	unsigned long user_page_addr;
+	struct page **pages = &proc->pages[(start - proc->buffer) / PAGE_SIZE];
+	struct page **page_array_ptr = pages;
+	int i, nr = (end - start) / PAGE_SIZE;
 	struct vm_struct tmp_area;
-	struct page **page;
-	struct mm_struct *mm;
+	void *page_addr, *lo, *hi;
+	int ret;
 
-	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
-		     "binder: %d: %s pages %p-%p\n", proc->pid,
-		     allocate ? "allocate" : "free", start, end);
+	for (i = 0; i < nr; i++) {
+		BUG_ON(pages[i]);
+		pages[i] = alloc_page(GFP_KERNEL);
+		if (pages[i] == NULL) {
+			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
+			       "for page at %p\n", proc->pid,
+			       start + i * PAGE_SIZE);
+			goto err_alloc_page_failed;
+		}
+	}
+
+	tmp_area.addr = start;
+	tmp_area.size = end - start + PAGE_SIZE /* guard page? */;
+	ret = map_vm_area(&tmp_area, PAGE_KERNEL, &page_array_ptr);
+	if (ret) {
+		printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
+		       "to map pages at %p in kernel\n", proc->pid, start);
+		goto err_map_kernel_failed;
+	}
+
+	for (i = 0, page_addr = start; i < nr; i++, page_addr += PAGE_SIZE) {
+		lo = clamp(fill_start, page_addr, page_addr + PAGE_SIZE);
+		hi = clamp(fill_end, lo, page_addr + PAGE_SIZE);
+		if (lo == page_addr && hi == page_addr + PAGE_SIZE)
+			proc->alloc_stats.page_fills++;
+		memset(page_addr, 0, lo - page_addr);
+		memset(hi, 0, page_addr + PAGE_SIZE - hi);
+		set_page_private(pages[i], 1);
+	}
+	proc->alloc_stats.page_maps += nr;
+	return 0;
+
+err_map_kernel_failed:
+err_alloc_page_failed:
+	while (i--) {
+		__free_page(pages[i]);
+		pages[i] = NULL;
+	}
+	return -ENOMEM;
+}
+
+/*
+ * binder_unmap_page_range - unmap and free the pages from 'start' to 'end',
+ * keeping up to binder_page_retain of them mapped for the next allocation.
+ */
+static void binder_unmap_page_range(struct binder_proc *proc,
+				    struct vm_area_struct *vma,
+				    void *start, void *end)
+{
+	struct page **page;
+	void *page_addr;
+	int retain;
 
 	if (end <= start)
-		return 0;
+		return;
+
+	if (vma && proc->pages_retained < binder_page_retain) {
+		retain = min_t(int, binder_page_retain - proc->pages_retained,
+			       (end - start) / PAGE_SIZE);
+		proc->pages_retained += retain;
+		binder_retained_pages += retain;
+		start += retain * PAGE_SIZE;
+		if (start >= end)
+			return;
+	}
 
 	if (vma)
-		mm = NULL;
-	else
-		mm = get_task_mm(proc->tsk);
+		zap_page_range(vma, (uintptr_t)start + proc->user_buffer_offset,
+			       end - start, NULL);
+	unmap_kernel_range((unsigned long)start, end - start);
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		__free_page(*page);
+		*page = NULL;
+		proc->alloc_stats.page_frees++;
+	}
+}
 
-	if (mm) {
-		down_write(&mm->mmap_sem);
-		vma = proc->vma;
+/*
+ * binder_free_page - unmap the page at 'page_addr' from userspace (if 'vma'
+ * is set) and from the kernel, and free it.
+ */
+static void binder_free_page(struct binder_proc *proc,
+			     struct vm_area_struct *vma, void *page_addr)
+{
+	struct page **page;
+
+	page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+	if (vma)
+		zap_page_range(vma, (uintptr_t)page_addr +
+			       proc->user_buffer_offset, PAGE_SIZE, NULL);
+	unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+	set_page_private(*page, 0);
+	__free_page(*page);
+	*page = NULL;
+	proc->alloc_stats.page_frees++;
+}
+
+/*
+ * binder_drop_page_range - undo binder_alloc_page_range() from 'start' to
+ * 'end': free the pages it allocated and retain the reused ones again.
+ */
+static void binder_drop_page_range(struct binder_proc *proc,
+				   struct vm_area_struct *vma,
+				   void *start, void *end)
+{
+	void *page_addr;
+
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		if (!page_private(proc->pages[(page_addr - proc->buffer) /
+					      PAGE_SIZE])) {
+			proc->pages_retained++;
+			binder_retained_pages++;
+			continue;
+		}
+		binder_free_page(proc, vma, page_addr);
 	}
+}
 
-	if (allocate == 0)
-		goto free_range;
+/*
+ * binder_trim_retained - free up to 'nr' of the pages kept mapped by
+ * binder_unmap_page_range(). Those are the populated pages lying wholly
+ * inside the data of a free buffer. Returns the number of pages freed.
+ */
+static int binder_trim_retained(struct binder_proc *proc,
+				struct vm_area_struct *vma, int nr)
+{
+	struct binder_buffer *buffer;
+	void *page_addr, *end;
+	int freed = 0;
 
-	if (vma == NULL) {
-		printk(KERN_ERR "binder: %d: binder_alloc_buf failed to "
-		       "map pages in userspace, no vma\n", proc->pid);
-		goto err_no_vma;
+	list_for_each_entry(buffer, &proc->buffers, entry) {
+		if (!buffer->free)
+			continue;
+		page_addr = (void *)PAGE_ALIGN((uintptr_t)buffer->data);
+		end = (void *)(((uintptr_t)buffer->data +
+				binder_buffer_size(proc, buffer)) & PAGE_MASK);
+		for (; page_addr < end; page_addr += PAGE_SIZE) {
+			if (freed == nr || !proc->pages_retained)
+				return freed;
+			if (!proc->pages[(page_addr - proc->buffer) /
+					 PAGE_SIZE])
+				continue;
+			binder_free_page(proc, vma, page_addr);
+			proc->pages_retained--;
+			binder_retained_pages--;
+			proc->alloc_stats.page_trims++;
+			freed++;
+		}
 	}
+	return freed;
+}
+
+/*
+ * binder_alloc_page_range - populate the kernel side of a range of the
+ * buffer area. Pages kept mapped by an earlier release are reused as they
+ * are, the others are allocated and mapped in runs, see
+ * binder_map_page_run().
+ */
+static int binder_alloc_page_range(struct binder_proc *proc,
+				   void *start, void *end,
+				   void *fill_start, void *fill_end)
+{
+	void *page_addr, *run_end;
+
+	for (page_addr = start; page_addr < end; page_addr = run_end) {
+		struct page **page;
 
-	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
-		int ret;
-		struct page **page_array_ptr;
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		if (*page) {
+			/* kept mapped by binder_unmap_page_range() */
+			proc->pages_retained--;
+			binder_retained_pages--;
+			proc->alloc_stats.page_reuses++;
+			run_end = page_addr + PAGE_SIZE;
+			continue;
+		}
 
-		BUG_ON(*page);
-		*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-		if (*page == NULL) {
-			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
-			       "for page at %p\n", proc->pid, page_addr);
-			goto err_alloc_page_failed;
+		for (run_end = page_addr; run_end < end && !*page;
+		     run_end += PAGE_SIZE, page++)
+			;
+		if (binder_map_page_run(proc, page_addr, run_end,
+					fill_start, fill_end)) {
+			/* give back what we already took */
+			binder_drop_page_range(proc, NULL, start, page_addr);
+			return -ENOMEM;
 		}
-		tmp_area.addr = page_addr;
-		tmp_area.size = PAGE_SIZE + PAGE_SIZE /* guard page? */;
-		page_array_ptr = page;
-		ret = map_vm_area(&tmp_area, PAGE_KERNEL, &page_array_ptr);
-		if (ret) {
-			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
-			       "to map page at %p in kernel\n",
-			       proc->pid, page_addr);
-			goto err_map_kernel_failed;
-		}
-		user_page_addr =
-			(uintptr_t)page_addr + proc->user_buffer_offset;
-		ret = vm_insert_page(vma, user_page_addr, page[0]);
-		if (ret) {
+	}
+	return 0;
+}
+
+/*
+ * binder_insert_page_range - map the pages binder_alloc_page_range() added
+ * from 'start' to 'end' in userspace. If that fails they are dropped again.
+ */
+static int binder_insert_page_range(struct binder_proc *proc,
+				    void *start, void *end,
+				    struct vm_area_struct *vma)
+{
+	struct mm_struct *mm = NULL;
+	unsigned long user_page_addr;
+	void *page_addr;
+	struct page *page;
+	int ret = 0;
+
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		page = proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		if (page_private(page))
+			break;
+	}
+	if (page_addr >= end)
+		return 0;
+
+	if (vma == NULL) {
+		mm = get_task_mm(proc->tsk);
+		if (mm) {
+			down_write(&mm->mmap_sem);
+			vma = proc->vma;
+		}
+	}
+	if (vma == NULL) {
+		printk(KERN_ERR "binder: %d: binder_alloc_buf failed to "
+		       "map pages in userspace, no vma\n", proc->pid);
+		ret = -ENOMEM;
+	}
+
+	for (; ret == 0 && page_addr < end; page_addr += PAGE_SIZE) {
+		page = proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		if (!page_private(page))
+			continue;
+		user_page_addr = (uintptr_t)page_addr + proc->user_buffer_offset;
+		ret = vm_insert_page(vma, user_page_addr, page);
+		if (ret)
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
 			       "to map page at %lx in userspace\n",
 			       proc->pid, user_page_addr);
-			goto err_vm_insert_page_failed;
-		}
 		/* vm_insert_page does not seem to increment the refcount */
 	}
+
+	if (ret)
+		binder_drop_page_range(proc, vma, start, end);
+	else
+		for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE)
+			set_page_private(proc->pages[(page_addr - proc->buffer) /
+						     PAGE_SIZE], 0);
+
 	if (mm) {
 		up_write(&mm->mmap_sem);
 		mmput(mm);
 	}
-	return 0;
+	return ret;
+}
 
-free_range:
-	for (page_addr = end - PAGE_SIZE; page_addr >= start;
-	     page_addr -= PAGE_SIZE) {
-		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
-		if (vma)
-			zap_page_range(vma, (uintptr_t)page_addr +
-				proc->user_buffer_offset, PAGE_SIZE, NULL);
-err_vm_insert_page_failed:
-		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
-err_map_kernel_failed:
-		__free_page(*page);
-		*page = NULL;
-err_alloc_page_failed:
-		;
+/*
+ * binder_update_page_range - populate or release the pages backing a range
+ * of the buffer area.
+ */
+static int binder_update_page_range(struct binder_proc *proc, int allocate,
+				    void *start, void *end,
+				    struct vm_area_struct *vma)
+{
+	struct mm_struct *mm;
+
+	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
+		     "binder: %d: %s pages %p-%p\n", proc->pid,
+		     allocate ? "allocate" : "free", start, end);
+
+	if (end <= start)
+		return 0;
+
+	if (allocate) {
+		if (binder_alloc_page_range(proc, start, end, NULL, NULL))
+			return -ENOMEM;
+		return binder_insert_page_range(proc, start, end, vma);
+	}
+
+	if (vma)
+		mm = NULL;
+	else
+		mm = get_task_mm(proc->tsk);
+
+	if (mm) {
+		down_write(&mm->mmap_sem);
+		vma = proc->vma;
 	}
-err_no_vma:
+
+	binder_unmap_page_range(proc, vma, start, end);
+
 	if (mm) {
 		up_write(&mm->mmap_sem);
 		mmput(mm);
 	}
-	return -ENOMEM;
+	return 0;
 }
 
+/*
+ * binder_alloc_buf - allocate a buffer and copy the payload 'data' into it.
+ * Returns NULL if there is no room, ERR_PTR(-EFAULT) if 'data' is invalid.
+ */
 static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 					      size_t data_size,
-					      size_t offsets_size, int is_async)
+					      size_t offsets_size, int is_async,
+					      const void __user *data)
 {
-	struct rb_node *n = proc->free_buffers.rb_node;
 	struct binder_buffer *buffer;
 	size_t buffer_size;
-	struct rb_node *best_fit = NULL;
 	void *has_page_addr;
+	void *start_page_addr;
 	void *end_page_addr;
 	size_t size;
 
@@ -723,30 +1041,14 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		return NULL;
 	}
 
-	while (n) {
-		buffer = rb_entry(n, struct binder_buffer, rb_node);
-		BUG_ON(!buffer->free);
-		buffer_size = binder_buffer_size(proc, buffer);
-
-		if (size < buffer_size) {
-			best_fit = n;
-			n = n->rb_left;
-		} else if (size > buffer_size)
-			n = n->rb_right;
-		else {
-			best_fit = n;
-			break;
-		}
-	}
-	if (best_fit == NULL) {
+	buffer = binder_find_free_buffer(proc, size);
+	if (buffer == NULL) {
 		printk(KERN_ERR "binder: %d: binder_alloc_buf size %zd failed, "
 		       "no address space\n", proc->pid, size);
+		proc->alloc_stats.failed++;
 		return NULL;
 	}
-	if (n == NULL) {
-		buffer = rb_entry(best_fit, struct binder_buffer, rb_node);
-		buffer_size = binder_buffer_size(proc, buffer);
-	}
+	buffer_size = binder_buffer_size(proc, buffer);
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: binder_alloc_buf size %zd got buff"
@@ -754,7 +1056,7 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 
 	has_page_addr =
 		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK);
-	if (n == NULL) {
+	if (buffer_size != size) {
 		if (size + sizeof(struct binder_buffer) + 4 >= buffer_size)
 			buffer_size = size; /* no room for other buffers */
 		else
@@ -764,12 +1066,30 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		(void *)PAGE_ALIGN((uintptr_t)buffer->data + buffer_size);
 	if (end_page_addr > has_page_addr)
 		end_page_addr = has_page_addr;
-	if (binder_update_page_range(proc, 1,
-	    (void *)PAGE_ALIGN((uintptr_t)buffer->data), end_page_addr, NULL))
+	start_page_addr = (void *)PAGE_ALIGN((uintptr_t)buffer->data);
+	if (binder_alloc_page_range(proc, start_page_addr, end_page_addr,
+				    buffer->data, buffer->data + data_size)) {
+		proc->alloc_stats.failed++;
 		return NULL;
+	}
+	/*
+	 * The new pages only have the parts around the payload cleared, so
+	 * fill them before the receiver can see them.
+	 */
+	if (copy_from_user(buffer->data, data, data_size)) {
+		binder_drop_page_range(proc, NULL, start_page_addr,
+				       end_page_addr);
+		return ERR_PTR(-EFAULT);
+	}
+	if (binder_insert_page_range(proc, start_page_addr, end_page_addr,
+				     NULL)) {
+		proc->alloc_stats.failed++;
+		return NULL;
+	}
 
-	rb_erase(best_fit, &proc->free_buffers);
+	binder_erase_free_buffer(proc, buffer);
 	buffer->free = 0;
+	proc->alloc_stats.allocs++;
 	binder_insert_allocated_buffer(proc, buffer);
 	if (buffer_size != size) {
 		struct binder_buffer *new_buffer = (void *)buffer->data + size;
@@ -890,7 +1210,7 @@ static void binder_free_buf(struct binder_proc *proc,
 		struct binder_buffer *next = list_entry(buffer->entry.next,
 						struct binder_buffer, entry);
 		if (next->free) {
-			rb_erase(&next->rb_node, &proc->free_buffers);
+			binder_erase_free_buffer(proc, next);
 			binder_delete_free_buffer(proc, next);
 		}
 	}
@@ -898,8 +1218,8 @@ static void binder_free_buf(struct binder_proc *proc,
 		struct binder_buffer *prev = list_entry(buffer->entry.prev,
 						struct binder_buffer, entry);
 		if (prev->free) {
+			binder_erase_free_buffer(proc, prev);
 			binder_delete_free_buffer(proc, buffer);
-			rb_erase(&prev->rb_node, &proc->free_buffers);
 			buffer = prev;
 		}
 	}
@@ -1527,7 +1847,13 @@ static void binder_transaction(struct binder_proc *proc,
 	t->flags = tr->flags;
 	t->priority = task_nice(current);
 	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
-		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
+		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY),
+		tr->data.ptr.buffer);
+	if (IS_ERR(t->buffer)) {
+		binder_user_error("binder: %d:%d got transaction with invalid "
+			"data ptr\n", proc->pid, thread->pid);
+		t->buffer = NULL;
+	}
 	if (t->buffer == NULL) {
 		return_error = BR_FAILED_REPLY;
 		goto err_binder_alloc_buf_failed;
@@ -1541,12 +1867,6 @@ static void binder_transaction(struct binder_proc *proc,
 
 	offp = (size_t *)(t->buffer->data + ALIGN(tr->data_size, sizeof(void *)));
 
-	if (copy_from_user(t->buffer->data, tr->data.ptr.buffer, tr->data_size)) {
-		binder_user_error("binder: %d:%d got transaction with invalid "
-			"data ptr\n", proc->pid, thread->pid);
-		return_error = BR_FAILED_REPLY;
-		goto err_copy_data_failed;
-	}
 	if (copy_from_user(offp, tr->data.ptr.offsets, tr->offsets_size)) {
 		binder_user_error("binder: %d:%d got transaction with invalid "
 			"offsets ptr\n", proc->pid, thread->pid);
@@ -2856,6 +3176,7 @@ err_bad_arg:
 static int binder_open(struct inode *nodp, struct file *filp)
 {
 	struct binder_proc *proc;
+	int i;
 
 	binder_debug(BINDER_DEBUG_OPEN_CLOSE, "binder_open: %d:%d\n",
 		     current->group_leader->pid, current->pid);
@@ -2863,6 +3184,8 @@ static int binder_open(struct inode *nodp, struct file *filp)
 	proc = kzalloc(sizeof(*proc), GFP_KERNEL);
 	if (proc == NULL)
 		return -ENOMEM;
+	for (i = 0; i < BINDER_FREE_CLASSES; i++)
+		INIT_LIST_HEAD(&proc->free_small[i]);
 	get_task_struct(current);
 	proc->tsk = current;
 	INIT_LIST_HEAD(&proc->todo);
@@ -3021,6 +3344,7 @@ static void binder_deferred_release(struct binder_proc *proc)
 
 	binder_stats_deleted(BINDER_STAT_PROC);
 
+	binder_retained_pages -= proc->pages_retained;
 	page_count = 0;
 	if (proc->pages) {
 		int i;
@@ -3280,6 +3604,54 @@ static char *print_binder_ref(char *buf, char *end, struct binder_ref *ref)
 	return buf;
 }
 
+/*
+ * print_binder_alloc_stats - allocator counters and free space layout.
+ * Fragmentation is the share of free space outside the largest free buffer.
+ */
+static char *print_binder_alloc_stats(char *buf, char *end,
+				      struct binder_proc *proc)
+{
+	struct binder_alloc_stats *stats = &proc->alloc_stats;
+	struct binder_buffer *buffer;
+	size_t free_size = 0, largest = 0, size;
+	int free_count = 0, i;
+	struct rb_node *n;
+
+	for (n = rb_first(&proc->free_buffers); n != NULL; n = rb_next(n)) {
+		buffer = rb_entry(n, struct binder_buffer, rb_node);
+		size = binder_buffer_size(proc, buffer);
+		free_size += size;
+		largest = max(largest, size);
+		free_count++;
+	}
+	for (i = 0; i < BINDER_FREE_CLASSES; i++) {
+		list_for_each_entry(buffer, &proc->free_small[i], class_entry) {
+			size = binder_buffer_size(proc, buffer);
+			free_size += size;
+			largest = max(largest, size);
+			free_count++;
+		}
+	}
+
+	buf += snprintf(buf, end - buf, "  alloc: allocs %u small %u "
+			"failed %u\n", stats->allocs, stats->small_allocs,
+			stats->failed);
+	if (buf >= end)
+		return buf;
+	buf += snprintf(buf, end - buf, "  pages: maps %u fills %u reuses %u "
+			"frees %u trims %u retained %d\n", stats->page_maps,
+			stats->page_fills, stats->page_reuses,
+			stats->page_frees, stats->page_trims,
+			proc->pages_retained);
+	if (buf >= end)
+		return buf;
+	buf += snprintf(buf, end - buf, "  free space: %zd in %d buffers, "
+			"largest %zd, fragmentation %zd%%\n", free_size,
+			free_count, largest, free_size ?
+			(free_size - largest) * 100 / free_size : 0);
+	return buf;
+}
+
 static char *print_binder_proc(char *buf, char *end,
 			       struct binder_proc *proc, int print_all)
 {
@@ -3332,6 +3704,8 @@ static char *print_binder_proc(char *buf, char *end,
 				"  has delivered dead binder\n");
 		break;
 	}
+	if (print_all && buf < end)
+		buf = print_binder_alloc_stats(buf, end, proc);
 	if (!print_all && buf == header_buf)
 		buf = start_buf;
 	return buf;
@@ -3480,6 +3854,9 @@ static char *print_binder_proc_stats(char *buf, char *end,
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		count++;
 	buf += snprintf(buf, end - buf, "  buffers: %d\n", count);
+	if (buf >= end)
+		return buf;
+	buf = print_binder_alloc_stats(buf, end, proc);
 	if (buf >= end)
 		return buf;
 
@@ -3727,6 +4104,59 @@ static struct miscdevice binder_miscdev = {
 	.fops = &binder_fops
 };
 
+/*
+ * Give retained pages back under memory pressure. Reclaim can run with
+ * binder_lock or a binder process's mmap_sem held (binder allocates its
+ * pages under them), so only try them.
+ */
+static int binder_shrink(int nr_to_scan, gfp_t gfp_mask)
+{
+	struct binder_proc *proc;
+	struct hlist_node *pos;
+	struct mm_struct *mm;
+	struct vm_area_struct *vma;
+	int rem;
+
+	if (nr_to_scan <= 0)
+		return binder_retained_pages;
+
+	if (!mutex_trylock(&binder_lock))
+		return -1;
+
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
+		if (nr_to_scan <= 0)
+			break;
+		if (!proc->pages_retained)
+			continue;
+
+		mm = get_task_mm(proc->tsk);
+		if (mm && !down_write_trylock(&mm->mmap_sem)) {
+			mmput(mm);
+			continue;
+		}
+		vma = proc->vma;
+		/* exiting, wait for binder_vma_close() */
+		if (vma && !mm)
+			continue;
+
+		nr_to_scan -= binder_trim_retained(proc, vma, nr_to_scan);
+
+		if (mm) {
+			up_write(&mm->mmap_sem);
+			mmput(mm);
+		}
+	}
+	rem = binder_retained_pages;
+	mutex_unlock(&binder_lock);
+
+	return rem;
+}
+
+static struct shrinker binder_shrinker = {
+	.shrink = binder_shrink,
+	.seeks = DEFAULT_SEEKS
+};
+
 static int __init binder_init(void)
 {
 	int ret;
@@ -3767,6 +4197,7 @@ static int __init binder_init(void)
 				       binder_read_proc_transaction_log,
 				       &binder_transaction_log_failed);
 	}
+	register_shrinker(&binder_shrinker);
 	return ret;
 }
 
@@ -24,10 +24,37 @@
 #include <linux/uaccess.h>
 #include <linux/poll.h>
 #include <linux/time.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/mm.h>
+#include <linux/io.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
 
+/*
+ * Size of each per-cpu staging ring. Must be a power of two and larger than
+ * LOGGER_ENTRY_MAX_LEN.
+ */
+#define LOGGER_STAGE_SIZE	(16*1024)
+
+/*
+ * struct logger_stage - per-cpu staging ring of a log
+ *
+ * Writers append whole entries here with preemption disabled and without
+ * taking log->mutex; only the owning cpu moves 'head'. The entries are moved
+ * into the log proper by merge_stages() under log->mutex, which is the only
+ * place that moves 'tail'. Both offsets are free running.
+ */
+struct logger_stage {
+	unsigned char		*buffer;	/* LOGGER_STAGE_SIZE bytes */
+	size_t			head;		/* next write offset */
+	size_t			tail;		/* next entry to merge */
+	unsigned long		nr_staged;	/* entries written here */
+};
+
 /*
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
@@ -44,6 +71,12 @@ struct logger_log {
 	size_t			w_off;	/* current write head offset */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
+	u32			w_total; /* bytes written, for mmap readers */
+	int			nr_mapped; /* readers with a control page */
+	struct logger_stage	*stage;	/* per-cpu staging rings */
+	unsigned long		nr_merged;	/* entries merged from stages */
+	unsigned long		nr_slow;	/* writes done under the mutex */
+	atomic_t		nr_contended;	/* writers that found mutex held */
 };
 
 /*
@@ -56,6 +89,7 @@ struct logger_reader {
 	struct logger_log	*log;	/* associated log */
 	struct list_head	list;	/* entry in logger_log's list */
 	size_t			r_off;	/* current read head offset */
+	struct logger_mmap_ctl	*ctl;	/* mmap control page, if mapped */
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
@@ -84,6 +118,9 @@ static inline struct logger_log *file_get_log(struct file *file)
 		return file->private_data;
 }
 
+static void merge_stages(struct logger_log *log);
+static void publish_log(struct logger_log *log);
+
 /*
  * get_entry_len - Grabs the length of the payload of the next entry starting
  * from 'off'.
@@ -166,6 +203,7 @@ start:
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
 		mutex_lock(&log->mutex);
+		merge_stages(log);
 		ret = (log->w_off == reader->r_off);
 		mutex_unlock(&log->mutex);
 		if (!ret)
@@ -315,33 +353,244 @@ static ssize_t do_write_log_from_user(struct logger_log *log,
 	return count;
 }
 
+/* stage_offset - index into a staging ring for free running offset 'n' */
+#define stage_offset(n)		((n) & (LOGGER_STAGE_SIZE - 1))
+
+/*
+ * stage_read - copy 'count' bytes at offset 'off' out of 'stage'
+ */
+static void stage_read(struct logger_stage *stage, size_t off, void *buf,
+		       size_t count)
+{
+	size_t len;
+
+	off = stage_offset(off);
+	len = min(count, LOGGER_STAGE_SIZE - off);
+	memcpy(buf, stage->buffer + off, len);
+	if (count != len)
+		memcpy(buf + len, stage->buffer, count - len);
+}
+
+/*
+ * stage_write - copy 'count' bytes from 'buf' into 'stage' at offset 'off'
+ */
+static void stage_write(struct logger_stage *stage, size_t off,
+			const void *buf, size_t count)
+{
+	size_t len;
+
+	off = stage_offset(off);
+	len = min(count, LOGGER_STAGE_SIZE - off);
+	memcpy(stage->buffer + off, buf, len);
+	if (count != len)
+		memcpy(stage->buffer, buf + len, count - len);
+}
+
+/*
+ * stage_write_from_user - like stage_write() but from user-space, without
+ * sleeping. Returns nonzero if the user buffer is not resident.
+ *
+ * Caller must have page faults disabled.
+ */
+static int stage_write_from_user(struct logger_stage *stage, size_t off,
+				 const void __user *buf, size_t count)
+{
+	size_t len;
+
+	off = stage_offset(off);
+	len = min(count, LOGGER_STAGE_SIZE - off);
+	if (len && __copy_from_user_inatomic(stage->buffer + off, buf, len))
+		return -EFAULT;
+	if (count != len &&
+	    __copy_from_user_inatomic(stage->buffer, buf + len, count - len))
+		return -EFAULT;
+
+	return 0;
+}
+
+static inline int entry_before(struct logger_entry *a, struct logger_entry *b)
+{
+	return a->sec < b->sec || (a->sec == b->sec && a->nsec < b->nsec);
+}
+
+/*
+ * merge_stages - move the entries staged by writers into the log, oldest
+ * first. Each cpu's ring is already in time order, so we only have to pick
+ * the oldest head entry among the rings. Entries staged while we run are
+ * left for the next merge so a busy writer cannot keep us here.
+ *
+ * The caller needs to hold log->mutex.
+ */
+static void merge_stages(struct logger_log *log)
+{
+	struct logger_stage *stage, *oldest;
+	struct logger_entry entry, oldest_entry;
+	size_t pending = 0, len;
+	unsigned char *buf;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		stage = per_cpu_ptr(log->stage, cpu);
+		pending += ACCESS_ONCE(stage->head) - stage->tail;
+	}
+
+	while (pending) {
+		oldest = NULL;
+		for_each_possible_cpu(cpu) {
+			stage = per_cpu_ptr(log->stage, cpu);
+			if (ACCESS_ONCE(stage->head) == stage->tail)
+				continue;
+			smp_rmb();
+			stage_read(stage, stage->tail, &entry, sizeof(entry));
+			if (!oldest || entry_before(&entry, &oldest_entry)) {
+				oldest = stage;
+				oldest_entry = entry;
+			}
+		}
+		if (!oldest)
+			break;
+
+		len = sizeof(struct logger_entry) + oldest_entry.len;
+		fix_up_readers(log, len);
+
+		/* the entry may wrap around the end of the staging ring */
+		buf = oldest->buffer + stage_offset(oldest->tail);
+		if (stage_offset(oldest->tail) + len > LOGGER_STAGE_SIZE) {
+			size_t first = LOGGER_STAGE_SIZE -
+				       stage_offset(oldest->tail);
+
+			do_write_log(log, buf, first);
+			do_write_log(log, oldest->buffer, len - first);
+		} else
+			do_write_log(log, buf, len);
+
+		/* make sure we are done with the data before the writer */
+		smp_mb();
+		oldest->tail += len;
+		log->w_total += len;
+		log->nr_merged++;
+		pending -= min(pending, len);
+	}
+
+	publish_log(log);
+}
+
+/*
+ * stage_write_entry - try to append an entry to this cpu's staging ring.
+ * Returns the payload length written, or 0 if the entry did not fit or the
+ * user buffer was not resident, in which case the caller takes the slow path.
+ */
+static ssize_t stage_write_entry(struct logger_log *log,
+				 struct logger_entry *header,
+				 const struct iovec *iov,
+				 unsigned long nr_segs, int *half_full)
+{
+	struct logger_stage *stage;
+	struct timespec now;
+	size_t head, used, len = sizeof(struct logger_entry) + header->len;
+	ssize_t ret = 0;
+	int fault = 0;
+
+	stage = per_cpu_ptr(log->stage, get_cpu());
+
+	head = stage->head;
+	used = head - ACCESS_ONCE(stage->tail);
+	if (LOGGER_STAGE_SIZE - used < len) {
+		put_cpu();
+		return 0;
+	}
+
+	/* timestamps are taken in order on each cpu */
+	now = current_kernel_time();
+	header->sec = now.tv_sec;
+	header->nsec = now.tv_nsec;
+	stage_write(stage, head, header, sizeof(struct logger_entry));
+
+	pagefault_disable();
+	while (nr_segs-- > 0) {
+		size_t seg = min_t(size_t, iov->iov_len, header->len - ret);
+
+		if (stage_write_from_user(stage, head + sizeof(*header) + ret,
+					  iov->iov_base, seg)) {
+			fault = 1;
+			break;
+		}
+		iov++;
+		ret += seg;
+	}
+	pagefault_enable();
+
+	if (unlikely(fault)) {
+		put_cpu();
+		return 0;
+	}
+
+	/* publish the entry to merge_stages() */
+	smp_wmb();
+	stage->head = head + len;
+	stage->nr_staged++;
+	*half_full = (used + len) > LOGGER_STAGE_SIZE / 2;
+	put_cpu();
+
+	return ret;
+}
+
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
  * them above all else.
+ *
+ * Entries go to a per-cpu staging ring without taking log->mutex. Readers
+ * merge the rings into the log before looking at it; writers only do so,
+ * with mutex_trylock(), once their ring is half full. Only when the ring is
+ * full or the user buffer faults do we fall back to writing under the mutex.
  */
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
+	size_t orig;
 	struct logger_entry header;
 	struct timespec now;
 	ssize_t ret = 0;
-
-	now = current_kernel_time();
+	int half_full = 0;
 
 	header.pid = current->tgid;
 	header.tid = current->pid;
-	header.sec = now.tv_sec;
-	header.nsec = now.tv_nsec;
+	header.__pad = 0;
 	header.len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
 
 	/* null writes succeed, return zero */
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
+	ret = stage_write_entry(log, &header, iov, nr_segs, &half_full);
+	if (likely(ret)) {
+		/* mmap readers only see what has been merged */
+		if ((half_full || ACCESS_ONCE(log->nr_mapped)) &&
+		    mutex_trylock(&log->mutex)) {
+			merge_stages(log);
+			mutex_unlock(&log->mutex);
+		}
+
+		/* wake up any blocked readers */
+		wake_up_interruptible(&log->wq);
+		return ret;
+	}
+
+	if (!mutex_trylock(&log->mutex)) {
+		atomic_inc(&log->nr_contended);
+		mutex_lock(&log->mutex);
+	}
+
+	/* keep the log in time order: everything staged goes first */
+	merge_stages(log);
+	log->nr_slow++;
+
+	orig = log->w_off;
+	now = current_kernel_time();
+	header.sec = now.tv_sec;
+	header.nsec = now.tv_nsec;
 
 	/*
 	 * Fix up any readers, pulling them forward to the first readable
@@ -372,6 +621,8 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 		ret += nr;
 	}
 
+	log->w_total += sizeof(struct logger_entry) + header.len;
+	publish_log(log);
 	mutex_unlock(&log->mutex);
 
 	/* wake up any blocked readers */
@@ -408,9 +659,11 @@ static int logger_open(struct inode *inode, struct file *file)
 			return -ENOMEM;
 
 		reader->log = log;
+		reader->ctl = NULL;
 		INIT_LIST_HEAD(&reader->list);
 
 		mutex_lock(&log->mutex);
+		merge_stages(log);
 		reader->r_off = log->head;
 		list_add_tail(&reader->list, &log->readers);
 		mutex_unlock(&log->mutex);
@@ -431,7 +684,15 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
+		struct logger_log *log = reader->log;
+
+		mutex_lock(&log->mutex);
 		list_del(&reader->list);
+		if (reader->ctl) {
+			free_page((unsigned long) reader->ctl);
+			log->nr_mapped--;
+		}
+		mutex_unlock(&log->mutex);
 		kfree(reader);
 	}
 
@@ -462,7 +723,13 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 	poll_wait(file, &log->wq, wait);
 
 	mutex_lock(&log->mutex);
-	if (log->w_off != reader->r_off)
+	merge_stages(log);
+	if (reader->ctl) {
+		size_t r_off = logger_offset(ACCESS_ONCE(reader->ctl->r_off));
+
+		if (log->w_off != r_off)
+			ret |= POLLIN | POLLRDNORM;
+	} else if (log->w_off != reader->r_off)
 		ret |= POLLIN | POLLRDNORM;
 	mutex_unlock(&log->mutex);
 
@@ -476,6 +743,7 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	long ret = -ENOTTY;
 
 	mutex_lock(&log->mutex);
+	merge_stages(log);
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
@@ -511,6 +779,7 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		list_for_each_entry(reader, &log->readers, list)
 			reader->r_off = log->w_off;
 		log->head = log->w_off;
+		publish_log(log);
 		ret = 0;
 		break;
 	}
@@ -520,11 +789,108 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	return ret;
 }
 
+/*
+ * publish_log - update the control pages of mmap readers after the log
+ * changed. Readers sample the page under 'seq', see logger.h.
+ *
+ * The caller needs to hold log->mutex.
+ */
+static void publish_log(struct logger_log *log)
+{
+	struct logger_reader *reader;
+	struct logger_mmap_ctl *ctl;
+
+	if (!log->nr_mapped)
+		return;
+
+	list_for_each_entry(reader, &log->readers, list) {
+		ctl = reader->ctl;
+		if (!ctl)
+			continue;
+		ctl->seq++;
+		smp_wmb();
+		ctl->w_off = log->w_off;
+		ctl->head = log->head;
+		ctl->w_total = log->w_total;
+		smp_wmb();
+		ctl->seq++;
+	}
+}
+
+/*
+ * logger_mmap_ctl - map the reader's control page, allocating it on first use
+ */
+static int logger_mmap_ctl(struct logger_reader *reader,
+			   struct vm_area_struct *vma)
+{
+	struct logger_log *log = reader->log;
+	struct logger_mmap_ctl *ctl;
+	int ret = 0;
+
+	if (vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+
+	mutex_lock(&log->mutex);
+	if (!reader->ctl) {
+		ctl = (struct logger_mmap_ctl *) get_zeroed_page(GFP_KERNEL);
+		if (!ctl) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		ctl->version = LOGGER_MMAP_VERSION;
+		ctl->size = log->size;
+		ctl->r_off = reader->r_off;
+		reader->ctl = ctl;
+		log->nr_mapped++;
+		merge_stages(log);
+		publish_log(log);
+	}
+	ret = vm_insert_page(vma, vma->vm_start, virt_to_page(reader->ctl));
+out:
+	mutex_unlock(&log->mutex);
+	return ret;
+}
+
+/*
+ * logger_mmap - the log's mmap file operation, for readers only
+ *
+ * The log buffer is mapped read-only; entries are only ever changed by the
+ * kernel. The control page is per reader and writable, see logger.h.
+ */
+static int logger_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct logger_reader *reader;
+	struct logger_log *log;
+
+	if (!(file->f_mode & FMODE_READ))
+		return -EBADF;
+
+	reader = file->private_data;
+	log = reader->log;
+
+	switch (vma->vm_pgoff) {
+	case LOGGER_MMAP_CTL_PGOFF:
+		return logger_mmap_ctl(reader, vma);
+	case LOGGER_MMAP_BUF_PGOFF:
+		if (vma->vm_end - vma->vm_start != log->size)
+			return -EINVAL;
+		if (vma->vm_flags & VM_WRITE)
+			return -EPERM;
+		vma->vm_flags &= ~VM_MAYWRITE;
+		return remap_pfn_range(vma, vma->vm_start,
+				       virt_to_phys(log->buffer) >> PAGE_SHIFT,
+				       log->size, vma->vm_page_prot);
+	}
+
+	return -EINVAL;
+}
+
 static const struct file_operations logger_fops = {
 	.owner = THIS_MODULE,
 	.read = logger_read,
 	.aio_write = logger_aio_write,
 	.poll = logger_poll,
+	.mmap = logger_mmap,
 	.unlocked_ioctl = logger_ioctl,
 	.compat_ioctl = logger_ioctl,
 	.open = logger_open,
@@ -534,10 +900,11 @@ static const struct file_operations logger_fops = {
 /*
  * Defines a log structure with name 'NAME' and a size of 'SIZE' bytes, which
  * must be a power of two, greater than LOGGER_ENTRY_MAX_LEN, and less than
- * LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
+ * LONG_MAX minus LOGGER_ENTRY_MAX_LEN. The buffer is page aligned so that
+ * readers can mmap() it.
  */
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
+static unsigned char _buf_ ## VAR[SIZE] __aligned(PAGE_SIZE); \
 static struct logger_log VAR = { \
 	.buffer = _buf_ ## VAR, \
 	.misc = { \
@@ -552,6 +919,7 @@ static struct logger_log VAR = { \
 	.w_off = 0, \
 	.head = 0, \
 	.size = SIZE, \
+	.nr_contended = ATOMIC_INIT(0), \
 };
 
 DEFINE_LOGGER_DEVICE(log_main, LOGGER_LOG_MAIN, 64*1024)
@@ -572,14 +940,101 @@ static struct logger_log *get_log_from_minor(int minor)
 	return NULL;
 }
 
+static struct dentry *logger_debugfs_dir;
+
+/*
+ * logger_stats_show - staging and contention counters of all logs, for
+ * /sys/kernel/debug/logger/stats
+ */
+static int logger_stats_show(struct seq_file *m, void *unused)
+{
+	struct logger_log *logs[] = {
+		&log_main, &log_events, &log_radio, &log_system
+	};
+	int i, cpu;
+
+	seq_printf(m, "%-12s %10s %10s %10s %10s\n", "log", "staged",
+		   "merged", "slow", "contended");
+	for (i = 0; i < ARRAY_SIZE(logs); i++) {
+		struct logger_log *log = logs[i];
+		unsigned long staged = 0;
+
+		if (!log->stage)
+			continue;
+		for_each_possible_cpu(cpu)
+			staged += per_cpu_ptr(log->stage, cpu)->nr_staged;
+
+		seq_printf(m, "%-12s %10lu %10lu %10lu %10d\n",
+			   log->misc.name, staged, log->nr_merged,
+			   log->nr_slow, atomic_read(&log->nr_contended));
+	}
+
+	return 0;
+}
+
+static int logger_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, logger_stats_show, NULL);
+}
+
+static const struct file_operations logger_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = logger_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void free_log_stages(struct logger_log *log)
+{
+	int cpu;
+
+	if (!log->stage)
+		return;
+
+	for_each_possible_cpu(cpu)
+		kfree(per_cpu_ptr(log->stage, cpu)->buffer);
+	free_percpu(log->stage);
+	log->stage = NULL;
+}
+
+static int __init init_log_stages(struct logger_log *log)
+{
+	int cpu;
+
+	log->stage = alloc_percpu(struct logger_stage);
+	if (!log->stage)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct logger_stage *stage = per_cpu_ptr(log->stage, cpu);
+
+		stage->buffer = kmalloc(LOGGER_STAGE_SIZE, GFP_KERNEL);
+		if (!stage->buffer) {
+			free_log_stages(log);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
 static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+	ret = init_log_stages(log);
+	if (unlikely(ret)) {
+		printk(KERN_ERR "logger: failed to allocate staging "
+		       "buffers for log '%s'!\n", log->misc.name);
+		return ret;
+	}
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
 		       "device for log '%s'!\n", log->misc.name);
+		free_log_stages(log);
 		return ret;
 	}
 
@@ -609,6 +1064,11 @@ static int __init logger_init(void)
 	if (unlikely(ret))
 		goto out;
 
+	logger_debugfs_dir = debugfs_create_dir("logger", NULL);
+	if (logger_debugfs_dir)
+		debugfs_create_file("stats", S_IRUGO, logger_debugfs_dir,
+				    NULL, &logger_stats_fops);
+
 out:
 	return ret;
 }
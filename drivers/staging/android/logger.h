@@ -46,4 +46,39 @@ struct logger_entry {
 #define LOGGER_GET_NEXT_ENTRY_LEN	_IO(__LOGGERIO, 3) /* next entry len */
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
 
+/*
+ * mmap() interface for readers
+ *
+ * A reader may map a control page at offset LOGGER_MMAP_CTL_PGOFF (one page,
+ * read-write) and the log buffer itself at LOGGER_MMAP_BUF_PGOFF (exactly
+ * LOGGER_GET_LOG_BUF_SIZE bytes, read-only). The kernel keeps the control
+ * page of each mapping reader up to date whenever entries are added to the
+ * log.
+ *
+ * To consume entries, sample the control page: read 'seq', retry while it is
+ * odd, read 'w_off', 'head' and 'w_total', then make sure 'seq' has not
+ * changed. Entries between the reader's position and 'w_off' are complete
+ * and may wrap around the end of the buffer. The reader counts the bytes it
+ * consumed; if 'w_total' minus that count exceeds the number of readable
+ * bytes, (w_off - head) modulo the buffer size, the reader has been lapped
+ * and must restart from 'head'. The same check after copying an entry out
+ * tells whether the copy raced with a writer.
+ *
+ * Before sleeping in poll(), store the buffer offset of the next entry to
+ * read in 'r_off'; poll() reports POLLIN when it differs from 'w_off'.
+ */
+struct logger_mmap_ctl {
+	__u32		version;	/* LOGGER_MMAP_VERSION */
+	__u32		size;		/* size of the log buffer */
+	__u32		seq;		/* odd while the kernel updates */
+	__u32		w_off;		/* end of the last complete entry */
+	__u32		head;		/* oldest readable entry */
+	__u32		w_total;	/* bytes ever written, wraps */
+	__u32		r_off;		/* written by the reader */
+};
+
+#define LOGGER_MMAP_VERSION		1
+#define LOGGER_MMAP_CTL_PGOFF		0
+#define LOGGER_MMAP_BUF_PGOFF		1
+
 #endif /* _LINUX_LOGGER_H */
@@ -0,0 +1,173 @@
+/*
+ * drivers/staging/android/logger_test.c
+ *
+ * Write stress test for the Android logger. Starts 'writers' kernel
+ * threads, spread round robin over the online cpus, each writing
+ * 'msglen' byte entries to 'device' for 'seconds' seconds, and reports
+ * the write rate per thread and in total.
+ *
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/completion.h>
+#include <linux/err.h>
+#include <linux/fs.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/uio.h>
+#include <linux/uaccess.h>
+
+static unsigned int writers = 2;
+module_param(writers, uint, 0);
+MODULE_PARM_DESC(writers, "Number of concurrent writer threads");
+
+static unsigned int seconds = 5;
+module_param(seconds, uint, 0);
+MODULE_PARM_DESC(seconds, "Duration of the run in seconds");
+
+static unsigned int msglen = 64;
+module_param(msglen, uint, 0);
+MODULE_PARM_DESC(msglen, "Message length in bytes");
+
+static char *device = "/dev/log/main";
+module_param(device, charp, 0);
+MODULE_PARM_DESC(device, "Log device to write to");
+
+struct logger_test_writer {
+	struct task_struct	*task;
+	struct completion	done;
+	unsigned long		nr_writes;
+	unsigned long		nr_errors;
+	u64			ns;
+};
+
+/*
+ * Write entries in the format liblog uses: priority byte, tag and
+ * message, each string nul terminated.
+ */
+static int logger_test_thread(void *data)
+{
+	struct logger_test_writer *w = data;
+	static const char prio = 4;
+	static const char tag[] = "logger_test";
+	unsigned long deadline;
+	struct iovec vec[3];
+	struct file *filp;
+	mm_segment_t fs;
+	ktime_t start;
+	char *msg;
+	loff_t pos;
+
+	msg = kmalloc(msglen + 1, GFP_KERNEL);
+	if (!msg)
+		goto out;
+	memset(msg, 'x', msglen);
+	msg[msglen] = '\0';
+
+	filp = filp_open(device, O_WRONLY, 0);
+	if (IS_ERR(filp)) {
+		pr_err("logger_test: cannot open %s (%ld)\n", device,
+			PTR_ERR(filp));
+		kfree(msg);
+		goto out;
+	}
+
+	vec[0].iov_base = (void __user *)&prio;
+	vec[0].iov_len = 1;
+	vec[1].iov_base = (void __user *)tag;
+	vec[1].iov_len = sizeof(tag);
+	vec[2].iov_base = (void __user *)msg;
+	vec[2].iov_len = msglen + 1;
+
+	fs = get_fs();
+	set_fs(KERNEL_DS);
+	deadline = jiffies + seconds * HZ;
+	start = ktime_get();
+	while (time_before(jiffies, deadline)) {
+		pos = 0;
+		if (vfs_writev(filp, vec, 3, &pos) < 0)
+			w->nr_errors++;
+		else
+			w->nr_writes++;
+		if (!(w->nr_writes % 256))
+			cond_resched();
+	}
+	w->ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	set_fs(fs);
+
+	filp_close(filp, NULL);
+	kfree(msg);
+out:
+	complete(&w->done);
+	return 0;
+}
+
+/* events per second for given no. of events in ns nanoseconds */
+static unsigned long rate(unsigned long n, u64 ns)
+{
+	return ns ? (unsigned long)div64_u64((u64)n * NSEC_PER_SEC, ns) : 0;
+}
+
+static int __init logger_test_init(void)
+{
+	struct logger_test_writer *w;
+	unsigned long total = 0;
+	unsigned int i;
+	int cpu = -1;
+
+	if (!writers || !seconds)
+		return -EINVAL;
+
+	w = kcalloc(writers, sizeof(*w), GFP_KERNEL);
+	if (!w)
+		return -ENOMEM;
+
+	for (i = 0; i < writers; i++) {
+		init_completion(&w[i].done);
+		w[i].task = kthread_create(logger_test_thread, &w[i],
+					   "logger_test/%u", i);
+		if (IS_ERR(w[i].task)) {
+			complete(&w[i].done);
+			continue;
+		}
+
+		cpu = cpumask_next(cpu, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_online_mask);
+		kthread_bind(w[i].task, cpu);
+	}
+
+	/* start them together */
+	for (i = 0; i < writers; i++)
+		if (!IS_ERR(w[i].task))
+			wake_up_process(w[i].task);
+
+	for (i = 0; i < writers; i++) {
+		wait_for_completion(&w[i].done);
+		pr_info("logger_test: writer %u: %lu writes, %lu errors, "
+			"%lu writes/s\n", i, w[i].nr_writes, w[i].nr_errors,
+			rate(w[i].nr_writes, w[i].ns));
+		total += rate(w[i].nr_writes, w[i].ns);
+	}
+
+	pr_info("logger_test: %s: %u writers, %u byte messages: "
+		"%lu writes/s\n", device, writers, msglen, total);
+
+	kfree(w);
+	return 0;
+}
+
+static void __exit logger_test_exit(void)
+{
+}
+
+module_init(logger_test_init);
+module_exit(logger_test_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Android logger write stress test");
@@ -16,6 +16,15 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * Processes are kept on per oom_adj lists which are updated on fork, exit
+ * and oom_adj writes, so picking a victim only looks at the highest non
+ * empty list at or above the threshold instead of walking every task. Within
+ * that list the process with the highest cost is killed: its RSS, plus its
+ * swapped out pages weighted by /sys/module/lowmemorykiller/parameters/
+ * swap_weight (percent; swap is usually compressed RAM on ramzswap), plus
+ * the pinned ashmem it maps and, with the memory controller, the amount by which
+ * its memory cgroup exceeds its soft limit.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -31,9 +40,13 @@
 
 #include <linux/module.h>
 #include <linux/kernel.h>
+#include <linux/ashmem.h>
+#include <linux/memcontrol.h>
 #include <linux/mm.h>
+#include <linux/notifier.h>
 #include <linux/oom.h>
 #include <linux/sched.h>
+#include <linux/spinlock.h>
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -50,6 +63,18 @@ static size_t lowmem_minfree[6] = {
 	16 * 1024,	/* 64MB */
 };
 static int lowmem_minfree_size = 4;
+static uint32_t lowmem_swap_weight = 50;
+
+/* One list of thread groups (signal_structs) per oom_adj value */
+#define LOWMEM_BUCKETS		(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+#define lowmem_bucket(adj)	(clamp((adj), OOM_DISABLE, OOM_ADJUST_MAX) - \
+				 OOM_DISABLE)
+
+/* Max no. of processes of one list considered per kill */
+#define LOWMEM_SCAN_MAX		32
+
+static struct list_head lowmem_buckets[LOWMEM_BUCKETS];
+static DEFINE_SPINLOCK(lowmem_lock);
 
 #define lowmem_print(level, x...)			\
 	do {						\
@@ -57,15 +82,93 @@ static int lowmem_minfree_size = 4;
 			printk(x);			\
 	} while (0)
 
+static int lowmem_oom_adj_notify(struct notifier_block *nb,
+				 unsigned long event, void *data)
+{
+	struct signal_struct *sig = ((struct task_struct *)data)->signal;
+
+	spin_lock(&lowmem_lock);
+	switch (event) {
+	case OOM_ADJ_CHANGE:
+		list_del(&sig->lowmem_node);
+		/* fall through */
+	case OOM_ADJ_FORK:
+		list_add_tail(&sig->lowmem_node,
+			      &lowmem_buckets[lowmem_bucket(sig->oom_adj)]);
+		break;
+	case OOM_ADJ_EXIT:
+		list_del(&sig->lowmem_node);
+		break;
+	}
+	spin_unlock(&lowmem_lock);
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block lowmem_oom_adj_nb = {
+	.notifier_call = lowmem_oom_adj_notify,
+};
+
+/*
+ * Find a thread of the group that still has an mm and return it with
+ * task_lock() held. The caller holds tasklist_lock.
+ */
+static struct task_struct *lowmem_lock_task_mm(struct task_struct *p)
+{
+	struct task_struct *t = p;
+
+	do {
+		task_lock(t);
+		if (t->mm)
+			return t;
+		task_unlock(t);
+	} while_each_thread(p, t);
+
+	return NULL;
+}
+
+/*
+ * Pages we expect to get back by killing p. Returns 0 if p has no mm,
+ * otherwise the cost and its resident set size in *rss.
+ */
+static int lowmem_task_cost(struct task_struct *p, int *rss)
+{
+	struct mm_struct *mm;
+	struct task_struct *t;
+	unsigned long swap, excess, ashmem;
+
+	*rss = 0;
+	t = lowmem_lock_task_mm(p);
+	if (!t)
+		return 0;
+
+	mm = t->mm;
+	*rss = get_mm_rss(mm);
+	swap = get_mm_counter(mm, MM_SWAPENTS);
+	excess = mem_cgroup_mm_soft_limit_excess(mm);
+	ashmem = ashmem_mm_pages(mm);
+	task_unlock(t);
+
+	if (*rss <= 0)
+		return 0;
+
+	return *rss + swap * lowmem_swap_weight / 100 + excess + ashmem;
+}
+
 static int lowmem_shrink(int nr_to_scan, gfp_t gfp_mask)
 {
 	struct task_struct *p;
 	struct task_struct *selected = NULL;
+	struct task_struct *candidates[LOWMEM_SCAN_MAX];
+	struct signal_struct *sig;
 	int rem = 0;
 	int tasksize;
-	int i;
+	int taskcost;
+	int i, nr;
+	int bucket;
 	int min_adj = OOM_ADJUST_MAX + 1;
 	int selected_tasksize = 0;
+	int selected_taskcost = 0;
 	int selected_oom_adj;
 	int array_size = ARRAY_SIZE(lowmem_adj);
 	int other_free = global_page_state(NR_FREE_PAGES);
@@ -96,40 +199,39 @@ static int lowmem_shrink(int nr_to_scan, gfp_t gfp_mask)
 	}
 	selected_oom_adj = min_adj;
 
+	/*
+	 * tasklist_lock keeps the groups on the lists (they are removed
+	 * on exit under the write lock) and their curr_target alive.
+	 */
 	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
-
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
+	for (bucket = LOWMEM_BUCKETS - 1;
+	     !selected && bucket >= lowmem_bucket(min_adj); bucket--) {
+		nr = 0;
+		spin_lock(&lowmem_lock);
+		list_for_each_entry(sig, &lowmem_buckets[bucket],
+				    lowmem_node) {
+			/* Unlocked hint, checked again under task_lock() */
+			if (!sig->curr_target->mm)
 				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
+			candidates[nr++] = sig->curr_target;
+			if (nr == LOWMEM_SCAN_MAX)
+				break;
+		}
+		spin_unlock(&lowmem_lock);
+
+		for (i = 0; i < nr; i++) {
+			p = candidates[i];
+			taskcost = lowmem_task_cost(p, &tasksize);
+			if (taskcost <= selected_taskcost)
 				continue;
+			selected = p;
+			selected_tasksize = tasksize;
+			selected_taskcost = taskcost;
+			selected_oom_adj = bucket + OOM_DISABLE;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, "
+				     "cost %d, to kill\n", p->pid, p->comm,
+				     selected_oom_adj, tasksize, taskcost);
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
 	}
 	if (selected) {
 		if (fatal_signal_pending(selected)) {
@@ -138,9 +240,10 @@ static int lowmem_shrink(int nr_to_scan, gfp_t gfp_mask)
 			read_unlock(&tasklist_lock);
 			return rem;
 		}
-		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
-			     selected->pid, selected->comm,
-			     selected_oom_adj, selected_tasksize);
+		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d, "
+			     "cost %d\n", selected->pid, selected->comm,
+			     selected_oom_adj, selected_tasksize,
+			     selected_taskcost);
 		force_sig(SIGKILL, selected);
 		rem -= selected_tasksize;
 	}
@@ -157,6 +260,19 @@ static struct shrinker lowmem_shrinker = {
 
 static int __init lowmem_init(void)
 {
+	struct task_struct *p;
+	int i;
+
+	for (i = 0; i < LOWMEM_BUCKETS; i++)
+		INIT_LIST_HEAD(&lowmem_buckets[i]);
+
+	/* No fork or exit can slip in between */
+	write_lock_irq(&tasklist_lock);
+	register_oom_adj_notifier(&lowmem_oom_adj_nb);
+	for_each_process(p)
+		lowmem_oom_adj_notify(&lowmem_oom_adj_nb, OOM_ADJ_FORK, p);
+	write_unlock_irq(&tasklist_lock);
+
 	register_shrinker(&lowmem_shrinker);
 	return 0;
 }
@@ -164,6 +280,7 @@ static int __init lowmem_init(void)
 static void __exit lowmem_exit(void)
 {
 	unregister_shrinker(&lowmem_shrinker);
+	unregister_oom_adj_notifier(&lowmem_oom_adj_nb);
 }
 
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
@@ -172,6 +289,7 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(swap_weight, lowmem_swap_weight, uint, S_IRUGO | S_IWUSR);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
@@ -7,8 +7,8 @@
 //#define CONFIG_SWAP_NOTIFIERS
 
 #if LINUX_VERSION_CODE <= KERNEL_VERSION(2,6,23)
-#define BIO_IO_ERROR(bio)	bio_io_error(bio, PAGE_SIZE)
-#define BIO_ENDIO(bio, error)	bio_endio(bio, PAGE_SIZE, error)
+#define BIO_IO_ERROR(bio)	bio_io_error(bio, (bio)->bi_size)
+#define BIO_ENDIO(bio, error)	bio_endio(bio, (bio)->bi_size, error)
 #else
 #define BIO_IO_ERROR(bio)	bio_io_error(bio)
 #define BIO_ENDIO(bio, error)	bio_endio(bio, error)
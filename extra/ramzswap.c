@@ -17,16 +17,21 @@
 #include <linux/bitops.h>
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
+#include <linux/crypto.h>
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
+#include <linux/ktime.h>
 #include <linux/lzo.h>
 #include <linux/mutex.h>
 #include <linux/proc_fs.h>
+#include <linux/sched.h>
 #include <linux/string.h>
 #include <linux/swap.h>
 #include <linux/swapops.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 
 #include "compat.h"
 #include "ramzswap.h"
@@ -45,6 +50,13 @@ static unsigned int MAX_CPAGE_SIZE;
 static unsigned long disksize_kb;
 static unsigned long memlimit_kb;
 static char *backing_swap;
+static char compressor[CRYPTO_MAX_ALG_NAME] = DEFAULT_COMPRESSOR;
+static unsigned int num_streams;
+static unsigned int writeback_idle_secs = DEFAULT_WB_IDLE_SECS;
+static unsigned int writeback_interval_secs = DEFAULT_WB_INTERVAL_SECS;
+static unsigned int writeback_batch = DEFAULT_WB_BATCH;
+static unsigned int compact_threshold_perc = DEFAULT_COMPACT_THRESHOLD_PERC;
+static int dedup = 1;
 
 static int __init ramzswap_init(void);
 static struct block_device_operations ramzswap_devops = {
@@ -66,15 +78,30 @@ static void clear_flag(u32 index, enum rzs_pageflags flag)
 	rzs.table[index].flags &= ~BIT(flag);
 }
 
+/*
+ * Coarse clock used for table[].atime.
+ */
+static u32 rzs_now(void)
+{
+	return (u32)div_u64(get_jiffies_64(), HZ);
+}
+
+/*
+ * Checks a word at a time, OR-ing 8 words per iteration so that the
+ * loop has no data dependent branch per word (and can be vectorized
+ * by the compiler). Non-zero pages usually bail out in the first
+ * iteration.
+ */
 static int page_zero_filled(void *ptr)
 {
-	u32 pos;
-	u64 *page;
+	unsigned long *page, *end;
 
-	page = (u64 *)ptr;
+	page = (unsigned long *)ptr;
+	end = page + PAGE_SIZE / sizeof(*page);
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	for (; page != end; page += 8) {
+		if (page[0] | page[1] | page[2] | page[3] |
+		    page[4] | page[5] | page[6] | page[7])
 			return 0;
 	}
 
@@ -119,15 +146,377 @@ static void ramzswap_flush_dcache_page(struct page *page)
 #endif
 }
 
+/*
+ * Compression backends.
+ *
+ * "lzo" calls lib/lzo directly. Any other compressor name is
+ * looked up through the crypto API (e.g. "deflate" trades speed
+ * for a better compression ratio).
+ */
+static int rzs_lzo_init(struct rzs_stream *zs, const char *name)
+{
+	zs->private = kmalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
+	return zs->private ? 0 : -ENOMEM;
+}
+
+static void rzs_lzo_destroy(struct rzs_stream *zs)
+{
+	kfree(zs->private);
+}
+
+static int rzs_lzo_compress(struct rzs_stream *zs, const unsigned char *src,
+			unsigned char *dst, size_t *dst_len)
+{
+	int ret;
+
+	ret = lzo1x_1_compress(src, PAGE_SIZE, dst, dst_len, zs->private);
+	return ret == LZO_E_OK ? 0 : ret;
+}
+
+static int rzs_lzo_decompress(struct rzs_stream *zs, const unsigned char *src,
+			size_t src_len, unsigned char *dst, size_t *dst_len)
+{
+	int ret;
+
+	ret = lzo1x_decompress_safe(src, src_len, dst, dst_len);
+	return ret == LZO_E_OK ? 0 : ret;
+}
+
+static int rzs_crypto_init(struct rzs_stream *zs, const char *name)
+{
+	struct crypto_comp *tfm;
+
+	tfm = crypto_alloc_comp(name, 0, 0);
+	if (IS_ERR(tfm))
+		return PTR_ERR(tfm);
+
+	zs->private = tfm;
+	return 0;
+}
+
+static void rzs_crypto_destroy(struct rzs_stream *zs)
+{
+	if (zs->private)
+		crypto_free_comp(zs->private);
+}
+
+static int rzs_crypto_compress(struct rzs_stream *zs,
+			const unsigned char *src, unsigned char *dst,
+			size_t *dst_len)
+{
+	int ret;
+	unsigned int dlen = 2 * PAGE_SIZE;
+
+	ret = crypto_comp_compress(zs->private, src, PAGE_SIZE, dst, &dlen);
+	*dst_len = dlen;
+	return ret;
+}
+
+static int rzs_crypto_decompress(struct rzs_stream *zs,
+			const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len)
+{
+	int ret;
+	unsigned int dlen = *dst_len;
+
+	ret = crypto_comp_decompress(zs->private, src, src_len, dst, &dlen);
+	*dst_len = dlen;
+	return ret;
+}
+
+static const struct rzs_backend rzs_backend_lzo = {
+	.name		= "lzo",
+	.init		= rzs_lzo_init,
+	.destroy	= rzs_lzo_destroy,
+	.compress	= rzs_lzo_compress,
+	.decompress	= rzs_lzo_decompress,
+};
+
+static const struct rzs_backend rzs_backend_crypto = {
+	.name		= "crypto",
+	.stream_decompress = 1,
+	.init		= rzs_crypto_init,
+	.destroy	= rzs_crypto_destroy,
+	.compress	= rzs_crypto_compress,
+	.decompress	= rzs_crypto_decompress,
+};
+
+static void free_streams(const struct rzs_backend *backend,
+			struct rzs_stream *streams, int count)
+{
+	int i;
+
+	if (!streams)
+		return;
+
+	for (i = 0; i < count; i++) {
+		struct rzs_stream *zs = &streams[i];
+
+		if (zs->private)
+			backend->destroy(zs);
+		kfree(zs->buffer);
+	}
+
+	kfree(streams);
+}
+
+/*
+ * Allocate 'count' streams of the given backend, all put on 'idle'.
+ */
+static int alloc_streams(const struct rzs_backend *backend, const char *name,
+			int count, struct rzs_stream **streamsp,
+			struct list_head *idle)
+{
+	int i, ret;
+	struct rzs_stream *streams;
+
+	streams = kzalloc(count * sizeof(*streams), GFP_KERNEL);
+	if (!streams)
+		return -ENOMEM;
+
+	for (i = 0; i < count; i++) {
+		struct rzs_stream *zs = &streams[i];
+
+		zs->id = i;
+		zs->buffer = kmalloc(2 * PAGE_SIZE, GFP_KERNEL);
+		if (!zs->buffer) {
+			ret = -ENOMEM;
+			goto fail;
+		}
+
+		ret = backend->init(zs, name);
+		if (ret) {
+			zs->private = NULL;
+			goto fail;
+		}
+
+		list_add_tail(&zs->list, idle);
+	}
+
+	*streamsp = streams;
+	return 0;
+
+fail:
+	pr_err(C "Error allocating compression stream %d\n", i);
+	free_streams(backend, streams, count);
+	return ret;
+}
+
+static void destroy_streams(void)
+{
+	free_streams(rzs.backend, rzs.streams, rzs.num_streams);
+	rzs.streams = NULL;
+	rzs.num_streams = 0;
+}
+
+static const struct rzs_backend *find_backend(const char *name)
+{
+	if (!strcmp(name, "lzo"))
+		return &rzs_backend_lzo;
+	if (crypto_has_comp(name, 0, 0))
+		return &rzs_backend_crypto;
+	return NULL;
+}
+
+/*
+ * Select compression backend and allocate compression streams:
+ * one per online CPU unless num_streams module param says otherwise.
+ */
+static int setup_streams(void)
+{
+	int ret, count;
+
+	rzs.backend = find_backend(compressor);
+	if (!rzs.backend) {
+		pr_err(C "Unknown compressor: %s\n", compressor);
+		return -EINVAL;
+	}
+	rzs.backend_name = compressor;
+
+	count = num_streams ? num_streams : num_online_cpus();
+	if (count > MAX_COMP_STREAMS)
+		count = MAX_COMP_STREAMS;
+
+	INIT_LIST_HEAD(&rzs.idle_streams);
+	spin_lock_init(&rzs.stream_lock);
+	init_waitqueue_head(&rzs.stream_wait);
+
+	ret = alloc_streams(rzs.backend, compressor, count, &rzs.streams,
+			&rzs.idle_streams);
+	if (ret)
+		return ret;
+	rzs.num_streams = count;
+
+	pr_info(C "Using %s compressor with %d streams\n",
+		rzs.backend_name, rzs.num_streams);
+	return 0;
+}
+
+/*
+ * Switch compressor at runtime. This is only possible while the
+ * device holds no compressed data and no stream is in use: stored
+ * objects could not be decompressed by another backend. New streams
+ * are set up outside rzs.lock since allocating them may swap.
+ */
+static int ramzswap_compressor_set(const char *val, struct kernel_param *kp)
+{
+	char buf[CRYPTO_MAX_ALG_NAME], *name;
+	const struct rzs_backend *backend;
+	struct rzs_stream *streams, *zs;
+	LIST_HEAD(idle);
+	int ret, count, nr_idle;
+
+	if (!val)
+		return -EINVAL;
+
+	strlcpy(buf, val, sizeof(buf));
+	name = strstrip(buf);
+	if (!*name)
+		return -EINVAL;
+
+	/* Module load: setup_streams() checks it */
+	if (!rzs.streams) {
+		strlcpy(compressor, name, sizeof(compressor));
+		return 0;
+	}
+
+	backend = find_backend(name);
+	if (!backend)
+		return -EINVAL;
+
+	count = rzs.num_streams;
+	ret = alloc_streams(backend, name, count, &streams, &idle);
+	if (ret)
+		return ret;
+
+	mutex_lock(&rzs.lock);
+	spin_lock(&rzs.stream_lock);
+
+	nr_idle = 0;
+	list_for_each_entry(zs, &rzs.idle_streams, list)
+		nr_idle++;
+
+	ret = -EBUSY;
+	if (!stats.compr_size && count == rzs.num_streams &&
+			nr_idle == count) {
+		swap(rzs.streams, streams);
+		swap(rzs.backend, backend);
+		INIT_LIST_HEAD(&rzs.idle_streams);
+		list_splice(&idle, &rzs.idle_streams);
+		strlcpy(compressor, name, sizeof(compressor));
+		ret = 0;
+	}
+
+	spin_unlock(&rzs.stream_lock);
+	mutex_unlock(&rzs.lock);
+
+	/* Old streams on success, unused new ones otherwise */
+	free_streams(backend, streams, count);
+
+	if (!ret)
+		pr_info(C "Using %s compressor with %d streams\n",
+			compressor, count);
+	return ret;
+}
+
+static int ramzswap_compressor_get(char *buffer, struct kernel_param *kp)
+{
+	return sprintf(buffer, "%s", compressor);
+}
+
+static struct rzs_stream *find_idle_stream(void)
+{
+	struct rzs_stream *zs = NULL;
+
+	spin_lock(&rzs.stream_lock);
+	if (!list_empty(&rzs.idle_streams)) {
+		zs = list_first_entry(&rzs.idle_streams,
+				struct rzs_stream, list);
+		list_del(&zs->list);
+	}
+	spin_unlock(&rzs.stream_lock);
+
+	return zs;
+}
+
+/*
+ * Get an idle compression stream, sleeping if all of them
+ * are in use.
+ */
+static struct rzs_stream *rzs_stream_get(void)
+{
+	struct rzs_stream *zs;
+
+	zs = find_idle_stream();
+	if (unlikely(!zs)) {
+		stat_inc(stats.stream_contended);
+		wait_event(rzs.stream_wait, (zs = find_idle_stream()));
+	}
+
+	stat_inc(zs->num_get);
+	return zs;
+}
+
+static void rzs_stream_put(struct rzs_stream *zs)
+{
+	spin_lock(&rzs.stream_lock);
+	list_add(&zs->list, &rzs.idle_streams);
+	spin_unlock(&rzs.stream_lock);
+
+	wake_up(&rzs.stream_wait);
+}
+
+/*
+ * Compress a page into zs->buffer.
+ */
+static int rzs_compress(struct rzs_stream *zs, const unsigned char *src,
+			size_t *clen)
+{
+	int ret;
+#if defined(STATS)
+	ktime_t start = ktime_get();
+#endif
+
+	ret = rzs.backend->compress(zs, src, zs->buffer, clen);
+
+#if defined(STATS)
+	zs->compress_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	stat_inc(zs->num_compress);
+#endif
+	return ret;
+}
+
+/*
+ * Decompress an object. zs may be NULL unless the backend
+ * needs a stream for decompression (see ramzswap_rw()).
+ */
+static int rzs_decompress(struct rzs_stream *zs, const unsigned char *src,
+			size_t src_len, unsigned char *dst, size_t *dst_len)
+{
+	int ret;
+#if defined(STATS)
+	ktime_t start = ktime_get();
+#endif
+
+	ret = rzs.backend->decompress(zs, src, src_len, dst, dst_len);
+
+#if defined(STATS)
+	stats.decompress_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+#endif
+	return ret;
+}
+
 #if defined(STATS)
 static struct proc_dir_entry *proc;
 
 static int proc_ramzswap_read(char *page, char **start, off_t off,
 				int count, int *eof, void *data)
 {
-	int len;
+	int i, len;
+	u64 pool_total, pool_used;
 	size_t succ_writes, mem_used;
 	unsigned int good_compress_perc = 0, no_compress_perc = 0;
+	unsigned int frag_perc = 0, dedup_perc = 0;
 
 	mem_used = xv_get_total_size_bytes(rzs.mem_pool)
 			+ (stats.pages_expand << PAGE_SHIFT);
@@ -190,14 +579,86 @@ static int proc_ramzswap_read(char *page, char **start, off_t off,
 		(size_t)(K(stats.compr_size)),
 		(size_t)(K(mem_used)));
 
+	pool_total = xv_get_total_size_bytes(rzs.mem_pool);
+	pool_used = xv_get_used_size_bytes(rzs.mem_pool);
+	if (pool_total)
+		frag_perc = 100 - div64_u64(pool_used * 100, pool_total);
+
+	if (stats.dedup_lookups)
+		dedup_perc = div64_u64(stats.dedup_hits * 100,
+					stats.dedup_lookups);
+
+	/* Deduplication */
+	len += sprintf(page + len,
+		"DedupLookups:	%8llu\n"
+		"DedupHits:	%8llu\n"
+		"DedupHitRate:	%8u %%\n"
+		"DedupPages:	%8u\n",
+		stats.dedup_lookups,
+		stats.dedup_hits,
+		dedup_perc,
+		stats.pages_dedup);
+
+	/* Allocator fragmentation and compaction */
+	len += sprintf(page + len,
+		"PoolPages:	%8llu\n"
+		"PoolUsed:	%8llu kB\n"
+		"Fragmentation:	%8u %%\n"
+		"CompactRuns:	%8llu\n"
+		"CompactPages:	%8llu\n"
+		"CompactMoved:	%8llu\n",
+		pool_total >> PAGE_SHIFT,
+		K(pool_used),
+		frag_perc,
+		stats.compact_runs,
+		stats.compact_pages,
+		stats.compact_moved);
+
 	if (rzs.backing_swap) {
 		/* This must always be less than ComprDataSize */
 		len += sprintf(page + len,
 			"BDevNumReads:	%8llu\n"
-			"BDevNumWrites:	%8llu\n",
+			"BDevNumWrites:	%8llu\n"
+			"WritebackPages:	%8llu\n"
+			"WritebackBios:	%8llu\n"
+			"WritebackErrors:%8llu\n",
 			stats.bdev_num_reads,
-			stats.bdev_num_writes);
+			stats.bdev_num_writes,
+			stats.wb_pages,
+			stats.wb_bios,
+			stats.wb_errors);
+	}
+
+	/* Request sizes, in pages per bio */
+	len += sprintf(page + len,
+		"BioPages:	%8llu %8llu %8llu %8llu %8llu %8llu\n",
+		stats.bio_pages[0], stats.bio_pages[1], stats.bio_pages[2],
+		stats.bio_pages[3], stats.bio_pages[4], stats.bio_pages[5]);
+
+	/* Compression streams, replaced under rzs.lock */
+	mutex_lock(&rzs.lock);
+	len += sprintf(page + len,
+		"Compressor:	%8s\n"
+		"CompStreams:	%8d\n"
+		"StreamContended:%8llu\n"
+		"DecompressTime:	%8llu us\n",
+		rzs.backend_name,
+		rzs.num_streams,
+		stats.stream_contended,
+		div_u64(stats.decompress_ns, NSEC_PER_USEC));
+
+	for (i = 0; i < rzs.num_streams; i++) {
+		struct rzs_stream *zs = &rzs.streams[i];
+
+		if (len > PAGE_SIZE - 128)
+			break;
+		len += sprintf(page + len,
+			"Stream%-2d:	%8llu used %8llu compressed "
+			"%8llu us\n",
+			zs->id, zs->num_get, zs->num_compress,
+			div_u64(zs->compress_ns, NSEC_PER_USEC));
 	}
+	mutex_unlock(&rzs.lock);
 
 	return len;
 }
@@ -271,28 +732,120 @@ out:
 }
 
 /*
- * Check if request is within bounds and page aligned.
+ * Check if request is within bounds and made of whole,
+ * page aligned pages. Swap readahead sends a cluster of
+ * consecutive pages in a single bio.
  */
 static inline int valid_swap_request(struct bio *bio)
 {
+	int i;
+	struct bio_vec *bvec;
+
 	if (unlikely(
-		(bio->bi_sector >= (rzs.disksize >> SECTOR_SHIFT)) ||
+		!bio->bi_size ||
 		(bio->bi_sector & (SECTORS_PER_PAGE - 1)) ||
-		(bio->bi_vcnt != 1) ||
-		(bio->bi_size != PAGE_SIZE) ||
-		(bio->bi_io_vec[0].bv_offset != 0))) {
+		(bio->bi_sector + (bio->bi_size >> SECTOR_SHIFT) >
+					(rzs.disksize >> SECTOR_SHIFT)) ||
+		(bio->bi_size != bio_segments(bio) << PAGE_SHIFT))) {
 
 		return 0;
 	}
 
+	bio_for_each_segment(bvec, bio, i) {
+		if (unlikely(bvec->bv_len != PAGE_SIZE || bvec->bv_offset))
+			return 0;
+	}
+
 	/* swap request is valid */
 	return 1;
 }
 
+/*
+ * Deduplication.
+ *
+ * Identical pages compress to identical data, so a hash of the
+ * compressed data is used to find an already stored copy. Entries
+ * sharing an object all point to it directly (readers do not care)
+ * and sit on the same hash chain, which lets compaction find and
+ * update all of them when the object moves. Object refcount lives
+ * in table[].count of the entry its back-reference points to. All of
+ * this runs under rzs.lock.
+ */
+static u32 *dedup_bucket(u32 hash)
+{
+	return &rzs.dedup_hash[hash & (rzs.dedup_buckets - 1)];
+}
+
+static void dedup_add(u32 index, u32 hash)
+{
+	u32 *head = dedup_bucket(hash);
+
+	rzs.dedup[index].hash = hash;
+	rzs.dedup[index].next = *head;
+	*head = index;
+}
+
+static void dedup_del(u32 index)
+{
+	u32 *p = dedup_bucket(rzs.dedup[index].hash);
+
+	while (*p && *p != index)
+		p = &rzs.dedup[*p].next;
+
+	if (*p)
+		*p = rzs.dedup[index].next;
+	rzs.dedup[index].next = 0;
+}
+
+/*
+ * Find a stored object with same compressed data. Returns index of
+ * a table entry pointing to it, or 0 if not found.
+ */
+static u32 dedup_find(u32 hash, const unsigned char *data, size_t clen)
+{
+	u32 i;
+	int match;
+	struct zobj_header *zheader;
+
+	for (i = *dedup_bucket(hash); i; i = rzs.dedup[i].next) {
+		if (rzs.dedup[i].hash != hash)
+			continue;
+
+		zheader = get_ptr_atomic(rzs.table[i].pagenum,
+				rzs.table[i].offset, KM_USER1);
+		match = rzs.table[zheader->table_idx].count <
+				DEDUP_MAX_REFCOUNT &&
+			xv_get_object_size(zheader) - sizeof(*zheader) == clen &&
+			!memcmp(zheader + 1, data, clen);
+		put_ptr_atomic(zheader, KM_USER1);
+
+		if (match)
+			return i;
+	}
+
+	return 0;
+}
+
+/*
+ * Find another entry sharing object <pagenum, offset> on given chain.
+ */
+static u32 dedup_find_sharer(u32 hash, u32 pagenum, u32 offset)
+{
+	u32 i;
+
+	for (i = *dedup_bucket(hash); i; i = rzs.dedup[i].next)
+		if (rzs.table[i].pagenum == pagenum &&
+				rzs.table[i].offset == offset)
+			return i;
+
+	return 0;
+}
+
 static void ramzswap_free_page(size_t index)
 {
-	u32 clen;
-	void *obj;
+	u32 clen, owner;
+	u8 refcount;
+	struct zobj_header *zheader;
 
 	u32 pagenum = rzs.table[index].pagenum;
 	u32 offset = rzs.table[index].offset;
@@ -313,20 +866,68 @@ static void ramzswap_free_page(size_t index)
 		goto out;
 	}
 
-	obj = get_ptr_atomic(pagenum, offset, KM_USER0);
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	put_ptr_atomic(obj, KM_USER0);
+	zheader = get_ptr_atomic(pagenum, offset, KM_USER0);
+	clen = xv_get_object_size(zheader) - sizeof(*zheader);
+	owner = zheader->table_idx;
+	put_ptr_atomic(zheader, KM_USER0);
+
+	refcount = --rzs.table[owner].count;
 
-	xv_free(rzs.mem_pool, pagenum, offset);
 	stat_dec_if_less(stats.good_compress, clen, PAGE_SIZE / 2 + 1);
 
+	if (rzs.dedup)
+		dedup_del(index);
+
+	/* Object still used by other entries (only with dedup) */
+	if (refcount) {
+		/* Hand back-reference and refcount over to a sharer */
+		if (owner == index) {
+			u32 sharer = dedup_find_sharer(rzs.dedup[index].hash,
+						pagenum, offset);
+
+			zheader = get_ptr_atomic(pagenum, offset, KM_USER0);
+			zheader->table_idx = sharer;
+			put_ptr_atomic(zheader, KM_USER0);
+			rzs.table[sharer].count = refcount;
+		}
+
+		stat_dec(stats.pages_dedup);
+		clen = 0;
+		goto out;
+	}
+
+	xv_free(rzs.mem_pool, pagenum, offset);
+
 out:
 	stats.compr_size -= clen;
 	stat_dec(stats.pages_stored);
 
 	rzs.table[index].pagenum = 0;
 	rzs.table[index].offset = 0;
+	rzs.table[index].count = 0;
+}
+
+#if defined(CONFIG_SWAP_FREE_NOTIFY) || defined(CONFIG_SWAP_NOTIFIERS)
+/*
+ * Free the page at a swap slot that is no longer used. Swap free
+ * notifiers are called with swap_lock held, so we cannot sleep on
+ * rzs.lock here: if it is busy, or writeback still owns the slot,
+ * leave the page alone. The next write to this slot frees it.
+ */
+static void ramzswap_notify_free(size_t index)
+{
+	if (!mutex_trylock(&rzs.lock))
+		return;
+
+	if ((rzs.table[index].pagenum || test_flag(index, RZS_ZERO)) &&
+			!test_flag(index, RZS_WRITEBACK)) {
+		ramzswap_free_page(index);
+		stat_inc(stats.notify_free);
+	}
+
+	mutex_unlock(&rzs.lock);
 }
+#endif
 
 #ifdef CONFIG_SWAP_FREE_NOTIFY
 /*
@@ -335,38 +936,33 @@ out:
  */
 static void ramzswap_free_notify(unsigned long index)
 {
-	if (rzs.table[index].pagenum) {
-		ramzswap_free_page(index);
-		stat_inc(rzs.stats.notify_free);
-	}
+	ramzswap_notify_free(index);
 }
 #endif
 
-int handle_zero_page(struct bio *bio)
+/*
+ * Per-page result of a bio segment: done in memory, or to be
+ * forwarded to backing swap. Negative values are errors.
+ */
+#define RZS_IO_DONE	0
+#define RZS_IO_FORWARD	1
+
+static int handle_zero_page(struct page *page)
 {
 	void *user_mem;
-	struct page *page = bio->bi_io_vec[0].bv_page;
 
 	user_mem = get_ptr_atomic(page_to_pfn(page), 0, KM_USER0);
 	memset(user_mem, 0, PAGE_SIZE);
 	put_ptr_atomic(user_mem, KM_USER0);
 
 	ramzswap_flush_dcache_page(page);
-
-	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	BIO_ENDIO(bio, 0);
-	return 0;
+	return RZS_IO_DONE;
 }
 
-int handle_uncompressed_page(struct bio *bio)
+static int handle_uncompressed_page(struct page *page, u32 index)
 {
-	u32 index;
-	struct page *page;
 	unsigned char *user_mem, *cmem;
 
-	page = bio->bi_io_vec[0].bv_page;
-	index = bio->bi_sector >>SECTORS_PER_PAGE_SHIFT;
-
 	user_mem = get_ptr_atomic(page_to_pfn(page), 0, KM_USER0);
 	cmem = get_ptr_atomic(rzs.table[index].pagenum,
 			rzs.table[index].offset, KM_USER1);
@@ -376,10 +972,7 @@ int handle_uncompressed_page(struct bio *bio)
 	put_ptr_atomic(cmem, KM_USER1);
 
 	ramzswap_flush_dcache_page(page);
-
-	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	BIO_ENDIO(bio, 0);
-	return 0;
+	return RZS_IO_DONE;
 }
 
 
@@ -390,10 +983,9 @@ int handle_uncompressed_page(struct bio *bio)
  * to this location - this happens due to readahead when
  * swap device is read from user-space (e.g. during swapon)
  */
-int handle_ramzswap_fault(struct bio *bio)
+static int handle_ramzswap_fault(struct page *page, u32 index)
 {
 	void *user_mem;
-	struct page *page = bio->bi_io_vec[0].bv_page;
 
 	/*
 	 * Always forward such requests to backing swap
@@ -402,33 +994,26 @@ int handle_ramzswap_fault(struct bio *bio)
 	if (rzs.backing_swap) {
 		stat_dec(stats.num_reads);
 		stat_inc(stats.bdev_num_reads);
-		bio->bi_bdev = rzs.backing_swap;
-		return 1;
+		return RZS_IO_FORWARD;
 	}
 
 	/*
 	 * Its unlikely event in case backing dev is
 	 * not present
 	 */
-	pr_debug(C "Read before write on swap device: "
-		"sector=%lu, size=%u, offset=%u\n",
-		(ulong)(bio->bi_sector), bio->bi_size,
-		bio->bi_io_vec[0].bv_offset);
+	pr_debug(C "Read before write on swap device: page=%u\n", index);
 	user_mem = kmap(page);
 	memset(user_mem, 0, PAGE_SIZE);
 	kunmap(page);
 
-	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	BIO_ENDIO(bio, 0);
-	return 0;
+	return RZS_IO_DONE;
 }
 
 #ifdef CONFIG_SWAP_NOTIFIERS
 static int ramzswap_slot_free_notify(struct notifier_block *self,
 			unsigned long index, void *swap_file)
 {
-	ramzswap_free_page(index);
-	stat_inc(stats.notify_free);
+	ramzswap_notify_free(index);
 	return 0;
 }
 
@@ -461,231 +1046,833 @@ static int ramzswap_swapoff_notify(struct notifier_block *self,
 	struct block_device *bdev;
 	struct inode *inode;
 
-	inode = ((struct file *)swap_file)->f_mapping->host;
-	bdev = I_BDEV(inode);
-	if ((struct ramzswap *)(bdev->bd_disk->private_data) != &rzs)
-		return 0;
+	inode = ((struct file *)swap_file)->f_mapping->host;
+	bdev = I_BDEV(inode);
+	if ((struct ramzswap *)(bdev->bd_disk->private_data) != &rzs)
+		return 0;
+
+	unregister_swap_event_notifier(&ramzswap_slot_free_nb,
+				SWAP_EVENT_SLOT_FREE, swap_id);
+	return 0;
+}
+
+static struct notifier_block ramzswap_swapon_nb = {
+	.notifier_call = ramzswap_swapon_notify
+};
+
+static struct notifier_block ramzswap_swapoff_nb = {
+	.notifier_call = ramzswap_swapoff_notify
+};
+#endif
+
+/*
+ * Caller holds rzs.move_lock for read and, if the backend needs
+ * one for decompression, a stream.
+ */
+static int ramzswap_read_page(struct rzs_stream *zs, struct page *page,
+			u32 index)
+{
+	int ret;
+	size_t clen;
+	struct zobj_header *zheader;
+	unsigned char *user_mem, *cmem;
+
+	stat_inc(stats.num_reads);
+
+	if (test_flag(index, RZS_ZERO))
+		return handle_zero_page(page);
+
+	/* Requested page is not present in compressed area */
+	if (!rzs.table[index].pagenum)
+		return handle_ramzswap_fault(page, index);
+
+	rzs.table[index].atime = rzs_now();
+
+	/* Page is stored uncompressed since its incompressible */
+	if (unlikely(test_flag(index, RZS_UNCOMPRESSED)))
+		return handle_uncompressed_page(page, index);
+
+	user_mem = get_ptr_atomic(page_to_pfn(page), 0, KM_USER0);
+	clen = PAGE_SIZE;
+
+	cmem = get_ptr_atomic(rzs.table[index].pagenum,
+			rzs.table[index].offset, KM_USER1);
+
+	ret = rzs_decompress(zs,
+		cmem + sizeof(*zheader),
+		xv_get_object_size(cmem) - sizeof(*zheader),
+		user_mem, &clen);
+
+	put_ptr_atomic(user_mem, KM_USER0);
+	put_ptr_atomic(cmem, KM_USER1);
+
+	/* should NEVER happen */
+	if (unlikely(ret)) {
+		pr_err(C "Decompression failed! err=%d, page=%u\n",
+			ret, index);
+		stat_inc(stats.failed_reads);
+		return -EIO;
+	}
+
+	ramzswap_flush_dcache_page(page);
+	return RZS_IO_DONE;
+}
+
+/*
+ * The stream is taken on first use and kept in *zsp for the
+ * remaining pages of the bio; the caller releases it.
+ */
+static int ramzswap_write_page(struct rzs_stream **zsp, struct page *page,
+			size_t index)
+{
+	int ret;
+	u32 offset, hash = 0, dup;
+	size_t clen;
+	struct zobj_header *zheader;
+	struct page *page_store;
+	unsigned char *user_mem, *cmem, *src;
+
+	stat_inc(stats.num_writes);
+
+	/*
+	 * System swaps to same sector again when the stored page
+	 * is no longer referenced by any process. So, its now safe
+	 * to free the memory that was allocated for this page.
+	 * Done under rzs.lock to serialize against writeback. A
+	 * writeback bio still in flight for this sector must land
+	 * before the new data can be forwarded to the same sector.
+	 */
+	mutex_lock(&rzs.lock);
+	while (unlikely(test_flag(index, RZS_WRITEBACK))) {
+		mutex_unlock(&rzs.lock);
+		wait_event(rzs.wb_wait, !test_flag(index, RZS_WRITEBACK));
+		mutex_lock(&rzs.lock);
+	}
+	if (rzs.table[index].pagenum)
+		ramzswap_free_page(index);
+
+	/*
+	 * No memory ia allocated for zero filled pages.
+	 * Simply clear zero page flag.
+	 */
+	if (test_flag(index, RZS_ZERO)) {
+		stat_dec(stats.pages_zero);
+		clear_flag(index, RZS_ZERO);
+	}
+	mutex_unlock(&rzs.lock);
+
+	user_mem = get_ptr_atomic(page_to_pfn(page), 0, KM_USER0);
+	if (page_zero_filled(user_mem)) {
+		put_ptr_atomic(user_mem, KM_USER0);
+		stat_inc(stats.pages_zero);
+		set_flag(index, RZS_ZERO);
+		return RZS_IO_DONE;
+	}
+	put_ptr_atomic(user_mem, KM_USER0);
+
+	if (rzs.backing_swap &&
+		(stats.compr_size > rzs.memlimit - PAGE_SIZE)) {
+		/* Make room by pushing out cold pages */
+		queue_work(rzs.wb_workqueue, &rzs.wb_kick);
+		goto forward;
+	}
+
+	/*
+	 * Compression runs outside rzs.lock using a private stream,
+	 * so writers on different CPUs do not serialize here.
+	 */
+	if (!*zsp)
+		*zsp = rzs_stream_get();
+	src = (*zsp)->buffer;
+
+	user_mem = get_ptr_atomic(page_to_pfn(page), 0, KM_USER0);
+	ret = rzs_compress(*zsp, user_mem, &clen);
+	put_ptr_atomic(user_mem, KM_USER0);
+
+	if (unlikely(ret)) {
+		pr_err(C "Compression failed! err=%d\n", ret);
+		stat_inc(stats.failed_writes);
+		return -EIO;
+	}
+
+	/*
+	 * Page is incompressible. Forward it to backing swap
+	 * if present. Otherwise, store it as-is (uncompressed)
+	 * since we do not want to return too many swap write
+	 * errors which has side effect of hanging the system.
+	 */
+	if (unlikely(clen > MAX_CPAGE_SIZE)) {
+		if (rzs.backing_swap)
+			goto forward;
+
+		clen = PAGE_SIZE;
+		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
+		if (unlikely(!page_store)) {
+			stat_inc(stats.failed_writes);
+			return -ENOMEM;
+		}
+
+		mutex_lock(&rzs.lock);
+		offset = 0;
+		set_flag(index, RZS_UNCOMPRESSED);
+		stat_inc(stats.pages_expand);
+		rzs.table[index].pagenum = page_to_pfn(page_store);
+		src = get_ptr_atomic(page_to_pfn(page), 0, KM_USER0);
+		goto memstore;
+	}
+
+	if (rzs.dedup)
+		hash = jhash(src, clen, 0);
+
+	mutex_lock(&rzs.lock);
+
+	if (rzs.dedup) {
+		stat_inc(stats.dedup_lookups);
+		dup = dedup_find(hash, src, clen);
+		if (dup) {
+			stat_inc(stats.dedup_hits);
+			goto dedupstore;
+		}
+	}
+
+	if (xv_malloc(rzs.mem_pool, clen + sizeof(*zheader),
+			&rzs.table[index].pagenum, &offset,
+			GFP_NOIO | __GFP_HIGHMEM)) {
+		mutex_unlock(&rzs.lock);
+		pr_info(C "Error allocating memory for compressed "
+			"page: %zu, size=%zu\n", index, clen);
+		stat_inc(stats.failed_writes);
+		if (rzs.backing_swap)
+			goto forward;
+		return -ENOMEM;
+	}
+
+memstore:
+	rzs.table[index].offset = offset;
+
+	cmem = get_ptr_atomic(rzs.table[index].pagenum,
+			rzs.table[index].offset, KM_USER1);
+
+	/* Back-reference needed for writeback and defragmentation */
+	if (!test_flag(index, RZS_UNCOMPRESSED)) {
+		zheader = (struct zobj_header *)cmem;
+		zheader->table_idx = index;
+		rzs.table[index].count = 1;
+		cmem += sizeof(*zheader);
+		if (rzs.dedup)
+			dedup_add(index, hash);
+	}
+
+	memcpy(cmem, src, clen);
+
+	put_ptr_atomic(cmem, KM_USER1);
+	if (unlikely(test_flag(index, RZS_UNCOMPRESSED)))
+		put_ptr_atomic(src, KM_USER0);
+
+	stats.compr_size += clen;
+	goto stored;
+
+dedupstore:
+	/* Share object already stored for table entry 'dup' */
+	rzs.table[index].pagenum = rzs.table[dup].pagenum;
+	rzs.table[index].offset = rzs.table[dup].offset;
+
+	zheader = get_ptr_atomic(rzs.table[index].pagenum,
+			rzs.table[index].offset, KM_USER1);
+	rzs.table[zheader->table_idx].count++;
+	put_ptr_atomic(zheader, KM_USER1);
+
+	dedup_add(index, hash);
+	stat_inc(stats.pages_dedup);
+
+stored:
+	rzs.table[index].atime = rzs_now();
+
+	/* Update stats */
+	stat_inc(stats.pages_stored);
+	stat_inc_if_less(stats.good_compress, clen, PAGE_SIZE / 2 + 1);
+
+	mutex_unlock(&rzs.lock);
+	return RZS_IO_DONE;
+
+forward:
+	stat_inc(stats.bdev_num_writes);
+	return RZS_IO_FORWARD;
+}
+
+/*
+ * Cold page writeback.
+ *
+ * Pages not accessed for writeback_idle_secs are decompressed into
+ * bounce pages and written to the backing swap device at the same
+ * offset. Sector numbers of ramzswap and the backing device match,
+ * so once the in-memory copy is freed, reads for that page are
+ * forwarded to the backing device by handle_ramzswap_fault().
+ *
+ * While I/O is in flight the page is marked RZS_WRITEBACK and is
+ * still served from memory. It may be freed meanwhile, but writes to
+ * it wait for the flag to clear, so a bio of ours can never land on
+ * top of newer data. The in-memory copy is freed with rzs.move_lock
+ * held for write since readers only hold that lock.
+ */
+static int writeback_fill_page(struct rzs_stream *zs, u32 index,
+			struct page *page)
+{
+	int ret = 0;
+	size_t clen = PAGE_SIZE;
+	struct zobj_header *zheader;
+	unsigned char *user_mem, *cmem;
+
+	user_mem = get_ptr_atomic(page_to_pfn(page), 0, KM_USER0);
+	cmem = get_ptr_atomic(rzs.table[index].pagenum,
+			rzs.table[index].offset, KM_USER1);
+
+	if (unlikely(test_flag(index, RZS_UNCOMPRESSED))) {
+		memcpy(user_mem, cmem, PAGE_SIZE);
+		goto out;
+	}
+
+	/* Back-reference points to this entry or to one sharing it */
+	zheader = (struct zobj_header *)cmem;
+	if (unlikely(rzs.table[zheader->table_idx].pagenum !=
+				rzs.table[index].pagenum ||
+			rzs.table[zheader->table_idx].offset !=
+				rzs.table[index].offset)) {
+		pr_err(C "Bad back-reference: page=%u, table_idx=%u\n",
+			index, zheader->table_idx);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	ret = rzs_decompress(zs, cmem + sizeof(*zheader),
+		xv_get_object_size(cmem) - sizeof(*zheader),
+		user_mem, &clen);
+
+out:
+	put_ptr_atomic(user_mem, KM_USER0);
+	put_ptr_atomic(cmem, KM_USER1);
+	return ret;
+}
+
+static void writeback_end_io(struct bio *bio, int error)
+{
+	if (error || !test_bit(BIO_UPTODATE, &bio->bi_flags))
+		rzs.wb_error = 1;
+
+	bio_put(bio);
+	if (atomic_dec_and_test(&rzs.wb_pending))
+		complete(&rzs.wb_done);
+}
+
+static void writeback_submit(struct bio *bio)
+{
+	atomic_inc(&rzs.wb_pending);
+	stat_inc(stats.wb_bios);
+	submit_bio(WRITE, bio);
+}
+
+/*
+ * Write out wb_pages[0..nr-1]. Runs of consecutive table indices
+ * go out as a single multi-page bio.
+ */
+static void writeback_submit_batch(int nr)
+{
+	int i;
+	struct bio *bio = NULL;
+
+	rzs.wb_error = 0;
+	atomic_set(&rzs.wb_pending, 1);
+	INIT_COMPLETION(rzs.wb_done);
+
+	for (i = 0; i < nr; i++) {
+		u32 index = rzs.wb_index[i];
+
+		if (bio && (rzs.wb_index[i - 1] + 1 != index ||
+			bio_add_page(bio, rzs.wb_pages[i], PAGE_SIZE, 0)
+							!= PAGE_SIZE)) {
+			writeback_submit(bio);
+			bio = NULL;
+		}
+
+		if (bio)
+			continue;
+
+		bio = bio_alloc(GFP_NOIO, nr - i);
+		bio->bi_bdev = rzs.backing_swap;
+		bio->bi_sector = (sector_t)index << SECTORS_PER_PAGE_SHIFT;
+		bio->bi_end_io = writeback_end_io;
+		bio_add_page(bio, rzs.wb_pages[i], PAGE_SIZE, 0);
+	}
+
+	if (bio)
+		writeback_submit(bio);
+
+	blk_unplug(bdev_get_queue(rzs.backing_swap));
+
+	/* Drop our initial reference and wait for all bios */
+	if (!atomic_dec_and_test(&rzs.wb_pending))
+		wait_for_completion(&rzs.wb_done);
+}
+
+/*
+ * Write back one batch of pages not accessed for idle seconds.
+ * Returns no. of pages freed.
+ */
+static int writeback_cold_pages(u32 idle)
+{
+	int i, nr = 0;
+	size_t scanned, num_pages;
+	u32 index, now;
+	struct rzs_stream *zs = NULL;
+
+	num_pages = rzs.disksize >> PAGE_SHIFT;
+	now = rzs_now();
+
+	if (rzs.backend->stream_decompress)
+		zs = rzs_stream_get();
+
+	/* Index 0 is the swap header, never written back */
+	for (scanned = 1; scanned < num_pages; scanned++) {
+		index = rzs.wb_cursor;
+		if (++rzs.wb_cursor >= num_pages)
+			rzs.wb_cursor = 1;
+
+		if (!rzs.table[index].pagenum ||
+			now - rzs.table[index].atime < idle)
+			continue;
+
+		mutex_lock(&rzs.lock);
+		if (rzs.table[index].pagenum &&
+			!test_flag(index, RZS_WRITEBACK) &&
+			!writeback_fill_page(zs, index, rzs.wb_pages[nr])) {
+			set_flag(index, RZS_WRITEBACK);
+			rzs.wb_index[nr++] = index;
+		}
+		mutex_unlock(&rzs.lock);
+
+		if (nr == writeback_batch)
+			break;
+
+		if (!(scanned % 1024))
+			cond_resched();
+	}
+
+	if (zs)
+		rzs_stream_put(zs);
+
+	if (!nr)
+		return 0;
+
+	writeback_submit_batch(nr);
+
+	mutex_lock(&rzs.lock);
+	down_write(&rzs.move_lock);
+	for (i = 0; i < nr; i++) {
+		index = rzs.wb_index[i];
+		/* Not rewritten meanwhile, so this is still our data */
+		if (!rzs.wb_error && rzs.table[index].pagenum) {
+			ramzswap_free_page(index);
+			stat_inc(stats.wb_pages);
+		}
+		clear_flag(index, RZS_WRITEBACK);
+	}
+	up_write(&rzs.move_lock);
+	mutex_unlock(&rzs.lock);
+	wake_up_all(&rzs.wb_wait);
+
+	if (rzs.wb_error) {
+		pr_err(C "Error writing back %d pages\n", nr);
+		stat_inc(stats.wb_errors);
+		return 0;
+	}
+
+	return nr;
+}
+
+static void ramzswap_writeback_work(struct work_struct *work)
+{
+	writeback_cold_pages(writeback_idle_secs);
+
+	if (writeback_interval_secs)
+		queue_delayed_work(rzs.wb_workqueue, &rzs.wb_work,
+				writeback_interval_secs * HZ);
+}
+
+/*
+ * Queued by writers once memlimit is reached. Idle time does not
+ * matter then: push pages out, in scan order, until under the limit.
+ */
+static void ramzswap_writeback_kick(struct work_struct *work)
+{
+	while (stats.compr_size > rzs.memlimit - PAGE_SIZE &&
+		writeback_cold_pages(0))
+		cond_resched();
+}
+
+static void destroy_writeback(void)
+{
+	int i;
+
+	if (rzs.wb_workqueue) {
+		cancel_delayed_work_sync(&rzs.wb_work);
+		cancel_work_sync(&rzs.wb_kick);
+		destroy_workqueue(rzs.wb_workqueue);
+		rzs.wb_workqueue = NULL;
+	}
+
+	if (rzs.wb_pages) {
+		for (i = 0; i < writeback_batch; i++)
+			if (rzs.wb_pages[i])
+				__free_page(rzs.wb_pages[i]);
+		kfree(rzs.wb_pages);
+		rzs.wb_pages = NULL;
+	}
+
+	kfree(rzs.wb_index);
+	rzs.wb_index = NULL;
+}
+
+/*
+ * Bounce pages are allocated upfront since writeback typically
+ * runs when we are already short on memory.
+ */
+static int setup_writeback(void)
+{
+	int i;
+
+	if (!writeback_batch)
+		writeback_batch = DEFAULT_WB_BATCH;
+	if (writeback_batch > BIO_MAX_PAGES)
+		writeback_batch = BIO_MAX_PAGES;
+
+	rzs.wb_pages = kzalloc(writeback_batch * sizeof(*rzs.wb_pages),
+				GFP_KERNEL);
+	rzs.wb_index = kzalloc(writeback_batch * sizeof(*rzs.wb_index),
+				GFP_KERNEL);
+	if (!rzs.wb_pages || !rzs.wb_index)
+		goto fail;
+
+	for (i = 0; i < writeback_batch; i++) {
+		rzs.wb_pages[i] = alloc_page(GFP_KERNEL | __GFP_HIGHMEM);
+		if (!rzs.wb_pages[i])
+			goto fail;
+	}
 
-	unregister_swap_event_notifier(&ramzswap_slot_free_nb,
-				SWAP_EVENT_SLOT_FREE, swap_id);
-	return 0;
-}
+	rzs.wb_cursor = 1;
+	init_completion(&rzs.wb_done);
+	init_waitqueue_head(&rzs.wb_wait);
+	INIT_DELAYED_WORK(&rzs.wb_work, ramzswap_writeback_work);
+	INIT_WORK(&rzs.wb_kick, ramzswap_writeback_kick);
 
-static struct notifier_block ramzswap_swapon_nb = {
-	.notifier_call = ramzswap_swapon_notify
-};
+	rzs.wb_workqueue = create_singlethread_workqueue("ramzswap_wb");
+	if (!rzs.wb_workqueue)
+		goto fail;
 
-static struct notifier_block ramzswap_swapoff_nb = {
-	.notifier_call = ramzswap_swapoff_notify
-};
-#endif
+	if (writeback_interval_secs)
+		queue_delayed_work(rzs.wb_workqueue, &rzs.wb_work,
+				writeback_interval_secs * HZ);
+	return 0;
+
+fail:
+	pr_err(C "Error allocating writeback resources\n");
+	destroy_writeback();
+	return -ENOMEM;
+}
 
-int ramzswap_read(struct bio *bio)
+/*
+ * Compaction.
+ *
+ * xvmalloc pages end up pinned by a few small live objects after
+ * swap churn. Compaction empties such pages by moving their objects
+ * into free space elsewhere in the pool, using the zobj_header
+ * back-reference to update the table entry.
+ */
+static int ramzswap_move_object(struct xv_pool *pool, u32 pagenum,
+			u32 offset, void *priv)
 {
-	int ret;
-	u32 index;
-	size_t clen;
-	struct page *page;
+	u32 size, index, new_pagenum, new_offset;
 	struct zobj_header *zheader;
-	unsigned char *user_mem, *cmem;
+	unsigned char *src, *dst;
+
+	zheader = get_ptr_atomic(pagenum, offset, KM_USER0);
+	size = xv_get_object_size(zheader);
+	index = zheader->table_idx;
+	put_ptr_atomic(zheader, KM_USER0);
+
+	if (unlikely(index >= (rzs.disksize >> PAGE_SHIFT) ||
+			rzs.table[index].pagenum != pagenum ||
+			rzs.table[index].offset != offset)) {
+		pr_err(C "Bad back-reference: page=%u, object=<%u, %u>\n",
+			index, pagenum, offset);
+		return -EINVAL;
+	}
 
-	stat_inc(stats.num_reads);
+	/* Only use existing free space; never grow the pool here */
+	if (xv_malloc(pool, size, &new_pagenum, &new_offset,
+			GFP_NOWAIT | __GFP_HIGHMEM))
+		return -ENOMEM;
 
-	page = bio->bi_io_vec[0].bv_page;
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	src = get_ptr_atomic(pagenum, offset, KM_USER0);
+	dst = get_ptr_atomic(new_pagenum, new_offset, KM_USER1);
+	memcpy(dst, src, size);
+	put_ptr_atomic(src, KM_USER0);
+	put_ptr_atomic(dst, KM_USER1);
 
-	if (test_flag(index, RZS_ZERO))
-		return handle_zero_page(bio);
+	rzs.table[index].pagenum = new_pagenum;
+	rzs.table[index].offset = new_offset;
 
-	/* Requested page is not present in compressed area */
-	if (!rzs.table[index].pagenum)
-		return handle_ramzswap_fault(bio);
+	/* Shared object: update all other entries too */
+	if (rzs.table[index].count > 1) {
+		u32 hash = rzs.dedup[index].hash;
 
-	/* Page is stored uncompressed since its incompressible */
-	if (unlikely(test_flag(index, RZS_UNCOMPRESSED)))
-		return handle_uncompressed_page(bio);
+		while ((index = dedup_find_sharer(hash, pagenum, offset))) {
+			rzs.table[index].pagenum = new_pagenum;
+			rzs.table[index].offset = new_offset;
+		}
+	}
 
-	user_mem = get_ptr_atomic(page_to_pfn(page), 0, KM_USER0);
-	clen = PAGE_SIZE;
+	xv_free(pool, pagenum, offset);
 
-	cmem = get_ptr_atomic(rzs.table[index].pagenum,
-			rzs.table[index].offset, KM_USER1);
+	stat_inc(stats.compact_moved);
+	return 0;
+}
 
-	ret = lzo1x_decompress_safe(
-		cmem + sizeof(*zheader),
-		xv_get_object_size(cmem) - sizeof(*zheader),
-		user_mem, &clen);
+/*
+ * Try to free up to nr_pages pool pages. Returns no. of pages freed.
+ * With trylock set, gives up instead of waiting for rzs.lock or
+ * move_lock: we can be called from reclaim triggered by our own write
+ * path, or by a read that holds move_lock for reading.
+ */
+static int ramzswap_compact(int nr_pages, int trylock)
+{
+	int ret, freed = 0;
+	u32 max_used;
+
+	max_used = compact_threshold_perc * PAGE_SIZE / 100;
+
+	while (freed < nr_pages) {
+		if (trylock) {
+			if (!mutex_trylock(&rzs.lock))
+				break;
+			if (!down_write_trylock(&rzs.move_lock)) {
+				mutex_unlock(&rzs.lock);
+				break;
+			}
+		} else {
+			mutex_lock(&rzs.lock);
+			down_write(&rzs.move_lock);
+		}
 
-	put_ptr_atomic(user_mem, KM_USER0);
-	put_ptr_atomic(cmem, KM_USER1);
+		ret = xv_compact(rzs.mem_pool, max_used,
+				ramzswap_move_object, NULL);
 
-	/* should NEVER happen */
-	if (unlikely(ret != LZO_E_OK)) {
-		pr_err(C "Decompression failed! err=%d, page=%u\n",
-			ret, index);
-		stat_inc(stats.failed_reads);
-		goto out;
-	}
+		up_write(&rzs.move_lock);
+		mutex_unlock(&rzs.lock);
 
-	ramzswap_flush_dcache_page(page);
+		if (ret <= 0)
+			break;
 
-	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	BIO_ENDIO(bio, 0);
-	return 0;
+		freed++;
+		cond_resched();
+	}
 
-out:
-	BIO_IO_ERROR(bio);
-	return 0;
+	stat_inc(stats.compact_runs);
+	stats.compact_pages += freed;
+	return freed;
 }
 
-int ramzswap_write(struct bio *bio)
+/*
+ * Memory shrinker: compact when the VM is looking for memory.
+ * Reports pool pages beyond what the stored objects need as
+ * reclaimable.
+ */
+static int ramzswap_shrink(int nr_to_scan, gfp_t gfp_mask)
 {
-	int ret, fwd_write_request = 0;
-	u32 offset;
-	size_t clen, index;
-	struct zobj_header *zheader;
-	struct page *page, *page_store;
-	unsigned char *user_mem, *cmem, *src;
+	u64 total, used;
 
-	stat_inc(stats.num_writes);
+	/* our read and writeback paths allocate with GFP_NOIO */
+	if (nr_to_scan && !(gfp_mask & __GFP_IO))
+		return -1;
 
-	page = bio->bi_io_vec[0].bv_page;
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	if (nr_to_scan)
+		ramzswap_compact(nr_to_scan, 1);
 
-	src = rzs.compress_buffer;
+	total = xv_get_total_size_bytes(rzs.mem_pool) >> PAGE_SHIFT;
+	used = DIV_ROUND_UP(xv_get_used_size_bytes(rzs.mem_pool), PAGE_SIZE);
 
-	/*
-	 * System swaps to same sector again when the stored page
-	 * is no longer referenced by any process. So, its now safe
-	 * to free the memory that was allocated for this page.
-	 */
-	if (rzs.table[index].pagenum)
-		ramzswap_free_page(index);
+	return total > used ? (int)(total - used) : 0;
+}
 
-	/*
-	 * No memory ia allocated for zero filled pages.
-	 * Simply clear zero page flag.
-	 */
-	if (test_flag(index, RZS_ZERO)) {
-		stat_dec(stats.pages_zero);
-		clear_flag(index, RZS_ZERO);
-	}
+static struct shrinker ramzswap_shrinker = {
+	.shrink = ramzswap_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
 
-	mutex_lock(&rzs.lock);
+/*
+ * Writing N to /sys/module/ramzswap/parameters/compact tries to
+ * free up to N pool pages (all sparse pages if N is 0).
+ */
+static int ramzswap_compact_set(const char *val, struct kernel_param *kp)
+{
+	unsigned long nr_pages;
 
-	user_mem = get_ptr_atomic(page_to_pfn(page), 0, KM_USER0);
-	if (page_zero_filled(user_mem)) {
-		put_ptr_atomic(user_mem, KM_USER0);
-		mutex_unlock(&rzs.lock);
-		stat_inc(stats.pages_zero);
-		set_flag(index, RZS_ZERO);
+	if (!rzs.mem_pool)
+		return -ENODEV;
 
-		set_bit(BIO_UPTODATE, &bio->bi_flags);
-		BIO_ENDIO(bio, 0);
-		return 0;
-	}
+	if (strict_strtoul(val, 10, &nr_pages))
+		return -EINVAL;
 
-	if (rzs.backing_swap &&
-		(stats.compr_size > rzs.memlimit - PAGE_SIZE)) {
-		put_ptr_atomic(user_mem, KM_USER0);
-		mutex_unlock(&rzs.lock);
-		fwd_write_request = 1;
-		goto out;
-	}
+	if (!nr_pages || nr_pages > INT_MAX)
+		nr_pages = INT_MAX;
 
-	ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-				rzs.compress_workmem);
+	ramzswap_compact(nr_pages, 0);
+	return 0;
+}
 
-	put_ptr_atomic(user_mem, KM_USER0);
+static int ramzswap_compact_get(char *buffer, struct kernel_param *kp)
+{
+	return sprintf(buffer, "%llu", stats.compact_pages);
+}
 
-	if (unlikely(ret != LZO_E_OK)) {
-		mutex_unlock(&rzs.lock);
-		pr_err(C "Compression failed! err=%d\n", ret);
-		stat_inc(stats.failed_writes);
-		goto out;
-	}
+/*
+ * Pages of a multi-page bio that have to go to the backing swap
+ * device are sent there in single page child bios. The parent bio
+ * completes once the last of them is done.
+ */
+struct rzs_fwd {
+	struct bio *parent;
+	atomic_t pending;
+	int error;
+};
 
-	/*
-	 * Page is incompressible. Forward it to backing swap
-	 * if present. Otherwise, store it as-is (uncompressed)
-	 * since we do not want to return too many swap write
-	 * errors which has side effect of hanging the system.
-	 */
-	if (unlikely(clen > MAX_CPAGE_SIZE)) {
-		if (rzs.backing_swap) {
-			mutex_unlock(&rzs.lock);
-			fwd_write_request = 1;
-			goto out;
-		}
+static void rzs_fwd_put(struct rzs_fwd *fwd)
+{
+	struct bio *parent = fwd->parent;
+	int error = fwd->error;
 
-		clen = PAGE_SIZE;
-		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
-		if (unlikely(!page_store)) {
-			mutex_unlock(&rzs.lock);
-			stat_inc(stats.failed_writes);
-			goto out;
-		}
+	if (!atomic_dec_and_test(&fwd->pending))
+		return;
 
-		offset = 0;
-		set_flag(index, RZS_UNCOMPRESSED);
-		stat_inc(stats.pages_expand);
-		rzs.table[index].pagenum = page_to_pfn(page_store);
-		src = get_ptr_atomic(page_to_pfn(page), 0, KM_USER0);
-		goto memstore;
+	kfree(fwd);
+	if (error) {
+		BIO_IO_ERROR(parent);
+		return;
 	}
+	set_bit(BIO_UPTODATE, &parent->bi_flags);
+	BIO_ENDIO(parent, 0);
+}
 
-	if (xv_malloc(rzs.mem_pool, clen + sizeof(*zheader),
-			&rzs.table[index].pagenum, &offset,
-			GFP_NOIO | __GFP_HIGHMEM)) {
-		mutex_unlock(&rzs.lock);
-		pr_info(C "Error allocating memory for compressed "
-			"page: %zu, size=%zu\n", index, clen);
-		stat_inc(stats.failed_writes);
-		if (rzs.backing_swap)
-			fwd_write_request = 1;
-		goto out;
-	}
+static void rzs_fwd_end_io(struct bio *bio, int error)
+{
+	struct rzs_fwd *fwd = bio->bi_private;
 
-memstore:
-	rzs.table[index].offset = offset;
+	if (error || !test_bit(BIO_UPTODATE, &bio->bi_flags))
+		fwd->error = 1;
 
-	cmem = get_ptr_atomic(rzs.table[index].pagenum,
-			rzs.table[index].offset, KM_USER1);
+	bio_put(bio);
+	rzs_fwd_put(fwd);
+}
 
-#if 0
-	/* Back-reference needed for memory defragmentation */
-	if (!test_flag(index, RZS_UNCOMPRESSED)) {
-		zheader = (struct zobj_header *)cmem;
-		zheader->table_idx = index;
-		cmem += sizeof(*zheader);
+static int rzs_fwd_page(struct rzs_fwd **fwdp, struct bio *parent,
+			struct page *page, u32 index)
+{
+	struct bio *bio;
+	struct rzs_fwd *fwd = *fwdp;
+
+	if (!fwd) {
+		fwd = kmalloc(sizeof(*fwd), GFP_NOIO);
+		if (!fwd)
+			return -ENOMEM;
+		fwd->parent = parent;
+		fwd->error = 0;
+		atomic_set(&fwd->pending, 1);	/* dropped by the submitter */
+		*fwdp = fwd;
 	}
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	bio->bi_bdev = rzs.backing_swap;
+	bio->bi_sector = (sector_t)index << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_end_io = rzs_fwd_end_io;
+	bio->bi_private = fwd;
+	bio_add_page(bio, page, PAGE_SIZE, 0);
+
+	atomic_inc(&fwd->pending);
+	submit_bio(bio_data_dir(parent), bio);
+	return 0;
+}
+
+/*
+ * Handle all pages of a bio in one go: the decompression stream
+ * and rzs.move_lock (reads) or the compression stream (writes) are
+ * taken once per bio and the bio is completed once at the end.
+ * Returns 1 if the bio was redirected to the backing swap device.
+ */
+static int ramzswap_rw(struct bio *bio)
+{
+	int i, rw, ret = 0, error = 0;
+	u32 index;
+	struct bio_vec *bvec;
+	struct rzs_fwd *fwd = NULL;
+	struct rzs_stream *zs = NULL;
+
+	rw = bio_data_dir(bio);
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+
+#if defined(STATS)
+	stats.bio_pages[min_t(int, fls(bio_segments(bio) - 1),
+				RZS_BIO_HIST - 1)]++;
 #endif
 
-	memcpy(cmem, src, clen);
+	if (rw == READ) {
+		/* Must be done before kmap_atomic() since it can sleep */
+		if (rzs.backend->stream_decompress)
+			zs = rzs_stream_get();
+		down_read(&rzs.move_lock);
+	}
 
-	put_ptr_atomic(cmem, KM_USER1);
-	if (unlikely(test_flag(index, RZS_UNCOMPRESSED)))
-		put_ptr_atomic(src, KM_USER0);
+	bio_for_each_segment(bvec, bio, i) {
+		if (rw == READ)
+			ret = ramzswap_read_page(zs, bvec->bv_page, index);
+		else
+			ret = ramzswap_write_page(&zs, bvec->bv_page, index);
 
-	/* Update stats */
-	stats.compr_size += clen;
-	stat_inc(stats.pages_stored);
-	stat_inc_if_less(stats.good_compress, clen, PAGE_SIZE / 2 + 1);
+		if (ret == RZS_IO_FORWARD) {
+			/* Common single page case: just redirect the bio */
+			if (bio_segments(bio) == 1)
+				break;
+			ret = rzs_fwd_page(&fwd, bio, bvec->bv_page, index);
+		}
 
-	mutex_unlock(&rzs.lock);
+		if (ret < 0)
+			error = ret;
+		index++;
+	}
 
-	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	BIO_ENDIO(bio, 0);
-	return 0;
+	if (rw == READ)
+		up_read(&rzs.move_lock);
 
-out:
-	if (fwd_write_request) {
-		stat_inc(stats.bdev_num_writes);
+	if (zs)
+		rzs_stream_put(zs);
+
+	if (ret == RZS_IO_FORWARD) {
 		bio->bi_bdev = rzs.backing_swap;
 		return 1;
 	}
 
-	BIO_IO_ERROR(bio);
+	if (fwd) {
+		if (error)
+			fwd->error = 1;
+		rzs_fwd_put(fwd);
+		return 0;
+	}
+
+	if (error) {
+		BIO_IO_ERROR(bio);
+		return 0;
+	}
+
+	set_bit(BIO_UPTODATE, &bio->bi_flags);
+	BIO_ENDIO(bio, 0);
 	return 0;
 }
 
@@ -694,25 +1881,13 @@ out:
  */
 static int ramzswap_make_request(struct request_queue *queue, struct bio *bio)
 {
-	int ret = 0;
-
 	if (!valid_swap_request(bio)) {
 		stat_inc(stats.invalid_io);
 		BIO_IO_ERROR(bio);
 		return 0;
 	}
 
-	switch (bio_data_dir(bio)) {
-	case READ:
-		ret = ramzswap_read(bio);
-		break;
-
-	case WRITE:
-		ret = ramzswap_write(bio);
-		break;
-	}
-
-	return ret;
+	return ramzswap_rw(bio);
 }
 
 /*
@@ -872,6 +2047,7 @@ static int __init ramzswap_init(void)
 	void *swap_header;
 
 	mutex_init(&rzs.lock);
+	init_rwsem(&rzs.move_lock);
 
 	ret = setup_backing_swap();
 	if (ret)
@@ -884,19 +2060,9 @@ static int __init ramzswap_init(void)
 	else
 		ramzswap_set_disksize(totalram_bytes);
 
-	rzs.compress_workmem = kmalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (rzs.compress_workmem == NULL) {
-		pr_err(C "Error allocating compressor working memory\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	rzs.compress_buffer = kmalloc(2 * PAGE_SIZE, GFP_KERNEL);
-	if (rzs.compress_buffer == NULL) {
-		pr_err(C "Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = setup_streams();
+	if (ret)
 		goto fail;
-	}
 
 	num_pages = rzs.disksize >> PAGE_SHIFT;
 	rzs.table = vmalloc(num_pages * sizeof(*rzs.table));
@@ -907,6 +2073,22 @@ static int __init ramzswap_init(void)
 	}
 	memset(rzs.table, 0, num_pages * sizeof(*rzs.table));
 
+	if (dedup) {
+		rzs.dedup_buckets = roundup_pow_of_two(
+			max_t(size_t, num_pages / DEDUP_PAGES_PER_BUCKET, 1));
+		rzs.dedup_hash = vmalloc(rzs.dedup_buckets *
+					sizeof(*rzs.dedup_hash));
+		rzs.dedup = vmalloc(num_pages * sizeof(*rzs.dedup));
+		if (rzs.dedup_hash == NULL || rzs.dedup == NULL) {
+			pr_err(C "Error allocating dedup hash table\n");
+			ret = -ENOMEM;
+			goto fail;
+		}
+		memset(rzs.dedup_hash, 0,
+			rzs.dedup_buckets * sizeof(*rzs.dedup_hash));
+		memset(rzs.dedup, 0, num_pages * sizeof(*rzs.dedup));
+	}
+
 	page = alloc_page(__GFP_ZERO);
 	if (page == NULL) {
 		pr_err(C "Error allocating swap header page\n");
@@ -989,6 +2171,12 @@ static int __init ramzswap_init(void)
 
 	pr_debug(C "Max compressed page size: %u bytes\n", MAX_CPAGE_SIZE);
 
+	if (rzs.backing_swap) {
+		ret = setup_writeback();
+		if (ret)
+			goto fail;
+	}
+
 #ifdef CONFIG_SWAP_NOTIFIERS
 	ret = register_swap_event_notifier(&ramzswap_swapon_nb,
 				SWAP_EVENT_SWAPON, 0);
@@ -1007,6 +2195,8 @@ static int __init ramzswap_init(void)
 	}
 #endif
 
+	register_shrinker(&ramzswap_shrinker);
+
 	pr_debug(C "Initialization done!\n");
 	return 0;
 
@@ -1017,11 +2207,13 @@ fail:
 		del_gendisk(rzs.disk);
 	}
 
+	destroy_writeback();
 	if (rzs.table && rzs.table[0].pagenum)
 		__free_page(pfn_to_page(rzs.table[0].pagenum));
-	kfree(rzs.compress_workmem);
-	kfree(rzs.compress_buffer);
+	destroy_streams();
 	vfree(rzs.table);
+	vfree(rzs.dedup);
+	vfree(rzs.dedup_hash);
 	xv_destroy_pool(rzs.mem_pool);
 #if defined(STATS)
 	if (proc)
@@ -1043,9 +2235,13 @@ static void __exit ramzswap_exit(void)
 				SWAP_EVENT_SWAPOFF, 0);
 #endif
 
+	unregister_shrinker(&ramzswap_shrinker);
+
 	unregister_blkdev(rzs.disk->major, rzs.disk->disk_name);
 	del_gendisk(rzs.disk);
 
+	destroy_writeback();
+
 	/* Close backing swap device (if present) */
 	if (rzs.backing_swap) {
 		set_blocksize(rzs.backing_swap, rzs.old_block_size);
@@ -1054,26 +2250,20 @@ static void __exit ramzswap_exit(void)
 	}
 
 	__free_page(pfn_to_page(rzs.table[0].pagenum));
-	kfree(rzs.compress_workmem);
-	kfree(rzs.compress_buffer);
+	destroy_streams();
 
-	/* Free all pages that are still in ramzswap */
+	/*
+	 * Free all pages that are still in ramzswap. Shared objects
+	 * are released once their last user goes away.
+	 */
 	for (index = 1; index < num_pages; index++) {
-		u32 pagenum, offset;
-
-		pagenum = rzs.table[index].pagenum;
-		offset = rzs.table[index].offset;
-
-		if (!pagenum)
-			continue;
-
-		if (unlikely(test_flag(index, RZS_UNCOMPRESSED)))
-			__free_page(pfn_to_page(pagenum));
-		else
-			xv_free(rzs.mem_pool, pagenum, offset);
+		if (rzs.table[index].pagenum)
+			ramzswap_free_page(index);
 	}
 
 	vfree(rzs.table);
+	vfree(rzs.dedup);
+	vfree(rzs.dedup_hash);
 	xv_destroy_pool(rzs.mem_pool);
 
 #if defined(STATS)
@@ -1116,9 +2306,8 @@ MODULE_PARM_DESC(memlimit_kb, "ramzswap memory limit (kB)");
 /*
  * This is block device to be used as backing store for ramzswap.
  * When pages more than memlimit_kb as swapped to ramzswap, we store
- * any additional pages in this device. We may also move some pages
- * from ramzswap to this device in case system is really low on
- * memory (TODO).
+ * any additional pages in this device. Cold pages are also moved
+ * from ramzswap to this device (see writeback_idle_secs).
  *
  * This device is not directly visible to kernel as a swap device
  * (/proc/swaps will only show /dev/ramzswap0 and not this device).
@@ -1127,6 +2316,74 @@ MODULE_PARM_DESC(memlimit_kb, "ramzswap memory limit (kB)");
 module_param(backing_swap, charp, 0);
 MODULE_PARM_DESC(backing_swap, "Backing swap partition");
 
+/*
+ * Compression backend. "lzo" uses lib/lzo directly; any other
+ * name is passed to the crypto API, so e.g. compressor=deflate
+ * gives better compression ratio at the cost of more CPU time.
+ * Current value is visible in /sys/module/ramzswap/parameters.
+ * It can be changed there only while ramzswap holds no compressed
+ * pages (e.g. before swapon), otherwise the write fails with EBUSY.
+ *
+ * Default: lzo
+ */
+module_param_call(compressor, ramzswap_compressor_set,
+			ramzswap_compressor_get, NULL, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(compressor, "Compression algorithm (default: lzo)");
+
+/*
+ * No. of compression streams i.e. max no. of pages that can be
+ * compressed concurrently. Writers block when all streams are
+ * busy (counted as StreamContended in /proc/ramzswap).
+ *
+ * Default: no. of online CPUs
+ */
+module_param(num_streams, uint, S_IRUGO);
+MODULE_PARM_DESC(num_streams, "No. of compression streams");
+
+/*
+ * Cold page writeback. Applicable only when backing swap device is
+ * provided. Pages not read or written for writeback_idle_secs are
+ * moved to the backing device every writeback_interval_secs (0 to
+ * disable periodic writeback; when memlimit is reached pages are
+ * written back regardless of idle time), at most writeback_batch
+ * pages per bio batch.
+ *
+ * Default: 300s idle, 60s interval, 32 pages
+ */
+module_param(writeback_idle_secs, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(writeback_idle_secs, "Idle time before writeback (s)");
+module_param(writeback_interval_secs, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(writeback_interval_secs, "Writeback interval (s)");
+module_param(writeback_batch, uint, S_IRUGO);
+MODULE_PARM_DESC(writeback_batch, "Max pages per writeback batch");
+
+/*
+ * Share storage between pages that compress to identical data
+ * (beyond zero filled pages, which are never stored). Costs one
+ * hash of the compressed data per write and 9 bytes per page of
+ * disksize for the hash table. Objects carry no extra header.
+ * At most 255 pages share one object.
+ *
+ * Default: 1 (enabled)
+ */
+module_param(dedup, bool, S_IRUGO);
+MODULE_PARM_DESC(dedup, "Deduplicate identical pages");
+
+/*
+ * Compaction of the compressed object pool. Pool pages with at most
+ * compact_threshold_perc of their space in use are emptied, either
+ * from the memory shrinker or on demand by writing the no. of pages
+ * to free (0 for all) to 'compact'. Reading 'compact' gives total
+ * no. of pages freed by compaction so far.
+ *
+ * Default: 50%
+ */
+module_param(compact_threshold_perc, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(compact_threshold_perc, "Max usage of pages to compact (%)");
+module_param_call(compact, ramzswap_compact_set, ramzswap_compact_get,
+			NULL, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(compact, "Compact memory pool (write no. of pages)");
+
 module_init(ramzswap_init);
 module_exit(ramzswap_exit);
 
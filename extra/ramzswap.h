@@ -15,7 +15,13 @@
 #ifndef _RAMZSWAP_H_
 #define _RAMZSWAP_H_
 
-#include "xvmalloc.h"
+#include <linux/completion.h>
+#include <linux/list.h>
+#include <linux/rwsem.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/xvmalloc.h>
 
 /*
  * Stored at beginning of each compressed object.
@@ -25,9 +31,7 @@
  * migrating compressed pages to backing swap disk.
  */
 struct zobj_header {
-#if 0
 	u32 table_idx;
-#endif
 };
 
 /*-- Configurable parameters */
@@ -50,6 +54,42 @@ struct zobj_header {
  */
 #define MAX_CPAGE_SIZE_NOBDEV	(PAGE_SIZE / 4 * 3)
 
+/*
+ * Writeback of cold pages to backing swap device: pages not
+ * accessed for DEFAULT_WB_IDLE_SECS are written back, checked
+ * every DEFAULT_WB_INTERVAL_SECS, in batches of at most
+ * DEFAULT_WB_BATCH pages.
+ */
+#define DEFAULT_WB_IDLE_SECS		300
+#define DEFAULT_WB_INTERVAL_SECS	60
+#define DEFAULT_WB_BATCH		32
+
+/*
+ * Deduplication hash table has one bucket for every
+ * DEDUP_PAGES_PER_BUCKET pages of disksize.
+ */
+#define DEDUP_PAGES_PER_BUCKET	4
+#define DEDUP_MAX_REFCOUNT	((u8)~0)
+
+/*
+ * Compaction: xvmalloc pages with at most this percentage of
+ * space in use are emptied by moving their objects elsewhere.
+ */
+#define DEFAULT_COMPACT_THRESHOLD_PERC	50
+
+/* Default compression backend */
+#define DEFAULT_COMPRESSOR	"lzo"
+
+/*
+ * Max number of compression streams. By default we create
+ * one stream per online CPU so that all CPUs can compress
+ * swapped out pages concurrently.
+ */
+#define MAX_COMP_STREAMS	NR_CPUS
+
+/* Buckets of the pages-per-bio histogram: 1, 2, 3-4, 5-8, 9-16, 17+ */
+#define RZS_BIO_HIST		6
+
 /*
  * NOTE: MAX_CPAGE_SIZE_{BDEV,NOBDEV} sizes must be
  * less than or equal to:
@@ -96,6 +136,12 @@ enum rzs_pageflags {
 	/* Page consists entirely of zeros */
 	RZS_ZERO,
 
+	/*
+	 * Page is being written back to backing swap device. Stays
+	 * set until the I/O completes, even if the page is freed.
+	 */
+	RZS_WRITEBACK,
+
 	__NR_RZS_PAGEFLAGS,
 };
 
@@ -105,17 +151,82 @@ enum rzs_pageflags {
 struct table {
 	u32 pagenum;
 	u16 offset;
-	u8 count;	/* object ref count (not yet used) */
+	u8 count;	/* object ref count, valid in the entry that
+			   zobj_header.table_idx points to */
 	u8 flags;
+	u32 atime;	/* last access time (seconds), for writeback */
+};
+
+/* Indexed by page no., only allocated with dedup enabled */
+struct dedup_entry {
+	u32 hash;	/* of compressed data */
+	u32 next;	/* next entry in same hash bucket */
+};
+
+/*
+ * Compression stream: per-stream compressor working memory and
+ * output buffer. Streams are kept on an idle list and handed out
+ * to writers, so as many pages can be compressed concurrently as
+ * there are streams.
+ */
+struct rzs_stream {
+	struct list_head list;
+	int id;
+	void *private;		/* backend working memory or transform */
+	unsigned char *buffer;	/* compressed output (2 * PAGE_SIZE) */
+#if defined(STATS)
+	u64 num_get;		/* no. of times this stream was used */
+	u64 num_compress;
+	u64 compress_ns;	/* total time spent compressing */
+#endif
+};
+
+/*
+ * Compression backend. Backends that need per-stream state for
+ * decompression (e.g. crypto API transforms) set stream_decompress
+ * so that readers also pick up a stream.
+ */
+struct rzs_backend {
+	const char *name;
+	int stream_decompress;
+	int (*init)(struct rzs_stream *zs, const char *name);
+	void (*destroy)(struct rzs_stream *zs);
+	int (*compress)(struct rzs_stream *zs, const unsigned char *src,
+			unsigned char *dst, size_t *dst_len);
+	int (*decompress)(struct rzs_stream *zs, const unsigned char *src,
+			size_t src_len, unsigned char *dst, size_t *dst_len);
 };
 
 struct ramzswap {
 	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
 	struct table *table;
 	struct mutex lock;
+	/*
+	 * Compaction moves compressed objects around. Readers, which
+	 * do not take rzs.lock, hold this for read while accessing
+	 * an object; compaction holds it for write.
+	 */
+	struct rw_semaphore move_lock;
 	struct gendisk *disk;
+
+	/*
+	 * Deduplication: hash of compressed data -> chain of table
+	 * indices (linked through dedup[].next). All entries sharing
+	 * an object are on the same chain.
+	 */
+	struct dedup_entry *dedup;
+	u32 *dedup_hash;
+	u32 dedup_buckets;	/* power of 2 */
+
+	/* compression streams */
+	const struct rzs_backend *backend;
+	const char *backend_name;
+	struct rzs_stream *streams;
+	int num_streams;
+	struct list_head idle_streams;
+	spinlock_t stream_lock;
+	wait_queue_head_t stream_wait;
+
 	/*
 	 * This is limit on compressed data size (stats.compr_size)
 	 * Its applicable only when backing swap device is present.
@@ -133,6 +244,18 @@ struct ramzswap {
 	struct file *swap_file;
 	int old_block_size;
 	int init_notify_callback;
+
+	/* cold page writeback to backing swap */
+	struct workqueue_struct *wb_workqueue;
+	struct delayed_work wb_work;
+	struct work_struct wb_kick;	/* memlimit reached */
+	wait_queue_head_t wb_wait;	/* RZS_WRITEBACK cleared */
+	struct page **wb_pages;		/* bounce pages, one per batch slot */
+	u32 *wb_index;			/* table index of each wb_pages[] */
+	size_t wb_cursor;		/* next table index to scan */
+	atomic_t wb_pending;		/* bios in flight */
+	int wb_error;
+	struct completion wb_done;
 };
 
 struct ramzswap_stats {
@@ -153,6 +276,18 @@ struct ramzswap_stats {
 	u32 pages_expand;	/* no. of incompressible pages */
 	u64 bdev_num_reads;	/* no. of reads on backing dev */
 	u64 bdev_num_writes;	/* no. of writes on backing dev */
+	u64 wb_pages;		/* no. of cold pages written back */
+	u64 wb_bios;		/* no. of writeback bios submitted */
+	u64 wb_errors;		/* no. of failed writeback batches */
+	u64 stream_contended;	/* no. of times all streams were busy */
+	u64 decompress_ns;	/* total time spent decompressing */
+	u64 dedup_lookups;	/* no. of dedup hash lookups */
+	u64 dedup_hits;		/* no. of pages found already stored */
+	u32 pages_dedup;	/* no. of pages sharing another's object */
+	u64 compact_runs;	/* no. of compaction passes */
+	u64 compact_pages;	/* no. of pages freed by compaction */
+	u64 compact_moved;	/* no. of objects moved by compaction */
+	u64 bio_pages[RZS_BIO_HIST];	/* bios by no. of pages */
 #endif
 };
 /*-- */
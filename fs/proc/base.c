@@ -1061,6 +1061,7 @@ static ssize_t oom_adjust_write(struct file *file, const char __user *buf,
 	}
 
 	task->signal->oom_adj = oom_adjust;
+	oom_adj_notify(OOM_ADJ_CHANGE, task);
 
 	unlock_task_sighand(task, &flags);
 	put_task_struct(task);
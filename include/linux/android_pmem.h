@@ -106,6 +106,7 @@ enum pmem_allocator_type {
 
 	PMEM_ALLOCATORTYPE_ALLORNOTHING,
 	PMEM_ALLOCATORTYPE_BUDDYBESTFIT,
+	PMEM_ALLOCATORTYPE_EXTENT,	/* rbtrees of free extents */
 
 	PMEM_ALLOCATORTYPE_MAX,
 };
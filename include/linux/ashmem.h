@@ -14,6 +14,7 @@
 
 #include <linux/limits.h>
 #include <linux/ioctl.h>
+#include <linux/mm_types.h>
 
 #define ASHMEM_NAME_LEN		256
 
@@ -51,4 +52,17 @@ int get_ashmem_file(int fd, struct file **filp, struct file **vm_file,
 			unsigned long *len);
 void put_ashmem_file(struct file *file);
 
+/*
+ * Pinned pages of the ashmem areas first mapped by mm. Unpinned
+ * pages are left out since the ashmem shrinker reclaims them anyway.
+ */
+static inline unsigned long ashmem_mm_pages(struct mm_struct *mm)
+{
+#ifdef CONFIG_ASHMEM
+	return atomic_long_read(&mm->ashmem_pages);
+#else
+	return 0;
+#endif
+}
+
 #endif	/* _LINUX_ASHMEM_H */
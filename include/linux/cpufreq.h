@@ -123,11 +123,24 @@ struct cpufreq_policy {
 #define CPUFREQ_RESUMECHANGE	(8)
 #define CPUFREQ_SUSPENDCHANGE	(9)
 
+/* why a transition was requested, see struct cpufreq_freqs */
+enum cpufreq_reason {
+	CPUFREQ_REASON_DRIVER,		/* no request seen, e.g. a resync */
+	CPUFREQ_REASON_GOVERNOR,	/* the governor's own decision */
+	CPUFREQ_REASON_LIMITS,		/* policy min/max or governor change */
+	CPUFREQ_REASON_BOOST,		/* as LIMITS, with a boost floor */
+	CPUFREQ_REASON_MAX,
+};
+
 struct cpufreq_freqs {
 	unsigned int cpu;	/* cpu nr */
 	unsigned int old;
 	unsigned int new;
 	u8 flags;		/* flags of cpufreq_driver, see below. */
+	/* set by cpufreq_notify_transition(), drivers need not fill in */
+	u8 reason;		/* enum cpufreq_reason */
+	unsigned int requested;	/* target passed to the driver, 0 if none */
+	s64 latency_ns;		/* PRECHANGE to POSTCHANGE, POSTCHANGE only */
 };
 
 
@@ -176,6 +189,9 @@ struct cpufreq_governor {
 	unsigned int max_transition_latency; /* HW must be able to switch to
 			next freq faster than this value in nano secs or we
 			will fallback to performance governor */
+	/* optional: apply a boost floor change itself instead of having
+	 * the boost core raise policy->min */
+	void	(*boost)		(struct cpufreq_policy *policy);
 	struct list_head	governor_list;
 	struct module		*owner;
 };
@@ -312,41 +328,109 @@ static inline unsigned int cpufreq_quick_get(unsigned int cpu)
 #endif
 
 /*********************************************************************
- *                       CPUFREQ ONDEMAND TICKLE                     *
+ *                            CPUFREQ BOOST                          *
  *********************************************************************/
-#ifdef CONFIG_CPU_FREQ_GOV_ONDEMAND_TICKLE
-void cpufreq_ondemand_tickle(void);
-void cpufreq_ondemand_tickle_millis(unsigned int millis);
-void cpufreq_ondemand_floor(unsigned int freq);
-void cpufreq_ondemand_floor_millis(unsigned int freq, unsigned int millis);
-void cpufreq_ondemand_hold(void);
-void cpufreq_ondemand_unhold(void);
-void cpufreq_ondemand_hold_check(int *flag);
-void cpufreq_ondemand_unhold_check(int *flag);
-void cpufreq_ondemand_floor_hold(unsigned int freq);
-void cpufreq_ondemand_floor_unhold(void);
-void cpufreq_ondemand_floor_hold_check(unsigned int freq, int *flag);
-void cpufreq_ondemand_floor_unhold_check(int *flag);
-void cpufreq_ondemand_hold_sync(void);
-#define CPUFREQ_TICKLE cpufreq_ondemand_tickle
-#define CPUFREQ_TICKLE_MILLIS(millis) cpufreq_ondemand_tickle_millis((millis));
-#define CPUFREQ_FLOOR cpufreq_ondemand_floor
+
+/*
+ * A boost client is anything that tickles or floors the cpus: a driver,
+ * an open tickle device, the input handler. Passing NULL accounts the
+ * request to the shared "kernel" client.
+ */
+struct cpufreq_boost_client {
+	struct list_head list;
+	char name[16];			/* TASK_COMM_LEN */
+
+	int boost_holds;
+	int floor_holds;
+	unsigned int floor;		/* kHz, while floor_holds */
+
+	unsigned long nr_boosts;
+	unsigned long nr_floors;
+	unsigned long nr_holds;
+	unsigned long held_jiffies;
+	unsigned long hold_start;
+};
+
+#ifdef CONFIG_CPU_FREQ_BOOST
+void cpufreq_boost_register_client(struct cpufreq_boost_client *client);
+void cpufreq_boost_unregister_client(struct cpufreq_boost_client *client);
+void cpufreq_boost(struct cpufreq_boost_client *client);
+void cpufreq_boost_millis(struct cpufreq_boost_client *client,
+			  unsigned int millis);
+void cpufreq_boost_hold(struct cpufreq_boost_client *client);
+void cpufreq_boost_hold_sync(struct cpufreq_boost_client *client);
+void cpufreq_boost_unhold(struct cpufreq_boost_client *client);
+void cpufreq_boost_floor(struct cpufreq_boost_client *client,
+			 unsigned int freq);
+void cpufreq_boost_floor_millis(struct cpufreq_boost_client *client,
+				unsigned int freq, unsigned int millis);
+void cpufreq_boost_floor_hold(struct cpufreq_boost_client *client,
+			      unsigned int freq);
+void cpufreq_boost_floor_unhold(struct cpufreq_boost_client *client);
+int cpufreq_boost_active(void);
+unsigned int cpufreq_boost_floor_freq(void);
+unsigned int cpufreq_boost_get_window(int floor);
+void cpufreq_boost_set_window(int floor, unsigned int millis);
+
+static inline void cpufreq_boost_hold_check(struct cpufreq_boost_client *client,
+					    int *flag)
+{
+	if (!*flag) {
+		cpufreq_boost_hold(client);
+		*flag = 1;
+	}
+}
+
+static inline void cpufreq_boost_unhold_check(struct cpufreq_boost_client *client,
+					      int *flag)
+{
+	if (*flag) {
+		cpufreq_boost_unhold(client);
+		*flag = 0;
+	}
+}
+
+static inline void cpufreq_boost_floor_hold_check(struct cpufreq_boost_client *client,
+						  unsigned int freq, int *flag)
+{
+	if (!*flag) {
+		cpufreq_boost_floor_hold(client, freq);
+		*flag = 1;
+	}
+}
+
+static inline void cpufreq_boost_floor_unhold_check(struct cpufreq_boost_client *client,
+						    int *flag)
+{
+	if (*flag) {
+		cpufreq_boost_floor_unhold(client);
+		*flag = 0;
+	}
+}
+
+#define CPUFREQ_TICKLE() cpufreq_boost(NULL)
+#define CPUFREQ_TICKLE_MILLIS(millis) cpufreq_boost_millis(NULL, (millis))
+#define CPUFREQ_FLOOR(freq) cpufreq_boost_floor(NULL, (freq))
 #define CPUFREQ_FLOOR_MILLIS(freq, millis) \
-	cpufreq_ondemand_floor_millis((freq), (millis))
-#define CPUFREQ_HOLD cpufreq_ondemand_hold
-#define CPUFREQ_UNHOLD cpufreq_ondemand_unhold
-#define CPUFREQ_HOLD_CHECK cpufreq_ondemand_hold_check
-#define CPUFREQ_UNHOLD_CHECK cpufreq_ondemand_unhold_check
-#define CPUFREQ_FLOOR_HOLD cpufreq_ondemand_floor_hold
-#define CPUFREQ_FLOOR_UNHOLD cpufreq_ondemand_floor_unhold
-#define CPUFREQ_FLOOR_HOLD_CHECK cpufreq_ondemand_floor_hold_check
-#define CPUFREQ_FLOOR_UNHOLD_CHECK cpufreq_ondemand_floor_unhold_check
-#define CPUFREQ_HOLD_SYNC cpufreq_ondemand_hold_sync
+	cpufreq_boost_floor_millis(NULL, (freq), (millis))
+#define CPUFREQ_HOLD() cpufreq_boost_hold(NULL)
+#define CPUFREQ_UNHOLD() cpufreq_boost_unhold(NULL)
+#define CPUFREQ_HOLD_CHECK(flag) cpufreq_boost_hold_check(NULL, (flag))
+#define CPUFREQ_UNHOLD_CHECK(flag) cpufreq_boost_unhold_check(NULL, (flag))
+#define CPUFREQ_FLOOR_HOLD(freq) cpufreq_boost_floor_hold(NULL, (freq))
+#define CPUFREQ_FLOOR_UNHOLD() cpufreq_boost_floor_unhold(NULL)
+#define CPUFREQ_FLOOR_HOLD_CHECK(freq, flag) \
+	cpufreq_boost_floor_hold_check(NULL, (freq), (flag))
+#define CPUFREQ_FLOOR_UNHOLD_CHECK(flag) \
+	cpufreq_boost_floor_unhold_check(NULL, (flag))
+#define CPUFREQ_HOLD_SYNC() cpufreq_boost_hold_sync(NULL)
 #else
+static inline int cpufreq_boost_active(void) { return 0; }
+static inline unsigned int cpufreq_boost_floor_freq(void) { return 0; }
 
 #define CPUFREQ_TICKLE()
 #define CPUFREQ_TICKLE_MILLIS(millis)
-#define CPUFREQ_FLOOR()
+#define CPUFREQ_FLOOR(freq)
 #define CPUFREQ_FLOOR_MILLIS(freq, millis)
 #define CPUFREQ_HOLD()
 #define CPUFREQ_UNHOLD()
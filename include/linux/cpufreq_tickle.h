@@ -1,7 +1,7 @@
 /*
  *  include/linux/cpufreq_tickle.h
  *
- *  Userspace interface to cpufreq_ondemand_tickle.
+ *  Userspace interface to the cpufreq boost core (/dev/ondemandtcl0).
  *
  *  Copyright (C) 2009 Palm, Inc.
  *                     Corey Tabaka <corey.tabaka@palm.com>
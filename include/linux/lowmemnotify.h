@@ -15,6 +15,22 @@
 #define MEMNOTIFY_CRITICAL 0xdead
 #define MEMNOTIFY_REBOOT   0xb00f
 
+/*
+ * Write one of these masks (unsigned long) to the device to be woken
+ * only for changes into the given thresholds. PREDICTED also wakes for
+ * changes of the predicted threshold, and only with it set does a read
+ * of two unsigned longs return the predicted message after the current
+ * one; otherwise reads return one word. Default is all levels, not
+ * predicted.
+ */
+#define MEMNOTIFY_SUBSCRIBE_NORMAL	0x0001
+#define MEMNOTIFY_SUBSCRIBE_MEDIUM	0x0002
+#define MEMNOTIFY_SUBSCRIBE_LOW		0x0004
+#define MEMNOTIFY_SUBSCRIBE_CRITICAL	0x0008
+#define MEMNOTIFY_SUBSCRIBE_REBOOT	0x0010
+#define MEMNOTIFY_SUBSCRIBE_ALL		0x001f
+#define MEMNOTIFY_SUBSCRIBE_PREDICTED	0x0100
+
 int memnotify_threshold(void);
 
 unsigned long memnotify_get_free(void);
@@ -257,6 +257,9 @@ struct mm_struct {
 	 * page_table_lock, in other configurations by being atomic.
 	 */
 	struct mm_rss_stat rss_stat;
+#ifdef CONFIG_ASHMEM
+	atomic_long_t ashmem_pages;	/* pinned ashmem charged to us */
+#endif
 
 	struct linux_binfmt *binfmt;
 
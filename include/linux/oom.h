@@ -13,6 +13,7 @@
 
 struct zonelist;
 struct notifier_block;
+struct task_struct;
 
 /*
  * Types of limitations to the nodes from which allocations may occur
@@ -30,6 +31,21 @@ extern void out_of_memory(struct zonelist *zonelist, gfp_t gfp_mask, int order);
 extern int register_oom_notifier(struct notifier_block *nb);
 extern int unregister_oom_notifier(struct notifier_block *nb);
 
+/*
+ * Events passed to oom_adj notifiers, with the task as data. They are
+ * called atomically: FORK and EXIT under tasklist_lock, CHANGE under
+ * the task's siglock.
+ */
+enum oom_adj_event {
+	OOM_ADJ_FORK,		/* new thread group created */
+	OOM_ADJ_EXIT,		/* last thread of the group released */
+	OOM_ADJ_CHANGE,		/* signal->oom_adj was written */
+};
+
+extern int register_oom_adj_notifier(struct notifier_block *nb);
+extern int unregister_oom_adj_notifier(struct notifier_block *nb);
+extern void oom_adj_notify(enum oom_adj_event event, struct task_struct *p);
+
 extern bool oom_killer_disabled;
 
 static inline void oom_killer_disable(void)
@@ -611,6 +611,9 @@ struct signal_struct {
 #endif
 
 	int oom_adj;	/* OOM kill score adjustment (bit shift) */
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+	struct list_head lowmem_node;	/* oom_adj bucket of lowmemorykiller */
+#endif
 };
 
 /* Context switch must be unlocked if interrupts are to be enabled */
@@ -1096,6 +1099,13 @@ struct sched_entity {
 
 	u64			avg_running;
 
+#ifdef CONFIG_CPU_FREQ_GOV_SCHED
+	/* decaying average of the time run, see sched_fair.c */
+	unsigned long		util;
+	u64			util_stamp;	/* sleep start, or leftover */
+	u64			util_exec;
+#endif
+
 #ifdef CONFIG_SCHEDSTATS
 	u64			wait_start;
 	u64			wait_max;
@@ -1904,6 +1914,10 @@ extern int can_nice(const struct task_struct *p, const int nice);
 extern int task_curr(const struct task_struct *p);
 extern int idle_cpu(int cpu);
 extern int sched_setscheduler(struct task_struct *, int, struct sched_param *);
+#ifdef CONFIG_CPU_FREQ_GOV_SCHED
+extern unsigned long sched_cpu_util(int cpu);
+extern void sched_util_set_hook(void (*hook)(int cpu, unsigned long util));
+#endif
 extern int sched_setscheduler_nocheck(struct task_struct *, int,
 				      struct sched_param *);
 extern struct task_struct *idle_task(int cpu);
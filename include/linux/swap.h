@@ -284,6 +284,8 @@ extern void swap_unplug_io_fn(struct backing_dev_info *, struct page *);
 #ifdef CONFIG_SWAP
 /* linux/mm/page_io.c */
 extern int swap_readpage(struct page *);
+extern int swap_readpage_batch(struct page *, struct bio **);
+extern void swap_read_batch_submit(struct bio **);
 extern int swap_writepage(struct page *page, struct writeback_control *wbc);
 extern void end_swap_bio_read(struct bio *bio, int err);
 
@@ -19,6 +19,7 @@ struct xv_pool;
 
 struct xv_pool *xv_create_pool(void);
 void xv_destroy_pool(struct xv_pool *pool);
+int xv_grow_pool(struct xv_pool *pool, gfp_t flags);
 
 int xv_malloc(struct xv_pool *pool, u32 size, u32 *pagenum, u32 *offset,
 							gfp_t flags);
@@ -26,5 +27,17 @@ void xv_free(struct xv_pool *pool, u32 pagenum, u32 offset);
 
 u32 xv_get_object_size(void *obj);
 u64 xv_get_total_size_bytes(struct xv_pool *pool);
+u64 xv_get_used_size_bytes(struct xv_pool *pool);
+
+/*
+ * Compaction callback: move object at <pagenum, offset> elsewhere
+ * (xv_malloc() new location, copy, xv_free() old location) and
+ * update all references to it. Return 0 on success.
+ */
+typedef int (*xv_move_fn)(struct xv_pool *pool, u32 pagenum, u32 offset,
+							void *priv);
+
+int xv_compact(struct xv_pool *pool, u32 max_used, xv_move_fn move,
+							void *priv);
 
 #endif
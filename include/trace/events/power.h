@@ -5,6 +5,7 @@
 #define _TRACE_POWER_H
 
 #include <linux/ktime.h>
+#include <linux/cpufreq.h>
 #include <linux/tracepoint.h>
 
 #ifndef _TRACE_POWER_ENUM_
@@ -75,6 +76,76 @@ TRACE_EVENT(power_frequency,
 	TP_printk("type=%lu state=%lu", (unsigned long)__entry->type, (unsigned long) __entry->state)
 );
 
+#define cpufreq_reason_names					\
+	{ CPUFREQ_REASON_DRIVER,	"driver" },		\
+	{ CPUFREQ_REASON_GOVERNOR,	"governor" },		\
+	{ CPUFREQ_REASON_LIMITS,	"limits" },		\
+	{ CPUFREQ_REASON_BOOST,		"boost" }
+
+TRACE_EVENT(cpufreq_request,
+
+	TP_PROTO(struct cpufreq_policy *policy, unsigned int target,
+		 unsigned int relation, unsigned int reason),
+
+	TP_ARGS(policy, target, relation, reason),
+
+	TP_STRUCT__entry(
+		__field(	unsigned int,	cpu		)
+		__field(	unsigned int,	cur		)
+		__field(	unsigned int,	target		)
+		__field(	unsigned int,	relation	)
+		__field(	unsigned int,	reason		)
+		__string(	governor,	policy->governor ?
+						policy->governor->name : "" )
+	),
+
+	TP_fast_assign(
+		__entry->cpu = policy->cpu;
+		__entry->cur = policy->cur;
+		__entry->target = target;
+		__entry->relation = relation;
+		__entry->reason = reason;
+		__assign_str(governor, policy->governor ?
+				       policy->governor->name : "");
+	),
+
+	TP_printk("cpu=%u cur=%u target=%u relation=%s reason=%s governor=%s",
+		  __entry->cpu, __entry->cur, __entry->target,
+		  __entry->relation == CPUFREQ_RELATION_H ? "H" : "L",
+		  __print_symbolic(__entry->reason, cpufreq_reason_names),
+		  __get_str(governor))
+);
+
+TRACE_EVENT(cpufreq_transition,
+
+	TP_PROTO(struct cpufreq_freqs *freqs),
+
+	TP_ARGS(freqs),
+
+	TP_STRUCT__entry(
+		__field(	unsigned int,	cpu		)
+		__field(	unsigned int,	old		)
+		__field(	unsigned int,	new		)
+		__field(	unsigned int,	requested	)
+		__field(	unsigned int,	reason		)
+		__field(	s64,		latency_ns	)
+	),
+
+	TP_fast_assign(
+		__entry->cpu = freqs->cpu;
+		__entry->old = freqs->old;
+		__entry->new = freqs->new;
+		__entry->requested = freqs->requested;
+		__entry->reason = freqs->reason;
+		__entry->latency_ns = freqs->latency_ns;
+	),
+
+	TP_printk("cpu=%u old=%u new=%u requested=%u reason=%s latency_ns=%lld",
+		  __entry->cpu, __entry->old, __entry->new, __entry->requested,
+		  __print_symbolic(__entry->reason, cpufreq_reason_names),
+		  (long long)__entry->latency_ns)
+);
+
 #endif /* _TRACE_POWER_H */
 
 /* This part must be outside protection */
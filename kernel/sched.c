@@ -599,6 +599,17 @@ struct rq {
 	unsigned long calc_load_update;
 	long calc_load_active;
 
+#ifdef CONFIG_CPU_FREQ_GOV_SCHED
+	/* utilization estimate for frequency selection, see sched_fair.c */
+	unsigned long util;
+	unsigned long util_avg;
+	unsigned long util_sum;
+	unsigned long util_kicked;
+	u64 util_stamp;
+	u32 util_rest[2];	/* idle and busy time not yet averaged */
+	int util_kick;
+#endif
+
 #ifdef CONFIG_SCHED_HRTICK
 #ifdef CONFIG_SMP
 	int hrtick_csd_pending;
@@ -2458,6 +2469,7 @@ out_running:
 #endif
 out:
 	task_rq_unlock(rq, &flags);
+	sched_util_kick(rq);
 	put_cpu();
 
 	return success;
@@ -2503,6 +2515,12 @@ static void __sched_fork(struct task_struct *p)
 	p->se.avg_wakeup		= sysctl_sched_wakeup_granularity;
 	p->se.avg_running		= 0;
 
+#ifdef CONFIG_CPU_FREQ_GOV_SCHED
+	p->se.util			= UTIL_FULL / 2;
+	p->se.util_stamp		= 0;
+	p->se.util_exec			= 0;
+#endif
+
 #ifdef CONFIG_SCHEDSTATS
 	p->se.wait_start			= 0;
 	p->se.wait_max				= 0;
@@ -2647,6 +2665,7 @@ void wake_up_new_task(struct task_struct *p, unsigned long clone_flags)
 		p->sched_class->task_wake_up(rq, p);
 #endif
 	task_rq_unlock(rq, &flags);
+	sched_util_kick(rq);
 }
 
 #ifdef CONFIG_PREEMPT_NOTIFIERS
@@ -2767,6 +2786,7 @@ static void finish_task_switch(struct rq *rq, struct task_struct *prev)
 	finish_arch_switch(prev);
 	perf_event_task_sched_in(current, cpu_of(rq));
 	finish_lock_switch(rq, prev);
+	sched_util_kick(rq);
 
 	fire_sched_in_preempt_notifiers(current);
 	if (mm)
@@ -5255,6 +5275,7 @@ void scheduler_tick(void)
 	update_cpu_load(rq);
 	curr->sched_class->task_tick(rq, curr, 0);
 	spin_unlock(&rq->lock);
+	sched_util_kick(rq);
 
 	perf_event_task_tick(curr, cpu);
 
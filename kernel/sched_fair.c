@@ -1007,6 +1007,192 @@ static inline void hrtick_update(struct rq *rq)
 }
 #endif
 
+#ifdef CONFIG_CPU_FREQ_GOV_SCHED
+/*
+ * Utilization estimates for frequency selection.
+ *
+ * Each task keeps a decaying average of the time it runs, which rises
+ * while it runs and falls while it sleeps. Each runqueue keeps the sum
+ * of that over its queued fair tasks, and a decaying average of the
+ * time it had fair tasks to run. The larger of the two, in
+ * SCHED_LOAD_SCALE units, is the runqueue's utilization. It is updated
+ * on enqueue, dequeue (and so on migration) and on the tick, so a
+ * burst of wakeups shows up as soon as the tasks are queued instead
+ * of one governor sampling period later.
+ *
+ * The averages keep UTIL_FRAC_SHIFT bits below a SCHED_LOAD_SCALE unit,
+ * and time too short to move them is carried over to the next update,
+ * so short and frequent activations are not lost to rounding.
+ *
+ * An idle runqueue gets no tick under NO_HZ, so its utilization is
+ * reported as zero as soon as the last fair task leaves, and the busy
+ * average is decayed by the whole idle time on the next enqueue.
+ *
+ * The hook is called once the runqueue lock has been dropped, when
+ * the estimate has moved by more than UTIL_KICK_DELTA or the runqueue
+ * went idle.
+ */
+
+/* time constant of the busy averages, 2^25ns ~ 33ms */
+#define UTIL_TAU_SHIFT		25
+#define UTIL_KICK_DELTA		(SCHED_LOAD_SCALE / 32)
+/* the averages keep this many bits below SCHED_LOAD_SCALE units */
+#define UTIL_FRAC_SHIFT		10
+#define UTIL_FULL		(SCHED_LOAD_SCALE << UTIL_FRAC_SHIFT)
+
+static void (*sched_util_hook)(int cpu, unsigned long util);
+
+/*
+ * Move @avg towards @target over *@delta ns. The step is linear in the
+ * time so it takes only shifts, and is rounded to the nearest fraction
+ * either way; a full time constant or more lands on @target. The time
+ * that did not move @avg is left in *@delta for the caller to carry over.
+ */
+static unsigned long util_ewma(unsigned long avg, unsigned long target,
+			       u64 *delta)
+{
+	long diff = (long)target - (long)avg;
+	unsigned long step;
+	u32 units;
+
+	if (*delta >= (1ULL << UTIL_TAU_SHIFT)) {
+		*delta = 0;
+		return target;
+	}
+
+	units = (u32)*delta >> 10;
+	step = ((u64)abs(diff) * units + (1UL << (UTIL_TAU_SHIFT - 11))) >>
+		(UTIL_TAU_SHIFT - 10);
+	if (diff && !step)
+		return avg;
+
+	*delta &= (1 << 10) - 1;
+	return diff < 0 ? avg - step : avg + step;
+}
+
+/*
+ * @busy is whether the runqueue had fair tasks since the last update.
+ * The time left over is kept apart for busy and idle periods, so it is
+ * only ever added to a period of the same kind.
+ */
+static void update_rq_util_avg(struct rq *rq, int busy)
+{
+	u64 delta = rq->clock - rq->util_stamp + rq->util_rest[busy];
+
+	rq->util_avg = util_ewma(rq->util_avg, busy ? UTIL_FULL : 0, &delta);
+	rq->util_rest[busy] = delta;
+	rq->util_stamp = rq->clock;
+}
+
+static void update_rq_util(struct rq *rq)
+{
+	unsigned long util;
+
+	util = min_t(unsigned long, rq->util_sum, SCHED_LOAD_SCALE);
+	if (rq->cfs.nr_running)
+		util = max(util, rq->util_avg >> UTIL_FRAC_SHIFT);
+	rq->util = util;
+
+	if (abs((long)util - (long)rq->util_kicked) > UTIL_KICK_DELTA ||
+	    (!rq->cfs.nr_running && util != rq->util_kicked))
+		rq->util_kick = 1;
+}
+
+/*
+ * The task is going to sleep: account what it ran since it last did. Run
+ * time left over stays between util_exec and sum_exec_runtime, sleep time
+ * left over from the last wakeup moves the sleep stamp back.
+ */
+static void util_task_sleep(struct rq *rq, struct sched_entity *se)
+{
+	u64 ran = se->sum_exec_runtime - se->util_exec;
+
+	se->util = util_ewma(se->util, UTIL_FULL, &ran);
+	se->util_exec = se->sum_exec_runtime - ran;
+	se->util_stamp = rq->clock - se->util_stamp;
+}
+
+/* after this, util_stamp holds the sleep time left over until the next */
+static void util_task_wake(struct rq *rq, struct sched_entity *se)
+{
+	/* clocks of different cpus are not synchronized */
+	s64 slept = rq->clock - se->util_stamp;
+	u64 rest = 0;
+
+	if (se->util_stamp && slept > 0) {
+		rest = slept;
+		se->util = util_ewma(se->util, 0, &rest);
+	}
+	se->util_stamp = rest;
+}
+
+static void util_enqueue(struct rq *rq, struct task_struct *p, int wakeup)
+{
+	update_rq_util_avg(rq, rq->cfs.nr_running != 0);
+	if (wakeup)
+		util_task_wake(rq, &p->se);
+	rq->util_sum += p->se.util >> UTIL_FRAC_SHIFT;
+	update_rq_util(rq);
+}
+
+static void util_dequeue(struct rq *rq, struct task_struct *p, int sleep)
+{
+	update_rq_util_avg(rq, 1);
+	rq->util_sum -= p->se.util >> UTIL_FRAC_SHIFT;
+	if (sleep)
+		util_task_sleep(rq, &p->se);
+	update_rq_util(rq);
+}
+
+static void util_update(struct rq *rq)
+{
+	update_rq_util_avg(rq, rq->cfs.nr_running != 0);
+	update_rq_util(rq);
+}
+
+/* Called without rq->lock */
+static inline void sched_util_kick(struct rq *rq)
+{
+	void (*hook)(int cpu, unsigned long util);
+
+	if (likely(!rq->util_kick))
+		return;
+
+	rq->util_kick = 0;
+	rq->util_kicked = rq->util;
+
+	rcu_read_lock_sched();
+	hook = rcu_dereference(sched_util_hook);
+	if (hook)
+		hook(cpu_of(rq), rq->util);
+	rcu_read_unlock_sched();
+}
+
+unsigned long sched_cpu_util(int cpu)
+{
+	return cpu_rq(cpu)->util;
+}
+EXPORT_SYMBOL_GPL(sched_cpu_util);
+
+/*
+ * Install or, with NULL, remove the utilization hook. The hook may be
+ * called from interrupt context and must not sleep.
+ */
+void sched_util_set_hook(void (*hook)(int cpu, unsigned long util))
+{
+	rcu_assign_pointer(sched_util_hook, hook);
+	synchronize_sched();
+}
+EXPORT_SYMBOL_GPL(sched_util_set_hook);
+#else
+static inline void util_enqueue(struct rq *rq, struct task_struct *p,
+				int wakeup) { }
+static inline void util_dequeue(struct rq *rq, struct task_struct *p,
+				int sleep) { }
+static inline void util_update(struct rq *rq) { }
+static inline void sched_util_kick(struct rq *rq) { }
+#endif
+
 /*
  * The enqueue_task method is called before nr_running is
  * increased. Here we update the fair scheduling stats and
@@ -1017,6 +1203,8 @@ static void enqueue_task_fair(struct rq *rq, struct task_struct *p, int wakeup)
 	struct cfs_rq *cfs_rq;
 	struct sched_entity *se = &p->se;
 
+	util_enqueue(rq, p, wakeup);
+
 	for_each_sched_entity(se) {
 		if (se->on_rq)
 			break;
@@ -1037,6 +1225,7 @@ static void dequeue_task_fair(struct rq *rq, struct task_struct *p, int sleep)
 {
 	struct cfs_rq *cfs_rq;
 	struct sched_entity *se = &p->se;
+	int task_sleep = sleep;
 
 	for_each_sched_entity(se) {
 		cfs_rq = cfs_rq_of(se);
@@ -1047,6 +1236,7 @@ static void dequeue_task_fair(struct rq *rq, struct task_struct *p, int sleep)
 		sleep = 1;
 	}
 
+	util_dequeue(rq, p, task_sleep);
 	hrtick_update(rq);
 }
 
@@ -1908,6 +2098,8 @@ static void task_tick_fair(struct rq *rq, struct task_struct *curr, int queued)
 		cfs_rq = cfs_rq_of(se);
 		entity_tick(cfs_rq, se, queued);
 	}
+
+	util_update(rq);
 }
 
 /*
@@ -14,9 +14,33 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/lzo.h>
+#include <asm/byteorder.h>
 #include <asm/unaligned.h>
 #include "lzodefs.h"
 
+/* First three bytes of a word, in memory order */
+#ifdef __LITTLE_ENDIAN
+#define LZO_MASK3	0x00ffffffu
+#else
+#define LZO_MASK3	0xffffff00u
+#endif
+
+static inline unsigned char *copy_literals(unsigned char *op,
+			const unsigned char *ii, size_t t)
+{
+	while (t >= 4) {
+		COPY4(op, ii);
+		op += 4;
+		ii += 4;
+		t -= 4;
+	}
+	while (t > 0) {
+		*op++ = *ii++;
+		t--;
+	}
+	return op;
+}
+
 static noinline size_t
 _lzo1x_1_do_compress(const unsigned char *in, size_t in_len,
 		unsigned char *out, size_t *out_len, void *wrkmem)
@@ -61,11 +85,16 @@ _lzo1x_1_do_compress(const unsigned char *in, size_t in_len,
 		goto literal;
 
 try_match:
+#ifdef LZO_FAST_UNALIGNED
+		if (!((lzo_get_u32(m_pos) ^ lzo_get_u32(ip)) & LZO_MASK3))
+			goto match;
+#else
 		if (get_unaligned((const unsigned short *)m_pos)
 				== get_unaligned((const unsigned short *)ip)) {
 			if (likely(m_pos[2] == ip[2]))
 					goto match;
 		}
+#endif
 
 literal:
 		dict[dindex] = ip;
@@ -93,9 +122,8 @@ match:
 				}
 				*op++ = tt;
 			}
-			do {
-				*op++ = *ii++;
-			} while (--t > 0);
+			op = copy_literals(op, ii, t);
+			ii += t;
 		}
 
 		ip += 3;
@@ -125,6 +153,13 @@ match:
 			end = in_end;
 			m = m_pos + M2_MAX_LEN + 1;
 
+#ifdef LZO_FAST_UNALIGNED
+			while (end - ip >= 4 &&
+					lzo_get_u32(m) == lzo_get_u32(ip)) {
+				m += 4;
+				ip += 4;
+			}
+#endif
 			while (ip < end && *m == *ip) {
 				m++;
 				ip++;
@@ -207,9 +242,7 @@ int lzo1x_1_compress(const unsigned char *in, size_t in_len, unsigned char *out,
 
 			*op++ = tt;
 		}
-		do {
-			*op++ = *ii++;
-		} while (--t > 0);
+		op = copy_literals(op, ii, t);
 	}
 
 	*op++ = M4_MARKER | 1;
@@ -22,9 +22,6 @@
 #define HAVE_OP(x, op_end, op) ((size_t)(op_end - op) < (x))
 #define HAVE_LB(m_pos, out, op) (m_pos < out || m_pos >= op)
 
-#define COPY4(dst, src)	\
-		put_unaligned(get_unaligned((const u32 *)(src)), (u32 *)(dst))
-
 int lzo1x_decompress_safe(const unsigned char *in, size_t in_len,
 			unsigned char *out, size_t *out_len)
 {
@@ -138,7 +135,7 @@ match:
 					t += 31 + *ip++;
 				}
 				m_pos = op - 1;
-				m_pos -= get_unaligned_le16(ip) >> 2;
+				m_pos -= lzo_get_le16(ip) >> 2;
 				ip += 2;
 			} else if (t >= 16) {
 				m_pos = op;
@@ -156,7 +153,7 @@ match:
 					}
 					t += 7 + *ip++;
 				}
-				m_pos -= get_unaligned_le16(ip) >> 2;
+				m_pos -= lzo_get_le16(ip) >> 2;
 				ip += 2;
 				if (m_pos == op)
 					goto eof_found;
@@ -0,0 +1,286 @@
+/*
+ *  LZO1X self test and benchmark module
+ *
+ *  Checks lzo1x_1_compress() output against known vectors, round
+ *  trips a set of page sized inputs and then reports compression
+ *  and decompression throughput for each of them.
+ *
+ *  Released under the terms of GNU General Public License Version 2.0
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/lzo.h>
+#include <linux/math64.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#define LZO_TEST_SIZE	PAGE_SIZE
+
+static unsigned int iterations = 1000;
+module_param(iterations, uint, 0);
+MODULE_PARM_DESC(iterations, "Benchmark iterations per corpus page");
+
+struct lzo_testvec {
+	unsigned int inlen, outlen;
+	const char *input, *output;
+};
+
+/* Same vectors as the crypto API lzo tests (crypto/testmgr.h) */
+static const struct lzo_testvec lzo_vectors[] = {
+	{
+		.inlen	= 70,
+		.outlen	= 46,
+		.input	= "Join us now and share the software "
+			"Join us now and share the software ",
+		.output	= "\x00\x0d\x4a\x6f\x69\x6e\x20\x75"
+			"\x73\x20\x6e\x6f\x77\x20\x61\x6e"
+			"\x64\x20\x73\x68\x61\x72\x65\x20"
+			"\x74\x68\x65\x20\x73\x6f\x66\x74"
+			"\x77\x70\x01\x01\x4a\x6f\x69\x6e"
+			"\x3d\x88\x00\x11\x00\x00",
+	}, {
+		.inlen	= 159,
+		.outlen	= 133,
+		.input	= "This document describes a compression method based on the LZO "
+			"compression algorithm.  This document defines the application of "
+			"the LZO algorithm used in UBIFS.",
+		.output	= "\x00\x2b\x54\x68\x69\x73\x20\x64"
+			  "\x6f\x63\x75\x6d\x65\x6e\x74\x20"
+			  "\x64\x65\x73\x63\x72\x69\x62\x65"
+			  "\x73\x20\x61\x20\x63\x6f\x6d\x70"
+			  "\x72\x65\x73\x73\x69\x6f\x6e\x20"
+			  "\x6d\x65\x74\x68\x6f\x64\x20\x62"
+			  "\x61\x73\x65\x64\x20\x6f\x6e\x20"
+			  "\x74\x68\x65\x20\x4c\x5a\x4f\x2b"
+			  "\x8c\x00\x0d\x61\x6c\x67\x6f\x72"
+			  "\x69\x74\x68\x6d\x2e\x20\x20\x54"
+			  "\x68\x69\x73\x2a\x54\x01\x02\x66"
+			  "\x69\x6e\x65\x73\x94\x06\x05\x61"
+			  "\x70\x70\x6c\x69\x63\x61\x74\x76"
+			  "\x0a\x6f\x66\x88\x02\x60\x09\x27"
+			  "\xf0\x00\x0c\x20\x75\x73\x65\x64"
+			  "\x20\x69\x6e\x20\x55\x42\x49\x46"
+			  "\x53\x2e\x11\x00\x00",
+	},
+};
+
+enum corpus_type {
+	CORPUS_ZERO,
+	CORPUS_TEXT,
+	CORPUS_WORDS,
+	CORPUS_MIXED,
+	CORPUS_RANDOM,
+	__NR_CORPUS,
+};
+
+static const char * const corpus_names[] = {
+	[CORPUS_ZERO]	= "zero",
+	[CORPUS_TEXT]	= "text",
+	[CORPUS_WORDS]	= "words",
+	[CORPUS_MIXED]	= "mixed",
+	[CORPUS_RANDOM]	= "random",
+};
+
+static u32 lzo_test_seed;
+
+/* Deterministic PRNG so that results are comparable between runs */
+static u32 lzo_test_rand(void)
+{
+	lzo_test_seed ^= lzo_test_seed << 13;
+	lzo_test_seed ^= lzo_test_seed >> 17;
+	lzo_test_seed ^= lzo_test_seed << 5;
+	return lzo_test_seed;
+}
+
+/*
+ * Fill a page with data resembling what gets swapped out: text,
+ * heap-like arrays of small integers and pointers, partly random
+ * data and incompressible data.
+ */
+static void fill_corpus(unsigned char *buf, enum corpus_type type)
+{
+	static const char text[] = "function onLoad() { this.controller."
+				"setupWidget(\"list\", this.attributes); }\n";
+	u32 *words = (u32 *)buf;
+	unsigned int i;
+
+	lzo_test_seed = 0x2545f491 + type;
+
+	switch (type) {
+	case CORPUS_ZERO:
+		memset(buf, 0, LZO_TEST_SIZE);
+		break;
+	case CORPUS_TEXT:
+		for (i = 0; i < LZO_TEST_SIZE; i++)
+			buf[i] = text[(i + i / 509) % (sizeof(text) - 1)];
+		break;
+	case CORPUS_WORDS:
+		for (i = 0; i < LZO_TEST_SIZE / 4; i++)
+			words[i] = (i & 1) ? 0xc0000000 + (lzo_test_rand() & 0xff0)
+					   : lzo_test_rand() & 0xff;
+		break;
+	case CORPUS_MIXED:
+		for (i = 0; i < LZO_TEST_SIZE; i++)
+			buf[i] = (i & 256) ? lzo_test_rand() : text[i % 32];
+		break;
+	case CORPUS_RANDOM:
+	default:
+		for (i = 0; i < LZO_TEST_SIZE / 4; i++)
+			words[i] = lzo_test_rand();
+		break;
+	}
+}
+
+static int test_vectors(unsigned char *out, void *wrkmem)
+{
+	int i, ret, err = 0;
+	size_t len;
+
+	for (i = 0; i < ARRAY_SIZE(lzo_vectors); i++) {
+		const struct lzo_testvec *v = &lzo_vectors[i];
+
+		ret = lzo1x_1_compress(v->input, v->inlen, out, &len, wrkmem);
+		if (ret != LZO_E_OK || len != v->outlen ||
+				memcmp(out, v->output, len)) {
+			pr_err("lzo_test: compress vector %d failed\n", i);
+			err = -EINVAL;
+		}
+
+		len = LZO_TEST_SIZE;
+		ret = lzo1x_decompress_safe(v->output, v->outlen, out, &len);
+		if (ret != LZO_E_OK || len != v->inlen ||
+				memcmp(out, v->input, len)) {
+			pr_err("lzo_test: decompress vector %d failed\n", i);
+			err = -EINVAL;
+		}
+	}
+
+	return err;
+}
+
+/*
+ * Round trip one corpus page, also making sure truncated input is
+ * rejected rather than read past.
+ */
+static int test_roundtrip(enum corpus_type type, unsigned char *in,
+			unsigned char *out, unsigned char *back, void *wrkmem,
+			size_t *clen)
+{
+	int ret;
+	size_t len = LZO_TEST_SIZE;
+
+	ret = lzo1x_1_compress(in, LZO_TEST_SIZE, out, clen, wrkmem);
+	if (ret != LZO_E_OK || *clen > lzo1x_worst_compress(LZO_TEST_SIZE))
+		goto fail;
+
+	ret = lzo1x_decompress_safe(out, *clen, back, &len);
+	if (ret != LZO_E_OK || len != LZO_TEST_SIZE ||
+			memcmp(in, back, LZO_TEST_SIZE))
+		goto fail;
+
+	len = LZO_TEST_SIZE;
+	ret = lzo1x_decompress_safe(out, *clen - 1, back, &len);
+	if (ret == LZO_E_OK)
+		goto fail;
+
+	return 0;
+
+fail:
+	pr_err("lzo_test: %s round trip failed (ret=%d)\n",
+		corpus_names[type], ret);
+	return -EINVAL;
+}
+
+/* MB/s for given no. of bytes processed in ns nanoseconds */
+static unsigned int mbps(u64 bytes, u64 ns)
+{
+	return ns ? (unsigned int)div64_u64(bytes * 1000, ns) : 0;
+}
+
+static void benchmark(enum corpus_type type, const unsigned char *in,
+			unsigned char *out, unsigned char *back, void *wrkmem)
+{
+	unsigned int i;
+	size_t clen = 0, len;
+	ktime_t start;
+	u64 comp_ns, decomp_ns, bytes;
+
+	start = ktime_get();
+	for (i = 0; i < iterations; i++) {
+		lzo1x_1_compress(in, LZO_TEST_SIZE, out, &clen, wrkmem);
+		if (!(i % 64))
+			cond_resched();
+	}
+	comp_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	start = ktime_get();
+	for (i = 0; i < iterations; i++) {
+		len = LZO_TEST_SIZE;
+		lzo1x_decompress_safe(out, clen, back, &len);
+		if (!(i % 64))
+			cond_resched();
+	}
+	decomp_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	bytes = (u64)iterations * LZO_TEST_SIZE;
+	pr_info("lzo_test: %-6s %4zu/%lu bytes  compress %5u MB/s  "
+		"decompress %5u MB/s\n", corpus_names[type], clen,
+		LZO_TEST_SIZE, mbps(bytes, comp_ns), mbps(bytes, decomp_ns));
+}
+
+static int __init lzo_test_init(void)
+{
+	int type, ret;
+	size_t clen;
+	void *wrkmem;
+	unsigned char *in, *out, *back;
+
+	wrkmem = kmalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
+	in = kmalloc(LZO_TEST_SIZE, GFP_KERNEL);
+	out = kmalloc(lzo1x_worst_compress(LZO_TEST_SIZE), GFP_KERNEL);
+	back = kmalloc(LZO_TEST_SIZE, GFP_KERNEL);
+	if (!wrkmem || !in || !out || !back) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ret = test_vectors(out, wrkmem);
+	if (ret)
+		goto out;
+
+	for (type = 0; type < __NR_CORPUS; type++) {
+		fill_corpus(in, type);
+		ret = test_roundtrip(type, in, out, back, wrkmem, &clen);
+		if (ret)
+			goto out;
+	}
+	pr_info("lzo_test: all tests passed\n");
+
+	if (!iterations)
+		goto out;
+
+	for (type = 0; type < __NR_CORPUS; type++) {
+		fill_corpus(in, type);
+		benchmark(type, in, out, back, wrkmem);
+	}
+
+out:
+	kfree(wrkmem);
+	kfree(in);
+	kfree(out);
+	kfree(back);
+	return ret;
+}
+
+static void __exit lzo_test_exit(void)
+{
+}
+
+module_init(lzo_test_init);
+module_exit(lzo_test_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZO1X self test and benchmark");
@@ -41,3 +41,60 @@
 #define DX2(p, s1, s2)	(((((size_t)((p)[2]) << (s2)) ^ (p)[1]) \
 							<< (s1)) ^ (p)[0])
 #define DX3(p, s1, s2, s3)	((DX2((p)+1, s2, s3) << (s1)) ^ (p)[0])
+
+/*
+ * Fast unaligned accessors.
+ *
+ * ARMv6 and later handle unaligned LDR/LDRH/STR/STRH in hardware
+ * once alignment.c clears SCTLR.A, but get_unaligned() on ARM is
+ * always built from byte loads and shifts. Use plain word accesses
+ * there instead; they are used for the match finder and the copy
+ * loops. The NEON unit is not used since the kernel does not save
+ * user NEON state.
+ */
+#if defined(CONFIG_ARM) && __LINUX_ARM_ARCH__ >= 6 && \
+	defined(CONFIG_ALIGNMENT_TRAP)
+
+static inline u32 lzo_get_u32(const void *p)
+{
+	u32 val;
+
+	asm("ldr	%0, %1" : "=r" (val) : "Q" (*(const u32 *)p));
+	return val;
+}
+
+static inline u16 lzo_get_u16(const void *p)
+{
+	u32 val;
+
+	asm("ldrh	%0, %1" : "=r" (val) : "Q" (*(const u16 *)p));
+	return val;
+}
+
+static inline void lzo_put_u32(void *p, u32 val)
+{
+	asm("str	%1, %0" : "=Q" (*(u32 *)p) : "r" (val));
+}
+
+#define LZO_FAST_UNALIGNED	1
+
+#else
+
+#define lzo_get_u32(p)		get_unaligned((const u32 *)(p))
+#define lzo_get_u16(p)		get_unaligned((const u16 *)(p))
+#define lzo_put_u32(p, v)	put_unaligned((v), (u32 *)(p))
+
+#ifdef CONFIG_HAVE_EFFICIENT_UNALIGNED_ACCESS
+#define LZO_FAST_UNALIGNED	1
+#endif
+
+#endif
+
+#define COPY4(dst, src)		lzo_put_u32((dst), lzo_get_u32(src))
+
+/* Little endian 16 bit load used for match offsets */
+#if defined(LZO_FAST_UNALIGNED) && defined(__LITTLE_ENDIAN)
+#define lzo_get_le16(p)		lzo_get_u16(p)
+#else
+#define lzo_get_le16(p)		get_unaligned_le16(p)
+#endif
@@ -18,9 +18,8 @@
 #include <linux/init.h>
 #include <linux/string.h>
 #include <linux/slab.h>
+#include <linux/xvmalloc.h>
 
-#include "compat.h"
-#include "xvmalloc.h"
 #include "xvmalloc_int.h"
 
 static void stat_inc(u64 *value)
@@ -126,6 +125,13 @@ static void xv_free_page(u32 pagenum)
 	__free_page(pfn_to_page(pagenum));
 }
 
+static void add_page_used(u32 pagenum, long bytes)
+{
+	struct page *page = pfn_to_page(pagenum);
+
+	set_page_private(page, page_private(page) + bytes);
+}
+
 /**
  * find_block - find block of at least given size
  * @pool: memory pool to search from
@@ -312,6 +318,9 @@ static int grow_pool(struct xv_pool *pool, gfp_t flags)
 	stat_inc(&pool->total_pages);
 
 	spin_lock(&pool->lock);
+	set_page_private(pfn_to_page(pagenum), 0);
+	list_add_tail(&pfn_to_page(pagenum)->lru, &pool->page_list);
+
 	block = get_ptr_atomic(pagenum, 0, KM_USER0);
 
 	block->size = PAGE_SIZE - XV_ALIGN;
@@ -327,6 +336,16 @@ static int grow_pool(struct xv_pool *pool, gfp_t flags)
 	return 0;
 }
 
+/*
+ * Add a free page to the pool ahead of need, for users whose own
+ * xv_malloc() calls cannot sleep and so never grow it.
+ */
+int xv_grow_pool(struct xv_pool *pool, gfp_t flags)
+{
+	return grow_pool(pool, flags);
+}
+EXPORT_SYMBOL_GPL(xv_grow_pool);
+
 /*
  * Create a memory pool. Allocates freelist, bitmaps and other
  * per-pool metadata.
@@ -342,6 +361,7 @@ struct xv_pool *xv_create_pool(void)
 		return NULL;
 
 	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->page_list);
 
 	return pool;
 }
@@ -388,7 +408,8 @@ int xv_malloc(struct xv_pool *pool, u32 size, u32 *pagenum, u32 *offset,
 
 	if (!*pagenum) {
 		spin_unlock(&pool->lock);
-		if (flags & GFP_NOWAIT)
+		/* Callers that cannot sleep do not grow the pool */
+		if (!(flags & __GFP_WAIT))
 			return -ENOMEM;
 		error = grow_pool(pool, flags);
 		if (unlikely(error))
@@ -433,6 +454,9 @@ int xv_malloc(struct xv_pool *pool, u32 size, u32 *pagenum, u32 *offset,
 	block->size = origsize;
 	clear_flag(block, BLOCK_FREE);
 
+	add_page_used(*pagenum, size + XV_ALIGN);
+	pool->used_bytes += size + XV_ALIGN;
+
 	put_ptr_atomic(block, KM_USER0);
 	spin_unlock(&pool->lock);
 
@@ -448,12 +472,16 @@ EXPORT_SYMBOL_GPL(xv_malloc);
 void xv_free(struct xv_pool *pool, u32 pagenum, u32 offset)
 {
 	void *page;
+	int isolated;
 	struct block_header *block, *tmpblock;
 
 	offset -= XV_ALIGN;
 
 	spin_lock(&pool->lock);
 
+	/* Free blocks of page under compaction are not on freelists */
+	isolated = (pagenum == pool->isolated_pagenum);
+
 	page = get_ptr_atomic(pagenum, 0, KM_USER0);
 	block = (struct block_header *)((char *)page + offset);
 
@@ -462,6 +490,9 @@ void xv_free(struct xv_pool *pool, u32 pagenum, u32 offset)
 
 	block->size = ALIGN(block->size, XV_ALIGN);
 
+	add_page_used(pagenum, -(long)(block->size + XV_ALIGN));
+	pool->used_bytes -= block->size + XV_ALIGN;
+
 	tmpblock = BLOCK_NEXT(block);
 	if (offset + block->size + XV_ALIGN == PAGE_SIZE)
 		tmpblock = NULL;
@@ -472,7 +503,7 @@ void xv_free(struct xv_pool *pool, u32 pagenum, u32 offset)
 		 * Blocks smaller than XV_MIN_ALLOC_SIZE
 		 * are not inserted in any free list.
 		 */
-		if (tmpblock->size >= XV_MIN_ALLOC_SIZE) {
+		if (tmpblock->size >= XV_MIN_ALLOC_SIZE && !isolated) {
 			remove_block(pool, pagenum,
 				    offset + block->size + XV_ALIGN, tmpblock,
 				    get_index_for_insert(tmpblock->size));
@@ -486,7 +517,7 @@ void xv_free(struct xv_pool *pool, u32 pagenum, u32 offset)
 						get_blockprev(block));
 		offset = offset - tmpblock->size - XV_ALIGN;
 
-		if (tmpblock->size >= XV_MIN_ALLOC_SIZE)
+		if (tmpblock->size >= XV_MIN_ALLOC_SIZE && !isolated)
 			remove_block(pool, pagenum, offset, tmpblock,
 				    get_index_for_insert(tmpblock->size));
 
@@ -497,6 +528,9 @@ void xv_free(struct xv_pool *pool, u32 pagenum, u32 offset)
 	/* No used objects in this page. Free it. */
 	if (block->size == PAGE_SIZE - XV_ALIGN) {
 		put_ptr_atomic(page, KM_USER0);
+		list_del(&pfn_to_page(pagenum)->lru);
+		if (isolated)
+			pool->isolated_pagenum = 0;
 		spin_unlock(&pool->lock);
 
 		xv_free_page(pagenum);
@@ -505,7 +539,7 @@ void xv_free(struct xv_pool *pool, u32 pagenum, u32 offset)
 	}
 
 	set_flag(block, BLOCK_FREE);
-	if (block->size >= XV_MIN_ALLOC_SIZE)
+	if (block->size >= XV_MIN_ALLOC_SIZE && !isolated)
 		insert_block(pool, pagenum, offset, block);
 
 	if (offset + block->size + XV_ALIGN != PAGE_SIZE) {
@@ -539,6 +573,141 @@ u64 xv_get_total_size_bytes(struct xv_pool *pool)
 }
 EXPORT_SYMBOL_GPL(xv_get_total_size_bytes);
 
+/*
+ * Returns memory actually used by objects (including block headers)
+ */
+u64 xv_get_used_size_bytes(struct xv_pool *pool)
+{
+	return pool->used_bytes;
+}
+EXPORT_SYMBOL_GPL(xv_get_used_size_bytes);
+
+/*
+ * Take free blocks of given page off the freelists (or put them back)
+ * so that objects moved out during compaction are not placed into the
+ * very page being emptied.
+ */
+static void isolate_page(struct xv_pool *pool, u32 pagenum, int isolate)
+{
+	u32 offset = 0;
+	char *page;
+	struct block_header *block;
+
+	page = get_ptr_atomic(pagenum, 0, KM_USER0);
+	while (offset < PAGE_SIZE) {
+		block = (struct block_header *)(page + offset);
+		if (test_flag(block, BLOCK_FREE) &&
+				block->size >= XV_MIN_ALLOC_SIZE) {
+			if (isolate)
+				remove_block(pool, pagenum, offset, block,
+					get_index_for_insert(block->size));
+			else
+				insert_block(pool, pagenum, offset, block);
+		}
+		offset += ALIGN(block->size, XV_ALIGN) + XV_ALIGN;
+	}
+	put_ptr_atomic(page, KM_USER0);
+
+	pool->isolated_pagenum = isolate ? pagenum : 0;
+}
+
+/*
+ * Offset of first allocated object in page, or 0 if none.
+ */
+static u32 first_used_object(u32 pagenum)
+{
+	u32 offset = 0, found = 0;
+	char *page;
+	struct block_header *block;
+
+	page = get_ptr_atomic(pagenum, 0, KM_USER0);
+	while (offset < PAGE_SIZE) {
+		block = (struct block_header *)(page + offset);
+		if (!test_flag(block, BLOCK_FREE)) {
+			found = offset + XV_ALIGN;
+			break;
+		}
+		offset += ALIGN(block->size, XV_ALIGN) + XV_ALIGN;
+	}
+	put_ptr_atomic(page, KM_USER0);
+
+	return found;
+}
+
+/*
+ * Pick a page with at most max_used bytes in use. Scanned pages are
+ * rotated to the tail so that successive calls make progress.
+ */
+static u32 find_sparse_page(struct xv_pool *pool, u32 max_used)
+{
+	u64 nr;
+	struct page *page;
+
+	for (nr = 0; nr < pool->total_pages; nr++) {
+		if (list_empty(&pool->page_list))
+			break;
+		page = list_first_entry(&pool->page_list, struct page, lru);
+		list_move_tail(&page->lru, &pool->page_list);
+		if (page_private(page) && page_private(page) <= max_used)
+			return page_to_pfn(page);
+	}
+
+	return 0;
+}
+
+/**
+ * xv_compact - empty one sparsely used page
+ * @pool: pool to compact
+ * @max_used: only pages with at most these many bytes in use qualify
+ * @move: callback to relocate a single object
+ * @priv: passed to @move
+ *
+ * Moves all objects out of a page with at most @max_used bytes in use
+ * so that the page gets freed. @move must allocate without __GFP_WAIT
+ * so that objects only go to existing free space. Caller must make
+ * sure nobody else frees or accesses objects in the pool meanwhile.
+ *
+ * Returns 1 if a page was freed, 0 if there was nothing to compact
+ * and -ENOMEM if the remaining free space could not hold the objects.
+ */
+int xv_compact(struct xv_pool *pool, u32 max_used, xv_move_fn move,
+							void *priv)
+{
+	int ret = 0;
+	u32 pagenum, offset;
+
+	spin_lock(&pool->lock);
+	pagenum = find_sparse_page(pool, max_used);
+	if (!pagenum) {
+		spin_unlock(&pool->lock);
+		return 0;
+	}
+	isolate_page(pool, pagenum, 1);
+	spin_unlock(&pool->lock);
+
+	/*
+	 * xv_free() of the last object frees the page and resets
+	 * isolated_pagenum.
+	 */
+	while (pool->isolated_pagenum == pagenum) {
+		spin_lock(&pool->lock);
+		offset = first_used_object(pagenum);
+		spin_unlock(&pool->lock);
+
+		ret = WARN_ON(!offset) ? -EINVAL : move(pool, pagenum,
+							offset, priv);
+		if (ret) {
+			spin_lock(&pool->lock);
+			isolate_page(pool, pagenum, 0);
+			spin_unlock(&pool->lock);
+			return -ENOMEM;
+		}
+	}
+
+	return 1;
+}
+EXPORT_SYMBOL_GPL(xv_compact);
+
 static int __init xv_malloc_init(void)
 {
 	return 0;
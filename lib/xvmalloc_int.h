@@ -14,6 +14,7 @@
 #define _XVMALLOC_INT_H_
 
 #include <linux/kernel.h>
+#include <linux/list.h>
 #include <linux/types.h>
 
 /* User configurable params */
@@ -79,8 +80,19 @@ struct xv_pool {
 
 	struct freelist_entry freelist[NUM_FREE_LISTS];
 
+	/*
+	 * All pages in pool, linked through page->lru. Bytes in use
+	 * in each page (including block headers) are kept in
+	 * page->private. Used to pick pages for compaction.
+	 */
+	struct list_head page_list;
+
+	/* Page being compacted: its free blocks are off the freelists */
+	u32 isolated_pagenum;
+
 	/* stats */
 	u64 total_pages;
+	u64 used_bytes;
 };
 
 #endif
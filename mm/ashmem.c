@@ -29,8 +29,22 @@
 #include <linux/mutex.h>
 #include <linux/shmem_fs.h>
 #include <linux/ashmem.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/wait.h>
 #include <asm/cacheflush.h>
 
+#ifdef CONFIG_ASHMEM_COMPRESS
+#include <linux/highmem.h>
+#include <linux/lzo.h>
+#include <linux/pagemap.h>
+#include <linux/radix-tree.h>
+#include <linux/swap.h>
+#include <linux/workqueue.h>
+#include <linux/xvmalloc.h>
+#endif
+
 #define ASHMEM_NAME_PREFIX "dev/ashmem/"
 #define ASHMEM_NAME_PREFIX_LEN (sizeof(ASHMEM_NAME_PREFIX) - 1)
 #define ASHMEM_FULL_NAME_LEN (ASHMEM_NAME_LEN + ASHMEM_NAME_PREFIX_LEN)
@@ -49,6 +63,15 @@ struct ashmem_area {
 	unsigned long vm_start;		/* Start address of vm_area
 					 * which maps this ashmem */
 	unsigned long prot_mask;	/* allowed prot bits, as vm_flags */
+	unsigned int referenced;	/* pinned since last aged */
+	struct mm_struct *mm;		/* first mapper, charged below */
+	unsigned long charged;		/* pinned pages charged to mm */
+	atomic_t purging;		/* truncations in flight */
+#ifdef CONFIG_ASHMEM_COMPRESS
+	struct radix_tree_root zpages;	/* compressed copies of purged pages */
+	struct list_head zlist;		/* entry in ashmem_zareas */
+	unsigned long nr_zpages;
+#endif
 };
 
 /*
@@ -63,13 +86,65 @@ struct ashmem_range {
 	size_t pgstart;			/* starting page, inclusive */
 	size_t pgend;			/* ending page, inclusive */
 	unsigned int purged;		/* ASHMEM_NOT or ASHMEM_WAS_PURGED */
+	unsigned int active;		/* on the active LRU list */
 };
 
-/* LRU list of unpinned pages, protected by ashmem_mutex */
-static LIST_HEAD(ashmem_lru_list);
+/*
+ * LRU lists of unpinned pages, protected by ashmem_mutex. Ranges are
+ * unpinned onto the inactive list and purged from its head. Ranges of
+ * areas that were pinned since they were last looked at get a second
+ * chance on the active list, which is aged back onto the inactive list
+ * to keep the two the same size.
+ */
+static LIST_HEAD(ashmem_active_list);
+static LIST_HEAD(ashmem_inactive_list);
 
-/* Count of pages on our LRU list, protected by ashmem_mutex */
+/* Count of pages on our LRU lists, protected by ashmem_mutex */
 static unsigned long lru_count;
+static unsigned long inactive_count;
+
+/* woken when an area's purging count drops to zero */
+static DECLARE_WAIT_QUEUE_HEAD(ashmem_purge_wait);
+
+/* Max. number of truncations ashmem_shrink() queues per lock hold */
+#define ASHMEM_PURGE_BATCH	16
+
+struct ashmem_purge {
+	struct ashmem_area *asma;
+	size_t pgstart;
+	size_t pgend;
+};
+
+/*
+ * Reclaim statistics. The counters of compressed pages and compression
+ * time are updated under ashmem_zmutex, the rest under ashmem_stats_lock.
+ */
+static struct ashmem_stats {
+	unsigned long shrink_calls;	/* calls asking to free pages */
+	unsigned long shrink_busy;	/* ...given up on a busy mutex */
+	unsigned long purged_ranges;
+	unsigned long purged_pages;
+	unsigned long truncations;	/* vmtruncate_range() calls */
+	unsigned long activated;
+	unsigned long deactivated;
+	unsigned long pin_waits;	/* pins that waited for a purge */
+#ifdef CONFIG_ASHMEM_COMPRESS
+	unsigned long zstored;		/* pages compressed */
+	unsigned long zholes;		/* ...found unpopulated */
+	unsigned long zfailed;		/* ...incompressible or no memory */
+	unsigned long zbusy;		/* ranges purged, pool was busy */
+	unsigned long zrestored;	/* pages decompressed on pin */
+	unsigned long zdropped;		/* compressed pages thrown away */
+	unsigned long pin_hits;		/* purged spans fully restored */
+	unsigned long pin_misses;	/* ...reported ASHMEM_WAS_PURGED */
+	u64 compress_ns;
+	u64 decompress_ns;
+#endif
+	u64 shrink_ns;
+	u64 shrink_max_ns;
+	u64 lock_max_ns;		/* longest ashmem_mutex hold */
+} ashmem_stats;
+static DEFINE_SPINLOCK(ashmem_stats_lock);
 
 /*
  * ashmem_mutex - protects the list of and each individual ashmem_area
@@ -107,14 +182,31 @@ static struct kmem_cache *ashmem_range_cachep __read_mostly;
 
 static inline void lru_add(struct ashmem_range *range)
 {
-	list_add_tail(&range->lru, &ashmem_lru_list);
+	list_add_tail(&range->lru, &ashmem_inactive_list);
 	lru_count += range_size(range);
+	inactive_count += range_size(range);
 }
 
 static inline void lru_del(struct ashmem_range *range)
 {
 	list_del(&range->lru);
 	lru_count -= range_size(range);
+	if (!range->active)
+		inactive_count -= range_size(range);
+}
+
+static inline void lru_activate(struct ashmem_range *range)
+{
+	list_move_tail(&range->lru, &ashmem_active_list);
+	range->active = 1;
+	inactive_count -= range_size(range);
+}
+
+static inline void lru_deactivate(struct ashmem_range *range)
+{
+	list_move_tail(&range->lru, &ashmem_inactive_list);
+	range->active = 0;
+	inactive_count += range_size(range);
 }
 
 /*
@@ -172,8 +264,470 @@ static inline void range_shrink(struct ashmem_range *range,
 	range->pgstart = start;
 	range->pgend = end;
 
-	if (range_on_lru(range))
+	if (range_on_lru(range)) {
 		lru_count -= pre - range_size(range);
+		if (!range->active)
+			inactive_count -= pre - range_size(range);
+	}
+}
+
+#ifdef CONFIG_ASHMEM_COMPRESS
+/*
+ * Compressed mode: before a purged range is truncated, its pages are LZO
+ * compressed into ashmem_zpool, indexed by page in the area's zpages tree.
+ * ASHMEM_PIN restores them and reports ASHMEM_WAS_PURGED only for pages
+ * that have no copy. Copies are dropped, oldest area first, when the pool
+ * outgrows compress_max_pages or the shrinker runs out of ranges.
+ *
+ * Pages are compressed from reclaim, which cannot sleep to grow the pool.
+ * zpool_grow_work keeps ASHMEM_ZPOOL_RESERVE free pool pages ahead of it
+ * instead, refilled after each store and whenever a store found no room.
+ *
+ * Lock Ordering: ashmem_mutex -> i_mutex -> ashmem_zmutex
+ */
+static int ashmem_compress;
+
+static unsigned int ashmem_compress_max_pages = 4096;
+module_param_named(compress_max_pages, ashmem_compress_max_pages, uint,
+		   S_IWUSR | S_IRUGO);
+
+/* pages compressing worse than this are purged */
+#define ASHMEM_ZPAGE_MAX	(PAGE_SIZE / 4 * 3)
+
+/* free pool pages kept for the shrinker to compress into */
+#define ASHMEM_ZPOOL_RESERVE	16
+
+struct ashmem_zpage {
+	pgoff_t index;			/* page in the area */
+	u32 pagenum;			/* xvmalloc location */
+	u16 offset;
+	u16 len;			/* compressed size, 0 if never populated */
+};
+
+/* ashmem_zmutex - protects the pool, the buffers and all zpages trees */
+static DEFINE_MUTEX(ashmem_zmutex);
+
+/* areas holding compressed pages, least recently compressed first */
+static LIST_HEAD(ashmem_zareas);
+
+static struct xv_pool *ashmem_zpool;
+static struct kmem_cache *ashmem_zpage_cachep __read_mostly;
+static void *ashmem_zwrkmem;
+static void *ashmem_zbuf;
+
+/* set when a store found no room, so the reserve is grown regardless */
+static int ashmem_zpool_starved;
+
+/*
+ * zpool_grow - top the pool up to ASHMEM_ZPOOL_RESERVE free pages, within
+ * compress_max_pages. Runs from a worker, where it may sleep.
+ */
+static void zpool_grow(struct work_struct *work)
+{
+	u64 limit, total, used;
+	int n;
+
+	limit = (u64)ashmem_compress_max_pages << PAGE_SHIFT;
+	for (n = 0; ashmem_compress && n < ASHMEM_ZPOOL_RESERVE; n++) {
+		total = xv_get_total_size_bytes(ashmem_zpool);
+		used = xv_get_used_size_bytes(ashmem_zpool);
+		if (total >= limit)
+			break;
+		if (!ashmem_zpool_starved &&
+		    total - used >= (u64)ASHMEM_ZPOOL_RESERVE << PAGE_SHIFT)
+			break;
+		ashmem_zpool_starved = 0;
+		if (xv_grow_pool(ashmem_zpool, GFP_NOIO | __GFP_NOWARN))
+			break;
+	}
+}
+
+static DECLARE_WORK(zpool_grow_work, zpool_grow);
+
+static int zpool_set_compress(const char *val, struct kernel_param *kp)
+{
+	int ret = param_set_bool(val, kp);
+
+	if (!ret && ashmem_compress && ashmem_zpool)
+		schedule_work(&zpool_grow_work);
+	return ret;
+}
+module_param_call(compress, zpool_set_compress, param_get_bool,
+		  &ashmem_compress, S_IWUSR | S_IRUGO);
+
+static void zarea_init(struct ashmem_area *asma)
+{
+	INIT_RADIX_TREE(&asma->zpages, GFP_NOWAIT | __GFP_NOWARN);
+	INIT_LIST_HEAD(&asma->zlist);
+}
+
+static void zpage_free(struct ashmem_zpage *zpage)
+{
+	if (zpage->len)
+		xv_free(ashmem_zpool, zpage->pagenum, zpage->offset);
+	kmem_cache_free(ashmem_zpage_cachep, zpage);
+}
+
+/*
+ * zarea_drop - throw away all of an area's compressed pages
+ *
+ * Caller must hold ashmem_zmutex.
+ */
+static void zarea_drop(struct ashmem_area *asma)
+{
+	struct ashmem_zpage *zpages[16];
+	unsigned long index = 0;
+	unsigned int i, n;
+
+	while ((n = radix_tree_gang_lookup(&asma->zpages, (void **)zpages,
+					   index, ARRAY_SIZE(zpages)))) {
+		index = zpages[n - 1]->index + 1;
+		for (i = 0; i < n; i++) {
+			radix_tree_delete(&asma->zpages, zpages[i]->index);
+			zpage_free(zpages[i]);
+		}
+	}
+	ashmem_stats.zdropped += asma->nr_zpages;
+	asma->nr_zpages = 0;
+	list_del_init(&asma->zlist);
+}
+
+static void zarea_release(struct ashmem_area *asma)
+{
+	mutex_lock(&ashmem_zmutex);
+	zarea_drop(asma);
+	mutex_unlock(&ashmem_zmutex);
+}
+
+/*
+ * zpool_evict - drop areas' compressed pages, oldest first, until 'pages'
+ * pool pages have been freed or the pool fits in compress_max_pages.
+ *
+ * Caller must hold ashmem_zmutex.
+ */
+static void zpool_evict(unsigned long pages)
+{
+	u64 limit, target;
+
+	limit = (u64)ashmem_compress_max_pages << PAGE_SHIFT;
+	target = xv_get_total_size_bytes(ashmem_zpool);
+	target = target > (u64)pages << PAGE_SHIFT ?
+		 target - ((u64)pages << PAGE_SHIFT) : 0;
+	target = min(target, limit);
+
+	while (!list_empty(&ashmem_zareas) &&
+	       xv_get_total_size_bytes(ashmem_zpool) > target)
+		zarea_drop(list_first_entry(&ashmem_zareas,
+					    struct ashmem_area, zlist));
+}
+
+/*
+ * zpage_store - compress the page at 'index' of an area into the pool.
+ * Pages that are not populated are recorded as holes, unless there is
+ * swap and the page could be swapped out.
+ *
+ * Caller must hold ashmem_zmutex.
+ */
+static void zpage_store(struct ashmem_area *asma, pgoff_t index)
+{
+	struct address_space *mapping = asma->file->f_mapping;
+	struct ashmem_zpage *zpage, *old;
+	struct page *page;
+	size_t clen = 0;
+	ktime_t start;
+	u32 offset;
+	void *src;
+	int ret;
+
+	page = find_lock_page(mapping, index);
+	if (!page && total_swap_pages)
+		goto fail;
+
+	if (page) {
+		start = ktime_get();
+		src = kmap_atomic(page, KM_USER0);
+		ret = lzo1x_1_compress(src, PAGE_SIZE, ashmem_zbuf, &clen,
+				       ashmem_zwrkmem);
+		kunmap_atomic(src, KM_USER0);
+		unlock_page(page);
+		page_cache_release(page);
+		ashmem_stats.compress_ns +=
+			ktime_to_ns(ktime_sub(ktime_get(), start));
+		if (ret != LZO_E_OK || clen > ASHMEM_ZPAGE_MAX)
+			goto fail;
+	}
+
+	zpage = kmem_cache_zalloc(ashmem_zpage_cachep,
+				  GFP_NOWAIT | __GFP_NOWARN);
+	if (!zpage)
+		goto fail;
+	zpage->index = index;
+
+	if (page) {
+		if (xv_malloc(ashmem_zpool, clen, &zpage->pagenum, &offset,
+			      GFP_NOWAIT | __GFP_NOWARN)) {
+			kmem_cache_free(ashmem_zpage_cachep, zpage);
+			ashmem_zpool_starved = 1;
+			goto fail;
+		}
+		zpage->offset = offset;
+		zpage->len = clen;
+
+		src = kmap_atomic(pfn_to_page(zpage->pagenum), KM_USER0);
+		memcpy(src + offset, ashmem_zbuf, clen);
+		kunmap_atomic(src, KM_USER0);
+		ashmem_stats.zstored++;
+	} else
+		ashmem_stats.zholes++;
+
+	old = radix_tree_delete(&asma->zpages, index);
+	if (old) {
+		zpage_free(old);
+		asma->nr_zpages--;
+	}
+	if (radix_tree_insert(&asma->zpages, index, zpage)) {
+		zpage_free(zpage);
+		goto fail;
+	}
+	asma->nr_zpages++;
+	return;
+
+fail:
+	ashmem_stats.zfailed++;
+}
+
+/*
+ * zpages_store - compress the pages from 'pgstart' to 'pgend' of an area
+ * that is about to be truncated. This runs from reclaim, so if the pool
+ * is busy the range is simply purged.
+ */
+static void zpages_store(struct ashmem_area *asma, size_t pgstart,
+			 size_t pgend)
+{
+	size_t index;
+
+	if (!ashmem_compress || !ashmem_zpool)
+		return;
+
+	if (!mutex_trylock(&ashmem_zmutex)) {
+		spin_lock(&ashmem_stats_lock);
+		ashmem_stats.zbusy++;
+		spin_unlock(&ashmem_stats_lock);
+		return;
+	}
+	for (index = pgstart; index <= pgend; index++)
+		zpage_store(asma, index);
+	if (asma->nr_zpages)
+		list_move_tail(&asma->zlist, &ashmem_zareas);
+	zpool_evict(0);
+	mutex_unlock(&ashmem_zmutex);
+
+	schedule_work(&zpool_grow_work);
+}
+
+/*
+ * zpage_restore - decompress a page back into the area's backing file.
+ * The range has just been pinned, so nobody else writes there. 'zpage'
+ * is no longer in the zpages tree, so its copy stays put without
+ * ashmem_zmutex. The time spent decompressing is added to 'ns'.
+ */
+static int zpage_restore(struct ashmem_area *asma, pgoff_t index,
+			 struct ashmem_zpage *zpage, u64 *ns)
+{
+	struct address_space *mapping = asma->file->f_mapping;
+	loff_t pos = (loff_t)index << PAGE_SHIFT;
+	size_t dlen = PAGE_SIZE;
+	struct page *page;
+	void *fsdata;
+	void *src, *dst;
+	ktime_t start;
+	int ret;
+
+	ret = pagecache_write_begin(asma->file, mapping, pos, PAGE_SIZE, 0,
+				    &page, &fsdata);
+	if (ret)
+		return ret;
+
+	start = ktime_get();
+	src = kmap_atomic(pfn_to_page(zpage->pagenum), KM_USER0);
+	dst = kmap_atomic(page, KM_USER1);
+	ret = lzo1x_decompress_safe(src + zpage->offset, zpage->len,
+				    dst, &dlen);
+	kunmap_atomic(dst, KM_USER1);
+	kunmap_atomic(src, KM_USER0);
+	flush_dcache_page(page);
+	*ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	pagecache_write_end(asma->file, mapping, pos, PAGE_SIZE, PAGE_SIZE,
+			    page, fsdata);
+
+	return ret == LZO_E_OK && dlen == PAGE_SIZE ? 0 : -EIO;
+}
+
+/*
+ * zpages_restore - restore the pages from 'pgstart' to 'pgend' of a purged
+ * range that is being pinned, consuming their compressed copies. Returns
+ * ASHMEM_WAS_PURGED if any page could not be restored.
+ *
+ * The page cache allocations happen without ashmem_zmutex, which the
+ * shrinker needs to make progress.
+ *
+ * Caller must hold ashmem_mutex.
+ */
+static int zpages_restore(struct ashmem_area *asma, size_t pgstart,
+			  size_t pgend)
+{
+	struct inode *inode = asma->file->f_dentry->d_inode;
+	struct ashmem_zpage *zpage;
+	int ret = ASHMEM_NOT_PURGED;
+	unsigned long restored = 0;
+	u64 ns = 0;
+	size_t index;
+
+	if (!asma->nr_zpages) {
+		ret = ASHMEM_WAS_PURGED;
+		goto out;
+	}
+
+	mutex_lock(&inode->i_mutex);
+	for (index = pgstart; index <= pgend; index++) {
+		mutex_lock(&ashmem_zmutex);
+		zpage = radix_tree_delete(&asma->zpages, index);
+		if (zpage && !--asma->nr_zpages)
+			list_del_init(&asma->zlist);
+		mutex_unlock(&ashmem_zmutex);
+
+		if (!zpage) {
+			ret = ASHMEM_WAS_PURGED;
+			continue;
+		}
+		if (zpage->len) {
+			if (zpage_restore(asma, index, zpage, &ns))
+				ret = ASHMEM_WAS_PURGED;
+			else
+				restored++;
+		}
+
+		mutex_lock(&ashmem_zmutex);
+		zpage_free(zpage);
+		mutex_unlock(&ashmem_zmutex);
+	}
+	mutex_unlock(&inode->i_mutex);
+
+	mutex_lock(&ashmem_zmutex);
+	ashmem_stats.zrestored += restored;
+	ashmem_stats.decompress_ns += ns;
+	mutex_unlock(&ashmem_zmutex);
+
+out:
+	spin_lock(&ashmem_stats_lock);
+	if (ret == ASHMEM_NOT_PURGED)
+		ashmem_stats.pin_hits++;
+	else
+		ashmem_stats.pin_misses++;
+	spin_unlock(&ashmem_stats_lock);
+	return ret;
+}
+
+/*
+ * zpool_shrink - drop compressed pages to free 'pages' pool pages. Unless
+ * 'wait' is set, give up if the pool is busy.
+ */
+static void zpool_shrink(unsigned long pages, int wait)
+{
+	if (!ashmem_zpool)
+		return;
+	if (wait)
+		mutex_lock(&ashmem_zmutex);
+	else if (!mutex_trylock(&ashmem_zmutex))
+		return;
+	zpool_evict(pages);
+	mutex_unlock(&ashmem_zmutex);
+}
+
+/* zpool_pages - pool pages the shrinker can give back, not the reserve */
+static unsigned long zpool_pages(void)
+{
+	if (!ashmem_zpool)
+		return 0;
+	return xv_get_used_size_bytes(ashmem_zpool) >> PAGE_SHIFT;
+}
+
+static int __init zpool_init(void)
+{
+	ashmem_zpage_cachep = kmem_cache_create("ashmem_zpage_cache",
+					  sizeof(struct ashmem_zpage),
+					  0, 0, NULL);
+	ashmem_zwrkmem = kmalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
+	ashmem_zbuf = kmalloc(lzo1x_worst_compress(PAGE_SIZE), GFP_KERNEL);
+	ashmem_zpool = xv_create_pool();
+	if (!ashmem_zpage_cachep || !ashmem_zwrkmem || !ashmem_zbuf ||
+	    !ashmem_zpool) {
+		printk(KERN_ERR "ashmem: no memory for compressed mode\n");
+		if (ashmem_zpool)
+			xv_destroy_pool(ashmem_zpool);
+		ashmem_zpool = NULL;
+		kfree(ashmem_zbuf);
+		kfree(ashmem_zwrkmem);
+		if (ashmem_zpage_cachep)
+			kmem_cache_destroy(ashmem_zpage_cachep);
+		return -ENOMEM;
+	}
+
+	/* compress=1 on the command line was set before the pool existed */
+	if (ashmem_compress)
+		schedule_work(&zpool_grow_work);
+	return 0;
+}
+
+static void zpool_exit(void)
+{
+	if (!ashmem_zpool)
+		return;
+	cancel_work_sync(&zpool_grow_work);
+	xv_destroy_pool(ashmem_zpool);
+	kfree(ashmem_zbuf);
+	kfree(ashmem_zwrkmem);
+	kmem_cache_destroy(ashmem_zpage_cachep);
+}
+#else
+static inline void zarea_init(struct ashmem_area *asma) { }
+static inline void zarea_release(struct ashmem_area *asma) { }
+static inline void zpages_store(struct ashmem_area *asma, size_t pgstart,
+				size_t pgend) { }
+static inline int zpages_restore(struct ashmem_area *asma, size_t pgstart,
+				 size_t pgend)
+{
+	return ASHMEM_WAS_PURGED;
+}
+static inline void zpool_shrink(unsigned long pages, int wait) { }
+static inline unsigned long zpool_pages(void) { return 0; }
+static inline int zpool_init(void) { return 0; }
+static inline void zpool_exit(void) { }
+#endif
+
+/*
+ * asma_charge - bring the pinned page count charged to the area's mm up
+ * to date. Called after anything that changes it.
+ *
+ * Caller must hold ashmem_mutex.
+ */
+static void asma_charge(struct ashmem_area *asma)
+{
+	struct ashmem_range *range;
+	unsigned long pinned = 0;
+
+	if (!asma->mm)
+		return;
+
+	if (asma->file) {
+		pinned = PAGE_ALIGN(asma->size) >> PAGE_SHIFT;
+		list_for_each_entry(range, &asma->unpinned_list, unpinned)
+			pinned -= range_size(range);
+	}
+
+	atomic_long_add(pinned - asma->charged, &asma->mm->ashmem_pages);
+	asma->charged = pinned;
 }
 
 static int ashmem_open(struct inode *inode, struct file *file)
@@ -190,6 +744,8 @@ static int ashmem_open(struct inode *inode, struct file *file)
 		return -ENOMEM;
 
 	INIT_LIST_HEAD(&asma->unpinned_list);
+	atomic_set(&asma->purging, 0);
+	zarea_init(asma);
 	memcpy(asma->name, ASHMEM_NAME_PREFIX, ASHMEM_NAME_PREFIX_LEN);
 	asma->prot_mask = PROT_MASK;
 	file->private_data = asma;
@@ -205,8 +761,17 @@ static int ashmem_release(struct inode *ignored, struct file *file)
 	mutex_lock(&ashmem_mutex);
 	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned)
 		range_del(range);
+	if (asma->mm)
+		atomic_long_sub(asma->charged, &asma->mm->ashmem_pages);
 	mutex_unlock(&ashmem_mutex);
 
+	if (asma->mm)
+		mmdrop(asma->mm);
+
+	/* the shrinker may still be truncating ranges it took off the LRU */
+	wait_event(ashmem_purge_wait, !atomic_read(&asma->purging));
+	zarea_release(asma);
+
 	if (asma->file)
 		fput(asma->file);
 	kmem_cache_free(ashmem_area_cachep, asma);
@@ -285,11 +850,163 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	vma->vm_flags |= VM_CAN_NONLINEAR;
 	asma->vm_start = vma->vm_start;
 
+	/* shared areas are charged to the process that maps them first */
+	if (!asma->mm && vma->vm_mm) {
+		asma->mm = vma->vm_mm;
+		atomic_inc(&asma->mm->mm_count);
+		asma_charge(asma);
+	}
+
 out:
 	mutex_unlock(&ashmem_mutex);
 	return ret;
 }
 
+/*
+ * purge_collect - take up to 'nr_to_scan' pages of unpinned ranges off the
+ * inactive list, mark them purged and queue them in 'batch', merging ranges
+ * adjacent to an already queued one of the same area. Returns the number
+ * of batch entries used and updates 'nr_to_scan'.
+ *
+ * Caller must hold ashmem_mutex.
+ */
+static int purge_collect(struct ashmem_purge *batch, int *nr_to_scan)
+{
+	struct ashmem_range *range;
+	unsigned long activated = 0, deactivated = 0, ranges = 0, pages = 0;
+	int i, n = 0;
+
+	while (*nr_to_scan > 0) {
+		/* age the active list to keep it no larger than the inactive */
+		while (lru_count - inactive_count > inactive_count) {
+			range = list_first_entry(&ashmem_active_list,
+						 struct ashmem_range, lru);
+			lru_deactivate(range);
+			deactivated++;
+		}
+		if (list_empty(&ashmem_inactive_list))
+			break;
+
+		range = list_first_entry(&ashmem_inactive_list,
+					 struct ashmem_range, lru);
+		if (range->asma->referenced) {
+			range->asma->referenced = 0;
+			lru_activate(range);
+			activated++;
+			continue;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (batch[i].asma != range->asma)
+				continue;
+			if (batch[i].pgend + 1 == range->pgstart) {
+				batch[i].pgend = range->pgend;
+				break;
+			}
+			if (range->pgend + 1 == batch[i].pgstart) {
+				batch[i].pgstart = range->pgstart;
+				break;
+			}
+		}
+		if (i == n) {
+			if (n == ASHMEM_PURGE_BATCH)
+				break;
+			batch[n].asma = range->asma;
+			batch[n].pgstart = range->pgstart;
+			batch[n].pgend = range->pgend;
+			atomic_inc(&range->asma->purging);
+			n++;
+		}
+
+		range->purged = ASHMEM_WAS_PURGED;
+		lru_del(range);
+		*nr_to_scan -= range_size(range);
+		ranges++;
+		pages += range_size(range);
+	}
+
+	spin_lock(&ashmem_stats_lock);
+	ashmem_stats.activated += activated;
+	ashmem_stats.deactivated += deactivated;
+	ashmem_stats.purged_ranges += ranges;
+	ashmem_stats.purged_pages += pages;
+	spin_unlock(&ashmem_stats_lock);
+
+	return n;
+}
+
+/*
+ * purge_batch - truncate the ranges queued by purge_collect(). Called
+ * without ashmem_mutex; ASHMEM_PIN and ashmem_release() wait for the
+ * area's purging count to drop, so the area and its file stay around and
+ * the pages cannot be repopulated under us.
+ */
+static void purge_batch(struct ashmem_purge *batch, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		struct ashmem_area *asma = batch[i].asma;
+		struct inode *inode = asma->file->f_dentry->d_inode;
+
+		zpages_store(asma, batch[i].pgstart, batch[i].pgend);
+		vmtruncate_range(inode, batch[i].pgstart * PAGE_SIZE,
+				 (batch[i].pgend + 1) * PAGE_SIZE - 1);
+		if (atomic_dec_and_test(&asma->purging))
+			wake_up_all(&ashmem_purge_wait);
+	}
+}
+
+/*
+ * __ashmem_shrink - purge 'nr_to_scan' pages, a batch at a time, holding
+ * ashmem_mutex only to pick the ranges. If 'wait' is not set we give up
+ * as soon as the mutex is busy rather than stall reclaim behind it, and
+ * return -1 if nothing was purged by then.
+ */
+static int __ashmem_shrink(int nr_to_scan, int wait)
+{
+	struct ashmem_purge batch[ASHMEM_PURGE_BATCH];
+	unsigned long truncations = 0, busy = 0;
+	ktime_t start, locked;
+	u64 lock_ns, lock_max_ns = 0, ns;
+	int n;
+
+	start = ktime_get();
+	while (nr_to_scan > 0) {
+		if (wait)
+			mutex_lock(&ashmem_mutex);
+		else if (!mutex_trylock(&ashmem_mutex)) {
+			busy = 1;
+			break;
+		}
+		locked = ktime_get();
+		n = purge_collect(batch, &nr_to_scan);
+		lock_ns = ktime_to_ns(ktime_sub(ktime_get(), locked));
+		mutex_unlock(&ashmem_mutex);
+
+		if (!n) {
+			/* nothing left to purge, give up compressed pages */
+			zpool_shrink(nr_to_scan, wait);
+			break;
+		}
+		purge_batch(batch, n);
+		truncations += n;
+		lock_max_ns = max(lock_max_ns, lock_ns);
+	}
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	spin_lock(&ashmem_stats_lock);
+	ashmem_stats.shrink_calls++;
+	ashmem_stats.shrink_busy += busy;
+	ashmem_stats.truncations += truncations;
+	ashmem_stats.shrink_ns += ns;
+	ashmem_stats.shrink_max_ns = max(ashmem_stats.shrink_max_ns, ns);
+	ashmem_stats.lock_max_ns = max(ashmem_stats.lock_max_ns, lock_max_ns);
+	spin_unlock(&ashmem_stats_lock);
+
+	return busy && !truncations ? -1 : 0;
+}
+
 /*
  * ashmem_shrink - our cache shrinker, called from mm/vmscan.c :: shrink_slab
  *
@@ -299,39 +1016,29 @@ out:
  * 'gfp_mask' is the mask of the allocation that got us into this mess.
  *
  * Return value is the number of objects (pages) remaining, or -1 if we cannot
- * proceed without risk of deadlock (due to gfp_mask).
+ * proceed without risk of deadlock (due to gfp_mask) or found ashmem_mutex
+ * busy before purging anything; shrink_slab() then keeps the work for its
+ * next call.
  *
- * We approximate LRU via least-recently-unpinned, jettisoning unpinned partial
- * chunks of ashmem regions LRU-wise one-at-a-time until we hit 'nr_to_scan'
- * pages freed.
+ * We approximate LRU via least-recently-unpinned, aged over two lists, and
+ * jettison unpinned partial chunks of ashmem regions until we hit
+ * 'nr_to_scan' pages freed. The truncation itself happens outside
+ * ashmem_mutex, so pin and unpin of other areas do not wait for it.
+ * Pages of the compressed pool are counted too, and are given back once
+ * no unpinned range is left.
  */
 static int ashmem_shrink(int nr_to_scan, gfp_t gfp_mask)
 {
-	struct ashmem_range *range, *next;
-
 	/* We might recurse into filesystem code, so bail out if necessary */
 	if (nr_to_scan && !(gfp_mask & __GFP_FS))
 		return -1;
 	if (!nr_to_scan)
-		return lru_count;
+		return lru_count + zpool_pages();
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &ashmem_lru_list, lru) {
-		struct inode *inode = range->asma->file->f_dentry->d_inode;
-		loff_t start = range->pgstart * PAGE_SIZE;
-		loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
-
-		vmtruncate_range(inode, start, end);
-		range->purged = ASHMEM_WAS_PURGED;
-		lru_del(range);
-
-		nr_to_scan -= range_size(range);
-		if (nr_to_scan <= 0)
-			break;
-	}
-	mutex_unlock(&ashmem_mutex);
+	if (__ashmem_shrink(nr_to_scan, 0))
+		return -1;
 
-	return lru_count;
+	return lru_count + zpool_pages();
 }
 
 static struct shrinker ashmem_shrinker = {
@@ -422,6 +1129,9 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 	struct ashmem_range *range, *next;
 	int ret = ASHMEM_NOT_PURGED;
 
+	/* the area is in use, give its other unpinned ranges a second chance */
+	asma->referenced = 1;
+
 	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned) {
 		/* moved past last applicable page; we can short circuit */
 		if (range_before_page(range, pgstart))
@@ -443,7 +1153,10 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 		 *    create a new range for the other side.
 		 */
 		if (page_range_in_range(range, pgstart, pgend)) {
-			ret |= range->purged;
+			if (range->purged)
+				ret |= zpages_restore(asma,
+					max_t(size_t, range->pgstart, pgstart),
+					min_t(size_t, range->pgend, pgend));
 
 			/* Case #1: Easy. Just nuke the whole thing. */
 			if (page_range_subsumes_range(range, pgstart, pgend)) {
@@ -567,12 +1280,27 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 
 	mutex_lock(&ashmem_mutex);
 
+	/*
+	 * A purge of this area may still be truncating pages; let it finish
+	 * so it does not throw away what the caller writes after pinning.
+	 */
+	while (cmd == ASHMEM_PIN && unlikely(atomic_read(&asma->purging))) {
+		mutex_unlock(&ashmem_mutex);
+		spin_lock(&ashmem_stats_lock);
+		ashmem_stats.pin_waits++;
+		spin_unlock(&ashmem_stats_lock);
+		wait_event(ashmem_purge_wait, !atomic_read(&asma->purging));
+		mutex_lock(&ashmem_mutex);
+	}
+
 	switch (cmd) {
 	case ASHMEM_PIN:
 		ret = ashmem_pin(asma, pgstart, pgend);
+		asma_charge(asma);
 		break;
 	case ASHMEM_UNPIN:
 		ret = ashmem_unpin(asma, pgstart, pgend);
+		asma_charge(asma);
 		break;
 	case ASHMEM_GET_PIN_STATUS:
 		ret = ashmem_get_pin_status(asma, pgstart, pgend);
@@ -715,8 +1443,8 @@ static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	case ASHMEM_PURGE_ALL_CACHES:
 		ret = -EPERM;
 		if (capable(CAP_SYS_ADMIN)) {
-			ret = ashmem_shrink(0, GFP_KERNEL);
-			ashmem_shrink(ret, GFP_KERNEL);
+			ret = lru_count;
+			__ashmem_shrink(ret, 1);
 		}
 		break;
 	case ASHMEM_CACHE_FLUSH_RANGE:
@@ -797,6 +1525,76 @@ static struct miscdevice ashmem_misc = {
 	.fops = &ashmem_fops,
 };
 
+static struct dentry *ashmem_debugfs;
+
+static int ashmem_stats_show(struct seq_file *m, void *unused)
+{
+	struct ashmem_stats stats;
+	unsigned long active, inactive;
+
+	mutex_lock(&ashmem_mutex);
+	active = lru_count - inactive_count;
+	inactive = inactive_count;
+	mutex_unlock(&ashmem_mutex);
+
+	spin_lock(&ashmem_stats_lock);
+	stats = ashmem_stats;
+	spin_unlock(&ashmem_stats_lock);
+
+	seq_printf(m, "active_pages %lu\n", active);
+	seq_printf(m, "inactive_pages %lu\n", inactive);
+	seq_printf(m, "activated %lu\n", stats.activated);
+	seq_printf(m, "deactivated %lu\n", stats.deactivated);
+	seq_printf(m, "purged_ranges %lu\n", stats.purged_ranges);
+	seq_printf(m, "purged_pages %lu\n", stats.purged_pages);
+	seq_printf(m, "truncations %lu\n", stats.truncations);
+	seq_printf(m, "shrink_calls %lu\n", stats.shrink_calls);
+	seq_printf(m, "shrink_busy %lu\n", stats.shrink_busy);
+	seq_printf(m, "shrink_avg_us %llu\n", stats.shrink_calls ?
+		   div_u64(div_u64(stats.shrink_ns, stats.shrink_calls),
+			   1000) : 0);
+	seq_printf(m, "shrink_max_us %llu\n",
+		   div_u64(stats.shrink_max_ns, 1000));
+	seq_printf(m, "lock_max_us %llu\n", div_u64(stats.lock_max_ns, 1000));
+	seq_printf(m, "pin_waits %lu\n", stats.pin_waits);
+#ifdef CONFIG_ASHMEM_COMPRESS
+	seq_printf(m, "compressed_pages %lu\n", stats.zstored);
+	seq_printf(m, "compressed_holes %lu\n", stats.zholes);
+	seq_printf(m, "compress_failed %lu\n", stats.zfailed);
+	seq_printf(m, "compress_busy %lu\n", stats.zbusy);
+	seq_printf(m, "compress_us %llu\n", div_u64(stats.compress_ns, 1000));
+	seq_printf(m, "restored_pages %lu\n", stats.zrestored);
+	seq_printf(m, "decompress_us %llu\n",
+		   div_u64(stats.decompress_ns, 1000));
+	seq_printf(m, "dropped_pages %lu\n", stats.zdropped);
+	seq_printf(m, "pin_hits %lu\n", stats.pin_hits);
+	seq_printf(m, "pin_misses %lu\n", stats.pin_misses);
+	if (ashmem_zpool) {
+		mutex_lock(&ashmem_zmutex);
+		seq_printf(m, "pool_bytes %llu\n",
+			   xv_get_total_size_bytes(ashmem_zpool));
+		seq_printf(m, "pool_used_bytes %llu\n",
+			   xv_get_used_size_bytes(ashmem_zpool));
+		mutex_unlock(&ashmem_zmutex);
+	}
+#endif
+
+	return 0;
+}
+
+static int ashmem_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ashmem_stats_show, NULL);
+}
+
+static const struct file_operations ashmem_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = ashmem_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 static int __init ashmem_init(void)
 {
 	int ret;
@@ -817,6 +1615,10 @@ static int __init ashmem_init(void)
 		return -ENOMEM;
 	}
 
+	ret = zpool_init();
+	if (unlikely(ret))
+		return ret;
+
 	ret = misc_register(&ashmem_misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "ashmem: failed to register misc device!\n");
@@ -825,6 +1627,11 @@ static int __init ashmem_init(void)
 
 	register_shrinker(&ashmem_shrinker);
 
+	ashmem_debugfs = debugfs_create_dir("ashmem", NULL);
+	if (ashmem_debugfs)
+		debugfs_create_file("stats", S_IRUGO, ashmem_debugfs, NULL,
+				    &ashmem_stats_fops);
+
 	printk(KERN_INFO "ashmem: initialized\n");
 
 	return 0;
@@ -834,12 +1641,14 @@ static void __exit ashmem_exit(void)
 {
 	int ret;
 
+	debugfs_remove_recursive(ashmem_debugfs);
 	unregister_shrinker(&ashmem_shrinker);
 
 	ret = misc_deregister(&ashmem_misc);
 	if (unlikely(ret))
 		printk(KERN_ERR "ashmem: failed to unregister misc device!\n");
 
+	zpool_exit();
 	kmem_cache_destroy(ashmem_range_cachep);
 	kmem_cache_destroy(ashmem_area_cachep);
 
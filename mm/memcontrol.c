@@ -535,6 +535,26 @@ static struct mem_cgroup *mem_cgroup_from_cont(struct cgroup *cont)
 				css);
 }
 
+/*
+ * Pages by which the memory cgroup of mm is above its soft limit.
+ * Lets low memory killers prefer processes of over-limit groups.
+ */
+unsigned long mem_cgroup_mm_soft_limit_excess(struct mm_struct *mm)
+{
+	struct mem_cgroup *mem;
+	unsigned long excess = 0;
+
+	if (mem_cgroup_disabled())
+		return 0;
+
+	rcu_read_lock();
+	mem = mem_cgroup_from_task(rcu_dereference(mm->owner));
+	if (mem)
+		excess = mem_cgroup_get_excess(mem);
+	rcu_read_unlock();
+	return excess;
+}
+
 struct mem_cgroup *mem_cgroup_from_task(struct task_struct *p)
 {
 	/*
@@ -20,11 +20,12 @@
 #include <asm/pgtable.h>
 
 static struct bio *get_swap_bio(gfp_t gfp_flags, pgoff_t index,
-				struct page *page, bio_end_io_t end_io)
+				struct page *page, bio_end_io_t end_io,
+				int nr_vecs)
 {
 	struct bio *bio;
 
-	bio = bio_alloc(gfp_flags, 1);
+	bio = bio_alloc(gfp_flags, nr_vecs);
 	if (bio) {
 		struct swap_info_struct *sis;
 		swp_entry_t entry = { .val = index, };
@@ -73,19 +74,26 @@ static void end_swap_bio_write(struct bio *bio, int err)
 void end_swap_bio_read(struct bio *bio, int err)
 {
 	const int uptodate = test_bit(BIO_UPTODATE, &bio->bi_flags);
-	struct page *page = bio->bi_io_vec[0].bv_page;
+	struct bio_vec *bvec = bio->bi_io_vec + bio->bi_vcnt - 1;
 
-	if (!uptodate) {
-		SetPageError(page);
-		ClearPageUptodate(page);
+	if (!uptodate)
 		printk(KERN_ALERT "Read-error on swap-device (%u:%u:%Lu)\n",
 				imajor(bio->bi_bdev->bd_inode),
 				iminor(bio->bi_bdev->bd_inode),
 				(unsigned long long)bio->bi_sector);
-	} else {
-		SetPageUptodate(page);
-	}
-	unlock_page(page);
+
+	/* Readahead batches carry several pages, see swap_readpage_batch() */
+	do {
+		struct page *page = bvec->bv_page;
+
+		if (!uptodate) {
+			SetPageError(page);
+			ClearPageUptodate(page);
+		} else {
+			SetPageUptodate(page);
+		}
+		unlock_page(page);
+	} while (--bvec >= bio->bi_io_vec);
 	bio_put(bio);
 }
 
@@ -103,7 +111,7 @@ int swap_writepage(struct page *page, struct writeback_control *wbc)
 		goto out;
 	}
 	bio = get_swap_bio(GFP_NOIO, page_private(page), page,
-				end_swap_bio_write);
+				end_swap_bio_write, 1);
 	if (bio == NULL) {
 		set_page_dirty(page);
 		unlock_page(page);
@@ -128,7 +136,7 @@ int swap_readpage(struct page *page)
 	VM_BUG_ON(!PageLocked(page));
 	VM_BUG_ON(PageUptodate(page));
 	bio = get_swap_bio(GFP_KERNEL, page_private(page), page,
-				end_swap_bio_read);
+				end_swap_bio_read, 1);
 	if (bio == NULL) {
 		unlock_page(page);
 		ret = -ENOMEM;
@@ -139,3 +147,54 @@ int swap_readpage(struct page *page)
 out:
 	return ret;
 }
+
+/*
+ * Like swap_readpage(), but try to append the page to the bio pending
+ * in *batch when it follows it on disk, so that a readahead cluster
+ * reaches the device as a single multi-page request.  A page that
+ * cannot be merged submits the pending bio and starts a new one.
+ * The caller must finish with swap_read_batch_submit().
+ */
+int swap_readpage_batch(struct page *page, struct bio **batch)
+{
+	struct bio *bio = *batch;
+	struct swap_info_struct *sis;
+	swp_entry_t entry = { .val = page_private(page), };
+	sector_t sector;
+	int nr_vecs;
+
+	VM_BUG_ON(!PageLocked(page));
+	VM_BUG_ON(PageUptodate(page));
+
+	if (bio) {
+		sis = get_swap_info_struct(swp_type(entry));
+		sector = map_swap_page(sis, swp_offset(entry)) *
+					(PAGE_SIZE >> 9);
+		if (bio->bi_bdev == sis->bdev &&
+		    bio->bi_sector + (bio->bi_size >> 9) == sector &&
+		    bio_add_page(bio, page, PAGE_SIZE, 0) == PAGE_SIZE) {
+			count_vm_event(PSWPIN);
+			return 0;
+		}
+		swap_read_batch_submit(batch);
+	}
+
+	nr_vecs = min(1 << page_cluster, BIO_MAX_PAGES);
+	bio = get_swap_bio(GFP_KERNEL, page_private(page), page,
+				end_swap_bio_read, nr_vecs);
+	if (bio == NULL) {
+		unlock_page(page);
+		return -ENOMEM;
+	}
+	count_vm_event(PSWPIN);
+	*batch = bio;
+	return 0;
+}
+
+void swap_read_batch_submit(struct bio **batch)
+{
+	if (*batch) {
+		submit_bio(READ, *batch);
+		*batch = NULL;
+	}
+}
@@ -269,14 +269,29 @@ struct page * lookup_swap_cache(swp_entry_t entry)
 	return page;
 }
 
+/*
+ * Pages queued in a readahead batch are locked but their bio has not
+ * been submitted yet, so we must not wait in the allocator for reclaim
+ * which could in turn wait on one of them.  Try without __GFP_WAIT
+ * first and only flush the batch when that fails.
+ */
+static gfp_t swap_batch_gfp(gfp_t gfp_mask, struct bio **batch)
+{
+	if (batch && *batch)
+		return (gfp_mask & ~__GFP_WAIT) | __GFP_NOWARN;
+	return gfp_mask;
+}
+
 /* 
  * Locate a page of swap in physical memory, reserving swap cache space
  * and reading the disk if it is not already cached.
  * A failure return means that either the page allocation failed or that
  * the swap entry is no longer in use.
+ * If batch is given, the read is queued there (see swap_readpage_batch).
  */
-struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
-			struct vm_area_struct *vma, unsigned long addr)
+static struct page *__read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr,
+			struct bio **batch)
 {
 	struct page *found_page, *new_page = NULL;
 	int err;
@@ -295,7 +310,12 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 		 * Get a new page to read into from swap.
 		 */
 		if (!new_page) {
-			new_page = alloc_page_vma(gfp_mask, vma, addr);
+			new_page = alloc_page_vma(swap_batch_gfp(gfp_mask,
+						batch), vma, addr);
+			if (!new_page && batch && *batch) {
+				swap_read_batch_submit(batch);
+				new_page = alloc_page_vma(gfp_mask, vma, addr);
+			}
 			if (!new_page)
 				break;		/* Out of memory */
 		}
@@ -303,7 +323,12 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 		/*
 		 * call radix_tree_preload() while we can wait.
 		 */
-		err = radix_tree_preload(gfp_mask & GFP_KERNEL);
+		err = radix_tree_preload(swap_batch_gfp(gfp_mask, batch) &
+					GFP_KERNEL);
+		if (err && batch && *batch) {
+			swap_read_batch_submit(batch);
+			err = radix_tree_preload(gfp_mask & GFP_KERNEL);
+		}
 		if (err)
 			break;
 
@@ -330,7 +355,10 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 			 * Initiate read into locked page and return.
 			 */
 			lru_cache_add_anon(new_page);
-			swap_readpage(new_page);
+			if (batch)
+				swap_readpage_batch(new_page, batch);
+			else
+				swap_readpage(new_page);
 			return new_page;
 		}
 		radix_tree_preload_end();
@@ -348,6 +376,12 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 	return found_page;
 }
 
+struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr)
+{
+	return __read_swap_cache_async(entry, gfp_mask, vma, addr, NULL);
+}
+
 /**
  * swapin_readahead - swap in pages in hope we need them soon
  * @entry: swap entry of this memory
@@ -372,6 +406,7 @@ struct page *swapin_readahead(swp_entry_t entry, gfp_t gfp_mask,
 {
 	int nr_pages;
 	struct page *page;
+	struct bio *batch = NULL;
 	unsigned long offset;
 	unsigned long end_offset;
 
@@ -385,12 +420,13 @@ struct page *swapin_readahead(swp_entry_t entry, gfp_t gfp_mask,
 	nr_pages = valid_swaphandles(entry, &offset);
 	for (end_offset = offset + nr_pages; offset < end_offset; offset++) {
 		/* Ok, do the async read-ahead now */
-		page = read_swap_cache_async(swp_entry(swp_type(entry), offset),
-						gfp_mask, vma, addr);
+		page = __read_swap_cache_async(swp_entry(swp_type(entry),
+					offset), gfp_mask, vma, addr, &batch);
 		if (!page)
 			break;
 		page_cache_release(page);
 	}
+	swap_read_batch_submit(&batch);	/* Whole cluster as one bio */
 	lru_add_drain();	/* Push any new pages onto the LRU now */
 	return read_swap_cache_async(entry, gfp_mask, vma, addr);
 }